@@ -49,6 +49,11 @@ enum ASTNodeTag {
   AST_FOR_STATEMENT,
   AST_IF_STATEMENT,
   AST_IF_ELSE_STATEMENT,
+  AST_SWITCH_STATEMENT,
+  AST_CASE_STATEMENT,
+  AST_DEFAULT_STATEMENT,
+  AST_BREAK_STATEMENT,
+  AST_CONTINUE_STATEMENT,
   AST_STRUCT_TYPE_DEFINITION,
   AST_UNION_TYPE_DEFINITION,
   AST_FIELD_DEFINITION_LIST,
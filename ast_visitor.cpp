@@ -101,6 +101,26 @@ void ASTVisitor::visit_if_else_statement(Node *n) {
   visit_children(n);
 }
 
+void ASTVisitor::visit_switch_statement(Node *n) {
+  visit_children(n);
+}
+
+void ASTVisitor::visit_case_statement(Node *n) {
+  visit_children(n);
+}
+
+void ASTVisitor::visit_default_statement(Node *n) {
+  visit_children(n);
+}
+
+void ASTVisitor::visit_break_statement(Node *n) {
+  visit_children(n);
+}
+
+void ASTVisitor::visit_continue_statement(Node *n) {
+  visit_children(n);
+}
+
 void ASTVisitor::visit_struct_type_definition(Node *n) {
   visit_children(n);
 }
@@ -220,6 +240,16 @@ void ASTVisitor::visit(Node *n) {
     visit_if_statement(n); break;
   case AST_IF_ELSE_STATEMENT:
     visit_if_else_statement(n); break;
+  case AST_SWITCH_STATEMENT:
+    visit_switch_statement(n); break;
+  case AST_CASE_STATEMENT:
+    visit_case_statement(n); break;
+  case AST_DEFAULT_STATEMENT:
+    visit_default_statement(n); break;
+  case AST_BREAK_STATEMENT:
+    visit_break_statement(n); break;
+  case AST_CONTINUE_STATEMENT:
+    visit_continue_statement(n); break;
   case AST_STRUCT_TYPE_DEFINITION:
     visit_struct_type_definition(n); break;
   case AST_UNION_TYPE_DEFINITION:
@@ -32,6 +32,11 @@ public:
   virtual void visit_for_statement(Node *n);
   virtual void visit_if_statement(Node *n);
   virtual void visit_if_else_statement(Node *n);
+  virtual void visit_switch_statement(Node *n);
+  virtual void visit_case_statement(Node *n);
+  virtual void visit_default_statement(Node *n);
+  virtual void visit_break_statement(Node *n);
+  virtual void visit_continue_statement(Node *n);
   virtual void visit_struct_type_definition(Node *n);
   virtual void visit_union_type_definition(Node *n);
   virtual void visit_field_definition_list(Node *n);
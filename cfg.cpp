@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <algorithm>
 #include <iterator>
+#include <set>
 #include "cpputil.h"
 #include "exceptions.h"
 #include "highlevel.h"
@@ -19,7 +20,8 @@ BasicBlock::BasicBlock(BasicBlockKind kind, unsigned id, int code_order, const s
   : m_kind(kind)
   , m_id(id)
   , m_label(label)
-  , m_code_order(code_order) {
+  , m_code_order(code_order)
+  , m_count(-1) {
 }
 
 BasicBlock::~BasicBlock() {
@@ -53,7 +55,8 @@ void BasicBlock::set_label(const std::string &label) {
 Edge::Edge(BasicBlock *source, BasicBlock *target, EdgeKind kind)
   : m_kind(kind)
   , m_source(source)
-  , m_target(target) {
+  , m_target(target)
+  , m_count(-1) {
 }
 
 Edge::~Edge() {
@@ -447,7 +450,7 @@ std::shared_ptr<ControlFlowGraph> ControlFlowGraphBuilder::build() {
       // Special case: if this block was originally discovered via a fall-through
       // edge, but is also reachable via a branch, then it might not be labeled
       // yet.  Set the label if necessary.
-      if (item.edge_kind == EDGE_BRANCH && !bb->has_label()) {
+      if (item.edge_kind != EDGE_FALLTHROUGH && !bb->has_label()) {
         bb->set_label(item.label);
       }
     } else {
@@ -462,7 +465,7 @@ std::shared_ptr<ControlFlowGraph> ControlFlowGraphBuilder::build() {
     // if the edge is a branch, make sure the work item's label matches
     // the BasicBlock's label (if it doesn't, then somehow this block
     // is reachable via two different labels, which shouldn't be possible)
-    assert(item.edge_kind != EDGE_BRANCH || bb->get_label() == item.label);
+    assert(item.edge_kind == EDGE_FALLTHROUGH || bb->get_label() == item.label);
 
     // connect to predecessor
     m_cfg->create_edge(item.pred, bb, item.edge_kind);
@@ -475,7 +478,18 @@ std::shared_ptr<ControlFlowGraph> ControlFlowGraphBuilder::build() {
     // if this basic block ends in a branch, prepare to create an edge
     // to the BasicBlock for the target (creating the BasicBlock if it
     // doesn't exist yet)
-    if (ends_in_branch(bb)) {
+    if (ends_in_branch(bb) && bb->get_last_instruction()->is_multiway_branch()) {
+      // a multi-way branch has an edge to each of the distinct
+      // targets in its jump table
+      const std::vector<std::string> &targets = bb->get_last_instruction()->get_jump_table()->targets;
+      std::set<std::string> seen;
+      for (auto j = targets.begin(); j != targets.end(); ++j) {
+        if (seen.insert(*j).second) {
+          unsigned target_index = m_iseq->get_index_of_labeled_instruction(*j);
+          work_list.push_back({ ins_index: target_index, pred: bb, edge_kind: EDGE_MULTIWAY, label: *j });
+        }
+      }
+    } else if (ends_in_branch(bb)) {
       unsigned target_index = get_branch_target_index(bb);
       // Note: we assume that branch instructions have the target label
       // as the last operand
@@ -516,7 +530,8 @@ bool ControlFlowGraphBuilder::is_branch(Instruction *ins) {
   // assume that if an instruction's last operand is a label,
   // it's a branch instruction
   unsigned num_operands = ins->get_num_operands();
-  return num_operands > 0 && ins->get_operand(num_operands - 1).get_kind() == Operand::LABEL;
+  return ins->is_multiway_branch()
+      || (num_operands > 0 && ins->get_operand(num_operands - 1).get_kind() == Operand::LABEL);
 }
 
 BasicBlock *ControlFlowGraphBuilder::scan_basic_block(const WorkItem &item, const std::string &label) {
@@ -603,7 +618,7 @@ bool HighLevelControlFlowGraphBuilder::is_function_call(Instruction *ins) {
 
 bool HighLevelControlFlowGraphBuilder::falls_through(Instruction *ins) {
   // only an unconditional jump instruction does not fall through
-  return ins->get_opcode() != HINS_jmp;
+  return ins->get_opcode() != HINS_jmp && ins->get_opcode() != HINS_jmptab;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -670,8 +685,9 @@ void ControlFlowGraphPrinter::print() {
     const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
     for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
       const Edge *e = *j;
-      assert(e->get_kind() == EDGE_BRANCH || e->get_kind() == EDGE_FALLTHROUGH);
-      printf("  %s EDGE to BASIC BLOCK %u\n", e->get_kind() == EDGE_FALLTHROUGH ? "fall-through" : "branch", e->get_target()->get_id());
+      const char *kind = e->get_kind() == EDGE_FALLTHROUGH ? "fall-through"
+                       : e->get_kind() == EDGE_BRANCH ? "branch" : "multi-way";
+      printf("  %s EDGE to BASIC BLOCK %u\n", kind, e->get_target()->get_id());
     }
 
     // If there is an end annotation, print it
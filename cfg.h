@@ -29,6 +29,9 @@ private:
   // in the original instruction sequence
   int m_code_order;
 
+  // number of times the block was executed, from a profile (-1 if unknown)
+  long m_count;
+
 public:
   BasicBlock(BasicBlockKind kind, unsigned id, int code_order, const std::string &label = "");
   ~BasicBlock();
@@ -43,6 +46,9 @@ public:
   void set_label(const std::string &label);
 
   int get_code_order() const { return m_code_order; }
+
+  long get_count() const { return m_count; }
+  void set_count(long count) { m_count = count; }
 };
 
 // Edges can be
@@ -51,9 +57,12 @@ public:
 //     InstructionSequence
 //   - "branch", meaning that the target BasicBlock's first instruction
 //     is *not* the immediate successor of the source block's last instruction
+//   - "multi-way", meaning that the target BasicBlock is one of the targets
+//     of a multi-way branch (jump table) ending the source block
 enum EdgeKind {
   EDGE_FALLTHROUGH,
   EDGE_BRANCH,
+  EDGE_MULTIWAY,
 };
 
 // An Edge is a predecessor/successor connection between a source BasicBlock
@@ -62,6 +71,8 @@ class Edge {
 private:
   EdgeKind m_kind;
   BasicBlock *m_source, *m_target;
+  // number of times the edge was taken, from a profile (-1 if unknown)
+  long m_count;
 
 public:
   Edge(BasicBlock *source, BasicBlock *target, EdgeKind kind);
@@ -70,6 +81,9 @@ public:
   EdgeKind get_kind() const { return m_kind; }
   BasicBlock *get_source() const { return m_source; }
   BasicBlock *get_target() const { return m_target; }
+
+  long get_count() const { return m_count; }
+  void set_count(long count) { m_count = count; }
 };
 
 // ControlFlowGraph: graph of BasicBlocks connected by Edges.
@@ -210,8 +224,8 @@ public:
   // Subclasses may override this method to specify which Instructions are
   // branches (i.e., have a control successor other than the next instruction
   // in the original InstructionSequence).  The default implementation assumes
-  // that any Instruction with an operand of type Operand::LABEL
-  // is a branch.
+  // that any Instruction with an operand of type Operand::LABEL,
+  // or with a jump table, is a branch.
   virtual bool is_branch(Instruction *ins);
 
   // Subclasses must override this to check whether the given Instruction
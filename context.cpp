@@ -24,6 +24,8 @@
 #include <iterator>
 #include <cassert>
 #include <sstream>
+#include <iostream>
+#include <map>
 #include "exceptions.h"
 #include "node.h"
 #include "ast.h"
@@ -38,9 +40,13 @@
 #include "context.h"
 #include "cfg.h"
 #include "optimizations.h"
+#include "inliner.h"
+#include "tail_calls.h"
+#include "edge_profile.h"
 
 Context::Context()
-        : m_ast(nullptr) {
+        : m_ast(nullptr)
+        , m_profile_mode(ProfileMode::NONE) {
 }
 
 Context::~Context() {
@@ -57,6 +63,14 @@ struct CloseFile {
 
 namespace {
 
+    // The high-level code generated for a function definition, and its
+    // string constants
+    struct GeneratedFunction {
+        Node *funcdef;
+        std::shared_ptr<InstructionSequence> hl_iseq;
+        std::vector<std::string> strings;
+    };
+
     template<typename Fn>
     void process_source_file(const std::string &filename, Fn fn) {
         // open the input source file
@@ -82,6 +96,60 @@ namespace {
         fn(pp.get());
     }
 
+    // Find the highest vreg number used in an InstructionSequence
+    int get_max_vreg(const std::shared_ptr<InstructionSequence> &iseq) {
+        int max_vreg = -1;
+        for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+            Instruction *ins = *i;
+            for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+                const Operand &operand = ins->get_operand(j);
+                if (operand.has_base_reg())
+                    max_vreg = std::max(max_vreg, operand.get_base_reg());
+                if (operand.has_index_reg())
+                    max_vreg = std::max(max_vreg, operand.get_index_reg());
+            }
+        }
+        return max_vreg;
+    }
+
+    // Renumber the local and temporary vregs of an InstructionSequence
+    // densely, in order of their first occurrence, so that the vregs which
+    // optimizations made unused don't leave gaps; returns the renumbered code
+    std::shared_ptr<InstructionSequence> renumber_vregs(const std::shared_ptr<InstructionSequence> &iseq) {
+        std::map<int, int> renumbered;
+        auto renumber = [&renumbered](int vreg) {
+            if (vreg < LocalStorageAllocation::VREG_FIRST_LOCAL)
+                return vreg;
+            auto i = renumbered.find(vreg);
+            if (i == renumbered.end())
+                i = renumbered.insert({ vreg, LocalStorageAllocation::VREG_FIRST_LOCAL + int(renumbered.size()) }).first;
+            return i->second;
+        };
+
+        std::shared_ptr<InstructionSequence> result(new InstructionSequence());
+        for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+            Instruction *ins = *i;
+            Operand operands[Instruction::MAX_OPERANDS];
+            for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+                const Operand &operand = ins->get_operand(j);
+                operands[j] = operand;
+                if (operand.has_index_reg())
+                    operands[j] = Operand(operand.get_kind(), renumber(operand.get_base_reg()), renumber(operand.get_index_reg()));
+                else if (operand.has_offset())
+                    operands[j] = Operand(operand.get_kind(), renumber(operand.get_base_reg()), operand.get_offset());
+                else if (operand.has_base_reg())
+                    operands[j] = Operand(operand.get_kind(), renumber(operand.get_base_reg()));
+            }
+            if (i.has_label())
+                result->define_label(i.get_label());
+            Instruction *renumbered_ins = new Instruction(ins->get_opcode(), operands[0], operands[1], operands[2], operands[3],
+                                                          ins->get_num_operands());
+            renumbered_ins->set_jump_table(ins->get_jump_table());
+            result->append(renumbered_ins);
+        }
+        return result;
+    }
+
 }
 
 void Context::scan_tokens(const std::string &filename, std::vector<Node *> &tokens) {
@@ -152,8 +220,13 @@ void Context::highlevel_codegen(ModuleCollector *module_collector, bool m_optimi
             module_collector->collect_global_var(sym->get_name(), sym->get_type());
     }
 
-    // generating high-level code for each function, and then send the
-    // generated high-level InstructionSequence to the ModuleCollector
+    // the profile to lay out the code with, or the counters added to it
+    EdgeProfile profile;
+    if (m_optimize && m_profile_mode == ProfileMode::USE)
+        profile.read(m_profile_filename);
+
+    // generate high-level code for each function
+    std::vector<GeneratedFunction> functions;
     int next_label_num = 0;
     for (auto i = m_ast->cbegin(); i != m_ast->cend(); ++i) {
         Node *child = *i;
@@ -161,69 +234,160 @@ void Context::highlevel_codegen(ModuleCollector *module_collector, bool m_optimi
             HighLevelCodegen hl_codegen(next_label_num, local_storage_alloc.next(), m_optimize);
             hl_codegen.visit(child);
 
-            std::shared_ptr<InstructionSequence> hl_iseq;
+            // store a pointer to the function definition AST in the
+            // high-level InstructionSequence: this is useful in case information
+            // about the function definition is needed by the low-level
+            // code generator
+            std::shared_ptr<InstructionSequence> hl_iseq = hl_codegen.get_hl_iseq();
+            hl_iseq->set_funcdef_ast(child);
+            functions.push_back({ child, hl_iseq, hl_codegen.get_strings() });
 
-            if (m_optimize) {
-                std::shared_ptr<InstructionSequence> m_hl_iseq = hl_codegen.get_hl_iseq();
+            // make sure local label numbers are not reused between functions
+            next_label_num = hl_codegen.get_next_label_num();
+        }
+    }
 
-                Node *funcdef_ast = m_hl_iseq->get_funcdef_ast();
+    // Turn self-recursive tail calls into loops, and then inline calls
+    // between the functions of the module
+    if (m_optimize) {
+        for (auto i = functions.begin(); i != functions.end(); ++i) {
+            TailCallElimination tail_calls(i->hl_iseq);
+            i->hl_iseq = tail_calls.eliminate_tail_recursion();
+        }
 
-                // cur_hl_iseq is the "current" version of the high-level IR,
-                // which could be a transformed version if we are doing optimizations
-                std::shared_ptr<InstructionSequence> cur_hl_iseq(m_hl_iseq);
-                // High-level optimizations
+        Inliner inliner(next_label_num);
+        for (auto i = functions.begin(); i != functions.end(); ++i)
+            inliner.add_function(i->hl_iseq);
+        inliner.inline_calls();
+        for (unsigned i = 0; i < functions.size(); i++)
+            functions[i].hl_iseq = inliner.get_function(i);
+        next_label_num = inliner.get_next_label_num();
+    }
 
-                // Create a control-flow graph representation of the high-level code
-                HighLevelControlFlowGraphBuilder hl_cfg_builder(cur_hl_iseq);
-                std::shared_ptr<ControlFlowGraph> cfg = hl_cfg_builder.build();
+    // optimize the high-level code of each function, and then send the
+    // high-level InstructionSequence to the ModuleCollector
+    for (auto i = functions.begin(); i != functions.end(); ++i) {
+        Node *child = i->funcdef;
+        std::shared_ptr<InstructionSequence> hl_iseq;
 
+        if (m_optimize) {
+            std::shared_ptr<InstructionSequence> m_hl_iseq = i->hl_iseq;
 
-                // Do local optimizations
-                ConstantPropagation hl_opts(cfg);
-                cfg = hl_opts.transform_cfg();
+            Node *funcdef_ast = m_hl_iseq->get_funcdef_ast();
 
-                // Copy propagation works but does nothing
-//                CopyPropagation cp_opts(cfg);
-//                cfg = cp_opts.transform_cfg();
+            // cur_hl_iseq is the "current" version of the high-level IR,
+            // which could be a transformed version if we are doing optimizations
+            std::shared_ptr<InstructionSequence> cur_hl_iseq(m_hl_iseq);
+            // High-level optimizations
 
-                // live instruction analysis
-                LiveRegisters live_regs(cfg);
-                cfg = live_regs.transform_cfg();
+            // Create a control-flow graph representation of the high-level code
+            HighLevelControlFlowGraphBuilder hl_cfg_builder(cur_hl_iseq);
+            std::shared_ptr<ControlFlowGraph> cfg = hl_cfg_builder.build();
 
 
-                // Convert the transformed high-level CFG back to an InstructionSequence
-                cur_hl_iseq = cfg->create_instruction_sequence();
+            // Do local optimizations
+            ConstantPropagation hl_opts(cfg);
+            cfg = hl_opts.transform_cfg();
 
-                // The function definition AST might have information needed for
-                // low-level code generation
-                cur_hl_iseq->set_funcdef_ast(funcdef_ast);
-                hl_iseq = cur_hl_iseq;
+            // Use the ranges of values to decide comparisons, and
+            // to remove or narrow extensions and divisions
+            ValueRangeOptimization value_ranges(cfg);
+            cfg = value_ranges.transform_cfg();
 
-            } else {
-                hl_iseq = hl_codegen.get_hl_iseq();
-            }
+            // Remove the jumps and blocks made useless by the decided
+            // branches, so the later passes see straight-line code
+            ControlFlowSimplification simplify_cfg(cfg);
+            cfg = simplify_cfg.transform_cfg();
 
+            // Replace short branches choosing a value with selects
+            // (conditional moves)
+            IfConversion if_conversion(cfg);
+            cfg = if_conversion.transform_cfg();
 
-            std::vector<std::string> strings = hl_codegen.get_strings();
-            for (int l = 0; l < (int) strings.size(); l++){
-                std::ostringstream stream;
-                stream << "str" << l;
-                module_collector->collect_string_constant(stream.str(), hl_codegen.get_strings().at(l));
-            }
+            // Reuse values already computed in the same block or in a
+            // dominating block
+            GlobalValueNumbering gvn(cfg);
+            cfg = gvn.transform_cfg();
+
+            // Hoist loop invariant computations into loop preheaders
+            LoopInvariantCodeMotion licm(cfg);
+            cfg = licm.transform_cfg();
+
+            // Turn array indexing in loops into pointer increments
+            InductionVariableStrengthReduction ivsr(cfg);
+            cfg = ivsr.transform_cfg();
+
+            // Share the values hoisted out of loops and the pointers
+            // created for them
+            GlobalValueNumbering gvn_after_loops(cfg);
+            cfg = gvn_after_loops.transform_cfg();
+
+            // Copy propagation works but does nothing
+//                CopyPropagation cp_opts(cfg);
+//                cfg = cp_opts.transform_cfg();
+
+            // live instruction analysis
+            LiveRegisters live_regs(cfg);
+            cfg = live_regs.transform_cfg();
+
+            // Thread jumps through the blocks emptied by the
+            // optimizations, and merge straight-line blocks
+            ControlFlowSimplification simplify_cfg_again(cfg);
+            cfg = simplify_cfg_again.transform_cfg();
+
+            // Count how often the edges are taken, or get the counts
+            // from the profile
             std::string fn_name = child->get_kid(1)->get_str();
+            if (m_profile_mode == ProfileMode::GENERATE) {
+                cfg = profile.instrument(fn_name, cfg, next_label_num);
+            } else if (m_profile_mode == ProfileMode::USE && !profile.annotate(fn_name, cfg)) {
+                std::cout << "/* Function '" << fn_name << "': not in the profile */" << std::endl;
+            }
 
-            // store a pointer to the function definition AST in the
-            // high-level InstructionSequence: this is useful in case information
-            // about the function definition is needed by the low-level
-            // code generator
-            hl_iseq->set_funcdef_ast(child);
+            // Place the blocks so that the likely paths fall through,
+            // and the rarely executed blocks are out of the way
+            BlockLayout layout(cfg, next_label_num);
+            cfg = layout.transform_cfg();
+            next_label_num = layout.get_next_label_num();
+
+            // Convert the transformed high-level CFG back to an InstructionSequence
+            cur_hl_iseq = cfg->create_instruction_sequence();
+
+            // The optimizations may have created vregs, and made others
+            // unused: compact the vreg numbers, and let the low-level code
+            // generator know the highest one
+            int max_vreg = get_max_vreg(cur_hl_iseq);
+            cur_hl_iseq = renumber_vregs(cur_hl_iseq);
+            Symbol *fn_sym = child->get_symbol();
+            fn_sym->set_vreg(get_max_vreg(cur_hl_iseq));
+            std::cout << "/* Function '" << fn_sym->get_name() << "': vregs renumbered, highest vreg is vr"
+                      << fn_sym->get_vreg() << " (was vr" << max_vreg << ") */" << std::endl;
+
+            // The function definition AST might have information needed for
+            // low-level code generation
+            cur_hl_iseq->set_funcdef_ast(funcdef_ast);
+            hl_iseq = cur_hl_iseq;
+
+        } else {
+            hl_iseq = i->hl_iseq;
+        }
 
-            module_collector->collect_function(fn_name, hl_iseq);
 
-            // make sure local label numbers are not reused between functions
-            next_label_num = hl_codegen.get_next_label_num();
+        const std::vector<std::string> &strings = i->strings;
+        for (int l = 0; l < (int) strings.size(); l++){
+            std::ostringstream stream;
+            stream << "str" << l;
+            module_collector->collect_string_constant(stream.str(), strings.at(l));
         }
+        std::string fn_name = child->get_kid(1)->get_str();
+
+        hl_iseq->set_funcdef_ast(child);
+
+        module_collector->collect_function(fn_name, hl_iseq);
     }
+
+    if (m_optimize && m_profile_mode == ProfileMode::GENERATE)
+        module_collector->collect_profile_counters(EdgeProfile::PROFILE_SYMBOL, profile.get_values());
 }
 
 namespace {
@@ -234,20 +398,24 @@ namespace {
     class LowLevelCodeGenModuleCollector : public ModuleCollector {
     private:
         ModuleCollector *m_delegate;
-        bool m_optimize;
+        OptimizationLevel m_opt_level;
+        bool m_print_peephole_stats;
 
     public:
-        LowLevelCodeGenModuleCollector(ModuleCollector *delegate, bool optimize);
+        LowLevelCodeGenModuleCollector(ModuleCollector *delegate, OptimizationLevel opt_level, bool print_peephole_stats);
         virtual ~LowLevelCodeGenModuleCollector();
 
         virtual void collect_string_constant(const std::string &name, const std::string &strval);
         virtual void collect_global_var(const std::string &name, const std::shared_ptr<Type> &type);
         virtual void collect_function(const std::string &name, const std::shared_ptr<InstructionSequence> &iseq);
+        virtual void collect_profile_counters(const std::string &name, const std::vector<unsigned long> &values);
     };
 
-    LowLevelCodeGenModuleCollector::LowLevelCodeGenModuleCollector(ModuleCollector *delegate, bool optimize)
+    LowLevelCodeGenModuleCollector::LowLevelCodeGenModuleCollector(ModuleCollector *delegate, OptimizationLevel opt_level,
+                                                                   bool print_peephole_stats)
             : m_delegate(delegate)
-            , m_optimize(optimize) {
+            , m_opt_level(opt_level)
+            , m_print_peephole_stats(print_peephole_stats) {
     }
 
     LowLevelCodeGenModuleCollector::~LowLevelCodeGenModuleCollector() {
@@ -262,7 +430,9 @@ namespace {
     }
 
     void LowLevelCodeGenModuleCollector::collect_function(const std::string &name, const std::shared_ptr<InstructionSequence> &iseq) {
-        LowLevelCodeGen ll_codegen(m_optimize);
+        LowLevelCodeGen ll_codegen(m_opt_level == OptimizationLevel::FULL,
+                                   m_opt_level == OptimizationLevel::LOCAL_REGISTERS,
+                                   m_print_peephole_stats);
 
         // translate high-level code to low-level code
         std::shared_ptr<InstructionSequence> ll_iseq = ll_codegen.generate(iseq);
@@ -271,9 +441,15 @@ namespace {
         m_delegate->collect_function(name, ll_iseq);
     }
 
+    void LowLevelCodeGenModuleCollector::collect_profile_counters(const std::string &name,
+                                                                  const std::vector<unsigned long> &values) {
+        m_delegate->collect_profile_counters(name, values);
+    }
+
 }
 
-void Context::lowlevel_codegen(ModuleCollector *module_collector, bool optimize) {
-    LowLevelCodeGenModuleCollector ll_codegen_module_collector(module_collector, optimize);
-    highlevel_codegen(&ll_codegen_module_collector, optimize);
+void Context::lowlevel_codegen(ModuleCollector *module_collector, OptimizationLevel opt_level, bool print_peephole_stats) {
+    LowLevelCodeGenModuleCollector ll_codegen_module_collector(module_collector, opt_level, print_peephole_stats);
+    // The high-level code is only optimized at the full optimization level
+    highlevel_codegen(&ll_codegen_module_collector, opt_level == OptimizationLevel::FULL);
 }
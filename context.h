@@ -27,6 +27,24 @@
 #include "module_collector.h"
 class Node;
 
+// Optimization levels: LOCAL_REGISTERS (-O1) keeps vregs in registers
+// within basic blocks while generating low-level code, FULL (-o) also
+// optimizes the high-level code and does global register allocation
+enum class OptimizationLevel {
+  NONE,
+  LOCAL_REGISTERS,
+  FULL,
+};
+
+// Edge profiling (only done with the FULL optimization level): GENERATE
+// adds counters to the code, USE lays out the code using the counts in a
+// profile written by the instrumented program
+enum class ProfileMode {
+  NONE,
+  GENERATE,
+  USE,
+};
+
 // The Context class gathers together all of the objects/data
 // used in the compilation process, and orchestrates the various
 // passes and transformations.
@@ -34,6 +52,8 @@ class Context {
 private:
   Node *m_ast;
   SemanticAnalysis m_sema;
+  ProfileMode m_profile_mode;
+  std::string m_profile_filename;
 
   // copy ctor and assignment operator not allowed
   Context(const Context &);
@@ -52,10 +72,18 @@ public:
   // Get pointer to root of AST
   Node *get_ast() const { return m_ast; }
 
+  // Instrument the code for edge profiling, or use the profile in
+  // the file (the filename is only needed for ProfileMode::USE)
+  void set_profile_mode(ProfileMode mode, const std::string &filename = "") {
+    m_profile_mode = mode;
+    m_profile_filename = filename;
+  }
+
   // functions for semantic analysis, code generation, etc.
   void analyze();
   void highlevel_codegen(ModuleCollector *module_collector, bool m_optimize);
-  void lowlevel_codegen(ModuleCollector *module_collector, bool optimize = false);
+  void lowlevel_codegen(ModuleCollector *module_collector, OptimizationLevel opt_level = OptimizationLevel::NONE,
+                        bool print_peephole_stats = false);
 };
 
 #endif // CONTEXT_H
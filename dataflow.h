@@ -65,6 +65,16 @@ public:
   // Logical navigation forward and backward (program order)
   ForwardNavigation LOGICAL_FORWARD;
   BackwardNavigation LOGICAL_BACKWARD;
+
+  // An analysis which learns something from the edge control takes out
+  // of a block (such as the outcome of its conditional branch) sets this
+  // and overrides model_edge()
+  const static bool MODELS_EDGES = false;
+
+  // Model a control edge: refine the fact at the end of its source block
+  // to what is known when control goes to its target
+  template<typename Fact>
+  void model_edge(const Edge *edge, Fact &fact) const { }
 };
 
 // Base class for backward analyses.
@@ -84,6 +94,12 @@ public:
   // Logical navigation forward and backward (reverse of program order)
   BackwardNavigation LOGICAL_FORWARD;
   ForwardNavigation LOGICAL_BACKWARD;
+
+  // Control edges aren't modeled by backward analyses
+  const static bool MODELS_EDGES = false;
+
+  template<typename Fact>
+  void model_edge(const Edge *edge, Fact &fact) const { }
 };
 
 // An instance of Dataflow performs a dataflow analysis on the basic blocks
@@ -226,7 +242,13 @@ void Dataflow<Analysis>::execute() {
       for (auto j = logical_predecessor_edges.cbegin(); j != logical_predecessor_edges.cend(); j++) {
         const Edge *e = *j;
         const BasicBlock *logical_predecessor = to_logical_predecessors.get_block(e);
-        fact = m_analysis.combine_facts(fact, logical_end_facts[logical_predecessor->get_id()]);
+        if (Analysis::MODELS_EDGES) {
+          FactType edge_fact = logical_end_facts[logical_predecessor->get_id()];
+          m_analysis.model_edge(e, edge_fact);
+          fact = m_analysis.combine_facts(fact, edge_fact);
+        } else {
+          fact = m_analysis.combine_facts(fact, logical_end_facts[logical_predecessor->get_id()]);
+        }
       }
 
       // Update (currently-known) fact at the "beginning" of this basic block
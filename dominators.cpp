@@ -0,0 +1,106 @@
+#include <cassert>
+#include <algorithm>
+#include "dominators.h"
+
+DominatorTree::DominatorTree(const std::shared_ptr<ControlFlowGraph> &cfg)
+  : m_cfg(cfg)
+  , m_rpo_index(cfg->get_num_blocks(), -1)
+  , m_idom(cfg->get_num_blocks(), nullptr)
+  , m_children(cfg->get_num_blocks()) {
+  compute_reverse_postorder();
+
+  BasicBlock *entry = m_cfg->get_entry_block();
+
+  // The entry block is (temporarily) its own immediate dominator, so that
+  // every processed block has a path up the tree ending at the entry
+  m_idom[entry->get_id()] = entry;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto i = m_rpo.begin(); i != m_rpo.end(); ++i) {
+      BasicBlock *bb = *i;
+      if (bb == entry) {
+        continue;
+      }
+
+      // the new idom is the common dominator of all processed predecessors
+      BasicBlock *new_idom = nullptr;
+      const ControlFlowGraph::EdgeList &incoming = m_cfg->get_incoming_edges(bb);
+      for (auto j = incoming.begin(); j != incoming.end(); ++j) {
+        BasicBlock *pred = (*j)->get_source();
+        if (m_idom[pred->get_id()] == nullptr) {
+          continue;
+        }
+        new_idom = (new_idom == nullptr) ? pred : intersect(pred, new_idom);
+      }
+
+      if (new_idom != m_idom[bb->get_id()]) {
+        m_idom[bb->get_id()] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  m_idom[entry->get_id()] = nullptr;
+
+  for (auto i = m_rpo.begin(); i != m_rpo.end(); ++i) {
+    BasicBlock *idom = m_idom[(*i)->get_id()];
+    if (idom != nullptr) {
+      m_children[idom->get_id()].push_back(*i);
+    }
+  }
+}
+
+DominatorTree::~DominatorTree() {
+}
+
+bool DominatorTree::dominates(const BasicBlock *a, const BasicBlock *b) const {
+  if (!is_reachable(a) || !is_reachable(b)) {
+    return false;
+  }
+
+  // a dominator always precedes the blocks it dominates in reverse postorder,
+  // so walk up the tree from b until we are no later than a
+  while (b != nullptr && m_rpo_index[b->get_id()] > m_rpo_index[a->get_id()]) {
+    b = m_idom[b->get_id()];
+  }
+  return b == a;
+}
+
+void DominatorTree::compute_reverse_postorder() {
+  std::vector<bool> visited(m_cfg->get_num_blocks(), false);
+  postorder(m_cfg->get_entry_block(), visited, m_rpo);
+  std::reverse(m_rpo.begin(), m_rpo.end());
+
+  for (unsigned i = 0; i < m_rpo.size(); i++) {
+    m_rpo_index[m_rpo[i]->get_id()] = int(i);
+  }
+}
+
+void DominatorTree::postorder(BasicBlock *bb, std::vector<bool> &visited, std::vector<BasicBlock *> &order) {
+  visited[bb->get_id()] = true;
+
+  const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+  for (auto i = outgoing.begin(); i != outgoing.end(); ++i) {
+    BasicBlock *succ = (*i)->get_target();
+    if (!visited[succ->get_id()]) {
+      postorder(succ, visited, order);
+    }
+  }
+
+  order.push_back(bb);
+}
+
+// Find the nearest common dominator of two processed blocks
+BasicBlock *DominatorTree::intersect(BasicBlock *a, BasicBlock *b) const {
+  while (a != b) {
+    while (m_rpo_index[a->get_id()] > m_rpo_index[b->get_id()]) {
+      a = m_idom[a->get_id()];
+    }
+    while (m_rpo_index[b->get_id()] > m_rpo_index[a->get_id()]) {
+      b = m_idom[b->get_id()];
+    }
+  }
+  return a;
+}
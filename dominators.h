@@ -0,0 +1,51 @@
+#ifndef DOMINATORS_H
+#define DOMINATORS_H
+
+#include <memory>
+#include <vector>
+#include "cfg.h"
+
+// Dominator tree of a control-flow graph, computed with the iterative
+// algorithm of Cooper, Harvey, and Kennedy ("A Simple, Fast Dominance
+// Algorithm"). Blocks which are not reachable from the entry block
+// are not part of the tree.
+class DominatorTree {
+private:
+  std::shared_ptr<ControlFlowGraph> m_cfg;
+  // reachable blocks in reverse postorder, and each block's position in it
+  // (-1 for unreachable blocks)
+  std::vector<BasicBlock *> m_rpo;
+  std::vector<int> m_rpo_index;
+  // immediate dominator of each block (by block id), null for the entry
+  // block and unreachable blocks
+  std::vector<BasicBlock *> m_idom;
+  std::vector<std::vector<BasicBlock *>> m_children;
+
+public:
+  DominatorTree(const std::shared_ptr<ControlFlowGraph> &cfg);
+  ~DominatorTree();
+
+  std::shared_ptr<ControlFlowGraph> get_cfg() const { return m_cfg; }
+
+  // Reachable blocks in reverse postorder: every block appears after
+  // its dominators
+  const std::vector<BasicBlock *> &get_reverse_postorder() const { return m_rpo; }
+
+  bool is_reachable(const BasicBlock *bb) const { return m_rpo_index[bb->get_id()] >= 0; }
+
+  // Get the immediate dominator of a block (null for the entry block)
+  BasicBlock *get_idom(const BasicBlock *bb) const { return m_idom[bb->get_id()]; }
+
+  // Get the blocks immediately dominated by a block
+  const std::vector<BasicBlock *> &get_children(const BasicBlock *bb) const { return m_children[bb->get_id()]; }
+
+  // Does block a dominate block b? (Every block dominates itself.)
+  bool dominates(const BasicBlock *a, const BasicBlock *b) const;
+
+private:
+  void compute_reverse_postorder();
+  void postorder(BasicBlock *bb, std::vector<bool> &visited, std::vector<BasicBlock *> &order);
+  BasicBlock *intersect(BasicBlock *a, BasicBlock *b) const;
+};
+
+#endif // DOMINATORS_H
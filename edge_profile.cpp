@@ -0,0 +1,360 @@
+#include <cassert>
+#include <algorithm>
+#include <fstream>
+#include "highlevel.h"
+#include "instruction.h"
+#include "exceptions.h"
+#include "local_storage_allocation.h"
+#include "dominators.h"
+#include "loops.h"
+#include "edge_profile.h"
+
+const char *const EdgeProfile::PROFILE_SYMBOL = "__nearly_cc_profile";
+
+namespace {
+
+// Elements of the counter array before the counters of a function: the
+// hash of its CFG, and the number of counters
+const unsigned RECORD_HEADER_SIZE = 2;
+
+int get_max_vreg(const ControlFlowGraph &cfg) {
+  int max_vreg = LocalStorageAllocation::VREG_FIRST_LOCAL - 1;
+  for (auto i = cfg.bb_begin(); i != cfg.bb_end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        const Operand &operand = ins->get_operand(k);
+        if (operand.has_base_reg()) {
+          max_vreg = std::max(max_vreg, operand.get_base_reg());
+        }
+        if (operand.has_index_reg()) {
+          max_vreg = std::max(max_vreg, operand.get_index_reg());
+        }
+      }
+    }
+  }
+  return max_vreg;
+}
+
+}
+
+EdgeProfile::EdgeProfile() {
+}
+
+EdgeProfile::~EdgeProfile() {
+}
+
+void EdgeProfile::read(const std::string &filename) {
+  std::ifstream in(filename);
+  if (!in) {
+    RuntimeError::raise("Couldn't open profile '%s'", filename.c_str());
+  }
+  unsigned long length = 0;
+  if (!(in >> length) || length == 0) {
+    RuntimeError::raise("Profile '%s' is empty", filename.c_str());
+  }
+  m_values.assign(1, length);
+  unsigned long value;
+  while (m_values.size() < length && in >> value) {
+    m_values.push_back(value);
+  }
+  if (m_values.size() != length) {
+    RuntimeError::raise("Profile '%s' is truncated", filename.c_str());
+  }
+
+  unsigned pos = 1;
+  while (pos + RECORD_HEADER_SIZE <= length && pos + RECORD_HEADER_SIZE + m_values[pos + 1] <= length) {
+    m_records[m_values[pos]] = pos;
+    pos += RECORD_HEADER_SIZE + unsigned(m_values[pos + 1]);
+  }
+}
+
+std::shared_ptr<ControlFlowGraph> EdgeProfile::instrument(const std::string &fn_name,
+                                                          const std::shared_ptr<ControlFlowGraph> &cfg,
+                                                          int &next_label_num) {
+  std::vector<Edge *> counted = find_counted_edges(cfg);
+  if (m_values.empty()) {
+    m_values.push_back(1);
+  }
+  unsigned first_counter = unsigned(m_values.size()) + RECORD_HEADER_SIZE;
+  m_values.push_back(hash(fn_name, *cfg));
+  m_values.push_back(counted.size());
+  m_values.resize(m_values.size() + counted.size(), 0);
+  m_values[0] = m_values.size();
+
+  // Decide where each counter goes: code added at the start of a block,
+  // or a block of its own (with a label, unless control falls through
+  // to it)
+  int next_vreg = get_max_vreg(*cfg) + 1;
+  std::vector<std::vector<Instruction *>> prologues(cfg->get_num_blocks());
+  std::map<const Edge *, unsigned> split_edges;
+  std::map<const Edge *, std::string> split_labels;
+  for (unsigned i = 0; i < counted.size(); i++) {
+    Edge *edge = counted[i];
+    BasicBlock *source = edge->get_source(), *target = edge->get_target();
+    if (source->get_kind() == BASICBLOCK_INTERIOR && cfg->get_outgoing_edges(source).size() == 1) {
+      append_increment(first_counter + i, next_vreg, prologues[source->get_id()]);
+    } else if (target->get_kind() == BASICBLOCK_INTERIOR && cfg->get_incoming_edges(target).size() == 1) {
+      append_increment(first_counter + i, next_vreg, prologues[target->get_id()]);
+    } else {
+      split_edges[edge] = first_counter + i;
+      if (edge->get_kind() != EDGE_FALLTHROUGH) {
+        split_labels[edge] = ".L" + std::to_string(next_label_num++);
+      }
+    }
+  }
+
+  // The code of each block, with its counters (after the enter
+  // instruction, in the first block), and its branch retargeted to the
+  // blocks of its counted edges
+  std::shared_ptr<ControlFlowGraph> result(new ControlFlowGraph());
+  std::vector<BasicBlock *> block_map(cfg->get_num_blocks(), nullptr);
+  for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+    BasicBlock *orig = *i;
+    std::vector<Instruction *> code;
+    for (auto j = orig->cbegin(); j != orig->cend(); j++) {
+      code.push_back((*j)->duplicate());
+    }
+    std::vector<Instruction *> &prologue = prologues[orig->get_id()];
+    auto pos = (!code.empty() && code.front()->get_opcode() == HINS_enter) ? code.begin() + 1 : code.begin();
+    code.insert(pos, prologue.begin(), prologue.end());
+
+    const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+    for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+      auto label = split_labels.find(*j);
+      if (label == split_labels.end()) {
+        continue;
+      }
+      std::string target_label = (*j)->get_target()->get_label();
+      Instruction *branch = code.back();
+      if ((*j)->get_kind() == EDGE_MULTIWAY) {
+        std::shared_ptr<JumpTable> table(new JumpTable(*branch->get_jump_table()));
+        std::replace(table->targets.begin(), table->targets.end(), target_label, label->second);
+        branch->set_jump_table(table);
+      } else {
+        unsigned num_operands = branch->get_num_operands();
+        Operand operands[3];
+        for (unsigned k = 0; k < num_operands; k++) {
+          operands[k] = branch->get_operand(k);
+        }
+        operands[num_operands - 1] = Operand(Operand::LABEL, label->second);
+        code.back() = new Instruction(branch->get_opcode(), operands[0], operands[1], operands[2], num_operands);
+        delete branch;
+      }
+    }
+
+    BasicBlock *bb = result->create_basic_block(orig->get_kind(), orig->get_code_order() * 2, orig->get_label());
+    for (auto j = code.begin(); j != code.end(); j++) {
+      bb->append(*j);
+    }
+    block_map[orig->get_id()] = bb;
+  }
+
+  // A block created on a fall through edge goes between its source and
+  // target, and blocks created on other edges go at the end
+  int next_code_order = cfg->get_exit_block()->get_code_order() * 2 - 1;
+  for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+    const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(*i);
+    for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+      Edge *edge = *j;
+      BasicBlock *source = block_map[edge->get_source()->get_id()];
+      BasicBlock *target = block_map[edge->get_target()->get_id()];
+      auto split = split_edges.find(edge);
+      if (split == split_edges.end()) {
+        result->create_edge(source, target, edge->get_kind());
+        continue;
+      }
+
+      std::vector<Instruction *> code;
+      append_increment(split->second, next_vreg, code);
+      BasicBlock *counter;
+      if (edge->get_kind() == EDGE_FALLTHROUGH) {
+        counter = result->create_basic_block(BASICBLOCK_INTERIOR, source->get_code_order() + 1);
+        result->create_edge(counter, target, EDGE_FALLTHROUGH);
+      } else {
+        counter = result->create_basic_block(BASICBLOCK_INTERIOR, next_code_order--, split_labels[edge]);
+        code.push_back(new Instruction(HINS_jmp, Operand(Operand::LABEL, target->get_label())));
+        result->create_edge(counter, target, EDGE_BRANCH);
+      }
+      for (auto k = code.begin(); k != code.end(); k++) {
+        counter->append(*k);
+      }
+      result->create_edge(source, counter, edge->get_kind());
+    }
+  }
+
+  return result;
+}
+
+bool EdgeProfile::annotate(const std::string &fn_name, const std::shared_ptr<ControlFlowGraph> &cfg) {
+  auto record = m_records.find(hash(fn_name, *cfg));
+  std::vector<Edge *> counted = find_counted_edges(cfg);
+  if (record == m_records.end() || m_values[record->second + 1] != counted.size()) {
+    return false;
+  }
+
+  // The count of each edge (-1 while it is unknown), and the edge from
+  // the exit block back to the entry block, whose count is the number
+  // of calls
+  std::vector<Edge *> edges = get_edges(*cfg);
+  std::map<const Edge *, unsigned> edge_index;
+  for (unsigned i = 0; i < edges.size(); i++) {
+    edge_index[edges[i]] = i;
+  }
+  unsigned calls = unsigned(edges.size());
+  std::vector<long> counts(edges.size() + 1, -1);
+  for (unsigned i = 0; i < counted.size(); i++) {
+    counts[edge_index[counted[i]]] = long(m_values[record->second + RECORD_HEADER_SIZE + i]);
+  }
+
+  // Control leaves each block as many times as it enters it, so when
+  // all but one of the edges of a block have known counts, the count
+  // of the remaining edge follows
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+      BasicBlock *bb = *i;
+      // the edges of the block, and whether each one enters it
+      std::vector<std::pair<unsigned, bool>> flow;
+      const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(bb);
+      for (auto j = incoming.begin(); j != incoming.end(); j++) {
+        flow.push_back({ edge_index[*j], true });
+      }
+      const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+      for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+        flow.push_back({ edge_index[*j], false });
+      }
+      if (bb->get_kind() == BASICBLOCK_ENTRY || bb->get_kind() == BASICBLOCK_EXIT) {
+        flow.push_back({ calls, bb->get_kind() == BASICBLOCK_ENTRY });
+      }
+
+      long balance = 0;
+      int num_unknown = 0;
+      std::pair<unsigned, bool> unknown;
+      for (auto j = flow.begin(); j != flow.end(); j++) {
+        if (counts[j->first] < 0) {
+          num_unknown++;
+          unknown = *j;
+        } else {
+          balance += j->second ? counts[j->first] : -counts[j->first];
+        }
+      }
+      if (num_unknown == 1) {
+        // (the counts are inconsistent if the program exited in the
+        // middle of the function)
+        counts[unknown.first] = std::max(0L, unknown.second ? -balance : balance);
+        changed = true;
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < edges.size(); i++) {
+    edges[i]->set_count(counts[i]);
+  }
+  for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    long count = (bb->get_kind() == BASICBLOCK_ENTRY) ? counts[calls] : 0;
+    const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(bb);
+    for (auto j = incoming.begin(); j != incoming.end(); j++) {
+      count += std::max(0L, (*j)->get_count());
+    }
+    bb->set_count(count);
+  }
+  return true;
+}
+
+// Kruskal's algorithm, adding the edges in the deepest loops to the
+// tree first (those are likely to be taken most often), after the edge
+// from the exit back to the entry. The edges left out of the tree are
+// counted, in the order of get_edges.
+std::vector<Edge *> EdgeProfile::find_counted_edges(const std::shared_ptr<ControlFlowGraph> &cfg) const {
+  DominatorTree dominators(cfg);
+  LoopInfo loops(dominators);
+  std::vector<Edge *> edges = get_edges(*cfg);
+  auto get_depth = [&](const Edge *edge) {
+    return std::min(loops.get_loop_depth(edge->get_source()), loops.get_loop_depth(edge->get_target()));
+  };
+  std::vector<unsigned> order(edges.size());
+  for (unsigned i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](unsigned left, unsigned right) {
+    return get_depth(edges[left]) > get_depth(edges[right]);
+  });
+
+  // the component of each block
+  std::vector<unsigned> parent(cfg->get_num_blocks());
+  for (unsigned i = 0; i < parent.size(); i++) {
+    parent[i] = i;
+  }
+  auto find = [&parent](unsigned id) {
+    while (parent[id] != id) {
+      id = parent[id] = parent[parent[id]];
+    }
+    return id;
+  };
+  parent[cfg->get_exit_block()->get_id()] = cfg->get_entry_block()->get_id();
+
+  std::vector<bool> in_tree(edges.size(), false);
+  for (auto i = order.begin(); i != order.end(); i++) {
+    unsigned source = find(edges[*i]->get_source()->get_id());
+    unsigned target = find(edges[*i]->get_target()->get_id());
+    if (source != target) {
+      parent[source] = target;
+      in_tree[*i] = true;
+    }
+  }
+
+  std::vector<Edge *> counted;
+  for (unsigned i = 0; i < edges.size(); i++) {
+    if (!in_tree[i]) {
+      counted.push_back(edges[i]);
+    }
+  }
+  return counted;
+}
+
+std::vector<Edge *> EdgeProfile::get_edges(const ControlFlowGraph &cfg) {
+  std::vector<Edge *> edges;
+  for (auto i = cfg.bb_begin(); i != cfg.bb_end(); i++) {
+    const ControlFlowGraph::EdgeList &outgoing = cfg.get_outgoing_edges(*i);
+    edges.insert(edges.end(), outgoing.begin(), outgoing.end());
+  }
+  return edges;
+}
+
+// FNV-1a hash of the function's name, and the opcodes of the blocks and
+// their edges
+unsigned long EdgeProfile::hash(const std::string &fn_name, const ControlFlowGraph &cfg) {
+  unsigned long h = 14695981039346656037UL;
+  auto add = [&h](unsigned long value) {
+    h = (h ^ value) * 1099511628211UL;
+  };
+  for (auto i = fn_name.begin(); i != fn_name.end(); i++) {
+    add((unsigned char) *i);
+  }
+  for (auto i = cfg.bb_begin(); i != cfg.bb_end(); i++) {
+    BasicBlock *bb = *i;
+    add(bb->get_kind());
+    for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+      add((*j)->get_opcode());
+    }
+    const ControlFlowGraph::EdgeList &outgoing = cfg.get_outgoing_edges(bb);
+    for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+      add((*j)->get_target()->get_id());
+      add((*j)->get_kind());
+    }
+  }
+  return h;
+}
+
+// Add 1 to a counter of the array
+void EdgeProfile::append_increment(unsigned index, int &next_vreg, std::vector<Instruction *> &code) {
+  int addr = next_vreg++, value = next_vreg++, sum = next_vreg++;
+  std::string counter = std::string(PROFILE_SYMBOL) + "+" + std::to_string(index * 8);
+  code.push_back(new Instruction(HINS_mov_q, Operand(Operand::VREG, addr), Operand(Operand::IMM_LABEL, counter)));
+  code.push_back(new Instruction(HINS_mov_q, Operand(Operand::VREG, value), Operand(Operand::VREG_MEM, addr)));
+  code.push_back(new Instruction(HINS_add_q, Operand(Operand::VREG, sum), Operand(Operand::VREG, value), Operand(Operand::IMM_IVAL, 1)));
+  code.push_back(new Instruction(HINS_mov_q, Operand(Operand::VREG_MEM, addr), Operand(Operand::VREG, sum)));
+}
@@ -0,0 +1,65 @@
+#ifndef EDGE_PROFILE_H
+#define EDGE_PROFILE_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cfg.h"
+
+// Edge profiling of the optimized high-level code of a module. To
+// instrument a function, a spanning tree of its CFG (with an edge from the
+// exit block back to the entry block) is chosen, preferring the edges in
+// the deepest loops, and only the edges which are not in the tree get a
+// counter: the counts of the tree edges follow from those, since control
+// leaves a block as many times as it enters it. A counter is incremented
+// at the start of the source block of its edge if the edge is the only
+// way out of it, or at the start of the target block if it is the only
+// way in, and otherwise in a new block on the edge.
+//
+// The counters of the module are in one array (PROFILE_SYMBOL), which
+// starts with its length. The counters of each function follow a hash of
+// the function's name and CFG, and the number of counters. The runtime
+// (profile_runtime.c) writes the array to a profile file when the program
+// exits. When the module is compiled again with the profile, and the same
+// options, each function whose CFG has the same hash gets the counts of
+// all of its edges and blocks.
+class EdgeProfile {
+private:
+  // the counter array: when instrumenting, its initial contents, and
+  // when using a profile, the contents written by the program
+  std::vector<unsigned long> m_values;
+  // position of each function's counters in the array, by hash
+  std::map<unsigned long, unsigned> m_records;
+
+public:
+  // Name of the counter array
+  static const char *const PROFILE_SYMBOL;
+
+  EdgeProfile();
+  ~EdgeProfile();
+
+  // Read a profile written by an instrumented program (a RuntimeError is
+  // thrown if it can't be read)
+  void read(const std::string &filename);
+
+  // Add counters to the edges of a function's CFG: returns the
+  // instrumented CFG
+  std::shared_ptr<ControlFlowGraph> instrument(const std::string &fn_name, const std::shared_ptr<ControlFlowGraph> &cfg,
+                                               int &next_label_num);
+
+  // Set the counts of the edges and blocks of a function's CFG from the
+  // profile: returns false if the profile has no counts for the CFG
+  bool annotate(const std::string &fn_name, const std::shared_ptr<ControlFlowGraph> &cfg);
+
+  // Initial contents of the counter array of the instrumented functions
+  const std::vector<unsigned long> &get_values() const { return m_values; }
+
+private:
+  std::vector<Edge *> find_counted_edges(const std::shared_ptr<ControlFlowGraph> &cfg) const;
+  static std::vector<Edge *> get_edges(const ControlFlowGraph &cfg);
+  static unsigned long hash(const std::string &fn_name, const ControlFlowGraph &cfg);
+  static void append_increment(unsigned index, int &next_vreg, std::vector<Instruction *> &code);
+};
+
+#endif // EDGE_PROFILE_H
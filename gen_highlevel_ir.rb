@@ -12,6 +12,9 @@ ARITH = [
   :mod,
   :lshift,
   :rshift,
+  :udiv,      # Unsigned division
+  :umod,      # Unsigned remainder
+  :urshift,   # Unsigned (logical) shift right
 
   # Integer comparisons to compute a boolean value:
   # note that all of these assign to a destination vreg
@@ -40,6 +43,18 @@ ARITH = [
   :mov,
 ]
 
+# Compare-and-branch operations: jump to the label (the third operand)
+# if the comparison of the first two operands is true.
+# These are also generated in 4 different widths.
+BRANCHES = [
+  :cjmplt,
+  :cjmplte,
+  :cjmpgt,
+  :cjmpgte,
+  :cjmpeq,
+  :cjmpneq,
+]
+
 SIZES = [ :b, :w, :l, :q ]
 
 NBYTES = {
@@ -98,6 +113,22 @@ OPCODES = [
   # conditional jump
   :cjmp_t,    # conditional jump if boolean is true
   :cjmp_f,    # conditional jump if boolean is false
+
+  # compare and branch
+  *(BRANCHES.product(SIZES).map { |pair| "#{pair[0]}_#{pair[1]}".to_sym }),
+
+  # bit test and branch: jump to the label (the third operand) if the bit
+  # of the first operand selected by the second operand is set
+  :cjmpbit_q,
+
+  # multi-way branch: jump to the target selected by the operand (an
+  # index into the instruction's jump table)
+  :jmptab,
+
+  # select: the destination (the first operand) gets the third operand
+  # if the second operand (a boolean) is nonzero, and the fourth operand
+  # otherwise. Generated in 4 different widths (of the selected values).
+  *(SIZES.map { |size| "sel_#{size}".to_sym }),
 ]
 
 $opcode_names = OPCODES.map { |sym| "HINS_#{sym.to_s}" }
@@ -0,0 +1,155 @@
+#! /usr/bin/env ruby
+
+# Generate the instruction lowering table (lowlevel_lowering.h) from the
+# machine description read from standard input (x86_64.desc).
+# The high-level opcodes are read from highlevel.h and the low-level
+# opcodes from lowlevel.h, so every high-level opcode gets a table entry
+# (in enumeration order), and every low-level opcode named in the
+# description must exist.
+
+SIZES = [ :b, :w, :l, :q ]
+
+TEMPLATES = [
+  :unsupported,
+  :nop,
+  :enter,
+  :leave,
+  :ret,
+  :jump,
+  :cjmp,
+  :localaddr,
+  :move,
+  :convert,
+  :binary,
+  :shift,
+  :unary,
+  :divide,
+  :compare,
+  :branch,
+  :bittest,
+  :jumptable,
+  :select,
+]
+
+FLAGS = [
+  :commutative,
+  :remainder,
+  :implicit,
+  :unsigned,
+  :widen,
+]
+
+def read_enum(filename, prefix)
+  names = []
+  File.open(filename) do |inf|
+    inf.each_line do |line|
+      if m = /^\s*(#{prefix}_\w+),/.match(line)
+        names.push(m[1])
+      end
+    end
+  end
+  return names
+end
+
+hl_opcodes = read_enum('highlevel.h', 'HINS')
+ll_opcodes = read_enum('lowlevel.h', 'MINS')
+
+# Map each high-level opcode name to its rule: [template, ll opcode, flags]
+rules = {}
+
+lineno = 0
+STDIN.each_line do |line|
+  lineno += 1
+  line = line.sub(/#.*$/, '').strip
+  next if line.empty?
+
+  fields = line.split(/\s+/)
+  raise "line #{lineno}: expected opcode, sizes, template, and ll_opcode" if fields.length < 4
+  opcode, sizes, template, ll_opcode, *flags = fields
+
+  raise "line #{lineno}: unknown template #{template}" if !TEMPLATES.include?(template.to_sym)
+  flags.each do |flag|
+    raise "line #{lineno}: unknown flag #{flag}" if !FLAGS.include?(flag.to_sym)
+  end
+
+  variants = []
+  if sizes == '-'
+    raise "line #{lineno}: #{ll_opcode} needs size variants" if ll_opcode.end_with?('*')
+    variants.push([ "HINS_#{opcode}", "MINS_#{ll_opcode}" ])
+  else
+    sizes.each_char do |size|
+      raise "line #{lineno}: unknown size #{size}" if !SIZES.include?(size.to_sym)
+      variants.push([ "HINS_#{opcode}_#{size}", "MINS_#{ll_opcode.sub(/\*$/, size.upcase)}" ])
+    end
+  end
+
+  variants.each do |hl, ll|
+    raise "line #{lineno}: unknown high-level opcode #{hl}" if !hl_opcodes.include?(hl)
+    raise "line #{lineno}: unknown low-level opcode #{ll}" if !ll_opcodes.include?(ll)
+    raise "line #{lineno}: #{hl} is described twice" if rules.has_key?(hl)
+    rules[hl] = [ template, ll, flags ]
+  end
+end
+
+File.open('lowlevel_lowering.h', 'w') do |outf|
+  outf.print <<'EOF1'
+#ifndef LOWLEVEL_LOWERING_H
+#define LOWLEVEL_LOWERING_H
+
+#include "highlevel.h"
+#include "lowlevel.h"
+
+// Generated from x86_64.desc by gen_lowering.rb
+// Do not edit this file!
+
+// How a high-level instruction is lowered: each template is a
+// lowering function in LowLevelCodeGen
+enum LoweringTemplate {
+EOF1
+
+  TEMPLATES.each do |template|
+    outf.puts "  LOWER_#{template.to_s.upcase},"
+  end
+
+  outf.print <<'EOF2'
+};
+
+// Flags modifying a template
+EOF2
+
+  FLAGS.each_with_index do |flag, i|
+    outf.puts "const int LOWER_#{flag.to_s.upcase} = #{1 << i};"
+  end
+
+  outf.print <<'EOF3'
+
+struct LoweringRule {
+  LoweringTemplate tmpl;
+  LowLevelOpcode ll_opcode;
+  int flags;
+};
+
+// Lowering rule of each high-level opcode, indexed by opcode
+constexpr LoweringRule LOWERING_RULES[] = {
+EOF3
+
+  hl_opcodes.each do |hl|
+    template, ll, flags = rules.fetch(hl, [ 'unsupported', 'MINS_NOP', [] ])
+    flag_expr = flags.empty? ? '0' : flags.map { |flag| "LOWER_#{flag.upcase}" }.join('|')
+    entry = "{ LOWER_#{template.upcase}, #{ll}, #{flag_expr} },"
+    outf.puts "  #{entry.ljust(48)} // #{hl}"
+  end
+
+  outf.print <<"EOF4"
+};
+
+static_assert(sizeof(LOWERING_RULES) / sizeof(LOWERING_RULES[0]) == #{hl_opcodes.last} + 1,
+              "every high-level opcode needs a lowering rule");
+
+constexpr const LoweringRule &get_lowering_rule(HighLevelOpcode opcode) {
+  return LOWERING_RULES[opcode];
+}
+
+#endif // LOWLEVEL_LOWERING_H
+EOF4
+end
@@ -34,6 +34,18 @@ const char *highlevel_opcode_to_str(HighLevelOpcode opcode) {
   case HINS_rshift_w:   return "rshift_w";
   case HINS_rshift_l:   return "rshift_l";
   case HINS_rshift_q:   return "rshift_q";
+  case HINS_udiv_b:     return "udiv_b";
+  case HINS_udiv_w:     return "udiv_w";
+  case HINS_udiv_l:     return "udiv_l";
+  case HINS_udiv_q:     return "udiv_q";
+  case HINS_umod_b:     return "umod_b";
+  case HINS_umod_w:     return "umod_w";
+  case HINS_umod_l:     return "umod_l";
+  case HINS_umod_q:     return "umod_q";
+  case HINS_urshift_b:  return "urshift_b";
+  case HINS_urshift_w:  return "urshift_w";
+  case HINS_urshift_l:  return "urshift_l";
+  case HINS_urshift_q:  return "urshift_q";
   case HINS_cmplt_b:    return "cmplt_b";
   case HINS_cmplt_w:    return "cmplt_w";
   case HINS_cmplt_l:    return "cmplt_l";
@@ -114,6 +126,36 @@ const char *highlevel_opcode_to_str(HighLevelOpcode opcode) {
   case HINS_localaddr:  return "localaddr";
   case HINS_cjmp_t:     return "cjmp_t";
   case HINS_cjmp_f:     return "cjmp_f";
+  case HINS_cjmplt_b:   return "cjmplt_b";
+  case HINS_cjmplt_w:   return "cjmplt_w";
+  case HINS_cjmplt_l:   return "cjmplt_l";
+  case HINS_cjmplt_q:   return "cjmplt_q";
+  case HINS_cjmplte_b:  return "cjmplte_b";
+  case HINS_cjmplte_w:  return "cjmplte_w";
+  case HINS_cjmplte_l:  return "cjmplte_l";
+  case HINS_cjmplte_q:  return "cjmplte_q";
+  case HINS_cjmpgt_b:   return "cjmpgt_b";
+  case HINS_cjmpgt_w:   return "cjmpgt_w";
+  case HINS_cjmpgt_l:   return "cjmpgt_l";
+  case HINS_cjmpgt_q:   return "cjmpgt_q";
+  case HINS_cjmpgte_b:  return "cjmpgte_b";
+  case HINS_cjmpgte_w:  return "cjmpgte_w";
+  case HINS_cjmpgte_l:  return "cjmpgte_l";
+  case HINS_cjmpgte_q:  return "cjmpgte_q";
+  case HINS_cjmpeq_b:   return "cjmpeq_b";
+  case HINS_cjmpeq_w:   return "cjmpeq_w";
+  case HINS_cjmpeq_l:   return "cjmpeq_l";
+  case HINS_cjmpeq_q:   return "cjmpeq_q";
+  case HINS_cjmpneq_b:  return "cjmpneq_b";
+  case HINS_cjmpneq_w:  return "cjmpneq_w";
+  case HINS_cjmpneq_l:  return "cjmpneq_l";
+  case HINS_cjmpneq_q:  return "cjmpneq_q";
+  case HINS_cjmpbit_q:  return "cjmpbit_q";
+  case HINS_jmptab:     return "jmptab";
+  case HINS_sel_b:      return "sel_b";
+  case HINS_sel_w:      return "sel_w";
+  case HINS_sel_l:      return "sel_l";
+  case HINS_sel_q:      return "sel_q";
   default: return nullptr;
   } // end switch
 } // end opcode_to_str function
@@ -149,6 +191,18 @@ int highlevel_opcode_get_source_operand_size(HighLevelOpcode opcode) {
   case HINS_rshift_w: return 2;
   case HINS_rshift_l: return 4;
   case HINS_rshift_q: return 8;
+  case HINS_udiv_b: return 1;
+  case HINS_udiv_w: return 2;
+  case HINS_udiv_l: return 4;
+  case HINS_udiv_q: return 8;
+  case HINS_umod_b: return 1;
+  case HINS_umod_w: return 2;
+  case HINS_umod_l: return 4;
+  case HINS_umod_q: return 8;
+  case HINS_urshift_b: return 1;
+  case HINS_urshift_w: return 2;
+  case HINS_urshift_l: return 4;
+  case HINS_urshift_q: return 8;
   case HINS_cmplt_b: return 1;
   case HINS_cmplt_w: return 2;
   case HINS_cmplt_l: return 4;
@@ -229,6 +283,36 @@ int highlevel_opcode_get_source_operand_size(HighLevelOpcode opcode) {
   case HINS_localaddr: return 0;
   case HINS_cjmp_t: return 0;
   case HINS_cjmp_f: return 0;
+  case HINS_cjmplt_b: return 1;
+  case HINS_cjmplt_w: return 2;
+  case HINS_cjmplt_l: return 4;
+  case HINS_cjmplt_q: return 8;
+  case HINS_cjmplte_b: return 1;
+  case HINS_cjmplte_w: return 2;
+  case HINS_cjmplte_l: return 4;
+  case HINS_cjmplte_q: return 8;
+  case HINS_cjmpgt_b: return 1;
+  case HINS_cjmpgt_w: return 2;
+  case HINS_cjmpgt_l: return 4;
+  case HINS_cjmpgt_q: return 8;
+  case HINS_cjmpgte_b: return 1;
+  case HINS_cjmpgte_w: return 2;
+  case HINS_cjmpgte_l: return 4;
+  case HINS_cjmpgte_q: return 8;
+  case HINS_cjmpeq_b: return 1;
+  case HINS_cjmpeq_w: return 2;
+  case HINS_cjmpeq_l: return 4;
+  case HINS_cjmpeq_q: return 8;
+  case HINS_cjmpneq_b: return 1;
+  case HINS_cjmpneq_w: return 2;
+  case HINS_cjmpneq_l: return 4;
+  case HINS_cjmpneq_q: return 8;
+  case HINS_cjmpbit_q: return 8;
+  case HINS_jmptab: return 0;
+  case HINS_sel_b: return 1;
+  case HINS_sel_w: return 2;
+  case HINS_sel_l: return 4;
+  case HINS_sel_q: return 8;
   default: return 0;
   }
 }
@@ -264,6 +348,18 @@ int highlevel_opcode_get_dest_operand_size(HighLevelOpcode opcode) {
   case HINS_rshift_w: return 2;
   case HINS_rshift_l: return 4;
   case HINS_rshift_q: return 8;
+  case HINS_udiv_b: return 1;
+  case HINS_udiv_w: return 2;
+  case HINS_udiv_l: return 4;
+  case HINS_udiv_q: return 8;
+  case HINS_umod_b: return 1;
+  case HINS_umod_w: return 2;
+  case HINS_umod_l: return 4;
+  case HINS_umod_q: return 8;
+  case HINS_urshift_b: return 1;
+  case HINS_urshift_w: return 2;
+  case HINS_urshift_l: return 4;
+  case HINS_urshift_q: return 8;
   case HINS_cmplt_b: return 1;
   case HINS_cmplt_w: return 2;
   case HINS_cmplt_l: return 4;
@@ -344,6 +440,36 @@ int highlevel_opcode_get_dest_operand_size(HighLevelOpcode opcode) {
   case HINS_localaddr: return 0;
   case HINS_cjmp_t: return 0;
   case HINS_cjmp_f: return 0;
+  case HINS_cjmplt_b: return 1;
+  case HINS_cjmplt_w: return 2;
+  case HINS_cjmplt_l: return 4;
+  case HINS_cjmplt_q: return 8;
+  case HINS_cjmplte_b: return 1;
+  case HINS_cjmplte_w: return 2;
+  case HINS_cjmplte_l: return 4;
+  case HINS_cjmplte_q: return 8;
+  case HINS_cjmpgt_b: return 1;
+  case HINS_cjmpgt_w: return 2;
+  case HINS_cjmpgt_l: return 4;
+  case HINS_cjmpgt_q: return 8;
+  case HINS_cjmpgte_b: return 1;
+  case HINS_cjmpgte_w: return 2;
+  case HINS_cjmpgte_l: return 4;
+  case HINS_cjmpgte_q: return 8;
+  case HINS_cjmpeq_b: return 1;
+  case HINS_cjmpeq_w: return 2;
+  case HINS_cjmpeq_l: return 4;
+  case HINS_cjmpeq_q: return 8;
+  case HINS_cjmpneq_b: return 1;
+  case HINS_cjmpneq_w: return 2;
+  case HINS_cjmpneq_l: return 4;
+  case HINS_cjmpneq_q: return 8;
+  case HINS_cjmpbit_q: return 8;
+  case HINS_jmptab: return 0;
+  case HINS_sel_b: return 1;
+  case HINS_sel_w: return 2;
+  case HINS_sel_l: return 4;
+  case HINS_sel_q: return 8;
   default: return 0;
   }
 }
@@ -36,6 +36,18 @@ enum HighLevelOpcode {
   HINS_rshift_w,
   HINS_rshift_l,
   HINS_rshift_q,
+  HINS_udiv_b,
+  HINS_udiv_w,
+  HINS_udiv_l,
+  HINS_udiv_q,
+  HINS_umod_b,
+  HINS_umod_w,
+  HINS_umod_l,
+  HINS_umod_q,
+  HINS_urshift_b,
+  HINS_urshift_w,
+  HINS_urshift_l,
+  HINS_urshift_q,
   HINS_cmplt_b,
   HINS_cmplt_w,
   HINS_cmplt_l,
@@ -116,6 +128,36 @@ enum HighLevelOpcode {
   HINS_localaddr,
   HINS_cjmp_t,
   HINS_cjmp_f,
+  HINS_cjmplt_b,
+  HINS_cjmplt_w,
+  HINS_cjmplt_l,
+  HINS_cjmplt_q,
+  HINS_cjmplte_b,
+  HINS_cjmplte_w,
+  HINS_cjmplte_l,
+  HINS_cjmplte_q,
+  HINS_cjmpgt_b,
+  HINS_cjmpgt_w,
+  HINS_cjmpgt_l,
+  HINS_cjmpgt_q,
+  HINS_cjmpgte_b,
+  HINS_cjmpgte_w,
+  HINS_cjmpgte_l,
+  HINS_cjmpgte_q,
+  HINS_cjmpeq_b,
+  HINS_cjmpeq_w,
+  HINS_cjmpeq_l,
+  HINS_cjmpeq_q,
+  HINS_cjmpneq_b,
+  HINS_cjmpneq_w,
+  HINS_cjmpneq_l,
+  HINS_cjmpneq_q,
+  HINS_cjmpbit_q,
+  HINS_jmptab,
+  HINS_sel_b,
+  HINS_sel_w,
+  HINS_sel_l,
+  HINS_sel_q,
 }; // HighLevelOpcode enumeration
 
 // Translate a high-level opcode to its assembler mnemonic.
@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <climits>
+#include <set>
 #include <sstream>
 #include "node.h"
 #include "instruction.h"
 #include "highlevel.h"
 #include "parse.tab.h"
+#include "ast.h"
 #include "exceptions.h"
 #include "highlevel_codegen.h"
 #include "local_storage_allocation.h"
@@ -45,7 +49,7 @@ void HighLevelCodegen::visit_function_definition(Node *n) {
     // visit body
     visit(n->get_kid(3));
 
-    m_hl_iseq->define_label(m_return_label_name);
+    define_label(m_return_label_name);
     m_hl_iseq->append(new Instruction(HINS_leave, Operand(Operand::IMM_IVAL, total_local_storage)));
     m_hl_iseq->append(new Instruction(HINS_ret));
     n->get_symbol()->set_vreg(m_next_vreg-1);
@@ -78,13 +82,34 @@ void HighLevelCodegen::visit_unary_expression(Node *n) {
                 HighLevelOpcode mov_opcode = get_opcode(HINS_mov_b, n->get_kid(1)->get_type());
                 m_hl_iseq->append(new Instruction(mov_opcode, op, n->get_kid(1)->get_operand()));
                 n->set_operand(op.to_memref());
-                m_next_vreg--;
             } else {
                 n->set_operand(n->get_kid(1)->get_operand().to_memref());
             }
+            break;
+        case TOK_MINUS:
+            visit_unary_operation(n, HINS_neg_b);
+            break;
+        case TOK_NOT:
+            visit_unary_operation(n, HINS_not_b);
+            break;
+        case TOK_BITWISE_COMPL:
+            visit_unary_operation(n, HINS_compl_b);
+            break;
+        case TOK_PLUS:
+            n->set_operand(n->get_kid(1)->get_operand());
+            break;
     }
 }
 
+/// Compute a unary operator's result into a new temporary
+/// \param n unary expression node
+/// \param base_opcode the _b variant of the operation
+void HighLevelCodegen::visit_unary_operation(Node *n, HighLevelOpcode base_opcode) {
+    Operand dest(Operand::VREG, next_temp_vreg());
+    m_hl_iseq->append(new Instruction(get_opcode(base_opcode, n->get_type()), dest, n->get_kid(1)->get_operand()));
+    n->set_operand(dest);
+}
+
 void HighLevelCodegen::visit_return_statement(Node *n) {
     // jump to the return label
     m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, m_return_label_name)));
@@ -115,83 +140,438 @@ void HighLevelCodegen::visit_while_statement(Node *n) {
     m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, jump_end)));
 
     // Set point to return to after each loop
-    m_hl_iseq->define_label(jump_back);
+    define_label(jump_back);
 
-    // visit body
+    // visit body (continue goes to the comparison)
+    m_break_labels.emplace_back();
+    m_continue_labels.push_back(jump_end);
     visit(n->get_kid(1));
+    m_continue_labels.pop_back();
 
     // visit comparison
-    m_hl_iseq->define_label(jump_end);
-    visit(n->get_kid(0));
-    m_hl_iseq->append(new Instruction(HINS_cjmp_t, n->get_kid(0)->get_operand() , Operand(Operand::LABEL, jump_back)));
-
+    define_label(jump_end);
+    visit_condition(n->get_kid(0), true, jump_back);
+    define_loop_label(m_break_labels);
 }
 
 void HighLevelCodegen::visit_do_while_statement(Node *n) {
     std::string jump_back = next_label();
 
     // Set point to return to after each loop
-    m_hl_iseq->define_label(jump_back);
+    define_label(jump_back);
     // visit body
+    m_break_labels.emplace_back();
+    m_continue_labels.emplace_back();
     visit(n->get_kid(0));
-    // visit comparison
-    visit(n->get_kid(1));
-    // Set point to jump to while true
-    m_hl_iseq->append(new Instruction(HINS_cjmp_t, n->get_kid(1)->get_operand() , Operand(Operand::LABEL, jump_back)));
+    define_loop_label(m_continue_labels);
+    // visit comparison, jump back while true
+    visit_condition(n->get_kid(1), true, jump_back);
+    define_loop_label(m_break_labels);
 }
 
 void HighLevelCodegen::visit_for_statement(Node *n) {
     // evaluate assignment
-    if (m_optimize){
-        machine_reg[n->get_kid(0)->get_kid(1)->get_symbol()->get_vreg()] = m_callee_count;
-        m_callee_count++;
-    }
     visit(n->get_kid(0));
 
     std::string jump_back = next_label();
     std::string jump_out = next_label();
     // set return point for loop
     m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, jump_out)));
-    m_hl_iseq->define_label(jump_back);
+    define_label(jump_back);
     // execute body
+    m_break_labels.emplace_back();
+    m_continue_labels.emplace_back();
     visit(n->get_kid(3));
-    // execute change to loop counter
+    // execute change to loop counter (continue goes here)
+    define_loop_label(m_continue_labels);
     visit(n->get_kid(2));
 
     // set label for exiting loop
-    m_hl_iseq->define_label(jump_out);
+    define_label(jump_out);
     // evaluate comparison, return to top if true
-    visit(n->get_kid(1));
-    m_hl_iseq->append(new Instruction(HINS_cjmp_t, n->get_kid(1)->get_operand() , Operand(Operand::LABEL, jump_back)));
-
-
+    visit_condition(n->get_kid(1), true, jump_back);
+    define_loop_label(m_break_labels);
 }
 
 void HighLevelCodegen::visit_if_statement(Node *n) {
     // Visit comparison
-    visit(n->get_kid(0));
     std::string label = next_label();
-    m_hl_iseq->append(new Instruction(HINS_cjmp_f, n->get_kid(0)->get_operand() , Operand(Operand::LABEL, label)));
+    visit_condition(n->get_kid(0), false, label);
     // Visit body
     visit(n->get_kid(1));
-    m_hl_iseq->define_label(label);
+    define_label(label);
 }
 
 void HighLevelCodegen::visit_if_else_statement(Node *n) {
     // Visit comparison
-    visit(n->get_kid(0));
     std::string label = next_label();
     std::string skip_false = next_label();
-    m_hl_iseq->append(new Instruction(HINS_cjmp_f, n->get_kid(0)->get_operand() , Operand(Operand::LABEL, label)));
+    visit_condition(n->get_kid(0), false, label);
     // Visit body
     visit(n->get_kid(1));
     m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, skip_false)));
-    m_hl_iseq->define_label(label);
+    define_label(label);
     visit(n->get_kid(2));
-    m_hl_iseq->define_label(skip_false);
+    define_label(skip_false);
+}
+
+/// Generate code for a switch statement. How the case is found depends
+/// on the case values: a few cases going to one or two targets are found
+/// by testing a bit of a mask, a dense range of values indexes a jump
+/// table, and otherwise a balanced binary search compares the value with
+/// the case values.
+/// \param n switch statement node
+void HighLevelCodegen::visit_switch_statement(Node *n) {
+    int size;
+    Operand value = get_switch_value(n->get_kid(0), size);
+
+    // label each case and default statement of this switch; consecutive
+    // ones (each the body of the one before) share the label of the first
+    std::vector<Node *> labeled;
+    collect_switch_labels(n->get_kid(1), labeled);
+    std::string end_label = next_label();
+    std::string default_label = end_label;
+    std::map<Node *, std::string> shared_labels;
+    std::vector<std::pair<Node *, std::string>> case_nodes;
+    for (Node *node : labeled) {
+        std::string label;
+        auto shared = shared_labels.find(node);
+        if (shared != shared_labels.end()) {
+            label = shared->second;
+            m_case_labels[node] = "";
+        } else {
+            label = next_label();
+            m_case_labels[node] = label;
+        }
+        Node *body = node->get_kid(node->get_num_kids() - 1);
+        if (body->get_tag() == AST_CASE_STATEMENT || body->get_tag() == AST_DEFAULT_STATEMENT)
+            shared_labels[body] = label;
+
+        if (node->get_tag() == AST_DEFAULT_STATEMENT)
+            default_label = label;
+        else
+            case_nodes.emplace_back(node, label);
+    }
+
+    std::shared_ptr<Type> type = n->get_kid(0)->get_type();
+    std::vector<std::pair<long, std::string>> cases;
+    std::set<std::string> targets;
+    for (auto &case_node : case_nodes) {
+        // the value a case matches is its value converted to the type of
+        // the switch value, as it is compared by get_switch_value
+        long case_value = case_node.first->get_literal_value().get_int_value();
+        int shift = 64 - 8 * int(type->get_storage_size());
+        if (type->is_signed())
+            case_value = (case_value << shift) >> shift;
+        else if (shift > 0)
+            case_value = long((unsigned long) case_value << shift >> shift);
+        else
+            case_value ^= LONG_MIN;
+
+        cases.emplace_back(case_value, case_node.second);
+        targets.insert(case_node.second);
+    }
+    std::sort(cases.begin(), cases.end());
+
+    unsigned num_cases = unsigned(cases.size());
+    unsigned long range = num_cases == 0 ? 0 : (unsigned long) cases.back().first - (unsigned long) cases.front().first;
+    // A bit test replaces a compare and branch for each case, so it pays
+    // off if there are several cases per target
+    unsigned num_targets = unsigned(targets.size());
+    bool use_bit_tests = range < 64 && ((num_targets == 1 && num_cases >= 3) || (num_targets == 2 && num_cases >= 5)
+                                        || (num_targets == 3 && num_cases >= 6));
+    // A jump table is used if at least a third of its entries are cases
+    bool use_jump_table = num_cases >= 4 && range < 3UL * num_cases;
+
+    if (num_cases == 0) {
+        m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, default_label)));
+    } else if (use_bit_tests) {
+        long min = cases.front().first;
+        Operand index = get_switch_index(value, size, min, cases.back().first, default_label);
+        std::map<std::string, unsigned long> masks;
+        std::vector<std::string> order;
+        for (auto &c : cases) {
+            if (masks.count(c.second) == 0)
+                order.push_back(c.second);
+            masks[c.second] |= 1UL << (c.first - min);
+        }
+        for (const std::string &label : order) {
+            m_hl_iseq->append(new Instruction(HINS_cjmpbit_q, Operand(Operand::IMM_IVAL, long(masks[label])), index,
+                                              Operand(Operand::LABEL, label)));
+        }
+        m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, default_label)));
+    } else if (use_jump_table) {
+        long min = cases.front().first;
+        Operand index = get_switch_index(value, size, min, cases.back().first, default_label);
+        std::shared_ptr<JumpTable> table(new JumpTable());
+        table->label = next_label();
+        table->targets.assign(range + 1, default_label);
+        for (auto &c : cases)
+            table->targets[c.first - min] = c.second;
+        Instruction *jump = new Instruction(HINS_jmptab, index);
+        jump->set_jump_table(table);
+        m_hl_iseq->append(jump);
+    } else {
+        visit_switch_tree(value, size, cases, 0, num_cases, default_label);
+    }
+
+    // the body, where the cases are labeled (break goes to the end)
+    m_break_labels.push_back(end_label);
+    visit(n->get_kid(1));
+    m_break_labels.pop_back();
+    define_label(end_label);
+}
+
+void HighLevelCodegen::visit_case_statement(Node *n) {
+    // (the label is empty if it is shared with the enclosing case)
+    const std::string &label = m_case_labels.at(n);
+    if (!label.empty())
+        define_label(label);
+    visit(n->get_kid(1));
+}
+
+void HighLevelCodegen::visit_default_statement(Node *n) {
+    const std::string &label = m_case_labels.at(n);
+    if (!label.empty())
+        define_label(label);
+    visit(n->get_kid(0));
+}
+
+void HighLevelCodegen::visit_break_statement(Node *n) {
+    std::string &label = m_break_labels.back();
+    if (label.empty())
+        label = next_label();
+    m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, label)));
+}
+
+void HighLevelCodegen::visit_continue_statement(Node *n) {
+    std::string &label = m_continue_labels.back();
+    if (label.empty())
+        label = next_label();
+    m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, label)));
+}
+
+/// Define the break or continue label of the innermost loop, if a
+/// statement jumps to it, and leave the loop
+/// \param labels the break or continue labels of the enclosing loops
+void HighLevelCodegen::define_loop_label(std::vector<std::string> &labels) {
+    if (!labels.back().empty())
+        define_label(labels.back());
+    labels.pop_back();
+}
+
+/// Find the case and default statements of a switch statement (but not
+/// those of nested switch statements), outer ones first
+/// \param n a statement in the body of the switch statement
+/// \param labeled the case and default statements found
+void HighLevelCodegen::collect_switch_labels(Node *n, std::vector<Node *> &labeled) {
+    if (n->get_tag() == AST_SWITCH_STATEMENT)
+        return;
+    if (n->get_tag() == AST_CASE_STATEMENT || n->get_tag() == AST_DEFAULT_STATEMENT)
+        labeled.push_back(n);
+    for (unsigned i = 0; i < n->get_num_kids(); i++)
+        collect_switch_labels(n->get_kid(i), labeled);
+}
+
+/// Evaluate the value of a switch statement into a vreg which can be
+/// compared as a signed 32 or 64 bit integer. Narrower values are
+/// extended, unsigned ints become longs, and the sign bit of an unsigned
+/// long is flipped, which keeps the order of the values.
+/// \param n the switch value expression
+/// \param size set to the size of the result, 4 or 8
+/// \return the operand holding the result
+Operand HighLevelCodegen::get_switch_value(Node *n, int &size) {
+    visit(n);
+    Operand operand = n->get_operand();
+    std::shared_ptr<Type> type = n->get_type();
+    BasicTypeKind kind = type->get_basic_type_kind();
+
+    size = (kind == BasicTypeKind::LONG || (kind == BasicTypeKind::INT && !type->is_signed())) ? 8 : 4;
+    HighLevelOpcode opcode;
+    if (kind == BasicTypeKind::CHAR)
+        opcode = type->is_signed() ? HINS_sconv_bl : HINS_uconv_bl;
+    else if (kind == BasicTypeKind::SHORT)
+        opcode = type->is_signed() ? HINS_sconv_wl : HINS_uconv_wl;
+    else if (kind == BasicTypeKind::INT && !type->is_signed())
+        opcode = HINS_uconv_lq;
+    else if (operand.get_kind() != Operand::VREG || !type->is_signed())
+        opcode = get_opcode(HINS_mov_b, type);
+    else
+        return operand;
+
+    Operand value(Operand::VREG, next_temp_vreg());
+    m_hl_iseq->append(new Instruction(opcode, value, operand));
+    if (kind == BasicTypeKind::LONG && !type->is_signed()) {
+        Operand sign_bit(Operand::VREG, next_temp_vreg());
+        m_hl_iseq->append(new Instruction(HINS_mov_q, sign_bit, Operand(Operand::IMM_IVAL, LONG_MIN)));
+        m_hl_iseq->append(new Instruction(HINS_xor_q, value, value, sign_bit));
+    }
+    return value;
+}
+
+/// Get an operand for a case value: an immediate, or for a 64 bit
+/// constant which isn't a sign extended 32 bit one, a vreg holding it
+/// \param value the case value
+/// \param size the size of the switch value, 4 or 8
+Operand HighLevelCodegen::get_switch_immediate(long value, int size) {
+    if (size == 4 || (value >= INT_MIN && value <= INT_MAX))
+        return Operand(Operand::IMM_IVAL, value);
+    Operand temp(Operand::VREG, next_temp_vreg());
+    m_hl_iseq->append(new Instruction(HINS_mov_q, temp, Operand(Operand::IMM_IVAL, value)));
+    return temp;
+}
+
+/// Compute the 64 bit index of the switch value in the range of the case
+/// values, jumping to the default label if it is outside the range
+/// \param value the switch value
+/// \param size the size of the switch value, 4 or 8
+/// \param min the smallest case value
+/// \param max the largest case value
+/// \param default_label the label of the default case
+/// \return the operand holding the index
+Operand HighLevelCodegen::get_switch_index(const Operand &value, int size, long min, long max,
+                                           const std::string &default_label) {
+    Operand index(Operand::VREG, next_temp_vreg());
+    if (size == 4) {
+        // zero extending value - min leaves values below the range above it,
+        // so a single comparison checks both ends
+        Operand difference = value;
+        if (min != 0) {
+            difference = Operand(Operand::VREG, next_temp_vreg());
+            m_hl_iseq->append(new Instruction(HINS_sub_l, difference, value, Operand(Operand::IMM_IVAL, min)));
+        }
+        m_hl_iseq->append(new Instruction(HINS_uconv_lq, index, difference));
+        m_hl_iseq->append(new Instruction(HINS_cjmpgt_q, index, Operand(Operand::IMM_IVAL, max - min),
+                                          Operand(Operand::LABEL, default_label)));
+        return index;
+    }
+
+    Operand low = get_switch_immediate(min, size);
+    m_hl_iseq->append(new Instruction(HINS_cjmplt_q, value, low, Operand(Operand::LABEL, default_label)));
+    m_hl_iseq->append(new Instruction(HINS_cjmpgt_q, value, get_switch_immediate(max, size),
+                                      Operand(Operand::LABEL, default_label)));
+    m_hl_iseq->append(new Instruction(HINS_sub_q, index, value, low));
+    return index;
+}
+
+/// Find the case matching a switch value by a binary search of the
+/// case values, down to a few cases which are compared in turn
+/// \param value the switch value
+/// \param size the size of the switch value, 4 or 8
+/// \param cases the case values (in ascending order) and their labels
+/// \param begin the first case searched
+/// \param end the end of the cases searched
+/// \param default_label the label of the default case
+void HighLevelCodegen::visit_switch_tree(const Operand &value, int size,
+                                         const std::vector<std::pair<long, std::string>> &cases,
+                                         unsigned begin, unsigned end, const std::string &default_label) {
+    HighLevelOpcode size_offset = HighLevelOpcode(size == 8 ? 3 : 2);
+    if (end - begin <= 3) {
+        for (unsigned i = begin; i < end; i++) {
+            m_hl_iseq->append(new Instruction(HighLevelOpcode(HINS_cjmpeq_b + size_offset), value,
+                                              get_switch_immediate(cases[i].first, size),
+                                              Operand(Operand::LABEL, cases[i].second)));
+        }
+        m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, default_label)));
+        return;
+    }
+
+    unsigned mid = begin + (end - begin) / 2;
+    std::string upper_half = next_label();
+    m_hl_iseq->append(new Instruction(HighLevelOpcode(HINS_cjmpgte_b + size_offset), value,
+                                      get_switch_immediate(cases[mid].first, size),
+                                      Operand(Operand::LABEL, upper_half)));
+    visit_switch_tree(value, size, cases, begin, mid, default_label);
+    define_label(upper_half);
+    visit_switch_tree(value, size, cases, mid, end, default_label);
+}
+
+/// Evaluate a condition and jump to a label if it is true (or false).
+/// A comparison branches on the compared values directly, a logical
+/// not branches on its operand with the opposite sense, and && and ||
+/// become a branch for each operand, so that no boolean is computed.
+/// \param n the condition expression
+/// \param jump_if whether to jump if the condition is true or false
+/// \param label the jump target
+void HighLevelCodegen::visit_condition(Node *n, bool jump_if, const std::string &label) {
+    if (n->get_tag() == AST_UNARY_EXPRESSION && n->get_kid(0)->get_tag() == TOK_NOT) {
+        visit_condition(n->get_kid(1), !jump_if, label);
+        return;
+    }
+
+    if (n->get_tag() == AST_BINARY_EXPRESSION
+        && (n->get_kid(0)->get_tag() == TOK_LOGICAL_AND || n->get_kid(0)->get_tag() == TOK_LOGICAL_OR)) {
+        // The right operand is only evaluated if the left one doesn't
+        // decide the condition: for a && b that is if a is true, for
+        // a || b if a is false
+        bool is_and = n->get_kid(0)->get_tag() == TOK_LOGICAL_AND;
+        if (jump_if == is_and) {
+            // the left operand can only decide against jumping
+            std::string skip = next_label();
+            visit_condition(n->get_kid(1), !is_and, skip);
+            visit_condition(n->get_kid(2), jump_if, label);
+            define_label(skip);
+        } else {
+            visit_condition(n->get_kid(1), jump_if, label);
+            visit_condition(n->get_kid(2), jump_if, label);
+        }
+        return;
+    }
+
+    HighLevelOpcode branch = HINS_nop, inverse = HINS_nop;
+    if (n->get_tag() == AST_BINARY_EXPRESSION) {
+        switch (n->get_kid(0)->get_tag()) {
+            case TOK_LT:
+                branch = HINS_cjmplt_b;
+                inverse = HINS_cjmpgte_b;
+                break;
+            case TOK_LTE:
+                branch = HINS_cjmplte_b;
+                inverse = HINS_cjmpgt_b;
+                break;
+            case TOK_GT:
+                branch = HINS_cjmpgt_b;
+                inverse = HINS_cjmplte_b;
+                break;
+            case TOK_GTE:
+                branch = HINS_cjmpgte_b;
+                inverse = HINS_cjmplt_b;
+                break;
+            case TOK_EQUALITY:
+                branch = HINS_cjmpeq_b;
+                inverse = HINS_cjmpneq_b;
+                break;
+            case TOK_INEQUALITY:
+                branch = HINS_cjmpneq_b;
+                inverse = HINS_cjmpeq_b;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (branch == HINS_nop) {
+        visit(n);
+        m_hl_iseq->append(new Instruction(jump_if ? HINS_cjmp_t : HINS_cjmp_f, n->get_operand(),
+                                          Operand(Operand::LABEL, label)));
+        return;
+    }
+
+    visit(n->get_kid(1));
+    Operand lhs = n->get_kid(1)->get_operand();
+    visit(n->get_kid(2));
+    Operand rhs = n->get_kid(2)->get_operand();
+    HighLevelOpcode opcode = get_opcode(jump_if ? branch : inverse, n->get_kid(1)->get_type());
+    m_hl_iseq->append(new Instruction(opcode, lhs, rhs, Operand(Operand::LABEL, label)));
 }
 
 void HighLevelCodegen::visit_binary_expression(Node *n) {
+    int tag = n->get_kid(0)->get_tag();
+    if (tag == TOK_LOGICAL_AND || tag == TOK_LOGICAL_OR) {
+        visit_logical_value(n);
+        return;
+    }
+
     // Visit lhs
     visit(n->get_kid(1));
     Operand lhs = n->get_kid(1)->get_operand();
@@ -222,6 +602,24 @@ void HighLevelCodegen::visit_binary_expression(Node *n) {
         case TOK_DIVIDE:
             op = HINS_div_b;
             break;
+        case TOK_MOD:
+            op = HINS_mod_b;
+            break;
+        case TOK_LEFT_SHIFT:
+            op = HINS_lshift_b;
+            break;
+        case TOK_RIGHT_SHIFT:
+            op = HINS_rshift_b;
+            break;
+        case TOK_AMPERSAND:
+            op = HINS_and_b;
+            break;
+        case TOK_BITWISE_OR:
+            op = HINS_or_b;
+            break;
+        case TOK_BITWISE_XOR:
+            op = HINS_xor_b;
+            break;
         case TOK_ASTERISK:
             op = HINS_mul_b;
             break;
@@ -241,19 +639,80 @@ void HighLevelCodegen::visit_binary_expression(Node *n) {
             op = HighLevelOpcode::HINS_cmpeq_b;
             break;
         case TOK_NOT:
+        case TOK_INEQUALITY:
             op = HighLevelOpcode::HINS_cmpneq_b;
             break;
-        case TOK_LOGICAL_AND:
-            op = HINS_and_b;
-            break;
-        case TOK_LOGICAL_OR:
-            op = HINS_or_b;
-            break;
+    }
+    // Division, remainder and right shift of unsigned values
+    std::shared_ptr<Type> type = n->get_kid(1)->get_type();
+    if (type->is_integral() && !type->is_signed()) {
+        if (op == HINS_div_b)
+            op = HINS_udiv_b;
+        else if (op == HINS_mod_b)
+            op = HINS_umod_b;
+        else if (op == HINS_rshift_b)
+            op = HINS_urshift_b;
     }
     // Make the change
-    m_hl_iseq->append(new Instruction(get_opcode(op, n->get_kid(1)->get_type()), dest, lhs, rhs));
+    m_hl_iseq->append(new Instruction(get_opcode(op, type), dest, lhs, rhs));
+    n->set_operand(dest);
+}
+
+/// Convert a value to the type of the conversion node: a narrower value
+/// is sign or zero extended, and a wider one is used as it is (its low
+/// bits are the converted value)
+/// \param n the implicit conversion node
+void HighLevelCodegen::visit_implicit_conversion(Node *n) {
+    Node *value = n->get_kid(0);
+    visit(value);
+    Operand operand = value->get_operand();
+    BasicTypeKind before = value->get_type()->get_basic_type_kind();
+    BasicTypeKind after = n->get_type()->get_basic_type_kind();
+    if (after <= before || operand.is_imm_ival()) {
+        n->set_operand(operand);
+        return;
+    }
+    Operand dest(Operand::VREG, next_temp_vreg());
+    m_hl_iseq->append(new Instruction(get_conversion_code(value->get_type()->is_signed(), before, after), dest, operand));
+    n->set_operand(dest);
+}
+
+/// Compute the 0/1 value of a && or || expression by branching on the
+/// condition, so that the right operand is only evaluated when needed
+/// \param n the binary expression node
+void HighLevelCodegen::visit_logical_value(Node *n) {
+    std::string is_false = next_label();
+    std::string done = next_label();
+    Operand dest(Operand::VREG, next_temp_vreg());
+    HighLevelOpcode mov_opcode = get_opcode(HINS_mov_b, n->get_type());
+
+    visit_condition(n, false, is_false);
+    m_hl_iseq->append(new Instruction(mov_opcode, dest, Operand(Operand::IMM_IVAL, 1)));
+    m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, done)));
+    define_label(is_false);
+    m_hl_iseq->append(new Instruction(mov_opcode, dest, Operand(Operand::IMM_IVAL, 0)));
+    define_label(done);
+    n->set_operand(dest);
+}
+
+/// Compute the value of a ?: expression by branching on the condition,
+/// so that only the chosen alternative is evaluated
+/// \param n the conditional expression node
+void HighLevelCodegen::visit_conditional_expression(Node *n) {
+    std::string is_false = next_label();
+    std::string done = next_label();
+    Operand dest(Operand::VREG, next_temp_vreg());
+    HighLevelOpcode mov_opcode = get_opcode(HINS_mov_b, n->get_type());
+
+    visit_condition(n->get_kid(0), false, is_false);
+    visit(n->get_kid(1));
+    m_hl_iseq->append(new Instruction(mov_opcode, dest, n->get_kid(1)->get_operand()));
+    m_hl_iseq->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, done)));
+    define_label(is_false);
+    visit(n->get_kid(2));
+    m_hl_iseq->append(new Instruction(mov_opcode, dest, n->get_kid(2)->get_operand()));
+    define_label(done);
     n->set_operand(dest);
-    m_next_vreg--;
 }
 
 void HighLevelCodegen::visit_function_call_expression(Node *n) {
@@ -270,7 +729,17 @@ void HighLevelCodegen::visit_function_call_expression(Node *n) {
         }
     }
     m_hl_iseq->append(new Instruction(HINS_call, Operand(Operand::LABEL, func)));
-    n->set_operand(Operand(Operand::VREG, 0));
+    if (n->get_type()->is_void()) {
+        n->set_operand(Operand(Operand::VREG, LocalStorageAllocation::VREG_RETVAL));
+        return;
+    }
+
+    // Copy the return value out of vr0, since a later call in the same
+    // expression would overwrite it
+    Operand result(Operand::VREG, next_temp_vreg());
+    HighLevelOpcode mov_opcode = get_opcode(HINS_mov_b, n->get_type());
+    m_hl_iseq->append(new Instruction(mov_opcode, result, Operand(Operand::VREG, LocalStorageAllocation::VREG_RETVAL)));
+    n->set_operand(result);
 }
 
 void HighLevelCodegen::visit_array_element_ref_expression(Node *n) {
@@ -291,23 +760,15 @@ void HighLevelCodegen::visit_array_element_ref_expression(Node *n) {
     // multiply to get to actual address of local variable
     Operand mult_dest(Operand::VREG, next_temp_vreg());
     Operand size_element(Operand::IMM_IVAL, element_type->get_storage_size());
-    auto mul_opcode = static_cast<HighLevelOpcode>(get_opcode(HINS_mul_b, element_type) + 1);
-    if (mul_opcode == HINS_div_b) {
-        mul_opcode = HINS_mul_q;
-    }
-    m_hl_iseq->append(new Instruction(mul_opcode, mult_dest, dest_up, size_element));
+    // (addresses are always 64 bit, whatever the element type)
+    m_hl_iseq->append(new Instruction(HINS_mul_q, mult_dest, dest_up, size_element));
 
     // add value of offset
     Operand final_dest(Operand::VREG, next_temp_vreg());
-    auto add_opcode = static_cast<HighLevelOpcode>(get_opcode(HINS_add_b, element_type) + 1);
-    if (add_opcode == HINS_sub_b) {
-        add_opcode = HINS_add_q;
-    }
-    m_hl_iseq->append(new Instruction(add_opcode, final_dest, address_register, mult_dest));
+    m_hl_iseq->append(new Instruction(HINS_add_q, final_dest, address_register, mult_dest));
 
     // set Operand to the location of the destination
     n->set_operand(final_dest.to_memref());
-    m_next_vreg-=3;
 }
 
 /// Set local operand to the stored vreg of the variable
@@ -321,12 +782,7 @@ void HighLevelCodegen::visit_variable_ref(Node *n) {
         }
 
     } else {
-        Symbol * sym = n->get_symbol();
-        int vreg = sym->get_vreg();
-        if (machine_reg.find(vreg) != machine_reg.end()) {
-            vreg = machine_reg[vreg];
-        }
-        op = Operand(Operand::VREG, vreg);
+        op = Operand(Operand::VREG, n->get_symbol()->get_vreg());
     }
 
     n->set_operand(op);
@@ -368,6 +824,16 @@ std::string HighLevelCodegen::next_label() {
     return label;
 }
 
+/// Define a label for the next instruction. When control structures end
+/// at the same point, a label can already be waiting for that
+/// instruction, so that label gets a nop of its own.
+/// \param label the label to define
+void HighLevelCodegen::define_label(const std::string &label) {
+    if (m_hl_iseq->has_label_at_end())
+        m_hl_iseq->append(new Instruction(HINS_nop));
+    m_hl_iseq->define_label(label);
+}
+
 void HighLevelCodegen::visit_field_ref_expression(Node *n) {
     // 	localaddr vr10, $0
     //	mov_q    vr11, $4
@@ -381,18 +847,16 @@ void HighLevelCodegen::visit_field_ref_expression(Node *n) {
 
     // Move the value of the offset of the field
     const Member *accessed_member = struct_type->find_member(n->get_kid(1)->get_str());
+    // (addresses are always 64 bit, whatever the type of the member)
     Operand elem (Operand::IMM_IVAL, accessed_member->get_offset());
-    HighLevelOpcode mov_opcode = get_opcode(HINS_mov_b, accessed_member->get_type());
     Operand dest (Operand::VREG, next_temp_vreg());
-    m_hl_iseq->append(new Instruction(mov_opcode, dest , elem));
+    m_hl_iseq->append(new Instruction(HINS_mov_q, dest , elem));
 
     // add values of offsets
     Operand final_dest(Operand::VREG, next_temp_vreg());
-    HighLevelOpcode add_opcode = get_opcode(HINS_add_b, accessed_member->get_type());
-    m_hl_iseq->append(new Instruction(add_opcode, final_dest, dest, address_register));
+    m_hl_iseq->append(new Instruction(HINS_add_q, final_dest, dest, address_register));
 
     n->set_operand(final_dest.to_memref());
-    m_next_vreg-=2;
 }
 
 void HighLevelCodegen::visit_indirect_field_ref_expression(Node *n) {
@@ -409,18 +873,16 @@ void HighLevelCodegen::visit_indirect_field_ref_expression(Node *n) {
 
     // Move the value of the offset of the field
     const Member *accessed_member = struct_type->find_member(n->get_kid(1)->get_str());
+    // (addresses are always 64 bit, whatever the type of the member)
     Operand elem (Operand::IMM_IVAL, accessed_member->get_offset());
-    HighLevelOpcode mov_opcode = get_opcode(HINS_mov_b, accessed_member->get_type());
     Operand dest (Operand::VREG, next_temp_vreg());
-    m_hl_iseq->append(new Instruction(mov_opcode, dest , elem));
+    m_hl_iseq->append(new Instruction(HINS_mov_q, dest , elem));
 
     // add values of offsets
     Operand final_dest(Operand::VREG, next_temp_vreg());
-    HighLevelOpcode add_opcode = get_opcode(HINS_add_b, accessed_member->get_type());
-    m_hl_iseq->append(new Instruction(add_opcode, final_dest, dest, address_register));
+    m_hl_iseq->append(new Instruction(HINS_add_q, final_dest, dest, address_register));
 
     n->set_operand(final_dest.to_memref());
-    m_next_vreg-=2;
 }
 
 int HighLevelCodegen::next_temp_vreg() {
@@ -441,35 +903,30 @@ Operand HighLevelCodegen::get_offset_address(Node * n) {
     return address_register;
 }
 
-[[maybe_unused]] HighLevelOpcode HighLevelCodegen::get_conversion_code(bool sign, BasicTypeKind before, BasicTypeKind after) {
-    HighLevelOpcode base = HINS_sconv_bw;
-    if (sign) {
-        base = static_cast<HighLevelOpcode>(int(base) + int(6));
+/// Get the opcode which sign or zero extends a value to a wider type
+/// \param is_signed true if the value is sign extended
+/// \param before the type of the value
+/// \param after the (wider) type it is converted to
+HighLevelOpcode HighLevelCodegen::get_conversion_code(bool is_signed, BasicTypeKind before, BasicTypeKind after) {
+    // the conversions from each size are in order of the size converted to:
+    // sconv_bw, sconv_bl, sconv_bq, sconv_wl, sconv_wq, sconv_lq
+    if (after <= before || after > BasicTypeKind::LONG) {
+        RuntimeError::raise("Invalid conversion");
     }
+    int index = 0;
     switch (before) {
         case BasicTypeKind::CHAR:
+            index = 0;
             break;
         case BasicTypeKind::SHORT:
-            base = static_cast<HighLevelOpcode>(int(base) + int(3));
+            index = 3;
             break;
         case BasicTypeKind::INT:
-            base = static_cast<HighLevelOpcode>(int(base) + int(5));
-            break;
-        default:
-            RuntimeError::raise("Invalid conversion");
-    }
-    switch (after) {
-        case BasicTypeKind::SHORT:
-            base = static_cast<HighLevelOpcode>(int(base) + int(1));
-            break;
-        case BasicTypeKind::INT:
-            base = static_cast<HighLevelOpcode>(int(base) + int(2));
-            break;
-        case BasicTypeKind::LONG:
-            base = static_cast<HighLevelOpcode>(int(base) + int(3));
+            index = 5;
             break;
         default:
             RuntimeError::raise("Invalid conversion");
     }
-    return base;
+    index += int(after) - int(before) - 1;
+    return HighLevelOpcode((is_signed ? HINS_sconv_bw : HINS_uconv_bw) + index);
 }
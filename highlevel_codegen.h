@@ -1,5 +1,8 @@
 #include <string>
+#include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 #include "highlevel.h"
 #include "instruction_seq.h"
 #include "ast_visitor.h"
@@ -13,11 +16,15 @@ private:
     bool m_optimize;
     int m_next_vreg;
     int m_next_label_num;
-    std::map<int, int> machine_reg;
-    int m_callee_count = 7;
     std::string m_return_label_name; // name of the label that return instructions should target
     std::shared_ptr<InstructionSequence> m_hl_iseq;
     std::vector<std::string> m_rodata;
+    // targets of break and continue statements in the enclosing loops and
+    // switch statements (empty until a statement jumps there)
+    std::vector<std::string> m_break_labels;
+    std::vector<std::string> m_continue_labels;
+    // labels of the case and default statements of the switch statements
+    std::map<Node *, std::string> m_case_labels;
 
 public:
     // the next_label_num controls where the next_label() member function
@@ -39,7 +46,14 @@ public:
     virtual void visit_for_statement(Node *n);
     virtual void visit_if_statement(Node *n);
     virtual void visit_if_else_statement(Node *n);
+    virtual void visit_switch_statement(Node *n);
+    virtual void visit_case_statement(Node *n);
+    virtual void visit_default_statement(Node *n);
+    virtual void visit_break_statement(Node *n);
+    virtual void visit_continue_statement(Node *n);
     virtual void visit_binary_expression(Node *n);
+    virtual void visit_conditional_expression(Node *n);
+    virtual void visit_implicit_conversion(Node *n);
     virtual void visit_function_call_expression(Node *n);
     virtual void visit_array_element_ref_expression(Node *n);
     virtual void visit_variable_ref(Node *n);
@@ -50,9 +64,20 @@ public:
 
 private:
     std::string next_label();
+    void define_label(const std::string &label);
     int next_temp_vreg();
+    void visit_unary_operation(Node *n, HighLevelOpcode base_opcode);
+    void visit_condition(Node *n, bool jump_if, const std::string &label);
+    void visit_logical_value(Node *n);
+    void define_loop_label(std::vector<std::string> &labels);
+    void collect_switch_labels(Node *n, std::vector<Node *> &labeled);
+    Operand get_switch_value(Node *n, int &size);
+    Operand get_switch_immediate(long value, int size);
+    Operand get_switch_index(const Operand &value, int size, long min, long max, const std::string &default_label);
+    void visit_switch_tree(const Operand &value, int size, const std::vector<std::pair<long, std::string>> &cases,
+                           unsigned begin, unsigned end, const std::string &default_label);
 
     Operand get_offset_address(Node *n);
 
-    [[maybe_unused]] static HighLevelOpcode get_conversion_code(bool sign, BasicTypeKind before, BasicTypeKind after);
+    static HighLevelOpcode get_conversion_code(bool is_signed, BasicTypeKind before, BasicTypeKind after);
 };
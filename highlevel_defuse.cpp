@@ -17,11 +17,13 @@ const std::set<HighLevelOpcode> NO_DEST = {
   HINS_leave,
   HINS_cjmp_t,
   HINS_cjmp_f,
+  HINS_cjmpbit_q,
+  HINS_jmptab,
 };
 
 // Does the instruction have a destination operand?
 bool has_dest_operand(HighLevelOpcode hl_opcode) {
-  return NO_DEST.count(hl_opcode) == 0;
+  return NO_DEST.count(hl_opcode) == 0 && !HighLevel::is_compare_and_branch(hl_opcode);
 }
 
 }
@@ -54,4 +56,17 @@ bool is_use(Instruction *ins, unsigned operand_index) {
   return operand.has_base_reg() || operand.has_index_reg();
 }
 
+bool is_jump(int hl_opcode) {
+  return hl_opcode == HINS_jmp || hl_opcode == HINS_jmptab || is_conditional_jump(hl_opcode);
+}
+
+bool is_conditional_jump(int hl_opcode) {
+  return hl_opcode == HINS_cjmp_t || hl_opcode == HINS_cjmp_f || hl_opcode == HINS_cjmpbit_q
+      || is_compare_and_branch(hl_opcode);
+}
+
+bool is_compare_and_branch(int hl_opcode) {
+  return hl_opcode >= HINS_cjmplt_b && hl_opcode <= HINS_cjmpneq_q;
+}
+
 }
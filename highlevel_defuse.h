@@ -8,6 +8,17 @@ namespace HighLevel {
 bool is_def(Instruction *ins);
 bool is_use(Instruction *ins, unsigned operand_index);
 
+// Does the opcode end a basic block with a jump (unconditional, conditional,
+// or through a jump table)?
+bool is_jump(int hl_opcode);
+
+// Is the opcode a conditional jump (cjmp_t/cjmp_f on a boolean, a
+// compare-and-branch, or a bit test)?
+bool is_conditional_jump(int hl_opcode);
+
+// Is the opcode a compare-and-branch?
+bool is_compare_and_branch(int hl_opcode);
+
 };
 
 #endif // HIGHLEVEL_DEFUSE_H
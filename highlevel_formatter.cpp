@@ -20,6 +20,9 @@ std::string HighLevelFormatter::format_operand(const Operand &operand) const {
     return cpputil::format("(vr%d, vt%d)", operand.get_base_reg(), operand.get_index_reg());
   case Operand::VREG_MEM_OFF:
     return cpputil::format("%ld(vr%dq)", operand.get_imm_ival(), operand.get_base_reg());
+  case Operand::VREG_MEM_IDX_OFF:
+    return cpputil::format("%ld(vr%d, vr%d, %d)", operand.get_offset(), operand.get_base_reg(),
+                           operand.get_index_reg(), operand.get_scale());
   default:
     return Formatter::format_operand(operand);
   }
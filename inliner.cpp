@@ -0,0 +1,405 @@
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include "node.h"
+#include "ast.h"
+#include "symtab.h"
+#include "highlevel.h"
+#include "local_storage_allocation.h"
+#include "cfg.h"
+#include "dominators.h"
+#include "loops.h"
+#include "inliner.h"
+
+namespace {
+
+// Callees of at most this many instructions (about as many as a call
+// with its argument and result moves) are always inlined
+const unsigned SMALL_CALLEE_SIZE = 8;
+
+// Size up to which a callee called only once in the module is inlined
+const unsigned SINGLE_CALL_CALLEE_SIZE = 200;
+
+// Size up to which other callees are inlined: the base limit is raised
+// for each argument and each constant argument, and then multiplied by
+// one more than the loop depth of the call (up to a depth of 2)
+const unsigned BASE_CALLEE_SIZE = 16;
+const unsigned ARG_BONUS = 2;
+const unsigned CONSTANT_ARG_BONUS = 8;
+const int MAX_LOOP_DEPTH_BONUS = 2;
+
+// A function grown by inlining to this many instructions has no more
+// calls inlined into it
+const unsigned MAX_CALLER_SIZE = 2000;
+
+// Size of the code of a function, without its enter, leave and ret
+unsigned get_size(const std::shared_ptr<InstructionSequence> &iseq) {
+  return iseq->get_length() - 3;
+}
+
+bool is_move(Instruction *ins) {
+  int opcode = ins->get_opcode();
+  return opcode >= HINS_mov_b && opcode <= HINS_mov_q;
+}
+
+// Replace the vregs of an operand
+template<typename Fn>
+Operand remap_vregs(const Operand &operand, Fn remap) {
+  if (operand.has_index_reg()) {
+    return Operand(operand.get_kind(), remap(operand.get_base_reg()), remap(operand.get_index_reg()));
+  } else if (operand.has_offset()) {
+    return Operand(operand.get_kind(), remap(operand.get_base_reg()), operand.get_offset());
+  } else if (operand.has_base_reg()) {
+    return Operand(operand.get_kind(), remap(operand.get_base_reg()));
+  }
+  return operand;
+}
+
+int get_max_vreg(const std::shared_ptr<InstructionSequence> &iseq) {
+  int max_vreg = LocalStorageAllocation::VREG_FIRST_LOCAL - 1;
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+    Instruction *ins = *i;
+    for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+      const Operand &operand = ins->get_operand(j);
+      if (operand.has_base_reg())
+        max_vreg = std::max(max_vreg, operand.get_base_reg());
+      if (operand.has_index_reg())
+        max_vreg = std::max(max_vreg, operand.get_index_reg());
+    }
+  }
+  return max_vreg;
+}
+
+std::string get_function_name(Node *funcdef) {
+  return funcdef->get_kid(1)->get_str();
+}
+
+}
+
+Inliner::Inliner(int next_label_num)
+  : m_next_label_num(next_label_num) {
+}
+
+Inliner::~Inliner() {
+}
+
+void Inliner::add_function(const std::shared_ptr<InstructionSequence> &iseq) {
+  Node *funcdef = iseq->get_funcdef_ast();
+  assert(funcdef != nullptr);
+
+  m_function_index[get_function_name(funcdef)] = unsigned(m_functions.size());
+  m_functions.push_back({ funcdef, iseq, {}, 0, funcdef->get_kid(2)->get_num_kids(), false });
+}
+
+void Inliner::inline_calls() {
+  build_call_graph();
+
+  // Visit callees before their callers
+  std::vector<bool> visited(m_functions.size(), false);
+  std::vector<unsigned> order;
+  for (unsigned i = 0; i < m_functions.size(); i++) {
+    find_callee_order(i, visited, order);
+  }
+
+  for (auto i = order.begin(); i != order.end(); ++i) {
+    inline_calls_in(m_functions[*i]);
+  }
+}
+
+void Inliner::build_call_graph() {
+  for (auto i = m_functions.begin(); i != m_functions.end(); ++i) {
+    Function &fn = *i;
+    fn.can_inline = is_inlinable(fn);
+
+    std::set<std::string> callees;
+    fn.funcdef->preorder([this, &callees](Node *n) {
+      if (n->get_tag() != AST_FUNCTION_CALL_EXPRESSION) {
+        return;
+      }
+      const std::string &name = n->get_kid(0)->get_symbol()->get_name();
+      auto j = m_function_index.find(name);
+      if (j != m_function_index.end()) {
+        m_functions[j->second].num_calls++;
+        callees.insert(name);
+      }
+    });
+    fn.callees.assign(callees.begin(), callees.end());
+  }
+}
+
+void Inliner::find_callee_order(unsigned index, std::vector<bool> &visited, std::vector<unsigned> &order) const {
+  if (visited[index]) {
+    return;
+  }
+  visited[index] = true;
+  const std::vector<std::string> &callees = m_functions[index].callees;
+  for (auto i = callees.begin(); i != callees.end(); ++i) {
+    find_callee_order(m_function_index.at(*i), visited, order);
+  }
+  order.push_back(index);
+}
+
+// Can the caller reach the callee through one or more calls?
+bool Inliner::calls(const std::string &caller, const std::string &callee) const {
+  std::set<std::string> seen;
+  std::vector<std::string> work_list(1, caller);
+  while (!work_list.empty()) {
+    std::string name = work_list.back();
+    work_list.pop_back();
+    const std::vector<std::string> &callees = m_functions[m_function_index.at(name)].callees;
+    for (auto i = callees.begin(); i != callees.end(); ++i) {
+      if (*i == callee) {
+        return true;
+      }
+      if (seen.insert(*i).second) {
+        work_list.push_back(*i);
+      }
+    }
+  }
+  return false;
+}
+
+// A function's code can be copied into a caller if it has the shape the
+// high-level code generator gives it (enter, the moves of the parameters
+// out of the argument vregs, the body, and leave and ret), and it has no
+// string constants (which are named by their index in the function which
+// uses them)
+bool Inliner::is_inlinable(const Function &fn) const {
+  const std::shared_ptr<InstructionSequence> &iseq = fn.iseq;
+  if (fn.num_params > 6 || iseq->get_length() < fn.num_params + 3) {
+    return false;
+  }
+  if (iseq->get_instruction(0)->get_opcode() != HINS_enter
+      || iseq->get_instruction(iseq->get_length() - 2)->get_opcode() != HINS_leave
+      || iseq->get_last_instruction()->get_opcode() != HINS_ret) {
+    return false;
+  }
+  for (unsigned i = 1; i <= fn.num_params; i++) {
+    Instruction *ins = iseq->get_instruction(i);
+    if (!is_move(ins) || iseq->has_label(i) || ins->get_operand(1).get_kind() != Operand::VREG
+        || ins->get_operand(1).get_base_reg() != int(i)) {
+      return false;
+    }
+  }
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+    Instruction *ins = *i;
+    for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+      if (ins->get_operand(j).get_kind() == Operand::IMM_LABEL) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Inliner::should_inline(const Function &callee, unsigned num_constant_args, int loop_depth,
+                            unsigned caller_size) const {
+  unsigned size = get_size(callee.iseq);
+  if (caller_size + size > MAX_CALLER_SIZE) {
+    return false;
+  }
+  if (size <= SMALL_CALLEE_SIZE) {
+    return true;
+  }
+  if (callee.num_calls == 1 && size <= SINGLE_CALL_CALLEE_SIZE) {
+    return true;
+  }
+  unsigned limit = BASE_CALLEE_SIZE + ARG_BONUS * callee.num_params + CONSTANT_ARG_BONUS * num_constant_args;
+  limit *= 1 + unsigned(std::min(loop_depth, MAX_LOOP_DEPTH_BONUS));
+  return size <= limit;
+}
+
+void Inliner::inline_calls_in(Function &caller) {
+  std::shared_ptr<InstructionSequence> iseq = caller.iseq;
+  std::string caller_name = get_function_name(caller.funcdef);
+
+  // Find the loop depth of each instruction: the blocks of the CFG start
+  // at the index of their first instruction
+  std::vector<int> loop_depths(iseq->get_length(), 0);
+  HighLevelControlFlowGraphBuilder cfg_builder(iseq);
+  std::shared_ptr<ControlFlowGraph> cfg = cfg_builder.build();
+  DominatorTree dominators(cfg);
+  LoopInfo loops(dominators);
+  for (auto i = cfg->bb_begin(); i != cfg->bb_end(); ++i) {
+    BasicBlock *bb = *i;
+    if (bb->get_kind() == BASICBLOCK_INTERIOR) {
+      int depth = loops.get_loop_depth(bb);
+      for (unsigned j = 0; j < bb->get_length(); j++) {
+        loop_depths[bb->get_code_order() + j] = depth;
+      }
+    }
+  }
+
+  // Choose the calls to inline. The moves into the argument vregs
+  // just before a call inlined are changed to move into new vregs.
+  int next_vreg = get_max_vreg(iseq) + 1;
+  unsigned caller_size = get_size(iseq);
+  unsigned frame_size = 0;
+  std::map<unsigned, InlinedCall> inlined_calls;
+  std::map<unsigned, int> arg_moves;
+  for (unsigned i = 0; i < iseq->get_length(); i++) {
+    Instruction *ins = iseq->get_instruction(i);
+    if (ins->get_opcode() != HINS_call) {
+      continue;
+    }
+    auto callee_index = m_function_index.find(ins->get_operand(0).get_label());
+    if (callee_index == m_function_index.end()) {
+      continue;
+    }
+    const Function &callee = m_functions[callee_index->second];
+    if (!callee.can_inline || &callee == &caller || calls(callee_index->first, caller_name)) {
+      continue;
+    }
+
+    // The arguments are moved into vr1, vr2, ... in order just before
+    // the call
+    unsigned num_constant_args = 0;
+    bool has_args = i >= callee.num_params;
+    for (unsigned j = 0; has_args && j < callee.num_params; j++) {
+      Instruction *move = iseq->get_instruction(i - callee.num_params + j);
+      has_args = is_move(move) && move->get_operand(0).get_kind() == Operand::VREG
+          && move->get_operand(0).get_base_reg() == int(j) + 1;
+      if (has_args && move->get_operand(1).is_imm_ival()) {
+        num_constant_args++;
+      }
+    }
+    if (!has_args || !should_inline(callee, num_constant_args, loop_depths[i], caller_size)) {
+      continue;
+    }
+
+    InlinedCall &call = inlined_calls[i];
+    call.callee = &callee;
+    for (unsigned j = 0; j < callee.num_params; j++) {
+      call.args.push_back(next_vreg);
+      arg_moves[i - callee.num_params + j] = next_vreg++;
+    }
+    caller_size += get_size(callee.iseq);
+    frame_size = std::max(frame_size, callee.funcdef->get_symbol()->get_offset());
+
+    std::cout << "/* Function '" << caller_name << "': inlined call to '" << callee_index->first << "' ("
+              << get_size(callee.iseq) << " instructions, loop depth " << loop_depths[i] << ") */" << std::endl;
+  }
+  if (inlined_calls.empty()) {
+    return;
+  }
+
+  // The inlined code's variables in memory are placed after the caller's.
+  // No two of the inlined calls are active at the same time, so they
+  // share the same storage.
+  Symbol *caller_sym = caller.funcdef->get_symbol();
+  unsigned frame_base = (caller_sym->get_offset() + 15) & ~15U;
+  if (frame_size > 0) {
+    caller_sym->set_offset(frame_base + frame_size);
+  }
+  Operand frame_storage(Operand::IMM_IVAL, caller_sym->get_offset());
+
+  std::shared_ptr<InstructionSequence> result(new InstructionSequence());
+  result->set_funcdef_ast(caller.funcdef);
+  unsigned index = 0;
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i, ++index) {
+    Instruction *ins = *i;
+    auto call = inlined_calls.find(index);
+    if (call != inlined_calls.end()) {
+      if (i.has_label()) {
+        result->define_label(i.get_label());
+        result->append(new Instruction(HINS_nop));
+      }
+      append_inlined_code(call->second, frame_base, next_vreg, result);
+      continue;
+    }
+
+    if (i.has_label()) {
+      result->define_label(i.get_label());
+    }
+    auto arg_move = arg_moves.find(index);
+    if (arg_move != arg_moves.end()) {
+      result->append(new Instruction(ins->get_opcode(), Operand(Operand::VREG, arg_move->second), ins->get_operand(1)));
+    } else if (ins->get_opcode() == HINS_enter || ins->get_opcode() == HINS_leave) {
+      result->append(new Instruction(ins->get_opcode(), frame_storage));
+    } else {
+      result->append(ins->duplicate());
+    }
+  }
+  caller.iseq = result;
+}
+
+// Append a copy of the callee's code, without its enter, leave and ret
+// (control leaves the code where the leave was, which a nop is left in
+// place of). The parameters are moved out of the vregs the arguments
+// were moved into.
+void Inliner::append_inlined_code(const InlinedCall &call, unsigned frame_base, int &next_vreg,
+                                  const std::shared_ptr<InstructionSequence> &result) {
+  const std::shared_ptr<InstructionSequence> &iseq = call.callee->iseq;
+
+  std::map<std::string, std::string> labels;
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+    if (i.has_label()) {
+      labels[i.get_label()] = next_label();
+    }
+    if ((*i)->get_jump_table()) {
+      labels[(*i)->get_jump_table()->label] = next_label();
+    }
+  }
+
+  // The argument, return value and machine vregs keep their numbers
+  std::map<int, int> vregs;
+  auto remap = [&vregs, &next_vreg](int vreg) {
+    if (vreg < LocalStorageAllocation::VREG_FIRST_LOCAL) {
+      return vreg;
+    }
+    auto i = vregs.find(vreg);
+    if (i == vregs.end()) {
+      i = vregs.insert({ vreg, next_vreg++ }).first;
+    }
+    return i->second;
+  };
+
+  unsigned index = 0;
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i, ++index) {
+    Instruction *ins = *i;
+    int opcode = ins->get_opcode();
+    if (opcode == HINS_enter || opcode == HINS_ret) {
+      continue;
+    }
+    if (i.has_label()) {
+      result->define_label(labels.at(i.get_label()));
+    }
+    if (opcode == HINS_leave) {
+      result->append(new Instruction(HINS_nop));
+      continue;
+    }
+
+    Operand operands[Instruction::MAX_OPERANDS];
+    for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+      const Operand &operand = ins->get_operand(j);
+      if (operand.get_kind() == Operand::LABEL && labels.count(operand.get_label()) > 0) {
+        operands[j] = Operand(Operand::LABEL, labels[operand.get_label()]);
+      } else if (opcode == HINS_localaddr && j == 1) {
+        operands[j] = Operand(Operand::IMM_IVAL, operand.get_imm_ival() + long(frame_base));
+      } else {
+        operands[j] = remap_vregs(operand, remap);
+      }
+    }
+    if (index <= call.args.size()) {
+      // a move of a parameter out of its argument vreg
+      operands[1] = Operand(Operand::VREG, call.args[index - 1]);
+    }
+
+    Instruction *copy = new Instruction(opcode, operands[0], operands[1], operands[2], operands[3],
+                                        ins->get_num_operands());
+    if (ins->get_jump_table()) {
+      std::shared_ptr<JumpTable> table(new JumpTable());
+      table->label = labels.at(ins->get_jump_table()->label);
+      for (auto j = ins->get_jump_table()->targets.begin(); j != ins->get_jump_table()->targets.end(); ++j) {
+        table->targets.push_back(labels.at(*j));
+      }
+      copy->set_jump_table(table);
+    }
+    result->append(copy);
+  }
+}
+
+std::string Inliner::next_label() {
+  return ".L" + std::to_string(m_next_label_num++);
+}
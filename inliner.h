@@ -0,0 +1,75 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "instruction_seq.h"
+
+class Node;
+
+// Inlining of calls to the functions defined in a module, on their
+// high-level code before it is optimized. The call graph is built from
+// the function call expressions of the function definitions, and the
+// functions are visited callees first, so that the code inlined for a
+// call already has the calls it makes inlined. A call is replaced by a
+// copy of the callee's code in which the vregs, labels and localaddr
+// offsets are renumbered, and the argument vregs by new vregs.
+// The cost model weighs the size of the callee against the number of
+// arguments and of constant arguments (each saves a move, and constant
+// ones may let the callee's code be folded), and the loop depth of the
+// call: small callees, and callees with a single call in the module,
+// are always inlined. Calls within a cycle of the call graph (such as
+// recursive calls) are never inlined.
+class Inliner {
+private:
+  struct Function {
+    Node *funcdef;
+    std::shared_ptr<InstructionSequence> iseq;
+    // names of the functions called
+    std::vector<std::string> callees;
+    // number of calls to the function in the module
+    unsigned num_calls;
+    unsigned num_params;
+    // false if the function's code can't be copied into another function
+    bool can_inline;
+  };
+
+  // A call which is inlined: the vregs which replace the argument vregs
+  struct InlinedCall {
+    const Function *callee;
+    std::vector<int> args;
+  };
+
+  std::vector<Function> m_functions;
+  std::map<std::string, unsigned> m_function_index;
+  int m_next_label_num;
+
+public:
+  Inliner(int next_label_num);
+  ~Inliner();
+
+  // Add a function of the module (with its function definition AST set)
+  void add_function(const std::shared_ptr<InstructionSequence> &iseq);
+
+  // Inline the calls chosen by the cost model in every function
+  void inline_calls();
+
+  std::shared_ptr<InstructionSequence> get_function(unsigned i) const { return m_functions[i].iseq; }
+
+  int get_next_label_num() const { return m_next_label_num; }
+
+private:
+  void build_call_graph();
+  void find_callee_order(unsigned index, std::vector<bool> &visited, std::vector<unsigned> &order) const;
+  bool calls(const std::string &caller, const std::string &callee) const;
+  bool is_inlinable(const Function &fn) const;
+  bool should_inline(const Function &callee, unsigned num_constant_args, int loop_depth, unsigned caller_size) const;
+  void inline_calls_in(Function &caller);
+  void append_inlined_code(const InlinedCall &call, unsigned frame_base, int &next_vreg,
+                           const std::shared_ptr<InstructionSequence> &result);
+  std::string next_label();
+};
+
+#endif // INLINER_H
@@ -14,9 +14,15 @@ Instruction::Instruction(int opcode, const Operand &op1, const Operand &op2)
 }
 
 Instruction::Instruction(int opcode, const Operand &op1, const Operand &op2, const Operand &op3, unsigned num_operands)
+  : Instruction(opcode, op1, op2, op3, Operand(), num_operands) {
+}
+
+Instruction::Instruction(int opcode, const Operand &op1, const Operand &op2, const Operand &op3, const Operand &op4,
+                         unsigned num_operands)
   : m_opcode(opcode)
   , m_num_operands(num_operands)
-  , m_operands { op1, op2, op3 } {
+  , m_operands { op1, op2, op3, op4 } {
+  assert(num_operands <= MAX_OPERANDS);
 }
 
 Instruction::~Instruction() {
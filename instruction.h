@@ -1,21 +1,39 @@
 #ifndef INSTRUCTION_H
 #define INSTRUCTION_H
 
+#include <memory>
+#include <string>
+#include <vector>
 #include "operand.h"
 
+// Jump table of a multi-way branch, which goes to the target selected
+// by its index operand
+struct JumpTable {
+  std::string label;                // label of the table in .rodata
+  std::vector<std::string> targets; // label of the target for each index
+};
+
 // Instruction object type.
 // Can be used for either high-level or low-level code.
 class Instruction {
+public:
+  // largest number of operands of an instruction
+  static const unsigned MAX_OPERANDS = 4;
+
 private:
   int m_opcode;
   unsigned m_num_operands;
-  Operand m_operands[3];
+  Operand m_operands[MAX_OPERANDS];
+  // targets of a multi-way branch (nullptr for other instructions)
+  std::shared_ptr<const JumpTable> m_jump_table;
 
 public:
   Instruction(int opcode);
   Instruction(int opcode, const Operand &op1);
   Instruction(int opcode, const Operand &op1, const Operand &op2);
   Instruction(int opcode, const Operand &op1, const Operand &op2, const Operand &op3, unsigned num_operands = 3);
+  Instruction(int opcode, const Operand &op1, const Operand &op2, const Operand &op3, const Operand &op4,
+              unsigned num_operands = 4);
 
   ~Instruction();
 
@@ -26,6 +44,11 @@ public:
   unsigned get_num_operands() const;
 
   const Operand &get_operand(unsigned index) const;
+
+  // A multi-way branch has a jump table instead of a label operand
+  bool is_multiway_branch() const { return m_jump_table != nullptr; }
+  const std::shared_ptr<const JumpTable> &get_jump_table() const { return m_jump_table; }
+  void set_jump_table(const std::shared_ptr<const JumpTable> &jump_table) { m_jump_table = jump_table; }
 };
 
 #endif // INSTRUCTION_H
@@ -0,0 +1,300 @@
+#include <cassert>
+#include "instruction.h"
+#include "highlevel.h"
+#include "highlevel_defuse.h"
+#include "local_storage_allocation.h"
+#include "instruction_selection.h"
+
+namespace {
+
+bool match_hl(int base, int hl_opcode) {
+  return hl_opcode >= base && hl_opcode < (base + 4);
+}
+
+// Check whether a value fits in a 32 bit immediate or displacement
+bool fits_imm32(long value) {
+  return value >= -2147483648L && value <= 2147483647L;
+}
+
+// Check whether the source operands of an instruction can be immediates
+bool allows_immediate(int hl_opcode) {
+  return match_hl(HINS_mov_b, hl_opcode) || match_hl(HINS_add_b, hl_opcode)
+      || match_hl(HINS_sub_b, hl_opcode) || match_hl(HINS_mul_b, hl_opcode)
+      || match_hl(HINS_div_b, hl_opcode) || match_hl(HINS_mod_b, hl_opcode)
+      || match_hl(HINS_udiv_b, hl_opcode) || match_hl(HINS_umod_b, hl_opcode)
+      || match_hl(HINS_cmplt_b, hl_opcode) || match_hl(HINS_cmplte_b, hl_opcode)
+      || match_hl(HINS_cmpgt_b, hl_opcode) || match_hl(HINS_cmpgte_b, hl_opcode)
+      || match_hl(HINS_cmpeq_b, hl_opcode) || match_hl(HINS_cmpneq_b, hl_opcode)
+      || HighLevel::is_compare_and_branch(hl_opcode);
+}
+
+bool ends_block(int hl_opcode) {
+  return HighLevel::is_jump(hl_opcode) || hl_opcode == HINS_call || hl_opcode == HINS_ret;
+}
+
+}
+
+InstructionSelection::InstructionSelection(const std::shared_ptr<InstructionSequence> &iseq)
+  : m_iseq(iseq)
+  , m_num_folded(0) {
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+    m_code.push_back((*i)->duplicate());
+  }
+  m_folded.assign(m_code.size(), false);
+}
+
+InstructionSelection::~InstructionSelection() {
+  for (auto i = m_code.begin(); i != m_code.end(); ++i) {
+    delete *i;
+  }
+}
+
+std::shared_ptr<InstructionSequence> InstructionSelection::select() {
+  find_defs_and_uses();
+
+  for (unsigned i = 0; i < m_code.size(); i++) {
+    Instruction *ins = m_code[i];
+    int opcode = ins->get_opcode();
+    unsigned num_operands = ins->get_num_operands();
+
+    Operand operands[Instruction::MAX_OPERANDS];
+    unsigned num_folded = m_num_folded;
+    for (unsigned k = 0; k < num_operands; k++) {
+      const Operand &operand = ins->get_operand(k);
+      operands[k] = operand;
+      if (operand.is_memref()) {
+        operands[k] = munch_memref(operand, i);
+      } else if (k > 0 && operand.get_kind() == Operand::VREG && allows_immediate(opcode)) {
+        operands[k] = munch_immediate(operand, i);
+      }
+    }
+
+    if (m_num_folded != num_folded) {
+      m_code[i] = new Instruction(opcode, operands[0], operands[1], operands[2], operands[3], num_operands);
+      delete ins;
+    }
+  }
+
+  std::shared_ptr<InstructionSequence> result(new InstructionSequence());
+  result->set_funcdef_ast(m_iseq->get_funcdef_ast());
+  unsigned index = 0;
+  for (auto i = m_iseq->cbegin(); i != m_iseq->cend(); ++i, ++index) {
+    if (m_folded[index]) {
+      continue;
+    }
+    if (i.has_label()) {
+      result->define_label(i.get_label());
+    }
+    result->append(m_code[index]->duplicate());
+  }
+  return result;
+}
+
+void InstructionSelection::find_defs_and_uses() {
+  std::map<int, unsigned> num_defs, num_uses;
+  unsigned block = 0;
+  for (unsigned i = 0; i < m_code.size(); i++) {
+    Instruction *ins = m_code[i];
+    if (i > 0 && m_iseq->has_label(i)) {
+      block++;
+    }
+    m_block.push_back(block);
+    if (ends_block(ins->get_opcode())) {
+      block++;
+    }
+
+    if (HighLevel::is_def(ins)) {
+      int dest = ins->get_operand(0).get_base_reg();
+      num_defs[dest]++;
+      m_def_index[dest] = i;
+    }
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      if (!HighLevel::is_use(ins, k)) {
+        continue;
+      }
+      const Operand &operand = ins->get_operand(k);
+      if (operand.has_base_reg()) {
+        num_uses[operand.get_base_reg()]++;
+        m_use_index[operand.get_base_reg()] = i;
+      }
+      if (operand.has_index_reg()) {
+        num_uses[operand.get_index_reg()]++;
+        m_use_index[operand.get_index_reg()] = i;
+      }
+    }
+  }
+
+  for (auto i = num_defs.begin(); i != num_defs.end(); ++i) {
+    if (i->second != 1) {
+      m_def_index.erase(i->first);
+    }
+  }
+  for (auto i = num_uses.begin(); i != num_uses.end(); ++i) {
+    if (i->second != 1) {
+      m_use_index.erase(i->first);
+    }
+  }
+}
+
+// Check whether the definition of a vreg can be folded into the operand
+// of the root instruction: the vreg must be a temporary defined once and
+// used once (by the consumer, which is either the root or an instruction
+// folded into it), in the same block as the root, and the vregs which the
+// definition reads must not change before the root.
+bool InstructionSelection::is_foldable(int vreg, unsigned consumer, unsigned root) const {
+  if (vreg < LocalStorageAllocation::VREG_FIRST_LOCAL) {
+    return false;
+  }
+  auto def = m_def_index.find(vreg);
+  auto use = m_use_index.find(vreg);
+  if (def == m_def_index.end() || use == m_use_index.end() || use->second != consumer) {
+    return false;
+  }
+  unsigned def_index = def->second;
+  if (def_index >= consumer || m_folded[def_index] || m_block[def_index] != m_block[root]
+      || m_iseq->has_label(def_index)) {
+    return false;
+  }
+
+  Instruction *ins = m_code[def_index];
+  for (unsigned k = 1; k < ins->get_num_operands(); k++) {
+    const Operand &operand = ins->get_operand(k);
+    if (operand.has_base_reg() && is_redefined(operand.get_base_reg(), def_index, root)) {
+      return false;
+    }
+    if (operand.has_index_reg() && is_redefined(operand.get_index_reg(), def_index, root)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Check whether a vreg is assigned between two instructions (exclusive)
+bool InstructionSelection::is_redefined(int vreg, unsigned from, unsigned to) const {
+  for (unsigned i = from + 1; i < to; i++) {
+    if (!m_folded[i] && HighLevel::is_def(m_code[i]) && m_code[i]->get_operand(0).get_base_reg() == vreg) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void InstructionSelection::fold(int vreg) {
+  m_folded[m_def_index.at(vreg)] = true;
+  m_num_folded++;
+}
+
+Operand InstructionSelection::munch_memref(const Operand &operand, unsigned root) {
+  Operand::Kind kind = operand.get_kind();
+  if (kind != Operand::VREG_MEM && kind != Operand::VREG_MEM_OFF) {
+    return operand;
+  }
+
+  Address addr = { operand.get_base_reg(), -1, 1, kind == Operand::VREG_MEM_OFF ? operand.get_offset() : 0L };
+  munch_address(operand.get_base_reg(), root, root, addr);
+
+  if (addr.index >= 0) {
+    if (addr.scale == 1 && addr.disp == 0) {
+      return Operand(Operand::VREG_MEM_IDX, addr.base, addr.index);
+    }
+    return Operand(Operand::VREG_MEM_IDX_OFF, addr.base, addr.index, addr.disp, addr.scale);
+  }
+  if (addr.disp != 0) {
+    return Operand(Operand::VREG_MEM_OFF, addr.base, addr.disp);
+  }
+  return Operand(Operand::VREG_MEM, addr.base);
+}
+
+// Cover the tree computing the address in a vreg with the base, index and
+// displacement of addr
+void InstructionSelection::munch_address(int vreg, unsigned consumer, unsigned root, Address &addr) {
+  addr.base = vreg;
+  if (!is_foldable(vreg, consumer, root)) {
+    return;
+  }
+
+  unsigned def_index = m_def_index.at(vreg);
+  Instruction *ins = m_code[def_index];
+  int opcode = ins->get_opcode();
+  if (opcode != HINS_add_q && opcode != HINS_sub_q) {
+    return;
+  }
+  const Operand &left = ins->get_operand(1);
+  const Operand &right = ins->get_operand(2);
+
+  // base + constant, or base - constant
+  if (left.get_kind() == Operand::VREG && right.is_imm_ival()) {
+    long disp = (opcode == HINS_add_q) ? right.get_imm_ival() : -right.get_imm_ival();
+    if (fits_imm32(addr.disp + disp)) {
+      fold(vreg);
+      addr.disp += disp;
+      munch_address(left.get_base_reg(), def_index, root, addr);
+    }
+    return;
+  }
+  if (opcode == HINS_add_q && left.is_imm_ival() && right.get_kind() == Operand::VREG) {
+    if (fits_imm32(addr.disp + left.get_imm_ival())) {
+      fold(vreg);
+      addr.disp += left.get_imm_ival();
+      munch_address(right.get_base_reg(), def_index, root, addr);
+    }
+    return;
+  }
+
+  // base + index*scale
+  if (opcode == HINS_add_q && left.get_kind() == Operand::VREG && right.get_kind() == Operand::VREG
+      && addr.index < 0) {
+    fold(vreg);
+    if (munch_scaled_index(right.get_base_reg(), def_index, root, addr)) {
+      munch_address(left.get_base_reg(), def_index, root, addr);
+    } else if (munch_scaled_index(left.get_base_reg(), def_index, root, addr)) {
+      munch_address(right.get_base_reg(), def_index, root, addr);
+    } else {
+      addr.index = right.get_base_reg();
+      addr.scale = 1;
+      munch_address(left.get_base_reg(), def_index, root, addr);
+    }
+  }
+}
+
+// Cover the tree computing a vreg with a scaled index, if it is a
+// multiplication by 1, 2, 4, or 8
+bool InstructionSelection::munch_scaled_index(int vreg, unsigned consumer, unsigned root, Address &addr) {
+  if (!is_foldable(vreg, consumer, root)) {
+    return false;
+  }
+  Instruction *ins = m_code[m_def_index.at(vreg)];
+  if (ins->get_opcode() != HINS_mul_q) {
+    return false;
+  }
+
+  for (unsigned k = 1; k <= 2; k++) {
+    const Operand &index = ins->get_operand(k);
+    const Operand &scale = ins->get_operand(3 - k);
+    if (index.get_kind() == Operand::VREG && scale.is_imm_ival()) {
+      long s = scale.get_imm_ival();
+      if (s == 1 || s == 2 || s == 4 || s == 8) {
+        fold(vreg);
+        addr.index = index.get_base_reg();
+        addr.scale = int(s);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Replace a source vreg which was just assigned a constant by the constant
+Operand InstructionSelection::munch_immediate(const Operand &operand, unsigned root) {
+  int vreg = operand.get_base_reg();
+  if (!is_foldable(vreg, root, root)) {
+    return operand;
+  }
+  Instruction *ins = m_code[m_def_index.at(vreg)];
+  if (!match_hl(HINS_mov_b, ins->get_opcode()) || !ins->get_operand(1).is_imm_ival()
+      || !fits_imm32(ins->get_operand(1).get_imm_ival())) {
+    return operand;
+  }
+  fold(vreg);
+  return ins->get_operand(1);
+}
@@ -0,0 +1,64 @@
+#ifndef INSTRUCTION_SELECTION_H
+#define INSTRUCTION_SELECTION_H
+
+#include <map>
+#include <vector>
+#include <memory>
+#include "instruction_seq.h"
+
+// Tree pattern instruction selection on the high-level code of a function,
+// by maximal munch. Each memory reference and source operand is the root
+// of an expression tree, whose interior nodes are the instructions defining
+// temporaries that are used exactly once, later in the same basic block.
+// The largest tree which matches one of the x86-64 operand forms is folded
+// into the operand, and the instructions it covers are removed:
+//
+//   add_q/sub_q by a constant     disp(base)
+//   add_q of a mul_q by 1/2/4/8   disp(base, index, scale)
+//   mov of a constant             $imm (in mov, add, sub, mul, and compare)
+//
+// A tree is only folded if none of the vregs it reads are redefined before
+// the operand using it, so the result is still correct after the live
+// ranges of these vregs have been extended up to that operand.
+class InstructionSelection {
+private:
+  struct Address {
+    int base;
+    int index;      // -1 if there is none
+    int scale;
+    long disp;
+  };
+
+  std::shared_ptr<InstructionSequence> m_iseq;
+  // the instructions, with the operands selected so far
+  std::vector<Instruction *> m_code;
+  // basic block number of each instruction
+  std::vector<unsigned> m_block;
+  // index of the only definition and the only use of each vreg
+  // (vregs defined or used more than once are not in the maps)
+  std::map<int, unsigned> m_def_index, m_use_index;
+  std::vector<bool> m_folded;
+  unsigned m_num_folded;
+
+public:
+  InstructionSelection(const std::shared_ptr<InstructionSequence> &iseq);
+  ~InstructionSelection();
+
+  std::shared_ptr<InstructionSequence> select();
+
+  // Number of instructions folded into the operands of others
+  unsigned get_num_folded() const { return m_num_folded; }
+
+private:
+  void find_defs_and_uses();
+  bool is_foldable(int vreg, unsigned consumer, unsigned root) const;
+  bool is_redefined(int vreg, unsigned from, unsigned to) const;
+  void fold(int vreg);
+
+  Operand munch_memref(const Operand &operand, unsigned root);
+  void munch_address(int vreg, unsigned consumer, unsigned root, Address &addr);
+  bool munch_scaled_index(int vreg, unsigned consumer, unsigned root, Address &addr);
+  Operand munch_immediate(const Operand &operand, unsigned root);
+};
+
+#endif // INSTRUCTION_SELECTION_H
@@ -3,13 +3,14 @@
 
 #include <string>
 #include "instruction.h"
+#include "highlevel.h"
 #include "highlevel_defuse.h"
 #include "dataflow.h"
 
 class LiveVregsAnalysis : public BackwardAnalysis {
 public:
   // We assume that there are never more than this many vregs used
-  static const unsigned MAX_VREGS = 256;
+  static const unsigned MAX_VREGS = 2048;
 
   // Fact type is a bitset of live virtual register numbers
   typedef std::bitset<MAX_VREGS> FactType;
@@ -35,6 +36,11 @@ public:
       fact.reset(operand.get_base_reg());
     }
 
+    // A function call defines the return value vreg
+    if (ins->get_opcode() == HINS_call) {
+      fact.reset(0);
+    }
+
     for (unsigned i = 0; i < ins->get_num_operands(); i++) {
       if (HighLevel::is_use(ins, i)) {
         Operand operand = ins->get_operand(i);
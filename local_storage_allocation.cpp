@@ -1,49 +1,45 @@
 #include <iostream>
+#include <algorithm>
+#include <map>
 #include "node.h"
 #include "ast.h"
 #include "local_storage_allocation.h"
 
 LocalStorageAllocation::LocalStorageAllocation()
-        : m_storage_calc(StorageCalculator::STRUCT, 0)
-        , m_total_local_storage(0U), m_next_vreg(VREG_FIRST_LOCAL), vreg_boundary(0) {
+        : m_total_local_storage(0U), m_next_vreg(VREG_FIRST_LOCAL), vreg_boundary(0) {
 }
 
 LocalStorageAllocation::~LocalStorageAllocation() = default;
 
 void LocalStorageAllocation::visit_declarator_list(Node *n) {
-    Node *maybe_struct = n->get_kid(0);
-    if (maybe_struct->has_symbol() && maybe_struct->get_symbol()->get_type()->is_struct()) {
-        StorageCalculator struct_calc;
-
-        for (unsigned i = 0; i < maybe_struct->get_type()->get_num_members(); i++) {
-            Member member = maybe_struct->get_type()->get_member(i);
-            unsigned new_mem = struct_calc.add_field(member.get_type());
-            maybe_struct->get_type()->get_member(i).set_offset(new_mem);
-        }
-        struct_calc.finish();
-        maybe_struct->get_symbol()->set_offset(m_total_local_storage);
-        std::cout << "/* struct '" << maybe_struct->get_str() << "' allocated " << struct_calc.get_size() << " bytes at offset " << m_total_local_storage <<  " */" << std::endl;
-        m_total_local_storage += struct_calc.get_size();
-        m_storage_calc.add_field(maybe_struct->get_type());
-
-    } else {
-        for (unsigned i = 0; i < n->get_num_kids(); i++) {
-            if (!n->get_kid(i)->get_symbol()->get_type()->is_struct()) {
-                assign_variable_storage(n->get_kid(i) ,n->get_kid(i));
+    for (unsigned i = 0; i < n->get_num_kids(); i++) {
+        Node *declarator = n->get_kid(i);
+        if (declarator->has_symbol() && declarator->get_symbol()->get_type()->is_struct()) {
+            StorageCalculator struct_calc;
+
+            for (unsigned j = 0; j < declarator->get_type()->get_num_members(); j++) {
+                Member member = declarator->get_type()->get_member(j);
+                unsigned new_mem = struct_calc.add_field(member.get_type());
+                declarator->get_type()->get_member(j).set_offset(new_mem);
             }
+            struct_calc.finish();
+            m_frame_vars.push_back(declarator);
+        } else {
+            assign_variable_storage(declarator, declarator);
         }
     }
 
 }
 
 void LocalStorageAllocation::visit_function_definition(Node *n) {
+    m_frame_vars.clear();
 
     // Visit parameter list
     visit_children(n->get_kid(2));
     // Visit statement list
     visit(n->get_kid(3));
-    std::cout << "/* function '" <<n->get_symbol()->get_name() << "' uses "<< m_total_local_storage <<  " bytes of memory, allocated " << m_next_vreg << " vreg's */\n" << std::endl;
-    n->get_symbol()->set_offset(m_total_local_storage);
+
+    layout_frame(n);
     n->get_symbol()->set_vreg(m_next_vreg);
 }
 
@@ -71,27 +67,118 @@ void LocalStorageAllocation::assign_variable_storage(Node *declarator, Node *bas
                 std::cout << "/* variable '" << declarator->get_str() << "' allocated to vr" << next_vreg << " */" << std::endl;
                 vreg_boundary+=declarator->get_symbol()->get_type()->get_storage_size();
             } else {
-                StorageCalculator array_calc;
-                array_calc.add_field(declarator->get_type());
-                unsigned global_mem = m_storage_calc.add_field(declarator->get_type());
-                declarator->get_symbol()->set_offset(global_mem);
-                array_calc.finish();
-                std::cout << "/* variable '" << declarator->get_str() << "' allocated " << array_calc.get_size() << " bytes of storage at offset " << global_mem << " */" << std::endl;
-                m_total_local_storage+=array_calc.get_size();
+                // The offset is assigned once the whole function has been seen
+                m_frame_vars.push_back(declarator);
             }
 
         }
     }
 }
 
+namespace {
+
+// Arrays whose size is a multiple of this are aligned to it in the stack
+// frame, so that they can be accessed with (aligned) vector instructions
+    const unsigned VECTOR_ALIGNMENT = 16;
+
+// Count the references to each variable in a function body, weighting each
+// one by 10 to the number of loops it is in
+    void count_references(Node *n, double weight, std::map<Symbol *, double> &counts) {
+        if (n->get_tag() == AST_VARIABLE_REF && n->has_symbol())
+            counts[n->get_symbol()] += weight;
+
+        int tag = n->get_tag();
+        if (tag == AST_WHILE_STATEMENT || tag == AST_DO_WHILE_STATEMENT || tag == AST_FOR_STATEMENT)
+            weight *= 10.0;
+        for (unsigned i = 0; i < n->get_num_kids(); i++)
+            count_references(n->get_kid(i), weight, counts);
+    }
+
+    unsigned align_up(unsigned offset, unsigned align) {
+        return (offset + align - 1U) & ~(align - 1U);
+    }
+
+}
+
+/**
+ * Lay out the variables of a function which need storage in the stack
+ * frame. Arrays and structs are placed from the bottom of the frame up,
+ * and scalars (variables whose address is taken) from the top down, so
+ * that they are closest to %rbp, the most frequently used ones first.
+ * Both groups are sorted by decreasing alignment, so the only padding
+ * left is between them, to make the frame size a multiple of its
+ * alignment.
+ * @param funcdef the function definition
+ */
+void LocalStorageAllocation::layout_frame(Node *funcdef) {
+    std::map<Symbol *, double> counts;
+    count_references(funcdef->get_kid(3), 1.0, counts);
+
+    struct FrameVar {
+        Node *declarator;
+        unsigned size, align;
+        double count;
+    };
+    std::vector<FrameVar> aggregates, scalars;
+    StorageCalculator declaration_order;
+    unsigned frame_align = 1U;
+    for (auto i = m_frame_vars.begin(); i != m_frame_vars.end(); ++i) {
+        const std::shared_ptr<Type> &type = (*i)->get_symbol()->get_type();
+        declaration_order.add_field(type);
+        FrameVar var = { *i, type->get_storage_size(), type->get_alignment(), counts[(*i)->get_symbol()] };
+        if (type->is_array() && var.size > 0U && var.size % VECTOR_ALIGNMENT == 0U)
+            var.align = std::max(var.align, VECTOR_ALIGNMENT);
+        frame_align = std::max(frame_align, var.align);
+        if (type->is_integral() || type->is_pointer())
+            scalars.push_back(var);
+        else
+            aggregates.push_back(var);
+    }
+    declaration_order.finish();
+
+    auto by_alignment = [](const FrameVar &left, const FrameVar &right) {
+        if (left.align != right.align)
+            return left.align > right.align;
+        return left.count > right.count;
+    };
+    std::stable_sort(aggregates.begin(), aggregates.end(), by_alignment);
+    std::stable_sort(scalars.begin(), scalars.end(), by_alignment);
+
+    // Aggregates: offsets upwards from the bottom of the frame
+    std::vector<unsigned> aggregate_offsets;
+    unsigned bottom = 0U;
+    for (auto i = aggregates.begin(); i != aggregates.end(); ++i) {
+        bottom = align_up(bottom, i->align);
+        aggregate_offsets.push_back(bottom);
+        bottom += i->size;
+    }
+    // Scalars: distances of their starts from the top of the frame
+    std::vector<unsigned> scalar_depths;
+    unsigned depth = 0U;
+    for (auto i = scalars.begin(); i != scalars.end(); ++i) {
+        depth = align_up(depth + i->size, i->align);
+        scalar_depths.push_back(depth);
+    }
+    m_total_local_storage = align_up(bottom + depth, frame_align);
+
+    auto assign = [](const FrameVar &var, unsigned offset) {
+        var.declarator->get_symbol()->set_offset(offset);
+        std::cout << "/* variable '" << var.declarator->get_str() << "' allocated " << var.size
+                  << " bytes of storage at offset " << offset << " */" << std::endl;
+    };
+    for (unsigned i = 0; i < aggregates.size(); i++)
+        assign(aggregates[i], aggregate_offsets[i]);
+    for (unsigned i = 0; i < scalars.size(); i++)
+        assign(scalars[i], m_total_local_storage - scalar_depths[i]);
+
+    std::cout << "/* function '" << funcdef->get_symbol()->get_name() << "' uses " << m_total_local_storage
+              << " bytes of memory (" << declaration_order.get_size() << " in declaration order), allocated "
+              << m_next_vreg << " vreg's */\n" << std::endl;
+    funcdef->get_symbol()->set_offset(m_total_local_storage);
+}
+
 int LocalStorageAllocation::next(){
     int temp = m_next_vreg;
     m_next_vreg++;
     return temp;
 }
-
-unsigned LocalStorageAllocation::assign_array(const std::shared_ptr<Type>& type) {
-    unsigned temp = m_storage_calc.add_field(type);
-    m_storage_calc.finish();
-    return temp;
-}
@@ -1,6 +1,7 @@
 #ifndef LOCAL_STORAGE_ALLOCATION_H
 #define LOCAL_STORAGE_ALLOCATION_H
 
+#include <vector>
 #include "storage.h"
 #include "ast_visitor.h"
 
@@ -16,10 +17,12 @@ public:
     static const int VREG_FIRST_LOCAL = 16;
 
 private:
-    StorageCalculator m_storage_calc;
     unsigned m_total_local_storage;
     int m_next_vreg;
     unsigned vreg_boundary;
+    // declarators of the current function's variables which need storage
+    // in the stack frame, in declaration order
+    std::vector<Node *> m_frame_vars;
 
 public:
     LocalStorageAllocation();
@@ -34,7 +37,7 @@ public:
 private:
     void assign_variable_storage(Node *declarator, Node *base);
 
-    unsigned int assign_array(const std::shared_ptr<Type> &type);
+    void layout_frame(Node *funcdef);
 
     void assign_struct_storage(Node *declarator, const StorageCalculator &calc);
 
@@ -0,0 +1,117 @@
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include "loops.h"
+
+bool Loop::contains(const BasicBlock *bb) const {
+  return std::find(blocks.begin(), blocks.end(), bb) != blocks.end();
+}
+
+LoopInfo::LoopInfo(const DominatorTree &dominators)
+  : m_dominators(dominators)
+  , m_innermost(dominators.get_cfg()->get_num_blocks(), nullptr) {
+  std::shared_ptr<ControlFlowGraph> cfg = m_dominators.get_cfg();
+  const std::vector<BasicBlock *> &rpo = m_dominators.get_reverse_postorder();
+
+  // Find the back edges (edges to a block dominating their source),
+  // grouped by header
+  std::map<BasicBlock *, std::vector<BasicBlock *>> back_edges;
+  for (auto i = rpo.begin(); i != rpo.end(); ++i) {
+    const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(*i);
+    for (auto j = outgoing.begin(); j != outgoing.end(); ++j) {
+      if (m_dominators.dominates((*j)->get_target(), *i)) {
+        back_edges[(*j)->get_target()].push_back(*i);
+      }
+    }
+  }
+
+  for (auto i = back_edges.begin(); i != back_edges.end(); ++i) {
+    std::unique_ptr<Loop> loop(new Loop());
+    loop->header = i->first;
+    loop->latches = i->second;
+    loop->parent = nullptr;
+    loop->depth = 1;
+
+    // Walk backwards from the latches until the header is reached
+    std::vector<bool> in_loop(cfg->get_num_blocks(), false);
+    in_loop[loop->header->get_id()] = true;
+    std::vector<BasicBlock *> work_list(loop->latches.begin(), loop->latches.end());
+    while (!work_list.empty()) {
+      BasicBlock *bb = work_list.back();
+      work_list.pop_back();
+      if (in_loop[bb->get_id()]) {
+        continue;
+      }
+      in_loop[bb->get_id()] = true;
+      const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(bb);
+      for (auto j = incoming.begin(); j != incoming.end(); ++j) {
+        if (m_dominators.is_reachable((*j)->get_source())) {
+          work_list.push_back((*j)->get_source());
+        }
+      }
+    }
+
+    for (auto j = rpo.begin(); j != rpo.end(); ++j) {
+      if (in_loop[(*j)->get_id()]) {
+        loop->blocks.push_back(*j);
+      }
+    }
+    m_loops.push_back(std::move(loop));
+  }
+
+  // Nested loops are smaller than the loops containing them
+  std::stable_sort(m_loops.begin(), m_loops.end(),
+                   [](const std::unique_ptr<Loop> &left, const std::unique_ptr<Loop> &right) {
+                     return left->blocks.size() < right->blocks.size();
+                   });
+
+  // The innermost loop of a block is the first (smallest) one containing
+  // it, and the parent of a loop is the first later loop containing its header
+  for (unsigned i = 0; i < m_loops.size(); i++) {
+    Loop *loop = m_loops[i].get();
+    for (auto j = loop->blocks.begin(); j != loop->blocks.end(); ++j) {
+      if (m_innermost[(*j)->get_id()] == nullptr) {
+        m_innermost[(*j)->get_id()] = loop;
+      }
+    }
+    for (unsigned j = i + 1; j < m_loops.size() && loop->parent == nullptr; j++) {
+      if (m_loops[j]->header != loop->header && m_loops[j]->contains(loop->header)) {
+        loop->parent = m_loops[j].get();
+      }
+    }
+  }
+
+  // parents come after their nested loops, so compute depths outermost first
+  for (auto i = m_loops.rbegin(); i != m_loops.rend(); ++i) {
+    if ((*i)->parent != nullptr) {
+      (*i)->depth = (*i)->parent->depth + 1;
+    }
+  }
+}
+
+LoopInfo::~LoopInfo() {
+}
+
+int LoopInfo::get_loop_depth(const BasicBlock *bb) const {
+  Loop *loop = get_loop_for(bb);
+  return loop != nullptr ? loop->depth : 0;
+}
+
+BasicBlock *LoopInfo::get_preheader(const Loop *loop) const {
+  std::shared_ptr<ControlFlowGraph> cfg = m_dominators.get_cfg();
+
+  BasicBlock *preheader = nullptr;
+  const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(loop->header);
+  for (auto i = incoming.begin(); i != incoming.end(); ++i) {
+    BasicBlock *pred = (*i)->get_source();
+    if (loop->contains(pred)) {
+      continue;
+    }
+    if (preheader != nullptr || cfg->get_outgoing_edges(pred).size() != 1
+        || pred->get_kind() != BASICBLOCK_INTERIOR) {
+      return nullptr;
+    }
+    preheader = pred;
+  }
+  return preheader;
+}
@@ -0,0 +1,56 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <memory>
+#include <vector>
+#include "cfg.h"
+#include "dominators.h"
+
+// A natural loop: the header and every block which can reach one of
+// the back edges to the header without passing through the header.
+// Back edges sharing a header are merged into one loop.
+struct Loop {
+  BasicBlock *header;
+  // blocks of the loop (including nested loops), in reverse postorder
+  std::vector<BasicBlock *> blocks;
+  // sources of the back edges
+  std::vector<BasicBlock *> latches;
+  // innermost enclosing loop, or null
+  Loop *parent;
+  // 1 for outermost loops
+  int depth;
+
+  bool contains(const BasicBlock *bb) const;
+};
+
+// Natural loops of a control-flow graph
+class LoopInfo {
+private:
+  const DominatorTree &m_dominators;
+  std::vector<std::unique_ptr<Loop>> m_loops;
+  // innermost loop containing each block (by block id)
+  std::vector<Loop *> m_innermost;
+
+public:
+  LoopInfo(const DominatorTree &dominators);
+  ~LoopInfo();
+
+  unsigned get_num_loops() const { return unsigned(m_loops.size()); }
+
+  // Loops are ordered so that nested loops come before the loops
+  // containing them
+  Loop *get_loop(unsigned i) const { return m_loops[i].get(); }
+
+  // Innermost loop containing a block, or null if it is not in a loop
+  Loop *get_loop_for(const BasicBlock *bb) const { return m_innermost[bb->get_id()]; }
+
+  // Number of loops a block is nested in (0 outside of loops)
+  int get_loop_depth(const BasicBlock *bb) const;
+
+  // Get the unique block outside the loop which branches or falls through
+  // to the header, if it has the header as its only successor
+  // (null if there is no such block)
+  BasicBlock *get_preheader(const Loop *loop) const;
+};
+
+#endif // LOOPS_H
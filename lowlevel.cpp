@@ -117,6 +117,110 @@ const char *lowlevel_opcode_to_str(LowLevelOpcode opcode) {
     return "sete";
   case MINS_SETNE:
     return "setne";
+  case MINS_ANDB:
+    return "andb";
+  case MINS_ANDW:
+    return "andw";
+  case MINS_ANDL:
+    return "andl";
+  case MINS_ANDQ:
+    return "andq";
+  case MINS_ORB:
+    return "orb";
+  case MINS_ORW:
+    return "orw";
+  case MINS_ORL:
+    return "orl";
+  case MINS_ORQ:
+    return "orq";
+  case MINS_XORB:
+    return "xorb";
+  case MINS_XORW:
+    return "xorw";
+  case MINS_XORL:
+    return "xorl";
+  case MINS_XORQ:
+    return "xorq";
+  case MINS_NEGB:
+    return "negb";
+  case MINS_NEGW:
+    return "negw";
+  case MINS_NEGL:
+    return "negl";
+  case MINS_NEGQ:
+    return "negq";
+  case MINS_NOTB:
+    return "notb";
+  case MINS_NOTW:
+    return "notw";
+  case MINS_NOTL:
+    return "notl";
+  case MINS_NOTQ:
+    return "notq";
+  case MINS_INCB:
+    return "incb";
+  case MINS_INCW:
+    return "incw";
+  case MINS_INCL:
+    return "incl";
+  case MINS_INCQ:
+    return "incq";
+  case MINS_DECB:
+    return "decb";
+  case MINS_DECW:
+    return "decw";
+  case MINS_DECL:
+    return "decl";
+  case MINS_DECQ:
+    return "decq";
+  case MINS_SALB:
+    return "salb";
+  case MINS_SALW:
+    return "salw";
+  case MINS_SALL:
+    return "sall";
+  case MINS_SALQ:
+    return "salq";
+  case MINS_SARB:
+    return "sarb";
+  case MINS_SARW:
+    return "sarw";
+  case MINS_SARL:
+    return "sarl";
+  case MINS_SARQ:
+    return "sarq";
+  case MINS_BTL:
+    return "btl";
+  case MINS_BTQ:
+    return "btq";
+  case MINS_SHRB:
+    return "shrb";
+  case MINS_SHRW:
+    return "shrw";
+  case MINS_SHRL:
+    return "shrl";
+  case MINS_SHRQ:
+    return "shrq";
+  case MINS_MULL:
+    return "mull";
+  case MINS_MULQ:
+    return "mulq";
+  case MINS_DIVL:
+    return "divl";
+  case MINS_DIVQ:
+    return "divq";
+  case MINS_CMOVL:
+    return "cmovl";
+  case MINS_CMOVLE:
+    return "cmovle";
+  case MINS_CMOVG:
+    return "cmovg";
+  case MINS_CMOVGE:
+    return "cmovge";
+  case MINS_CMOVE:
+    return "cmove";
+  case MINS_CMOVNE:
+    return "cmovne";
   default:
     assert(false);
     return nullptr;
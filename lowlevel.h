@@ -98,6 +98,58 @@ enum LowLevelOpcode {
   MINS_SETGE,
   MINS_SETE,
   MINS_SETNE,
+  MINS_ANDB,
+  MINS_ANDW,
+  MINS_ANDL,
+  MINS_ANDQ,
+  MINS_ORB,
+  MINS_ORW,
+  MINS_ORL,
+  MINS_ORQ,
+  MINS_XORB,
+  MINS_XORW,
+  MINS_XORL,
+  MINS_XORQ,
+  MINS_NEGB,
+  MINS_NEGW,
+  MINS_NEGL,
+  MINS_NEGQ,
+  MINS_NOTB,
+  MINS_NOTW,
+  MINS_NOTL,
+  MINS_NOTQ,
+  MINS_INCB,
+  MINS_INCW,
+  MINS_INCL,
+  MINS_INCQ,
+  MINS_DECB,
+  MINS_DECW,
+  MINS_DECL,
+  MINS_DECQ,
+  MINS_SALB,
+  MINS_SALW,
+  MINS_SALL,
+  MINS_SALQ,
+  MINS_SARB,
+  MINS_SARW,
+  MINS_SARL,
+  MINS_SARQ,
+  MINS_BTL,
+  MINS_BTQ,
+  MINS_SHRB,
+  MINS_SHRW,
+  MINS_SHRL,
+  MINS_SHRQ,
+  MINS_MULL,
+  MINS_MULQ,
+  MINS_DIVL,
+  MINS_DIVQ,
+  MINS_CMOVL,
+  MINS_CMOVLE,
+  MINS_CMOVG,
+  MINS_CMOVGE,
+  MINS_CMOVE,
+  MINS_CMOVNE,
 };
 
 const char *lowlevel_opcode_to_str(LowLevelOpcode opcode);
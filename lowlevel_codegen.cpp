@@ -1,89 +1,51 @@
 #include <cassert>
+#include <cstdint>
+#include <algorithm>
 #include <map>
+#include <set>
 #include <iostream>
 #include "node.h"
 #include "instruction.h"
 #include "operand.h"
 #include "local_storage_allocation.h"
 #include "highlevel.h"
+#include "highlevel_defuse.h"
 #include "lowlevel.h"
+#include "lowlevel_lowering.h"
 #include "exceptions.h"
 #include "lowlevel_codegen.h"
 #include "cfg.h"
 #include "optimizations.h"
+#include "register_allocation.h"
+#include "stack_slot_allocation.h"
+#include "instruction_selection.h"
+#include "peephole.h"
+#include "tail_calls.h"
 
 namespace {
 
-// This map has some "obvious" translations of high-level opcodes to
-// low-level opcodes.
-    const std::map<HighLevelOpcode, LowLevelOpcode> HL_TO_LL = {
-            { HINS_nop, MINS_NOP},
-            { HINS_add_b, MINS_ADDB },
-            { HINS_add_w, MINS_ADDW },
-            { HINS_add_l, MINS_ADDL },
-            { HINS_add_q, MINS_ADDQ },
-            { HINS_sub_b, MINS_SUBB },
-            { HINS_sub_w, MINS_SUBW },
-            { HINS_sub_l, MINS_SUBL },
-            { HINS_sub_q, MINS_SUBQ },
-            { HINS_mul_l, MINS_IMULL },
-            { HINS_mul_q, MINS_IMULQ },
-            { HINS_mov_b, MINS_MOVB },
-            { HINS_mov_w, MINS_MOVW },
-            { HINS_mov_l, MINS_MOVL },
-            { HINS_mov_q, MINS_MOVQ },
-            { HINS_sconv_bw, MINS_MOVSBW },
-            { HINS_sconv_bl, MINS_MOVSBL },
-            { HINS_sconv_bq, MINS_MOVSBQ },
-            { HINS_sconv_wl, MINS_MOVSWL },
-            { HINS_sconv_wq, MINS_MOVSWQ },
-            { HINS_sconv_lq, MINS_MOVSLQ },
-            { HINS_uconv_bw, MINS_MOVZBW },
-            { HINS_uconv_bl, MINS_MOVZBL },
-            { HINS_uconv_bq, MINS_MOVZBQ },
-            { HINS_uconv_wl, MINS_MOVZWL },
-            { HINS_uconv_wq, MINS_MOVZWQ },
-            { HINS_uconv_lq, MINS_MOVZLQ },
-            { HINS_ret, MINS_RET },
-            { HINS_jmp, MINS_JMP },
-            { HINS_call, MINS_CALL },
-
-            // For comparisons, it is expected that the code generator will first
-            // generate a cmpb/cmpw/cmpl/cmpq instruction to compare the operands,
-            // and then generate a setXX instruction to put the result of the
-            // comparison into the destination operand. These entries indicate
-            // the apprpropriate setXX instruction to use.
-            { HINS_cmplt_b, MINS_SETL },
-            { HINS_cmplt_w, MINS_SETL },
-            { HINS_cmplt_l, MINS_SETL },
-            { HINS_cmplt_q, MINS_SETL },
-            { HINS_cmplte_b, MINS_SETLE },
-            { HINS_cmplte_w, MINS_SETLE },
-            { HINS_cmplte_l, MINS_SETLE },
-            { HINS_cmplte_q, MINS_SETLE },
-            { HINS_cmpgt_b, MINS_SETG },
-            { HINS_cmpgt_w, MINS_SETG },
-            { HINS_cmpgt_l, MINS_SETG },
-            { HINS_cmpgt_q, MINS_SETG },
-            { HINS_cmpgte_b, MINS_SETGE },
-            { HINS_cmpgte_w, MINS_SETGE },
-            { HINS_cmpgte_l, MINS_SETGE },
-            { HINS_cmpgte_q, MINS_SETGE },
-            { HINS_cmpeq_b, MINS_SETE },
-            { HINS_cmpeq_w, MINS_SETE },
-            { HINS_cmpeq_l, MINS_SETE },
-            { HINS_cmpeq_q, MINS_SETE },
-            { HINS_cmpneq_b, MINS_SETNE },
-            { HINS_cmpneq_w, MINS_SETNE },
-            { HINS_cmpneq_l, MINS_SETNE },
-            { HINS_cmpneq_q, MINS_SETNE },
-    };
+// Vregs from this number on are stored in the stack frame (lower numbered
+// vregs are machine registers)
+    const int FIRST_MEMORY_VREG = 11;
+
+// Callee-saved registers used by the block-local register cache
+    const MachineReg CACHE_MREGS[] = { MREG_RBX, MREG_R12, MREG_R13, MREG_R14, MREG_R15 };
+
+// Check whether a low-level instruction writes its last operand
+    bool writes_last_operand(int ll_opcode) {
+        return !(ll_opcode >= MINS_CMPB && ll_opcode <= MINS_CMPQ)
+                && ll_opcode != MINS_BTL && ll_opcode != MINS_BTQ
+                && ll_opcode != MINS_MULL && ll_opcode != MINS_MULQ && ll_opcode != MINS_DIVL && ll_opcode != MINS_DIVQ
+                && ll_opcode != MINS_PUSHQ && ll_opcode != MINS_IDIVL && ll_opcode != MINS_IDIVQ;
+    }
 
 }
 
-LowLevelCodeGen::LowLevelCodeGen(bool optimize)
+LowLevelCodeGen::LowLevelCodeGen(bool optimize, bool cache_registers, bool print_peephole_stats)
         : m_total_memory_storage(0)
-        , m_optimize(optimize) {
+        , m_optimize(optimize)
+        , m_print_peephole_stats(print_peephole_stats)
+        , m_cache_registers(cache_registers) {
 }
 
 LowLevelCodeGen::~LowLevelCodeGen() {
@@ -91,13 +53,34 @@ LowLevelCodeGen::~LowLevelCodeGen() {
 
 std::shared_ptr<InstructionSequence> LowLevelCodeGen::generate(const std::shared_ptr<InstructionSequence> &hl_iseq) {
 
-    std::shared_ptr<InstructionSequence> ll_iseq = translate_hl_to_ll(hl_iseq);
+    std::shared_ptr<InstructionSequence> ll_iseq;
+    if (m_optimize || m_cache_registers)
+        ll_iseq = translate_hl_to_ll(select_instructions(hl_iseq));
+    else
+        ll_iseq = translate_hl_to_ll(hl_iseq);
 
-    // TODO: if optimizations are enabled, could do analysis/transformation of low-level code
-    if (m_optimize) {
+    if (m_optimize)
+        ll_iseq = optimize_peephole(ll_iseq);
+    return ll_iseq;
+}
 
+/**
+ * Run the peephole optimizer on the complete low-level code of a function,
+ * and print how often each rule was applied if requested.
+ * @param ll_iseq the low-level code, including prologue and epilogue
+ * @return the optimized code
+ */
+std::shared_ptr<InstructionSequence> LowLevelCodeGen::optimize_peephole(const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    PeepholeOptimizer peephole(ll_iseq);
+    std::shared_ptr<InstructionSequence> result = peephole.optimize();
+
+    if (m_print_peephole_stats) {
+        const std::string &name = ll_iseq->get_funcdef_ast()->get_symbol()->get_name();
+        for (unsigned rule = 0; rule < peephole.get_num_rules(); rule++)
+            std::cout << "/* Function '" << name << "': peephole rule " << peephole.get_rule_name(rule)
+                      << ": " << peephole.get_num_hits(rule) << " hits */" << std::endl;
     }
-    return ll_iseq;
+    return result;
 }
 
 std::shared_ptr<InstructionSequence> LowLevelCodeGen::translate_hl_to_ll(const std::shared_ptr<InstructionSequence> &hl_iseq) {
@@ -122,6 +105,18 @@ std::shared_ptr<InstructionSequence> LowLevelCodeGen::translate_hl_to_ll(const s
     // spilled machine registers, etc.
     vreg_boundary = ll_iseq->get_funcdef_ast()->get_symbol()->get_vreg();
     vreg_boundary = (vreg_boundary - 8) * 8;
+
+    find_vreg_sizes(hl_iseq);
+    if (m_optimize) {
+        find_tail_calls(hl_iseq);
+        allocate_registers(hl_iseq);
+    } else if (m_cache_registers) {
+        find_block_local_vregs(hl_iseq);
+    }
+    // When optimizing, the vregs in memory share stack slots
+    if (m_optimize || m_cache_registers)
+        assign_stack_slots(hl_iseq);
+
     std::cout << "/* Function '"<<ll_iseq->get_funcdef_ast()->get_symbol()->get_name().c_str() << "': uses "<< vreg_boundary <<" total bytes of memory storage for vregs */" << std::endl;
     std::cout << "/* Function '"<<ll_iseq->get_funcdef_ast()->get_symbol()->get_name().c_str() << "': placing vreg storage at offset -" << vreg_boundary << " from %rbp */" << std::endl;
 
@@ -144,15 +139,240 @@ std::shared_ptr<InstructionSequence> LowLevelCodeGen::translate_hl_to_ll(const s
 
         // If the high-level instruction has a label, define an equivalent
         // label in the low-level instruction sequence
-        if (i.has_label())
+        if (i.has_label()) {
+            // Control flow can join here, so cached values must be in memory
+            if (m_cache_registers)
+                end_cache_block(ll_iseq, true);
+            m_flags_vreg = -1;
+            // the previous labeled instruction may have translated to
+            // nothing (e.g. a copy between vregs in the same register)
+            if (ll_iseq->has_label_at_end())
+                ll_iseq->append(new Instruction(MINS_NOP));
             ll_iseq->define_label(i.get_label());
+        }
         // Translate the high-level instruction into one or more low-level instructions
         translate_instruction(hl_ins, ll_iseq);
     }
 
+    // The prologue and epilogue depend on which registers and how much of
+    // the stack frame the translated code uses
+    return add_prologue_and_epilogue(ll_iseq);
+}
+
+/**
+ * Add the prologue and epilogue to the translated code of a function.
+ * Only the callee-saved registers which the code writes are saved.
+ * A leaf function doesn't have to keep %rsp aligned: if it doesn't use
+ * its stack frame, it doesn't get one, and if the frame fits in the
+ * 128 byte red zone below %rsp, %rsp isn't adjusted.
+ * @param body the translated code, without prologue and epilogue
+ * @return the complete code of the function
+ */
+std::shared_ptr<InstructionSequence> LowLevelCodeGen::add_prologue_and_epilogue(const std::shared_ptr<InstructionSequence> &body) {
+    bool is_leaf = true;
+    bool uses_frame = false;
+    m_saved_mregs.clear();
+    for (auto i = body->cbegin(); i != body->cend(); ++i) {
+        Instruction *ll_ins = *i;
+        // Code which pushes temporaries can't keep its frame in the red zone
+        if (ll_ins->get_opcode() == MINS_CALL || ll_ins->get_opcode() == MINS_PUSHQ)
+            is_leaf = false;
+        for (unsigned j = 0; j < ll_ins->get_num_operands(); j++) {
+            const Operand &operand = ll_ins->get_operand(j);
+            if (operand.is_memref() && operand.get_base_reg() == MREG_RBP)
+                uses_frame = true;
+        }
+        if (ll_ins->get_num_operands() > 0 && writes_last_operand(ll_ins->get_opcode())) {
+            const Operand &dest = ll_ins->get_operand(ll_ins->get_num_operands() - 1);
+            if (!dest.is_memref() && dest.has_base_reg()) {
+                auto mreg = MachineReg(dest.get_base_reg());
+                if (RegisterAllocation::is_callee_saved(mreg)
+                    && std::find(m_saved_mregs.begin(), m_saved_mregs.end(), mreg) == m_saved_mregs.end())
+                    m_saved_mregs.push_back(mreg);
+            }
+        }
+    }
+    std::sort(m_saved_mregs.begin(), m_saved_mregs.end());
+
+    const std::string &name = body->get_funcdef_ast()->get_symbol()->get_name();
+    m_use_frame_pointer = !is_leaf || uses_frame;
+    if (is_leaf && (!uses_frame || m_total_memory_storage <= 128)) {
+        m_stack_adjustment = 0;
+        std::cout << "/* Function '" << name << "': leaf function, "
+                  << (uses_frame ? "local storage in the red zone" : "no stack frame") << " */" << std::endl;
+    } else {
+        m_stack_adjustment = m_total_memory_storage;
+    }
+    // %rbp (and so the frame) must be 16-byte aligned: pad above it when
+    // an odd number of registers is pushed
+    m_frame_padding = (m_use_frame_pointer && m_saved_mregs.size() % 2 != 0) ? 8 : 0;
+
+    std::shared_ptr<InstructionSequence> ll_iseq(new InstructionSequence());
+    ll_iseq->set_funcdef_ast(body->get_funcdef_ast());
+    append_prologue(ll_iseq);
+    unsigned index = 0;
+    for (auto i = body->cbegin(); i != body->cend(); ++i, ++index) {
+        if (i.has_label())
+            ll_iseq->define_label(i.get_label());
+        if (std::find(m_epilogue_positions.begin(), m_epilogue_positions.end(), index) != m_epilogue_positions.end())
+            append_epilogue(ll_iseq);
+        ll_iseq->append((*i)->duplicate());
+    }
+    if (std::find(m_epilogue_positions.begin(), m_epilogue_positions.end(), index) != m_epilogue_positions.end())
+        append_epilogue(ll_iseq);
+
     return ll_iseq;
 }
 
+/**
+ * Generate the function prologue, which creates an ABI-compliant stack frame.
+ * The local variable area is *below* the address in %rbp, and local storage
+ * can be accessed at negative offsets from %rbp. For example, the topmost
+ * 4 bytes in the local storage area are at -4(%rbp).
+ * @param ll_iseq the low-level code to add the prologue to
+ */
+void LowLevelCodeGen::append_prologue(const std::shared_ptr<InstructionSequence> &ll_iseq) const {
+    // Callee-saved registers are pushed before %rbp, so that the local
+    // storage area still starts right below %rbp
+    for (auto i = m_saved_mregs.begin(); i != m_saved_mregs.end(); ++i) {
+        ll_iseq->append(new Instruction(MINS_PUSHQ, Operand(Operand::MREG64, *i)));
+    }
+    if (m_frame_padding > 0)
+        ll_iseq->append(new Instruction(MINS_SUBQ, Operand(Operand::IMM_IVAL, m_frame_padding), Operand(Operand::MREG64, MREG_RSP)));
+    if (m_use_frame_pointer) {
+        ll_iseq->append(new Instruction(MINS_PUSHQ, Operand(Operand::MREG64, MREG_RBP)));
+        ll_iseq->append(new Instruction(MINS_MOVQ, Operand(Operand::MREG64, MREG_RSP), Operand(Operand::MREG64, MREG_RBP)));
+    }
+    if (m_stack_adjustment > 0)
+        ll_iseq->append(new Instruction(MINS_SUBQ, Operand(Operand::IMM_IVAL, m_stack_adjustment), Operand(Operand::MREG64, MREG_RSP)));
+}
+
+/**
+ * Generate the function epilogue: deallocate local storage area and
+ * restore the original values of %rbp and the callee-saved registers
+ * @param ll_iseq the low-level code to add the epilogue to
+ */
+void LowLevelCodeGen::append_epilogue(const std::shared_ptr<InstructionSequence> &ll_iseq) const {
+    if (m_stack_adjustment > 0)
+        ll_iseq->append(new Instruction(MINS_ADDQ, Operand(Operand::IMM_IVAL, m_stack_adjustment), Operand(Operand::MREG64, MREG_RSP)));
+    if (m_use_frame_pointer)
+        ll_iseq->append(new Instruction(MINS_POPQ, Operand(Operand::MREG64, MREG_RBP)));
+    if (m_frame_padding > 0)
+        ll_iseq->append(new Instruction(MINS_ADDQ, Operand(Operand::IMM_IVAL, m_frame_padding), Operand(Operand::MREG64, MREG_RSP)));
+    for (auto i = m_saved_mregs.rbegin(); i != m_saved_mregs.rend(); ++i) {
+        ll_iseq->append(new Instruction(MINS_POPQ, Operand(Operand::MREG64, *i)));
+    }
+}
+
+/**
+ * Fold address arithmetic and constants into the operands of the
+ * high-level instructions using them, so that they can be translated
+ * to x86-64 addressing modes and immediates.
+ * @param hl_iseq the high-level code of the function
+ * @return the high-level code with the folded instructions removed
+ */
+std::shared_ptr<InstructionSequence> LowLevelCodeGen::select_instructions(const std::shared_ptr<InstructionSequence> &hl_iseq) {
+    InstructionSelection selection(hl_iseq);
+    std::shared_ptr<InstructionSequence> result = selection.select();
+
+    std::cout << "/* Function '" << hl_iseq->get_funcdef_ast()->get_symbol()->get_name() << "': "
+              << selection.get_num_folded() << " instructions folded into addressing modes and immediates */" << std::endl;
+    return result;
+}
+
+/**
+ * Assign machine registers to the vregs of a function by graph coloring.
+ * Vregs which are spilled keep their stack slots.
+ * @param hl_iseq the high-level code of the function
+ */
+void LowLevelCodeGen::allocate_registers(const std::shared_ptr<InstructionSequence> &hl_iseq) {
+    HighLevelControlFlowGraphBuilder cfg_builder(hl_iseq);
+    std::shared_ptr<ControlFlowGraph> cfg = cfg_builder.build();
+
+    RegisterAllocation register_allocation(cfg);
+    register_allocation.allocate();
+    m_vreg_mregs = register_allocation.get_assignment();
+
+    std::cout << "/* Function '" << hl_iseq->get_funcdef_ast()->get_symbol()->get_name() << "': "
+              << register_allocation.get_num_allocated() << " vregs allocated to machine registers, "
+              << register_allocation.get_num_spilled() << " spilled to the stack */" << std::endl;
+}
+
+/**
+ * Assign stack slots to the vregs which live in memory, sharing slots
+ * between vregs which are never live at the same time, and sizing each
+ * slot by the width of the values it holds. This replaces the storage
+ * area with one 8 byte slot per vreg number.
+ * @param hl_iseq the high-level code of the function
+ */
+void LowLevelCodeGen::assign_stack_slots(const std::shared_ptr<InstructionSequence> &hl_iseq) {
+    std::set<int> vregs;
+    for (auto i = hl_iseq->cbegin(); i != hl_iseq->cend(); ++i) {
+        Instruction *hl_ins = *i;
+        for (unsigned j = 0; j < hl_ins->get_num_operands(); j++) {
+            const Operand &operand = hl_ins->get_operand(j);
+            std::vector<int> operand_vregs;
+            if (operand.has_base_reg())
+                operand_vregs.push_back(operand.get_base_reg());
+            if (operand.has_index_reg())
+                operand_vregs.push_back(operand.get_index_reg());
+            for (auto k = operand_vregs.begin(); k != operand_vregs.end(); ++k) {
+                if (*k >= FIRST_MEMORY_VREG && m_vreg_mregs.count(*k) == 0)
+                    vregs.insert(*k);
+            }
+        }
+    }
+
+    HighLevelControlFlowGraphBuilder cfg_builder(hl_iseq);
+    StackSlotAllocation slot_allocation(cfg_builder.build(), vregs, m_vreg_sizes);
+
+    if (m_cache_registers) {
+        // The register cache writes back a modified value when it is
+        // evicted, or at the latest at the next branch or label, so the
+        // value keeps its slot until then
+        unsigned length = hl_iseq->get_length();
+        std::vector<unsigned> def_extents(length);
+        unsigned end = length - 1;
+        for (unsigned i = length; i-- > 0; ) {
+            int hl_opcode = hl_iseq->get_instruction(i)->get_opcode();
+            if (HighLevel::is_jump(hl_opcode))
+                end = i;
+            def_extents[i] = end;
+            if (hl_iseq->has_label(i) && i > 0)
+                end = i - 1;
+        }
+        slot_allocation.set_def_extents(def_extents);
+    }
+
+    slot_allocation.allocate();
+
+    const std::string &name = hl_iseq->get_funcdef_ast()->get_symbol()->get_name();
+    std::cout << "/* Function '" << name << "': " << vregs.size() << " vregs in memory share "
+              << slot_allocation.get_num_slots() << " stack slots, reducing vreg storage from "
+              << vreg_boundary << " to " << slot_allocation.get_size() << " bytes */" << std::endl;
+
+    vreg_boundary = int(slot_allocation.get_size());
+    for (auto i = vregs.begin(); i != vregs.end(); ++i)
+        m_vreg_offsets[*i] = slot_allocation.get_offset(*i) - vreg_boundary;
+}
+
+/**
+ * Record the size of the value each vreg is defined with
+ * @param hl_iseq the high-level code of the function
+ */
+void LowLevelCodeGen::find_vreg_sizes(const std::shared_ptr<InstructionSequence> &hl_iseq) {
+    for (auto i = hl_iseq->cbegin(); i != hl_iseq->cend(); ++i) {
+        Instruction *hl_ins = *i;
+        if (!HighLevel::is_def(hl_ins)) {
+            continue;
+        }
+        auto hl_opcode = HighLevelOpcode(hl_ins->get_opcode());
+        int size = hl_opcode == HINS_localaddr ? 8 : highlevel_opcode_get_dest_operand_size(hl_opcode);
+        int &vreg_size = m_vreg_sizes[hl_ins->get_operand(0).get_base_reg()];
+        vreg_size = std::max(vreg_size, size);
+    }
+}
+
 namespace {
 
 // These helper functions are provided to make it easier to handle
@@ -207,35 +427,193 @@ namespace {
         }
     }
 
+// Check whether an operand is a machine register
+    bool is_mreg(const Operand &operand) {
+        Operand::Kind kind = operand.get_kind();
+        return kind == Operand::MREG8 || kind == Operand::MREG16
+                || kind == Operand::MREG32 || kind == Operand::MREG64;
+    }
+
+// Check whether an operand is, or refers to memory through, a machine
+// register (of any size)
+    bool uses_mreg(const Operand &operand, int mreg) {
+        if (operand.is_non_reg())
+            return false;
+        return operand.get_base_reg() == mreg || (operand.has_index_reg() && operand.get_index_reg() == mreg);
+    }
+
+// Check whether two operands are the same machine register, accessed
+// with the same size
+    bool is_same_mreg(const Operand &left, const Operand &right) {
+        return is_mreg(left) && right.get_kind() == left.get_kind() && left.get_base_reg() == right.get_base_reg();
+    }
+
+// Get the 32 bit register of a machine register operand, which holds
+// a byte or word value in its low bits
+    Operand widen_mreg(const Operand &operand) {
+        return Operand(Operand::MREG32, operand.get_base_reg());
+    }
+
+// Get the instruction which loads a byte or word into a 32 bit register
+// (zero extending it)
+    LowLevelOpcode get_widening_load(int size) {
+        return size == 1 ? MINS_MOVZBL : MINS_MOVZWL;
+    }
+
+// Get the conditional move which moves if the condition of a setcc
+// instruction holds
+    LowLevelOpcode setcc_to_cmov(LowLevelOpcode setcc) {
+        switch (setcc) {
+            case MINS_SETL:
+                return MINS_CMOVL;
+            case MINS_SETLE:
+                return MINS_CMOVLE;
+            case MINS_SETG:
+                return MINS_CMOVG;
+            case MINS_SETGE:
+                return MINS_CMOVGE;
+            case MINS_SETE:
+                return MINS_CMOVE;
+            case MINS_SETNE:
+                return MINS_CMOVNE;
+            default:
+                assert(false);
+                return MINS_NOP;
+        }
+    }
+
+// Get the conditional move done on the opposite condition
+    LowLevelOpcode invert_cmov(LowLevelOpcode cmov) {
+        switch (cmov) {
+            case MINS_CMOVL:
+                return MINS_CMOVGE;
+            case MINS_CMOVLE:
+                return MINS_CMOVG;
+            case MINS_CMOVG:
+                return MINS_CMOVLE;
+            case MINS_CMOVGE:
+                return MINS_CMOVL;
+            case MINS_CMOVE:
+                return MINS_CMOVNE;
+            default:
+                assert(cmov == MINS_CMOVNE);
+                return MINS_CMOVE;
+        }
+    }
+
+// Compute the multiplier and shift for a signed division by a constant
+// (|divisor| >= 2) of the given number of bits: the quotient is the high
+// half of the product of the dividend and the multiplier, shifted right
+// (Hacker's Delight, 10-4 and 10-15). The multiplier is sign extended.
+    void get_signed_magic(long divisor, int bits, long &multiplier, int &shift) {
+        unsigned long mask = bits == 64 ? ~0UL : (1UL << bits) - 1;
+        unsigned long sign_bit = 1UL << (bits - 1);
+        unsigned long ad = (divisor < 0 ? -(unsigned long) divisor : (unsigned long) divisor) & mask;
+        unsigned long t = sign_bit + ((unsigned long) divisor & sign_bit ? 1 : 0);
+        unsigned long anc = t - 1 - t % ad;
+        unsigned long q1 = sign_bit / anc, r1 = sign_bit - q1 * anc;
+        unsigned long q2 = sign_bit / ad, r2 = sign_bit - q2 * ad;
+        unsigned long delta;
+        int p = bits - 1;
+        do {
+            p++;
+            q1 = (2 * q1) & mask;
+            r1 = (2 * r1) & mask;
+            if (r1 >= anc) {
+                q1 = (q1 + 1) & mask;
+                r1 -= anc;
+            }
+            q2 = (2 * q2) & mask;
+            r2 = (2 * r2) & mask;
+            if (r2 >= ad) {
+                q2 = (q2 + 1) & mask;
+                r2 -= ad;
+            }
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+
+        unsigned long m = (q2 + 1) & mask;
+        if (divisor < 0)
+            m = -m & mask;
+        int extend = 64 - bits;
+        multiplier = long(m << extend) >> extend;
+        shift = p - bits;
+    }
+
+// Compute the multiplier and shift for an unsigned division by a
+// constant (>= 2) of the given number of bits. If the multiplier needs
+// bits + 1 bits, add is set, and the dividend is added to the high half
+// of the product (Hacker's Delight, 10-8 and 10-9).
+    void get_unsigned_magic(unsigned long divisor, int bits, unsigned long &multiplier, int &shift, bool &add) {
+        unsigned long mask = bits == 64 ? ~0UL : (1UL << bits) - 1;
+        unsigned long sign_bit = 1UL << (bits - 1);
+        unsigned long nc = (mask - ((-divisor & mask) % divisor)) & mask;
+        unsigned long q1 = sign_bit / nc, r1 = sign_bit - q1 * nc;
+        unsigned long q2 = (sign_bit - 1) / divisor, r2 = (sign_bit - 1) - q2 * divisor;
+        unsigned long delta;
+        int p = bits - 1;
+        add = false;
+        do {
+            p++;
+            if (r1 >= nc - r1) {
+                q1 = (2 * q1 + 1) & mask;
+                r1 = (2 * r1 - nc) & mask;
+            } else {
+                q1 = (2 * q1) & mask;
+                r1 = (2 * r1) & mask;
+            }
+            if (r2 + 1 >= divisor - r2) {
+                if (q2 >= sign_bit - 1)
+                    add = true;
+                q2 = (2 * q2 + 1) & mask;
+                r2 = (2 * r2 + 1 - divisor) & mask;
+            } else {
+                if (q2 >= sign_bit)
+                    add = true;
+                q2 = (2 * q2) & mask;
+                r2 = (2 * r2 + 1) & mask;
+            }
+            delta = divisor - 1 - r2;
+        } while (p < 2 * bits && (q1 < delta || (q1 == delta && r1 == 0)));
+
+        multiplier = (q2 + 1) & mask;
+        shift = p - bits;
+    }
+
 }
 
 void LowLevelCodeGen::translate_instruction(Instruction *hl_ins, const std::shared_ptr<InstructionSequence> &ll_iseq) {
     auto hl_opcode = HighLevelOpcode(hl_ins->get_opcode());
+    const LoweringRule &rule = get_lowering_rule(hl_opcode);
 
-
-    if (hl_opcode == HINS_enter) {
-        // Function prologue: this will create an ABI-compliant stack frame.
-        // The local variable area is *below* the address in %rbp, and local storage
-        // can be accessed at negative offsets from %rbp. For example, the topmost
-        // 4 bytes in the local storage area are at -4(%rbp).
-        ll_iseq->append(new Instruction(MINS_PUSHQ, Operand(Operand::MREG64, MREG_RBP)));
-        ll_iseq->append(new Instruction(MINS_MOVQ, Operand(Operand::MREG64, MREG_RSP), Operand(Operand::MREG64, MREG_RBP)));
-        ll_iseq->append(new Instruction(MINS_SUBQ, Operand(Operand::IMM_IVAL, m_total_memory_storage), Operand(Operand::MREG64, MREG_RSP)));
-
-        return;
+    switch (rule.tmpl) {
+        case LOWER_ENTER:
+            // The prologue is added once the whole function has been translated
+            return;
+        case LOWER_LEAVE:
+            // Same for the epilogue: remember where it goes
+            m_epilogue_positions.push_back(ll_iseq->get_length());
+            return;
+        case LOWER_RET:
+            ll_iseq->append(new Instruction(rule.ll_opcode));
+            return;
+        default:
+            break;
     }
 
-    if (hl_opcode == HINS_leave) {
-        // Function epilogue: deallocate local storage area and restore original value
-        // of %rbp
-        ll_iseq->append(new Instruction(MINS_ADDQ, Operand(Operand::IMM_IVAL, m_total_memory_storage), Operand(Operand::MREG64, MREG_RSP)));
-        ll_iseq->append(new Instruction(MINS_POPQ, Operand(Operand::MREG64, MREG_RBP)));
+    // The flags only hold a comparison for the instruction right after it
+    int flags_vreg = m_flags_vreg;
+    m_flags_vreg = -1;
 
-        return;
+    if (m_cache_registers) {
+        // Modified values must be in memory before a branch
+        if (HighLevel::is_jump(hl_opcode))
+            end_cache_block(ll_iseq, false);
+        cache_operands(hl_ins, ll_iseq);
     }
 
-    if (hl_opcode == HINS_ret) {
-        ll_iseq->append(new Instruction(MINS_RET));
+    if (rule.flags & LOWER_WIDEN) {
+        lower_widened(hl_ins, rule, ll_iseq);
         return;
     }
 
@@ -245,256 +623,930 @@ void LowLevelCodeGen::translate_instruction(Instruction *hl_ins, const std::shar
     // destination operand of a high-level instruction. This should be useful
     // for choosing the appropriate low-level instructions and
     // machine register operands.
+    switch (rule.tmpl) {
+        case LOWER_NOP:
+            ll_iseq->append(new Instruction(rule.ll_opcode));
+            return;
+        case LOWER_JUMP:
+            if (m_tail_calls.count(hl_ins) > 0) {
+                // Remove the stack frame, and let the callee return to
+                // this function's caller
+                m_epilogue_positions.push_back(ll_iseq->get_length());
+                ll_iseq->append(new Instruction(MINS_JMP, hl_ins->get_operand(0)));
+                return;
+            }
+            ll_iseq->append(new Instruction(rule.ll_opcode, hl_ins->get_operand(0)));
+            return;
+        case LOWER_CJMP:
+            lower_cjmp(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_LOCALADDR:
+            lower_localaddr(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_MOVE:
+            lower_move(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_CONVERT:
+            lower_convert(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_BINARY:
+            lower_binary(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_SHIFT:
+            lower_shift(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_UNARY:
+            lower_unary(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_DIVIDE:
+            lower_divide(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_COMPARE:
+            lower_compare(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_BRANCH:
+            lower_branch(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_BITTEST:
+            lower_bittest(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_JUMPTABLE:
+            lower_jumptable(hl_ins, rule, ll_iseq);
+            return;
+        case LOWER_SELECT:
+            lower_select(hl_ins, rule, flags_vreg, ll_iseq);
+            return;
+        default:
+            RuntimeError::raise("high level opcode %d not handled", int(hl_opcode));
+    }
+}
 
+/**
+ * Lower a conditional jump: compare the condition with 0
+ * @param hl_ins the cjmp_t or cjmp_f instruction
+ * @param rule the lowering rule (the jump taken if the condition is nonzero
+ *             or zero)
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_cjmp(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    // The source of a HINS_cjmp does not have a size, so compare it with
+    // the size it was computed with (or L if that isn't known)
+    Operand condition = hl_ins->get_operand(0);
+    int condition_size = 4;
+    if (condition.get_kind() == Operand::VREG && m_vreg_sizes.count(condition.get_base_reg()) > 0)
+        condition_size = m_vreg_sizes.at(condition.get_base_reg());
+    Operand ll_condition = get_ll_operand(condition, condition_size, ll_iseq);
+    LowLevelOpcode compare = select_ll_opcode(MINS_CMPB, condition_size);
+    ll_iseq->append(new Instruction(compare, Operand(Operand::IMM_IVAL, 0), ll_condition));
+    ll_iseq->append(new Instruction(rule.ll_opcode, hl_ins->get_operand(1)));
+}
 
+/**
+ * Lower the computation of the address of a variable in the stack frame
+ * @param hl_ins the localaddr instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_localaddr(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    // Always take 64 bit size as per spec
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), 8, ll_iseq);
+    Operand dest_operand = get_ll_operand(hl_ins->get_operand(0), 8, ll_iseq);
 
-    // 1 OPERAND
-
-    Operand dest_operand = hl_ins->get_operand(0);
+    // Get the actual offset, not the offset that hl gen passes in
+    Operand memory_ref(Operand::MREG64_MEM_OFF, MREG_RBP, -1*(m_total_memory_storage - src_operand.get_imm_ival()));
 
-    if (hl_opcode == HINS_jmp) {
-        ll_iseq->append(new Instruction(MINS_JMP, dest_operand));
+    if (is_mreg(dest_operand)) {
+        ll_iseq->append(new Instruction(rule.ll_opcode, memory_ref, dest_operand));
         return;
     }
+    Operand temp(select_mreg_kind(8), MREG_R10);
+    ll_iseq->append(new Instruction(rule.ll_opcode, memory_ref, temp));
+    ll_iseq->append(new Instruction(MINS_MOVQ, temp, dest_operand));
+}
 
-    if (hl_opcode == HINS_nop) {
-        ll_iseq->append(new Instruction(MINS_NOP));
+/**
+ * Lower a move, through %r10 if both operands are in memory. A byte or
+ * word is moved into a register as a 32 bit value (zero extended if it
+ * is loaded), so that the register doesn't depend on its previous
+ * value; it is only truncated when it is stored.
+ * @param hl_ins the mov instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_move(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+    Operand temp(select_mreg_kind(size), MREG_R10);
+
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+    if (src_operand.is_memref() && is_in_memory(hl_ins->get_operand(0))) {
+        // The source is loaded before the destination's address is
+        if (size < 4)
+            ll_iseq->append(new Instruction(get_widening_load(size), src_operand, widen_mreg(temp)));
+        else
+            ll_iseq->append(new Instruction(rule.ll_opcode, src_operand, temp));
+        src_operand = temp;
+    }
+    Operand dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    if (size < 4 && is_mreg(dest_operand)) {
+        if (src_operand.is_memref())
+            ll_iseq->append(new Instruction(get_widening_load(size), src_operand, widen_mreg(dest_operand)));
+        else if (!is_same_mreg(src_operand, dest_operand))
+            ll_iseq->append(new Instruction(MINS_MOVL, is_mreg(src_operand) ? widen_mreg(src_operand) : src_operand,
+                                            widen_mreg(dest_operand)));
         return;
     }
+    if (src_operand.is_imm_ival() && !is_mreg(dest_operand)
+        && (src_operand.get_imm_ival() < INT32_MIN || src_operand.get_imm_ival() > INT32_MAX)) {
+        // Only a register can be loaded with a 64 bit constant
+        ll_iseq->append(new Instruction(rule.ll_opcode, src_operand, temp));
+        src_operand = temp;
+    }
+
+    // A copy between vregs allocated to the same register does nothing
+    if (is_same_mreg(src_operand, dest_operand))
+        return;
+    ll_iseq->append(new Instruction(rule.ll_opcode, src_operand, dest_operand));
+}
 
-    if (hl_opcode == HINS_call) {
-        ll_iseq->append(new Instruction(MINS_CALL, dest_operand));
+/**
+ * Lower a sign or zero extension, directly into the destination if it
+ * is a register
+ * @param hl_ins the sconv or uconv instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_convert(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    auto hl_opcode = HighLevelOpcode(hl_ins->get_opcode());
+    int before = highlevel_opcode_get_source_operand_size(hl_opcode);
+    int after = highlevel_opcode_get_dest_operand_size(hl_opcode);
+    // A 32 bit move zero extends to 64 bits, and a conversion to a word
+    // extends to 32 bits
+    int written = (rule.flags & LOWER_IMPLICIT) ? 4 : std::max(after, 4);
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, after);
+
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), before, ll_iseq);
+    if (src_operand.is_imm_ival()) {
+        // Convert a constant now
+        int shift = 64 - 8 * before;
+        long value = src_operand.get_imm_ival();
+        bool is_unsigned = hl_opcode >= HINS_uconv_bw;
+        value = is_unsigned ? long((unsigned long) value << shift >> shift) : (value << shift) >> shift;
+        src_operand = Operand(Operand::IMM_IVAL, value);
+        Operand dest_operand = get_ll_operand(hl_ins->get_operand(0), after, ll_iseq);
+        if (!is_mreg(dest_operand) && (value < INT32_MIN || value > INT32_MAX)) {
+            // Only a register can be loaded with a 64 bit constant
+            Operand temp(select_mreg_kind(after), MREG_R10);
+            ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
+            src_operand = temp;
+        }
+        ll_iseq->append(new Instruction(mov_opcode, src_operand, dest_operand));
         return;
     }
 
+    Operand dest_operand;
+    if (!is_in_memory(hl_ins->get_operand(0)))
+        dest_operand = get_ll_operand(hl_ins->get_operand(0), after, ll_iseq);
+    if (is_mreg(dest_operand)) {
+        ll_iseq->append(new Instruction(rule.ll_opcode, src_operand, Operand(select_mreg_kind(written), dest_operand.get_base_reg())));
+        return;
+    }
+    ll_iseq->append(new Instruction(rule.ll_opcode, src_operand, Operand(select_mreg_kind(written), MREG_R10)));
+    dest_operand = get_ll_operand(hl_ins->get_operand(0), after, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, Operand(select_mreg_kind(after), MREG_R10), dest_operand));
+}
 
-    // 2 OPERAND
-    int src_size = highlevel_opcode_get_source_operand_size(hl_opcode);
-    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), src_size, ll_iseq);
-    int dest_size = highlevel_opcode_get_dest_operand_size(hl_opcode);
-    dest_operand = get_ll_operand(hl_ins->get_operand(0), dest_size, ll_iseq);
-
-    //conv
-    if (match_hl(HINS_uconv_bw, hl_opcode) || match_hl(HINS_uconv_bq, hl_opcode)
-        || match_hl(HINS_sconv_bw, hl_opcode)  || match_hl(HINS_sconv_bq, hl_opcode)) {
-        int before = 1;
-        int after;
-        switch (hl_opcode) {
-            case HINS_sconv_bw:
-            case HINS_uconv_bw:
-                after = 2;
-                break;
-            case HINS_sconv_bl:
-            case HINS_uconv_bl:
-                after = 4;
-                break;
-            case HINS_sconv_bq:
-            case HINS_uconv_bq:
-                after = 8;
-                break;
-            case HINS_sconv_wl:
-            case HINS_uconv_wl:
-                before = 2;
-                after = 4;
-                break;
-            case HINS_sconv_wq:
-            case HINS_uconv_wq:
-                before = 2;
-                after = 8;
-                break;
-            case HINS_sconv_lq:
-            case HINS_uconv_lq:
-                before = 4;
-                after = 8;
-                break;
-            default:
-                RuntimeError::raise("Non-conversion passed into conversion check");
-        }
-        // Move value into small temp
-        LowLevelOpcode old_move = select_ll_opcode(MINS_MOVB, before);
-        Operand r10_small(select_mreg_kind(before), MREG_R10);
-        ll_iseq->append(new Instruction(old_move, src_operand, r10_small));
-
-        // Convert it
-        Operand r10_big(select_mreg_kind(after), MREG_R10);
-        ll_iseq->append(new Instruction(HL_TO_LL.at(hl_opcode), r10_small, r10_big));
-        // Move it from big temp to destination
-        LowLevelOpcode new_move = select_ll_opcode(MINS_MOVB, after);
-        ll_iseq->append(new Instruction(new_move, r10_big, dest_operand));
+/**
+ * Lower a binary operation. The result is computed in the destination if
+ * it is a register (leaq and the three operand imul can use other
+ * registers for the operands), otherwise in %r10.
+ * @param hl_ins the instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_binary(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    auto hl_opcode = HighLevelOpcode(hl_ins->get_opcode());
+    int size = highlevel_opcode_get_source_operand_size(hl_opcode);
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, size);
+    Operand temp(select_mreg_kind(size), MREG_R10);
+    bool commutative = (rule.flags & LOWER_COMMUTATIVE) != 0;
+
+    // The operands are translated in the order they are used, since a
+    // memory reference may need %r11 for its address. Only one of them
+    // can if they are all used by the same instruction.
+    Operand dest_operand;
+    if (!is_in_memory(hl_ins->get_operand(0)))
+        dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    if (is_mreg(dest_operand) && !(hl_ins->get_operand(1).is_memref() && hl_ins->get_operand(2).is_memref())) {
+        Operand src_operand = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+        Operand src_second_operand = get_ll_operand(hl_ins->get_operand(2), size, ll_iseq);
+        if (commutative && src_operand.is_imm_ival())
+            std::swap(src_operand, src_second_operand);
+
+        if (hl_opcode == HINS_add_q && is_mreg(src_operand) && !is_same_mreg(src_operand, dest_operand)
+            && (is_mreg(src_second_operand) || src_second_operand.is_imm_ival())) {
+            Operand address = src_second_operand.is_imm_ival()
+                    ? Operand(Operand::MREG64_MEM_OFF, src_operand.get_base_reg(), src_second_operand.get_imm_ival())
+                    : Operand(Operand::MREG64_MEM_IDX, src_operand.get_base_reg(), long(src_second_operand.get_base_reg()));
+            ll_iseq->append(new Instruction(MINS_LEAQ, address, dest_operand));
+            return;
+        }
+        if (match_hl(HINS_mul_b, hl_opcode) && src_second_operand.is_imm_ival() && !src_operand.is_imm_ival()) {
+            ll_iseq->append(new Instruction(rule.ll_opcode, src_second_operand, src_operand, dest_operand));
+            return;
+        }
+        if (commutative && is_same_mreg(src_second_operand, dest_operand)) {
+            ll_iseq->append(new Instruction(rule.ll_opcode, src_operand, dest_operand));
+            return;
+        }
+        // Writing the destination first must not change the second operand
+        if (!uses_mreg(src_second_operand, dest_operand.get_base_reg())) {
+            if (!is_same_mreg(src_operand, dest_operand))
+                ll_iseq->append(new Instruction(mov_opcode, src_operand, dest_operand));
+            ll_iseq->append(new Instruction(rule.ll_opcode, src_second_operand, dest_operand));
+            return;
+        }
+        ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
+        ll_iseq->append(new Instruction(rule.ll_opcode, src_second_operand, temp));
+        ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
         return;
     }
 
-    // mov
-    if (match_hl(HINS_mov_b, hl_opcode)) {
+    // Move one into the other, then add using r10 as a temp variable
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
+    Operand src_second_operand = get_ll_operand(hl_ins->get_operand(2), size, ll_iseq);
+    ll_iseq->append(new Instruction(rule.ll_opcode, src_second_operand, temp));
+    dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
+}
 
-        LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, src_size);
+/**
+ * Lower a shift. A shift count which isn't constant has to be in %cl,
+ * so %rcx is saved on the stack while it holds the count.
+ * @param hl_ins the lshift or rshift instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_shift(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, size);
+    Operand temp(select_mreg_kind(size), MREG_R10);
+
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+    const Operand &count = hl_ins->get_operand(2);
+    if (count.is_imm_ival()) {
+        // The processor only uses the low 5 (6 for 64 bit shifts) bits
+        Operand count_operand(Operand::IMM_IVAL, count.get_imm_ival() & (size == 8 ? 63 : 31));
+        Operand dest_operand;
+        if (!is_in_memory(hl_ins->get_operand(0)))
+            dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+        if (is_mreg(dest_operand)) {
+            if (!is_same_mreg(src_operand, dest_operand))
+                ll_iseq->append(new Instruction(mov_opcode, src_operand, dest_operand));
+            ll_iseq->append(new Instruction(rule.ll_opcode, count_operand, dest_operand));
+            return;
+        }
+        ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
+        ll_iseq->append(new Instruction(rule.ll_opcode, count_operand, temp));
+        dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+        ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
+        return;
+    }
+
+    Operand rcx(Operand::MREG64, MREG_RCX);
+    Operand count_reg(select_mreg_kind(size), MREG_RCX);
+    ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
+    Operand count_operand = get_ll_operand(count, size, ll_iseq);
+    ll_iseq->append(new Instruction(MINS_PUSHQ, rcx));
+    if (!is_same_mreg(count_operand, count_reg))
+        ll_iseq->append(new Instruction(mov_opcode, count_operand, count_reg));
+    ll_iseq->append(new Instruction(rule.ll_opcode, Operand(Operand::MREG8, MREG_RCX), temp));
+    ll_iseq->append(new Instruction(MINS_POPQ, rcx));
+    Operand dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
+}
 
+/**
+ * Lower a unary operation (negation, complement, increment or decrement)
+ * @param hl_ins the instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_unary(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, size);
+    Operand temp(select_mreg_kind(size), MREG_R10);
+
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+    Operand dest_operand;
+    if (!is_in_memory(hl_ins->get_operand(0)))
+        dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    if (is_mreg(dest_operand)) {
+        if (!is_same_mreg(src_operand, dest_operand))
+            ll_iseq->append(new Instruction(mov_opcode, src_operand, dest_operand));
+        ll_iseq->append(new Instruction(rule.ll_opcode, dest_operand));
+        return;
+    }
+    ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
+    ll_iseq->append(new Instruction(rule.ll_opcode, temp));
+    dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
+}
 
-        if (src_operand.is_memref() && dest_operand.is_memref()) {
-            // move source operand into a temporary register
-            Operand::Kind mreg_kind = select_mreg_kind(src_size);
-            Operand r10(mreg_kind, MREG_R10);
-            ll_iseq->append(new Instruction(mov_opcode, src_operand, r10));
-            src_operand = r10;
+/**
+ * Lower a byte or word operation with the 32 bit instruction of its rule,
+ * whose result has the same low bits, so that only whole 32 bit registers
+ * are written. The operands are used in their 32 bit registers, or zero
+ * extended when they are loaded from memory (the value shifted by a right
+ * shift is sign or zero extended, since the bits above it are shifted
+ * into it). The result is computed in the destination if it and the
+ * operands are registers, otherwise in %r10, and it is only truncated
+ * when it is stored in memory.
+ * @param hl_ins the binary, shift or unary instruction
+ * @param rule the lowering rule (with the widen flag)
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_widened(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+    bool is_unary = rule.tmpl == LOWER_UNARY;
+    Operand hl_dest = hl_ins->get_operand(0);
+    Operand hl_first = hl_ins->get_operand(1);
+    Operand hl_second = is_unary ? Operand() : hl_ins->get_operand(2);
+    if ((rule.flags & LOWER_COMMUTATIVE) && (hl_first.is_imm_ival()
+        || (hl_second.get_kind() == Operand::VREG && hl_dest.get_kind() == Operand::VREG
+            && hl_second.get_base_reg() == hl_dest.get_base_reg())))
+        std::swap(hl_first, hl_second);
+    bool variable_count = rule.tmpl == LOWER_SHIFT && !hl_second.is_imm_ival();
+
+    LowLevelOpcode load = get_widening_load(size);
+    bool extend = rule.ll_opcode == MINS_SARL || rule.ll_opcode == MINS_SHRL;
+    if (rule.ll_opcode == MINS_SARL)
+        load = size == 1 ? MINS_MOVSBL : MINS_MOVSWL;
+
+    // Put the (extended) first operand in the 32 bit register computing
+    // the result
+    auto load_first = [&](const Operand &first, const Operand &result) {
+        if (first.is_imm_ival()) {
+            int shift = 64 - 8 * size;
+            long value = first.get_imm_ival();
+            if (extend)
+                value = rule.ll_opcode == MINS_SARL ? (value << shift) >> shift : long((unsigned long) value << shift >> shift);
+            ll_iseq->append(new Instruction(MINS_MOVL, Operand(Operand::IMM_IVAL, value), result));
+        } else if (first.is_memref() || extend) {
+            ll_iseq->append(new Instruction(load, first, result));
+        } else if (first.get_base_reg() != result.get_base_reg()) {
+            ll_iseq->append(new Instruction(MINS_MOVL, widen_mreg(first), result));
         }
+    };
+    auto count_operand = [&](const Operand &count) {
+        return rule.tmpl == LOWER_SHIFT ? Operand(Operand::IMM_IVAL, count.get_imm_ival() & 31) : count;
+    };
 
-        ll_iseq->append(new Instruction(mov_opcode, src_operand, dest_operand));
+    Operand dest_operand;
+    if (!is_in_memory(hl_dest))
+        dest_operand = get_ll_operand(hl_dest, 4, ll_iseq);
+    if (is_mreg(dest_operand) && !is_in_memory(hl_first) && (is_unary || !is_in_memory(hl_second)) && !variable_count) {
+        Operand first = get_ll_operand(hl_first, size, ll_iseq);
+        Operand second = is_unary ? Operand() : get_ll_operand(hl_second, size, ll_iseq);
+        if (rule.ll_opcode == MINS_IMULL && second.is_imm_ival() && !first.is_imm_ival()) {
+            ll_iseq->append(new Instruction(MINS_IMULL, second, widen_mreg(first), dest_operand));
+            return;
+        }
+        // Writing the destination first must not change the second operand
+        Operand result = dest_operand;
+        if (!is_unary && uses_mreg(second, dest_operand.get_base_reg()))
+            result = Operand(Operand::MREG32, MREG_R10);
+        load_first(first, result);
+        if (is_unary)
+            ll_iseq->append(new Instruction(rule.ll_opcode, result));
+        else
+            ll_iseq->append(new Instruction(rule.ll_opcode, second.is_imm_ival() ? count_operand(second) : widen_mreg(second), result));
+        if (!is_same_mreg(result, dest_operand))
+            ll_iseq->append(new Instruction(MINS_MOVL, result, dest_operand));
         return;
     }
 
-    // cjmp
-    if (hl_opcode == HINS_cjmp_t || hl_opcode == HINS_cjmp_f) {
-        // The source of a HINS_cjmp does not have a size so we make it L
-        ll_iseq->append(new Instruction(MINS_CMPL, Operand(Operand::IMM_IVAL, 0), dest_operand));
+    Operand temp(Operand::MREG32, MREG_R10);
+    load_first(get_ll_operand(hl_first, size, ll_iseq), temp);
+    if (is_unary) {
+        ll_iseq->append(new Instruction(rule.ll_opcode, temp));
+    } else if (variable_count) {
+        // The count has to be in %cl
+        Operand rcx(Operand::MREG64, MREG_RCX);
+        Operand count = get_ll_operand(hl_second, size, ll_iseq);
+        ll_iseq->append(new Instruction(MINS_PUSHQ, rcx));
+        ll_iseq->append(new Instruction(get_widening_load(size), count, Operand(Operand::MREG32, MREG_RCX)));
+        ll_iseq->append(new Instruction(rule.ll_opcode, Operand(Operand::MREG8, MREG_RCX), temp));
+        ll_iseq->append(new Instruction(MINS_POPQ, rcx));
+    } else {
+        Operand second = get_ll_operand(hl_second, size, ll_iseq);
+        if (second.is_memref()) {
+            Operand r11(Operand::MREG32, MREG_R11);
+            ll_iseq->append(new Instruction(get_widening_load(size), second, r11));
+            second = r11;
+        } else if (is_mreg(second)) {
+            second = widen_mreg(second);
+        } else {
+            second = count_operand(second);
+        }
+        ll_iseq->append(new Instruction(rule.ll_opcode, second, temp));
+    }
+    dest_operand = get_ll_operand(hl_dest, size, ll_iseq);
+    if (is_mreg(dest_operand))
+        ll_iseq->append(new Instruction(MINS_MOVL, temp, widen_mreg(dest_operand)));
+    else
+        ll_iseq->append(new Instruction(select_ll_opcode(MINS_MOVB, size), Operand(select_mreg_kind(size), MREG_R10), dest_operand));
+}
 
-        if (hl_opcode == HINS_cjmp_t) {
-            ll_iseq->append(new Instruction(MINS_JNE, src_operand));
+/**
+ * Lower a division or remainder. A division by a nonzero constant is done
+ * without a divide instruction (see lower_constant_division). Otherwise
+ * idiv/div divides %rdx:%rax, so the dividend is sign extended with
+ * cdq/cqto (or zero extended), and %rax and %rdx are saved on the stack
+ * since they might hold other vregs.
+ * @param hl_ins the div, mod, udiv or umod instruction
+ * @param rule the lowering rule
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_divide(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+    bool is_unsigned = (rule.flags & LOWER_UNSIGNED) != 0;
+    if (hl_ins->get_operand(2).is_imm_ival()) {
+        // the divisor as a value of the operand size
+        long divisor = hl_ins->get_operand(2).get_imm_ival();
+        if (size == 4)
+            divisor = is_unsigned ? long((unsigned int) divisor) : long(int(divisor));
+        if (divisor != 0) {
+            lower_constant_division(hl_ins, divisor, size, is_unsigned, (rule.flags & LOWER_REMAINDER) != 0, ll_iseq);
             return;
         }
-        ll_iseq->append(new Instruction(MINS_JE, src_operand));
-        return;
     }
 
-    // localaddr
-    if (hl_opcode == HINS_localaddr) {
-        // Always take 64 bit size as per spec
-        src_operand = get_ll_operand(hl_ins->get_operand(1), 8, ll_iseq);
-        dest_operand = get_ll_operand(hl_ins->get_operand(0), 8, ll_iseq);
-        Operand temp(select_mreg_kind(8), MREG_R10);
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, size);
+    Operand dividend(select_mreg_kind(size), MREG_R10);
+    Operand divisor(select_mreg_kind(size), MREG_R11);
+    Operand rax(Operand::MREG64, MREG_RAX);
+    Operand rdx(Operand::MREG64, MREG_RDX);
+
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, src_operand, dividend));
+    Operand src_second_operand = get_ll_operand(hl_ins->get_operand(2), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, src_second_operand, divisor));
+
+    ll_iseq->append(new Instruction(MINS_PUSHQ, rax));
+    ll_iseq->append(new Instruction(MINS_PUSHQ, rdx));
+    ll_iseq->append(new Instruction(mov_opcode, dividend, Operand(select_mreg_kind(size), MREG_RAX)));
+    if (is_unsigned) {
+        Operand edx(Operand::MREG32, MREG_RDX);
+        ll_iseq->append(new Instruction(MINS_XORL, edx, edx));
+    } else {
+        ll_iseq->append(new Instruction(size == 8 ? MINS_CQTO : MINS_CDQ));
+    }
+    ll_iseq->append(new Instruction(rule.ll_opcode, divisor));
+    MachineReg result = (rule.flags & LOWER_REMAINDER) ? MREG_RDX : MREG_RAX;
+    ll_iseq->append(new Instruction(mov_opcode, Operand(select_mreg_kind(size), result), dividend));
+    ll_iseq->append(new Instruction(MINS_POPQ, rdx));
+    ll_iseq->append(new Instruction(MINS_POPQ, rax));
+
+    Operand dest_operand = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    ll_iseq->append(new Instruction(mov_opcode, dividend, dest_operand));
+}
 
-        // Get the actual offset, not the offset that hl gen passes in
-        Operand memory_ref(Operand::MREG64_MEM_OFF, MREG_RBP, -1*(m_total_memory_storage - src_operand.get_imm_ival()));
+/**
+ * Lower a division or remainder by a nonzero constant. A division by a
+ * power of 2 is a shift; a signed one first adds 2^k - 1 to a negative
+ * dividend, so that the quotient is rounded toward 0. Other divisors
+ * multiply the dividend by a "magic number" approximating 2^n / divisor
+ * and keep the high half of the product (Granlund and Montgomery). The
+ * remainder is the dividend minus the quotient times the divisor.
+ * @param hl_ins the div, mod, udiv or umod instruction
+ * @param divisor the divisor (of the operand size, zero extended if unsigned)
+ * @param size the operand size (4 or 8)
+ * @param is_unsigned whether the division is unsigned
+ * @param remainder whether the result is the remainder
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_constant_division(Instruction *hl_ins, long divisor, int size, bool is_unsigned, bool remainder,
+                                              const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int bits = 8 * size;
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, size);
+    Operand::Kind kind = select_mreg_kind(size);
+    // the dividend, and in the end the result
+    Operand value(kind, MREG_R10);
+    Operand temp(kind, MREG_R11);
+    auto imm = [size](long n) { return Operand(Operand::IMM_IVAL, size == 4 ? long(int(n)) : n); };
+    auto append = [&ll_iseq](LowLevelOpcode opcode, const Operand &src, const Operand &dest) {
+        ll_iseq->append(new Instruction(opcode, src, dest));
+    };
+    // keep (or clear) the low k bits of a register: with an and if the
+    // mask fits in an immediate, otherwise with two shifts
+    auto mask_bits = [&](const Operand &reg, int k, bool keep) {
+        if (k < 32) {
+            append(select_ll_opcode(MINS_ANDB, size), imm(keep ? (1L << k) - 1 : -(1L << k)), reg);
+        } else if (keep) {
+            append(select_ll_opcode(MINS_SALB, size), imm(bits - k), reg);
+            append(select_ll_opcode(MINS_SHRB, size), imm(bits - k), reg);
+        } else {
+            append(select_ll_opcode(MINS_SHRB, size), imm(k), reg);
+            append(select_ll_opcode(MINS_SALB, size), imm(k), reg);
+        }
+    };
 
-        // Do the thing
-        ll_iseq->append(new Instruction(MINS_LEAQ, memory_ref, temp));
-        ll_iseq->append(new Instruction(MINS_MOVQ, temp, dest_operand));
-        return;
+    append(mov_opcode, get_ll_operand(hl_ins->get_operand(1), size, ll_iseq), value);
+
+    unsigned long magnitude = (is_unsigned || divisor > 0) ? (unsigned long) divisor : -(unsigned long) divisor;
+    if (magnitude == 1) {
+        if (remainder)
+            append(mov_opcode, imm(0), value);
+        else if (divisor < 0)
+            ll_iseq->append(new Instruction(select_ll_opcode(MINS_NEGB, size), value));
+    } else if ((magnitude & (magnitude - 1)) == 0) {
+        int k = __builtin_ctzl(magnitude);
+        if (is_unsigned) {
+            if (remainder)
+                mask_bits(value, k, true);
+            else
+                append(select_ll_opcode(MINS_SHRB, size), imm(k), value);
+        } else {
+            // temp = dividend + (2^k - 1 if it is negative)
+            append(mov_opcode, value, temp);
+            if (k > 1)
+                append(select_ll_opcode(MINS_SARB, size), imm(bits - 1), temp);
+            append(select_ll_opcode(MINS_SHRB, size), imm(bits - k), temp);
+            append(select_ll_opcode(MINS_ADDB, size), value, temp);
+            if (remainder) {
+                mask_bits(temp, k, false);
+                append(select_ll_opcode(MINS_SUBB, size), temp, value);
+            } else {
+                append(select_ll_opcode(MINS_SARB, size), imm(k), temp);
+                if (divisor < 0)
+                    ll_iseq->append(new Instruction(select_ll_opcode(MINS_NEGB, size), temp));
+                append(mov_opcode, temp, value);
+            }
+        }
+    } else {
+        // the high half of the product is in %rdx
+        Operand rax(Operand::MREG64, MREG_RAX);
+        Operand rdx(Operand::MREG64, MREG_RDX);
+        Operand low(kind, MREG_RAX);
+        Operand high(kind, MREG_RDX);
+        ll_iseq->append(new Instruction(MINS_PUSHQ, rax));
+        ll_iseq->append(new Instruction(MINS_PUSHQ, rdx));
+        int shift;
+        if (is_unsigned) {
+            unsigned long multiplier;
+            bool add;
+            get_unsigned_magic((unsigned long) divisor, bits, multiplier, shift, add);
+            append(mov_opcode, imm(long(multiplier)), low);
+            ll_iseq->append(new Instruction(size == 8 ? MINS_MULQ : MINS_MULL, value));
+            if (add) {
+                // quotient = (((dividend - high) >> 1) + high) >> (shift - 1)
+                append(mov_opcode, value, low);
+                append(select_ll_opcode(MINS_SUBB, size), high, low);
+                append(select_ll_opcode(MINS_SHRB, size), imm(1), low);
+                append(select_ll_opcode(MINS_ADDB, size), low, high);
+                shift--;
+            }
+            if (shift > 0)
+                append(select_ll_opcode(MINS_SHRB, size), imm(shift), high);
+        } else {
+            long multiplier;
+            get_signed_magic(divisor, bits, multiplier, shift);
+            append(mov_opcode, imm(multiplier), low);
+            ll_iseq->append(new Instruction(size == 8 ? MINS_IMULQ : MINS_IMULL, value));
+            if (divisor > 0 && multiplier < 0)
+                append(select_ll_opcode(MINS_ADDB, size), value, high);
+            else if (divisor < 0 && multiplier > 0)
+                append(select_ll_opcode(MINS_SUBB, size), value, high);
+            if (shift > 0)
+                append(select_ll_opcode(MINS_SARB, size), imm(shift), high);
+            // add 1 to a negative quotient, to round it toward 0
+            append(mov_opcode, high, low);
+            append(select_ll_opcode(MINS_SHRB, size), imm(bits - 1), low);
+            append(select_ll_opcode(MINS_ADDB, size), low, high);
+        }
+        if (remainder) {
+            if (size == 4 || (divisor >= INT32_MIN && divisor <= INT32_MAX)) {
+                ll_iseq->append(new Instruction(size == 8 ? MINS_IMULQ : MINS_IMULL, imm(divisor), high, high));
+            } else {
+                append(mov_opcode, imm(divisor), low);
+                append(size == 8 ? MINS_IMULQ : MINS_IMULL, low, high);
+            }
+            append(select_ll_opcode(MINS_SUBB, size), high, value);
+        } else {
+            append(mov_opcode, high, value);
+        }
+        ll_iseq->append(new Instruction(MINS_POPQ, rdx));
+        ll_iseq->append(new Instruction(MINS_POPQ, rax));
     }
 
-    // 3 OPERAND
-    int src_second_size = highlevel_opcode_get_source_operand_size(hl_opcode);
-    Operand src_second_operand = get_ll_operand(hl_ins->get_operand(2), src_second_size, ll_iseq);
-    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, src_second_size);
-    Operand temp(select_mreg_kind(src_second_size), MREG_R10);
+    append(mov_opcode, value, get_ll_operand(hl_ins->get_operand(0), size, ll_iseq));
+}
 
-    // math
-    if (match_hl(HINS_add_b, hl_opcode) || match_hl(HINS_sub_b, hl_opcode)
-        || match_hl(HINS_mul_b, hl_opcode) || match_hl(HINS_mod_b, hl_opcode)  ) {
+/**
+ * Lower a comparison (or a logical not, which compares with 0), setting
+ * the destination to 1 if the condition holds and 0 otherwise
+ * @param hl_ins the instruction
+ * @param rule the lowering rule (the setcc instruction)
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_compare(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    auto hl_opcode = HighLevelOpcode(hl_ins->get_opcode());
+    int src_size = highlevel_opcode_get_source_operand_size(hl_opcode);
+    int dest_size = highlevel_opcode_get_dest_operand_size(hl_opcode);
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, src_size);
+    Operand temp(select_mreg_kind(src_size), MREG_R10);
 
-        // Move one into the other, then add using r10 as a temp variable
+    // compare the two: the first operand can't be an immediate, and
+    // only one of them can be in memory
+    bool has_second = hl_ins->get_num_operands() > 2;
+    Operand src_operand = get_ll_operand(hl_ins->get_operand(1), src_size, ll_iseq);
+    if (src_operand.is_imm_ival() || (src_operand.is_memref() && has_second && is_in_memory(hl_ins->get_operand(2)))) {
         ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
-        ll_iseq->append(new Instruction(HL_TO_LL.at(hl_opcode), src_second_operand, temp));
-        ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
-        return;
+        src_operand = temp;
+    }
+    Operand src_second_operand = has_second
+            ? get_ll_operand(hl_ins->get_operand(2), src_size, ll_iseq)
+            : Operand(Operand::IMM_IVAL, 0);
+    ll_iseq->append(new Instruction(select_ll_opcode(MINS_CMPB, src_size), src_second_operand, src_operand));
+    // (setcc and the moves below leave the flags unchanged, so a select
+    // of the result can use them)
+    const Operand &hl_dest = hl_ins->get_operand(0);
+    if (hl_dest.get_kind() == Operand::VREG) {
+        m_flags_vreg = hl_dest.get_base_reg();
+        m_flags_cmov = setcc_to_cmov(rule.ll_opcode);
     }
 
-    // div
-    if (match_hl(HINS_div_b, hl_opcode)) {
+    // Set appropriate flag, directly in the destination if it is
+    // a register
+    Operand dest_operand = get_ll_operand(hl_ins->get_operand(0), dest_size, ll_iseq);
+    MachineReg flag_mreg = is_mreg(dest_operand) ? MachineReg(dest_operand.get_base_reg()) : MREG_R10;
+    Operand lowest(Operand::MREG8, flag_mreg);
+    ll_iseq->append(new Instruction(rule.ll_opcode, lowest));
 
-        // Move one into the other, then add using r10 as a temp variable
-        ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
-        if (hl_opcode == HINS_div_q) {
-            ll_iseq->append(new Instruction(MINS_IDIVQ, src_second_operand, temp));
+    if (dest_size == 1 && !is_mreg(dest_operand)) {
+        ll_iseq->append(new Instruction(MINS_MOVB, lowest, dest_operand));
+        return;
+    }
+    // A byte or word result is zero extended to 32 bits, like other
+    // narrow values in registers
+    Operand extended(select_mreg_kind(std::max(dest_size, 4)), flag_mreg);
+    ll_iseq->append(new Instruction(dest_size == 8 ? MINS_MOVZBQ : MINS_MOVZBL, lowest, extended));
+    if (!is_mreg(dest_operand))
+        ll_iseq->append(new Instruction(select_ll_opcode(MINS_MOVB, dest_size), Operand(select_mreg_kind(dest_size), flag_mreg), dest_operand));
+}
 
-        } else {
-            ll_iseq->append(new Instruction(MINS_IDIVL, src_second_operand, temp));
+/**
+ * Lower a compare-and-branch to a compare and a conditional jump
+ * @param hl_ins the compare-and-branch instruction
+ * @param rule the lowering rule (the conditional jump)
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_branch(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+
+    // the first operand can't be an immediate, and only one of them can
+    // be in memory
+    Operand left = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
+    if (left.is_imm_ival() || (left.is_memref() && is_in_memory(hl_ins->get_operand(1)))) {
+        Operand temp(select_mreg_kind(size), MREG_R10);
+        ll_iseq->append(new Instruction(select_ll_opcode(MINS_MOVB, size), left, temp));
+        left = temp;
+    }
+    Operand right = get_ll_operand(hl_ins->get_operand(1), size, ll_iseq);
+    ll_iseq->append(new Instruction(select_ll_opcode(MINS_CMPB, size), right, left));
+    ll_iseq->append(new Instruction(rule.ll_opcode, hl_ins->get_operand(2)));
+}
 
-        }
-        ll_iseq->append(new Instruction(mov_opcode, temp, dest_operand));
+/**
+ * Lower a select to a conditional move. If the condition is the result of
+ * the comparison just before, the flags still hold that comparison, and
+ * the conditional move tests them directly.
+ * @param hl_ins the sel instruction
+ * @param rule the lowering rule (the conditional move if the condition
+ *             is nonzero)
+ * @param flags_vreg the vreg whose comparison the flags hold, or -1
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_select(Instruction *hl_ins, const LoweringRule &rule, int flags_vreg,
+                                   const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    int size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(hl_ins->get_opcode()));
+    LowLevelOpcode mov_opcode = select_ll_opcode(MINS_MOVB, size);
+    Operand r10(select_mreg_kind(size), MREG_R10);
+    const Operand &condition = hl_ins->get_operand(1);
+
+    if (condition.is_imm_ival()) {
+        // a known condition selects one of the values
+        Operand value = get_ll_operand(hl_ins->get_operand(condition.get_imm_ival() != 0 ? 2 : 3), size, ll_iseq);
+        ll_iseq->append(new Instruction(mov_opcode, value, r10));
+        ll_iseq->append(new Instruction(mov_opcode, r10, get_ll_operand(hl_ins->get_operand(0), size, ll_iseq)));
         return;
     }
 
+    bool use_flags = condition.get_kind() == Operand::VREG && condition.get_base_reg() == flags_vreg;
+    LowLevelOpcode cmov = use_flags ? m_flags_cmov : rule.ll_opcode;
+    Operand ll_condition;
+    int condition_size = 4;
+    if (!use_flags) {
+        // like the condition of a HINS_cjmp, compare it with the size
+        // it was computed with
+        if (condition.get_kind() == Operand::VREG && m_vreg_sizes.count(condition.get_base_reg()) > 0)
+            condition_size = m_vreg_sizes.at(condition.get_base_reg());
+        ll_condition = get_ll_operand(condition, condition_size, ll_iseq);
+    }
 
-    // cmp
-    if (match_hl(HINS_cmplt_b, hl_opcode)|| match_hl(HINS_cmplte_b, hl_opcode)
-        || match_hl(HINS_cmpgt_b, hl_opcode) || match_hl(HINS_cmpgte_b, hl_opcode)
-        || match_hl(HINS_cmpeq_b, hl_opcode) || match_hl(HINS_cmpneq_b, hl_opcode)) {
-
-        // compare the two
-        LowLevelOpcode compare = select_ll_opcode(MINS_CMPB, src_second_size);
-        ll_iseq->append(new Instruction(mov_opcode, src_operand, temp));
-        ll_iseq->append(new Instruction(compare, src_second_operand, temp));
+    Operand if_true = get_ll_operand(hl_ins->get_operand(2), size, ll_iseq);
+    Operand if_false = get_ll_operand(hl_ins->get_operand(3), size, ll_iseq);
+    Operand dest = get_ll_operand(hl_ins->get_operand(0), size, ll_iseq);
 
-        // Set appropriate flag
-        Operand lowest(Operand::MREG8, MREG_R10);
-        ll_iseq->append(new Instruction(HL_TO_LL.at(hl_opcode), lowest));
+    // if the destination already holds the value selected when the
+    // condition is true, the other one is moved on the opposite condition
+    if (is_mreg(dest) && is_same_mreg(if_true, dest)) {
+        std::swap(if_true, if_false);
+        cmov = invert_cmov(cmov);
+    }
 
-        if (dest_size == 1) {
-            ll_iseq->append(new Instruction(mov_opcode, lowest, dest_operand));
-        } else {
-            Operand temp_2(select_mreg_kind(dest_size), MREG_R11);
-            LowLevelOpcode movz;
-            switch (dest_size) {
-                case 2:
-                    movz = MINS_MOVZBW;
-                    break;
-                case 4:
-                    movz = MINS_MOVZBL;
-                    break;
-                case 8:
-                    movz = MINS_MOVZBQ;
-                    break;
-                default:
-                    RuntimeError::raise("Invalid size passed in");
-            }
-            ll_iseq->append(new Instruction(movz, lowest, temp_2));
-            ll_iseq->append(new Instruction(mov_opcode, temp_2, dest_operand));
-        }
-        return;
+    // a conditional move can't move an immediate
+    if (if_true.is_imm_ival()) {
+        Operand r11(select_mreg_kind(size), MREG_R11);
+        ll_iseq->append(new Instruction(mov_opcode, if_true, r11));
+        if_true = r11;
     }
 
+    // the value is selected in the destination register, unless the
+    // destination is in memory, or is needed to compare or as the
+    // moved value
+    Operand result = dest;
+    if (!is_mreg(dest) || uses_mreg(if_true, dest.get_base_reg())
+        || (!use_flags && uses_mreg(ll_condition, dest.get_base_reg())))
+        result = r10;
+
+    if (!is_same_mreg(if_false, result))
+        ll_iseq->append(new Instruction(mov_opcode, if_false, result));
+    if (!use_flags)
+        ll_iseq->append(new Instruction(select_ll_opcode(MINS_CMPB, condition_size), Operand(Operand::IMM_IVAL, 0), ll_condition));
+    ll_iseq->append(new Instruction(cmov, if_true, result));
+    if (!is_same_mreg(result, dest))
+        ll_iseq->append(new Instruction(mov_opcode, result, dest));
+}
 
+/**
+ * Lower a bit test and branch: test the bit of the mask selected by the
+ * index, and jump if it is set
+ * @param hl_ins the cjmpbit instruction
+ * @param rule the lowering rule (the bit test instruction)
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_bittest(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    // bt with a memory operand addresses a bit string, not just the
+    // quadword, so the mask has to be in a register
+    Operand mask = get_ll_operand(hl_ins->get_operand(0), 8, ll_iseq);
+    if (!is_mreg(mask)) {
+        Operand temp(Operand::MREG64, MREG_R10);
+        ll_iseq->append(new Instruction(MINS_MOVQ, mask, temp));
+        mask = temp;
+    }
+    Operand bit = get_ll_operand(hl_ins->get_operand(1), 8, ll_iseq);
+    if (bit.is_memref()) {
+        Operand temp(Operand::MREG64, MREG_R11);
+        ll_iseq->append(new Instruction(MINS_MOVQ, bit, temp));
+        bit = temp;
+    }
+    ll_iseq->append(new Instruction(rule.ll_opcode, bit, mask));
+    // the tested bit is copied to the carry flag
+    ll_iseq->append(new Instruction(MINS_JB, hl_ins->get_operand(2)));
+}
 
-    RuntimeError::raise("high level opcode %d not handled", int(hl_opcode));
+/**
+ * Lower a multi-way branch: jump indirectly through the jump table
+ * entry selected by the index
+ * @param hl_ins the jmptab instruction (which has the jump table)
+ * @param rule the lowering rule (the jump instruction)
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::lower_jumptable(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    const std::shared_ptr<const JumpTable> &table = hl_ins->get_jump_table();
+    assert(table != nullptr);
+
+    Operand index = get_ll_operand(hl_ins->get_operand(0), 8, ll_iseq);
+    if (!is_mreg(index)) {
+        Operand temp(Operand::MREG64, MREG_R10);
+        ll_iseq->append(new Instruction(MINS_MOVQ, index, temp));
+        index = temp;
+    }
+    ll_iseq->append(new Instruction(MINS_MOVQ, Operand(Operand::IMM_LABEL, table->label), Operand(Operand::MREG64, MREG_R11)));
+    Instruction *jump = new Instruction(rule.ll_opcode, Operand(Operand::MREG64_MEM_IDX_OFF, MREG_R11, index.get_base_reg(), 0, 8));
+    jump->set_jump_table(table);
+    ll_iseq->append(jump);
 }
 
 Operand
 LowLevelCodeGen::get_ll_operand(Operand hl_operand, int size, const std::shared_ptr<InstructionSequence> &ll_iseq) {
     if (hl_operand.is_imm_ival() || hl_operand.is_imm_label() || hl_operand.is_label()) {
         return hl_operand;
-    } else if (hl_operand.get_base_reg() < 11) {
-        // VREG is actually a predefined register
-        Operand::Kind kind = select_mreg_kind(size);
-        if (hl_operand.is_memref()) {
-            kind = Operand::MREG64_MEM;
-        }
-        switch (hl_operand.get_base_reg()) {
-            case 0:
-                return {kind, MREG_RAX};
-            case 1:
-                return {kind, MREG_RDI};
-            case 2:
-                return {kind, MREG_RSI};
-            case 3:
-                return {kind, MREG_RDX};
-            case 4:
-                return {kind, MREG_RCX};
-            case 5:
-                return {kind, MREG_R8};
-            case 6:
-                return {kind, MREG_R9};
-            case 7:
-                return {kind, MREG_R12};
-            case 8:
-                return {kind, MREG_R13};
-            case 9:
-                return {kind, MREG_R14};
-            case 10:
-                return {kind, MREG_R15};
+    } else if (hl_operand.is_memref()) {
+        return get_ll_memref(hl_operand, ll_iseq);
+    }
 
+    MachineReg mreg;
+    if (get_vreg_mreg(hl_operand.get_base_reg(), mreg))
+        return {select_mreg_kind(size), mreg};
+    return {Operand::MREG64_MEM_OFF, MREG_RBP, get_offset(hl_operand.get_base_reg())};
+}
+
+/**
+ * Translate a high-level memory reference. Base and index vregs which are
+ * in memory are loaded into %r11; if both are, the address is computed
+ * in %r11.
+ * @param hl_operand the memory reference
+ * @param ll_iseq the low-level code being generated
+ * @return the low-level memory reference
+ */
+Operand LowLevelCodeGen::get_ll_memref(const Operand &hl_operand, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    Operand r11(Operand::MREG64, MREG_R11);
+    long disp = hl_operand.has_offset() ? hl_operand.get_offset() : 0;
+
+    MachineReg base;
+    bool base_in_mreg = get_vreg_mreg(hl_operand.get_base_reg(), base);
+    Operand base_slot(Operand::MREG64_MEM_OFF, MREG_RBP, base_in_mreg ? 0 : get_offset(hl_operand.get_base_reg()));
+
+    if (!hl_operand.has_index_reg()) {
+        if (!base_in_mreg) {
+            ll_iseq->append(new Instruction(MINS_MOVQ, base_slot, r11));
+            base = MREG_R11;
         }
-    } else {
-        Operand ll = Operand(Operand::MREG64_MEM_OFF, MREG_RBP, get_offset(hl_operand.get_base_reg()));
-        if (hl_operand.is_memref()) {
-            Operand reg_op(select_mreg_kind(8), MREG_R11);
+        if (disp == 0)
+            return {Operand::MREG64_MEM, base};
+        return {Operand::MREG64_MEM_OFF, base, disp};
+    }
 
-            // always 64 bit
-            ll_iseq->append(new Instruction(MINS_MOVQ, ll, reg_op));
+    int scale = hl_operand.get_scale();
+    MachineReg index;
+    bool index_in_mreg = get_vreg_mreg(hl_operand.get_index_reg(), index);
+    if (!base_in_mreg && !index_in_mreg) {
+        // Only one scratch register is left, so compute the address in it
+        Operand index_slot(Operand::MREG64_MEM_OFF, MREG_RBP, get_offset(hl_operand.get_index_reg()));
+        ll_iseq->append(new Instruction(MINS_MOVQ, index_slot, r11));
+        if (scale != 1)
+            ll_iseq->append(new Instruction(MINS_IMULQ, Operand(Operand::IMM_IVAL, scale), r11));
+        ll_iseq->append(new Instruction(MINS_ADDQ, base_slot, r11));
+        if (disp == 0)
             return {Operand::MREG64_MEM, MREG_R11};
+        return {Operand::MREG64_MEM_OFF, MREG_R11, disp};
+    }
+    if (!base_in_mreg) {
+        ll_iseq->append(new Instruction(MINS_MOVQ, base_slot, r11));
+        base = MREG_R11;
+    } else if (!index_in_mreg) {
+        Operand index_slot(Operand::MREG64_MEM_OFF, MREG_RBP, get_offset(hl_operand.get_index_reg()));
+        ll_iseq->append(new Instruction(MINS_MOVQ, index_slot, r11));
+        index = MREG_R11;
+    }
+
+    if (scale == 1 && disp == 0)
+        return {Operand::MREG64_MEM_IDX, base, long(index)};
+    return {Operand::MREG64_MEM_IDX_OFF, base, index, disp, scale};
+}
+
+/**
+ * Check whether a high-level operand is translated to a memory reference
+ * (it is one, or it is a vreg which isn't in a machine register)
+ * @param hl_operand the operand
+ * @return true if the operand is in memory
+ */
+bool LowLevelCodeGen::is_in_memory(const Operand &hl_operand) const {
+    if (hl_operand.is_memref())
+        return true;
+    MachineReg mreg;
+    return hl_operand.get_kind() == Operand::VREG && !get_vreg_mreg(hl_operand.get_base_reg(), mreg);
+}
+
+/**
+ * Find the machine register holding a vreg's value, if it is in one
+ * @param vreg the vreg number
+ * @param mreg set to the machine register
+ * @return true if the vreg is in a machine register, false if it is in memory
+ */
+bool LowLevelCodeGen::get_vreg_mreg(int vreg, MachineReg &mreg) const {
+    if (vreg < FIRST_MEMORY_VREG) {
+        // VREG is actually a predefined register
+        mreg = RegisterAllocation::get_precolored_mreg(vreg);
+        return true;
+    }
+    auto i = m_vreg_mregs.find(vreg);
+    if (i != m_vreg_mregs.end()) {
+        // VREG was allocated to a machine register
+        mreg = i->second;
+        return true;
+    }
+    // VREG was loaded into a register by the register cache
+    for (auto j = m_cache.begin(); j != m_cache.end(); ++j) {
+        if (j->vreg == vreg) {
+            mreg = j->mreg;
+            return true;
         }
-        return ll;
     }
-    RuntimeError::raise("Low level Operand cannot be established");
+    return false;
 }
 
 
@@ -504,5 +1556,213 @@ LowLevelCodeGen::get_ll_operand(Operand hl_operand, int size, const std::shared_
  * @return the actual memory offset
  */
 long LowLevelCodeGen::get_offset(int vreg) const {
-    return -1 * (vreg_boundary - ((vreg - 11) * 8));
+    if (m_optimize || m_cache_registers)
+        return m_vreg_offsets.at(vreg);
+    return -1 * (vreg_boundary - ((vreg - FIRST_MEMORY_VREG) * 8));
+}
+
+/**
+ * Get the size of a vreg's value (and stack slot)
+ * @param vreg the vreg number
+ * @return the size in bytes: 8 if the vreg is never defined
+ */
+int LowLevelCodeGen::get_vreg_size(int vreg) const {
+    auto i = m_vreg_sizes.find(vreg);
+    return (i == m_vreg_sizes.end() || i->second <= 0) ? 8 : i->second;
+}
+
+/**
+ * Find the tail calls which can be made jumps to the callee: the stack
+ * frame is removed first, so the callee returns to this function's caller.
+ * @param hl_iseq the high-level code of the function
+ */
+void LowLevelCodeGen::find_tail_calls(const std::shared_ptr<InstructionSequence> &hl_iseq) {
+    m_tail_calls.clear();
+    TailCallElimination tail_calls(hl_iseq);
+    for (unsigned i = 0; i < hl_iseq->get_length(); i++) {
+        Instruction *hl_ins = hl_iseq->get_instruction(i);
+        if (hl_ins->get_opcode() == HINS_call && tail_calls.is_sibling_call(i)) {
+            m_tail_calls.insert(hl_ins);
+            std::cout << "/* Function '" << hl_iseq->get_funcdef_ast()->get_symbol()->get_name() << "': tail call to '"
+                      << hl_ins->get_operand(0).get_label() << "' made a jump */" << std::endl;
+        }
+    }
+}
+
+/**
+ * Find the vregs which are defined once, and only used after the definition
+ * in the same basic block. They are dead at the end of the block, so the
+ * register cache doesn't need to write them back.
+ * @param hl_iseq the high-level code of the function
+ */
+void LowLevelCodeGen::find_block_local_vregs(const std::shared_ptr<InstructionSequence> &hl_iseq) {
+    // block of each vreg's definition, number of uses, and vregs which
+    // can't be block local
+    std::map<int, int> def_block;
+    std::map<int, int> uses;
+    std::set<int> not_local;
+
+    int block = 0;
+    for (auto i = hl_iseq->cbegin(); i != hl_iseq->cend(); ++i) {
+        Instruction *hl_ins = *i;
+        if (i.has_label())
+            block++;
+
+        for (unsigned j = 0; j < hl_ins->get_num_operands(); j++) {
+            if (!HighLevel::is_use(hl_ins, j))
+                continue;
+            const Operand &operand = hl_ins->get_operand(j);
+            std::vector<int> vregs = { operand.get_base_reg() };
+            if (operand.has_index_reg())
+                vregs.push_back(operand.get_index_reg());
+            for (auto k = vregs.begin(); k != vregs.end(); ++k) {
+                auto def = def_block.find(*k);
+                if (def == def_block.end() || def->second != block)
+                    not_local.insert(*k);
+                uses[*k]++;
+            }
+        }
+
+        if (HighLevel::is_def(hl_ins)) {
+            int vreg = hl_ins->get_operand(0).get_base_reg();
+            if (def_block.count(vreg) > 0)
+                not_local.insert(vreg);
+            def_block[vreg] = block;
+        }
+
+        int hl_opcode = hl_ins->get_opcode();
+        if (HighLevel::is_jump(hl_opcode))
+            block++;
+    }
+
+    for (auto i = def_block.begin(); i != def_block.end(); ++i) {
+        if (i->first >= FIRST_MEMORY_VREG && not_local.count(i->first) == 0)
+            m_block_local_uses[i->first] = uses[i->first];
+    }
+}
+
+/**
+ * Make sure that the vregs used by a high-level instruction are in cache
+ * registers (loading them from memory if necessary), and get a register
+ * for the vreg it defines.
+ * @param hl_ins the high-level instruction about to be translated
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::cache_operands(Instruction *hl_ins, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    if (m_cache.empty()) {
+        for (auto i = std::begin(CACHE_MREGS); i != std::end(CACHE_MREGS); ++i)
+            m_cache.push_back({ *i, -1, false, false, 0 });
+    }
+    // Registers holding block local vregs with no uses left are free
+    for (auto i = m_cache.begin(); i != m_cache.end(); ++i) {
+        i->pinned = false;
+        auto uses = m_block_local_uses.find(i->vreg);
+        if (uses != m_block_local_uses.end() && uses->second == 0) {
+            i->vreg = -1;
+            i->dirty = false;
+        }
+    }
+
+    // The sources are loaded first, since the destination might be
+    // one of them
+    for (unsigned i = 0; i < hl_ins->get_num_operands(); i++) {
+        if (!HighLevel::is_use(hl_ins, i))
+            continue;
+        const Operand &operand = hl_ins->get_operand(i);
+        std::vector<int> vregs = { operand.get_base_reg() };
+        if (operand.has_index_reg())
+            vregs.push_back(operand.get_index_reg());
+        for (auto j = vregs.begin(); j != vregs.end(); ++j) {
+            if (*j < FIRST_MEMORY_VREG)
+                continue;
+            cache_vreg(*j, true, ll_iseq);
+            auto uses = m_block_local_uses.find(*j);
+            if (uses != m_block_local_uses.end())
+                uses->second--;
+        }
+    }
+
+    if (HighLevel::is_def(hl_ins)) {
+        int vreg = hl_ins->get_operand(0).get_base_reg();
+        if (vreg >= FIRST_MEMORY_VREG)
+            m_cache[cache_vreg(vreg, false, ll_iseq)].dirty = true;
+    }
+}
+
+/**
+ * Get a cache register for a vreg. If the vreg isn't cached already, the
+ * least recently used register is taken (writing back its value if it
+ * was modified).
+ * @param vreg the vreg
+ * @param load true if the vreg's value should be loaded from memory
+ * @param ll_iseq the low-level code being generated
+ * @return the index of the cache entry
+ */
+unsigned LowLevelCodeGen::cache_vreg(int vreg, bool load, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    unsigned index = m_cache.size();
+    for (unsigned i = 0; i < m_cache.size() && index == m_cache.size(); i++) {
+        if (m_cache[i].vreg == vreg)
+            index = i;
+    }
+
+    if (index == m_cache.size()) {
+        for (unsigned i = 0; i < m_cache.size() && index == m_cache.size(); i++) {
+            if (m_cache[i].vreg < 0)
+                index = i;
+        }
+        for (unsigned i = 0; i < m_cache.size(); i++) {
+            if (!m_cache[i].pinned && (index == m_cache.size() || m_cache[i].last_use < m_cache[index].last_use))
+                index = i;
+        }
+        assert(index < m_cache.size());
+
+        CacheEntry &entry = m_cache[index];
+        write_back(entry, ll_iseq);
+        entry.vreg = vreg;
+        entry.dirty = false;
+        if (load) {
+            // The slot is only as wide as the vreg's value
+            int size = get_vreg_size(vreg);
+            Operand slot(Operand::MREG64_MEM_OFF, MREG_RBP, get_offset(vreg));
+            if (size < 4)
+                ll_iseq->append(new Instruction(get_widening_load(size), slot, Operand(Operand::MREG32, entry.mreg)));
+            else
+                ll_iseq->append(new Instruction(select_ll_opcode(MINS_MOVB, size), slot, Operand(select_mreg_kind(size), entry.mreg)));
+        }
+    }
+
+    m_cache[index].pinned = true;
+    m_cache[index].last_use = ++m_cache_clock;
+    return index;
+}
+
+/**
+ * Store a cached vreg's value in its stack slot, if it was modified
+ * @param entry the cache entry
+ * @param ll_iseq the low-level code being generated
+ */
+void LowLevelCodeGen::write_back(CacheEntry &entry, const std::shared_ptr<InstructionSequence> &ll_iseq) {
+    if (entry.vreg >= 0 && entry.dirty) {
+        int size = get_vreg_size(entry.vreg);
+        Operand slot(Operand::MREG64_MEM_OFF, MREG_RBP, get_offset(entry.vreg));
+        ll_iseq->append(new Instruction(select_ll_opcode(MINS_MOVB, size), Operand(select_mreg_kind(size), entry.mreg), slot));
+    }
+    entry.dirty = false;
+}
+
+/**
+ * Write back the modified values at the end of a basic block (except
+ * for vregs which are dead there).
+ * @param ll_iseq the low-level code being generated
+ * @param invalidate true if the cached values can't be used in the next
+ *                   block (because control flow joins there)
+ */
+void LowLevelCodeGen::end_cache_block(const std::shared_ptr<InstructionSequence> &ll_iseq, bool invalidate) {
+    for (auto i = m_cache.begin(); i != m_cache.end(); ++i) {
+        if (m_block_local_uses.count(i->vreg) == 0)
+            write_back(*i, ll_iseq);
+        i->dirty = false;
+        if (invalidate)
+            i->vreg = -1;
+    }
 }
@@ -1,8 +1,14 @@
 #ifndef LOWLEVEL_CODEGEN_H
 #define LOWLEVEL_CODEGEN_H
 
+#include <map>
 #include <memory>
+#include <set>
+#include <vector>
 #include "instruction_seq.h"
+#include "lowlevel.h"
+
+struct LoweringRule;
 
 // A LowLevelCodeGen object transforms an InstructionSequence containing
 // high-level instructions into an InstructionSequence containing
@@ -12,21 +18,99 @@ private:
 
     int m_total_memory_storage;
     bool m_optimize;
+    // print how often each peephole optimization rule was applied
+    bool m_print_peephole_stats;
     int vreg_boundary;
     int next_local_vreg = 0;
+    // machine registers assigned to vregs by register allocation
+    std::map<int, MachineReg> m_vreg_mregs;
+    // callee-saved registers pushed by the prologue
+    std::vector<MachineReg> m_saved_mregs;
+    bool m_use_frame_pointer = true;
+    long m_stack_adjustment = 0;
+    // space between the saved registers and the saved %rbp, which keeps
+    // %rbp 16-byte aligned
+    long m_frame_padding = 0;
+    // positions in the translated code where the epilogue goes
+    std::vector<unsigned> m_epilogue_positions;
+    // calls which are translated to jumps to the callee after the epilogue
+    std::set<Instruction *> m_tail_calls;
+    // size in bytes of the value each vreg is defined with
+    std::map<int, int> m_vreg_sizes;
+    // offsets from %rbp of the stack slots of the vregs in memory, when
+    // slots are shared by vregs which are never live at the same time
+    std::map<int, long> m_vreg_offsets;
+    // vreg set by the comparison just translated (-1 if there is none),
+    // and the conditional move on the flags which the comparison left
+    int m_flags_vreg = -1;
+    LowLevelOpcode m_flags_cmov = MINS_NOP;
+
+    // Block-local register cache: while a basic block is translated,
+    // recently used vregs are kept in callee-saved registers, and
+    // modified values are written back to their stack slots at the
+    // end of the block
+    struct CacheEntry {
+        MachineReg mreg;
+        int vreg;       // -1 if the register is free
+        bool dirty;
+        bool pinned;    // in use by the instruction being translated
+        unsigned last_use;
+    };
+    bool m_cache_registers;
+    std::vector<CacheEntry> m_cache;
+    unsigned m_cache_clock = 0;
+    // vregs defined once and only used later in the same block (which
+    // never need to be written back), with their number of uses left
+    std::map<int, int> m_block_local_uses;
 
 public:
 
-    explicit LowLevelCodeGen(bool optimize);
+    LowLevelCodeGen(bool optimize, bool cache_registers = false, bool print_peephole_stats = false);
     virtual ~LowLevelCodeGen();
 
     std::shared_ptr<InstructionSequence> generate(const std::shared_ptr<InstructionSequence> &hl_iseq);
 
 private:
     int get_vreg_boundary () const{return vreg_boundary;}
+    std::shared_ptr<InstructionSequence> select_instructions(const std::shared_ptr<InstructionSequence> &hl_iseq);
+    std::shared_ptr<InstructionSequence> optimize_peephole(const std::shared_ptr<InstructionSequence> &ll_iseq);
     std::shared_ptr<InstructionSequence> translate_hl_to_ll(const std::shared_ptr<InstructionSequence> &hl_iseq);
     void translate_instruction(Instruction *hl_ins, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_cjmp(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_localaddr(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_move(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_convert(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_binary(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_shift(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_unary(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_widened(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_divide(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_constant_division(Instruction *hl_ins, long divisor, int size, bool is_unsigned, bool remainder,
+                                 const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_compare(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_branch(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_bittest(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_jumptable(Instruction *hl_ins, const LoweringRule &rule, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void lower_select(Instruction *hl_ins, const LoweringRule &rule, int flags_vreg,
+                      const std::shared_ptr<InstructionSequence> &ll_iseq);
     Operand get_ll_operand(Operand hl_operand, int size, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    Operand get_ll_memref(const Operand &hl_operand, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    bool get_vreg_mreg(int vreg, MachineReg &mreg) const;
+    bool is_in_memory(const Operand &hl_operand) const;
+    void allocate_registers(const std::shared_ptr<InstructionSequence> &hl_iseq);
+    void find_vreg_sizes(const std::shared_ptr<InstructionSequence> &hl_iseq);
+    int get_vreg_size(int vreg) const;
+    void assign_stack_slots(const std::shared_ptr<InstructionSequence> &hl_iseq);
+    std::shared_ptr<InstructionSequence> add_prologue_and_epilogue(const std::shared_ptr<InstructionSequence> &body);
+    void append_prologue(const std::shared_ptr<InstructionSequence> &ll_iseq) const;
+    void append_epilogue(const std::shared_ptr<InstructionSequence> &ll_iseq) const;
+
+    void find_tail_calls(const std::shared_ptr<InstructionSequence> &hl_iseq);
+    void find_block_local_vregs(const std::shared_ptr<InstructionSequence> &hl_iseq);
+    void cache_operands(Instruction *hl_ins, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    unsigned cache_vreg(int vreg, bool load, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void write_back(CacheEntry &entry, const std::shared_ptr<InstructionSequence> &ll_iseq);
+    void end_cache_block(const std::shared_ptr<InstructionSequence> &ll_iseq, bool invalidate);
 
     long get_offset(int vreg) const;
 };
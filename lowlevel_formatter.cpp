@@ -76,6 +76,11 @@ std::string LowLevelFormatter::format_operand(const Operand &operand) const {
   case Operand::MREG64_MEM_OFF:
     return std::to_string(operand.get_offset()) + "(" + format_reg(operand.get_base_reg(), QUAD) + ")";
 
+  case Operand::MREG64_MEM_IDX_OFF:
+    return (operand.get_offset() != 0 ? std::to_string(operand.get_offset()) : std::string())
+      + "(" + format_reg(operand.get_base_reg(), QUAD) + "," + format_reg(operand.get_index_reg(), QUAD)
+      + "," + std::to_string(operand.get_scale()) + ")";
+
   default:
     assert(false);
     return "<unknown operand kind>";
@@ -102,6 +107,10 @@ std::string LowLevelFormatter::format_instruction(const Instruction *ins) const
     if (i > 0) {
       buf += ", ";
     }
+    // an indirect jump (through a jump table) needs a "*"
+    if (opcode == MINS_JMP && !ins->get_operand(i).is_label()) {
+      buf += "*";
+    }
     buf += format_operand(ins->get_operand(i));
   }
 
@@ -0,0 +1,209 @@
+#ifndef LOWLEVEL_LOWERING_H
+#define LOWLEVEL_LOWERING_H
+
+#include "highlevel.h"
+#include "lowlevel.h"
+
+// Generated from x86_64.desc by gen_lowering.rb
+// Do not edit this file!
+
+// How a high-level instruction is lowered: each template is a
+// lowering function in LowLevelCodeGen
+enum LoweringTemplate {
+  LOWER_UNSUPPORTED,
+  LOWER_NOP,
+  LOWER_ENTER,
+  LOWER_LEAVE,
+  LOWER_RET,
+  LOWER_JUMP,
+  LOWER_CJMP,
+  LOWER_LOCALADDR,
+  LOWER_MOVE,
+  LOWER_CONVERT,
+  LOWER_BINARY,
+  LOWER_SHIFT,
+  LOWER_UNARY,
+  LOWER_DIVIDE,
+  LOWER_COMPARE,
+  LOWER_BRANCH,
+  LOWER_BITTEST,
+  LOWER_JUMPTABLE,
+  LOWER_SELECT,
+};
+
+// Flags modifying a template
+const int LOWER_COMMUTATIVE = 1;
+const int LOWER_REMAINDER = 2;
+const int LOWER_IMPLICIT = 4;
+const int LOWER_UNSIGNED = 8;
+const int LOWER_WIDEN = 16;
+
+struct LoweringRule {
+  LoweringTemplate tmpl;
+  LowLevelOpcode ll_opcode;
+  int flags;
+};
+
+// Lowering rule of each high-level opcode, indexed by opcode
+constexpr LoweringRule LOWERING_RULES[] = {
+  { LOWER_NOP, MINS_NOP, 0 },                      // HINS_nop
+  { LOWER_BINARY, MINS_ADDL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_add_b
+  { LOWER_BINARY, MINS_ADDL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_add_w
+  { LOWER_BINARY, MINS_ADDL, LOWER_COMMUTATIVE },  // HINS_add_l
+  { LOWER_BINARY, MINS_ADDQ, LOWER_COMMUTATIVE },  // HINS_add_q
+  { LOWER_BINARY, MINS_SUBL, LOWER_WIDEN },        // HINS_sub_b
+  { LOWER_BINARY, MINS_SUBL, LOWER_WIDEN },        // HINS_sub_w
+  { LOWER_BINARY, MINS_SUBL, 0 },                  // HINS_sub_l
+  { LOWER_BINARY, MINS_SUBQ, 0 },                  // HINS_sub_q
+  { LOWER_BINARY, MINS_IMULL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_mul_b
+  { LOWER_BINARY, MINS_IMULL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_mul_w
+  { LOWER_BINARY, MINS_IMULL, LOWER_COMMUTATIVE }, // HINS_mul_l
+  { LOWER_BINARY, MINS_IMULQ, LOWER_COMMUTATIVE }, // HINS_mul_q
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_div_b
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_div_w
+  { LOWER_DIVIDE, MINS_IDIVL, 0 },                 // HINS_div_l
+  { LOWER_DIVIDE, MINS_IDIVQ, 0 },                 // HINS_div_q
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_mod_b
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_mod_w
+  { LOWER_DIVIDE, MINS_IDIVL, LOWER_REMAINDER },   // HINS_mod_l
+  { LOWER_DIVIDE, MINS_IDIVQ, LOWER_REMAINDER },   // HINS_mod_q
+  { LOWER_SHIFT, MINS_SALL, LOWER_WIDEN },         // HINS_lshift_b
+  { LOWER_SHIFT, MINS_SALL, LOWER_WIDEN },         // HINS_lshift_w
+  { LOWER_SHIFT, MINS_SALL, 0 },                   // HINS_lshift_l
+  { LOWER_SHIFT, MINS_SALQ, 0 },                   // HINS_lshift_q
+  { LOWER_SHIFT, MINS_SARL, LOWER_WIDEN },         // HINS_rshift_b
+  { LOWER_SHIFT, MINS_SARL, LOWER_WIDEN },         // HINS_rshift_w
+  { LOWER_SHIFT, MINS_SARL, 0 },                   // HINS_rshift_l
+  { LOWER_SHIFT, MINS_SARQ, 0 },                   // HINS_rshift_q
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_udiv_b
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_udiv_w
+  { LOWER_DIVIDE, MINS_DIVL, LOWER_UNSIGNED },     // HINS_udiv_l
+  { LOWER_DIVIDE, MINS_DIVQ, LOWER_UNSIGNED },     // HINS_udiv_q
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_umod_b
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_umod_w
+  { LOWER_DIVIDE, MINS_DIVL, LOWER_REMAINDER|LOWER_UNSIGNED }, // HINS_umod_l
+  { LOWER_DIVIDE, MINS_DIVQ, LOWER_REMAINDER|LOWER_UNSIGNED }, // HINS_umod_q
+  { LOWER_SHIFT, MINS_SHRL, LOWER_WIDEN },         // HINS_urshift_b
+  { LOWER_SHIFT, MINS_SHRL, LOWER_WIDEN },         // HINS_urshift_w
+  { LOWER_SHIFT, MINS_SHRL, 0 },                   // HINS_urshift_l
+  { LOWER_SHIFT, MINS_SHRQ, 0 },                   // HINS_urshift_q
+  { LOWER_COMPARE, MINS_SETL, 0 },                 // HINS_cmplt_b
+  { LOWER_COMPARE, MINS_SETL, 0 },                 // HINS_cmplt_w
+  { LOWER_COMPARE, MINS_SETL, 0 },                 // HINS_cmplt_l
+  { LOWER_COMPARE, MINS_SETL, 0 },                 // HINS_cmplt_q
+  { LOWER_COMPARE, MINS_SETLE, 0 },                // HINS_cmplte_b
+  { LOWER_COMPARE, MINS_SETLE, 0 },                // HINS_cmplte_w
+  { LOWER_COMPARE, MINS_SETLE, 0 },                // HINS_cmplte_l
+  { LOWER_COMPARE, MINS_SETLE, 0 },                // HINS_cmplte_q
+  { LOWER_COMPARE, MINS_SETG, 0 },                 // HINS_cmpgt_b
+  { LOWER_COMPARE, MINS_SETG, 0 },                 // HINS_cmpgt_w
+  { LOWER_COMPARE, MINS_SETG, 0 },                 // HINS_cmpgt_l
+  { LOWER_COMPARE, MINS_SETG, 0 },                 // HINS_cmpgt_q
+  { LOWER_COMPARE, MINS_SETGE, 0 },                // HINS_cmpgte_b
+  { LOWER_COMPARE, MINS_SETGE, 0 },                // HINS_cmpgte_w
+  { LOWER_COMPARE, MINS_SETGE, 0 },                // HINS_cmpgte_l
+  { LOWER_COMPARE, MINS_SETGE, 0 },                // HINS_cmpgte_q
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_cmpeq_b
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_cmpeq_w
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_cmpeq_l
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_cmpeq_q
+  { LOWER_COMPARE, MINS_SETNE, 0 },                // HINS_cmpneq_b
+  { LOWER_COMPARE, MINS_SETNE, 0 },                // HINS_cmpneq_w
+  { LOWER_COMPARE, MINS_SETNE, 0 },                // HINS_cmpneq_l
+  { LOWER_COMPARE, MINS_SETNE, 0 },                // HINS_cmpneq_q
+  { LOWER_BINARY, MINS_ANDL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_and_b
+  { LOWER_BINARY, MINS_ANDL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_and_w
+  { LOWER_BINARY, MINS_ANDL, LOWER_COMMUTATIVE },  // HINS_and_l
+  { LOWER_BINARY, MINS_ANDQ, LOWER_COMMUTATIVE },  // HINS_and_q
+  { LOWER_BINARY, MINS_ORL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_or_b
+  { LOWER_BINARY, MINS_ORL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_or_w
+  { LOWER_BINARY, MINS_ORL, LOWER_COMMUTATIVE },   // HINS_or_l
+  { LOWER_BINARY, MINS_ORQ, LOWER_COMMUTATIVE },   // HINS_or_q
+  { LOWER_BINARY, MINS_XORL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_xor_b
+  { LOWER_BINARY, MINS_XORL, LOWER_COMMUTATIVE|LOWER_WIDEN }, // HINS_xor_w
+  { LOWER_BINARY, MINS_XORL, LOWER_COMMUTATIVE },  // HINS_xor_l
+  { LOWER_BINARY, MINS_XORQ, LOWER_COMMUTATIVE },  // HINS_xor_q
+  { LOWER_UNARY, MINS_NEGL, LOWER_WIDEN },         // HINS_neg_b
+  { LOWER_UNARY, MINS_NEGL, LOWER_WIDEN },         // HINS_neg_w
+  { LOWER_UNARY, MINS_NEGL, 0 },                   // HINS_neg_l
+  { LOWER_UNARY, MINS_NEGQ, 0 },                   // HINS_neg_q
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_not_b
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_not_w
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_not_l
+  { LOWER_COMPARE, MINS_SETE, 0 },                 // HINS_not_q
+  { LOWER_UNARY, MINS_NOTL, LOWER_WIDEN },         // HINS_compl_b
+  { LOWER_UNARY, MINS_NOTL, LOWER_WIDEN },         // HINS_compl_w
+  { LOWER_UNARY, MINS_NOTL, 0 },                   // HINS_compl_l
+  { LOWER_UNARY, MINS_NOTQ, 0 },                   // HINS_compl_q
+  { LOWER_UNARY, MINS_INCL, LOWER_WIDEN },         // HINS_inc_b
+  { LOWER_UNARY, MINS_INCL, LOWER_WIDEN },         // HINS_inc_w
+  { LOWER_UNARY, MINS_INCL, 0 },                   // HINS_inc_l
+  { LOWER_UNARY, MINS_INCQ, 0 },                   // HINS_inc_q
+  { LOWER_UNARY, MINS_DECL, LOWER_WIDEN },         // HINS_dec_b
+  { LOWER_UNARY, MINS_DECL, LOWER_WIDEN },         // HINS_dec_w
+  { LOWER_UNARY, MINS_DECL, 0 },                   // HINS_dec_l
+  { LOWER_UNARY, MINS_DECQ, 0 },                   // HINS_dec_q
+  { LOWER_MOVE, MINS_MOVB, 0 },                    // HINS_mov_b
+  { LOWER_MOVE, MINS_MOVW, 0 },                    // HINS_mov_w
+  { LOWER_MOVE, MINS_MOVL, 0 },                    // HINS_mov_l
+  { LOWER_MOVE, MINS_MOVQ, 0 },                    // HINS_mov_q
+  { LOWER_CONVERT, MINS_MOVSBL, 0 },               // HINS_sconv_bw
+  { LOWER_CONVERT, MINS_MOVSBL, 0 },               // HINS_sconv_bl
+  { LOWER_CONVERT, MINS_MOVSBQ, 0 },               // HINS_sconv_bq
+  { LOWER_CONVERT, MINS_MOVSWL, 0 },               // HINS_sconv_wl
+  { LOWER_CONVERT, MINS_MOVSWQ, 0 },               // HINS_sconv_wq
+  { LOWER_CONVERT, MINS_MOVSLQ, 0 },               // HINS_sconv_lq
+  { LOWER_CONVERT, MINS_MOVZBL, 0 },               // HINS_uconv_bw
+  { LOWER_CONVERT, MINS_MOVZBL, 0 },               // HINS_uconv_bl
+  { LOWER_CONVERT, MINS_MOVZBQ, 0 },               // HINS_uconv_bq
+  { LOWER_CONVERT, MINS_MOVZWL, 0 },               // HINS_uconv_wl
+  { LOWER_CONVERT, MINS_MOVZWQ, 0 },               // HINS_uconv_wq
+  { LOWER_CONVERT, MINS_MOVL, LOWER_IMPLICIT },    // HINS_uconv_lq
+  { LOWER_RET, MINS_RET, 0 },                      // HINS_ret
+  { LOWER_JUMP, MINS_JMP, 0 },                     // HINS_jmp
+  { LOWER_JUMP, MINS_CALL, 0 },                    // HINS_call
+  { LOWER_ENTER, MINS_NOP, 0 },                    // HINS_enter
+  { LOWER_LEAVE, MINS_NOP, 0 },                    // HINS_leave
+  { LOWER_LOCALADDR, MINS_LEAQ, 0 },               // HINS_localaddr
+  { LOWER_CJMP, MINS_JNE, 0 },                     // HINS_cjmp_t
+  { LOWER_CJMP, MINS_JE, 0 },                      // HINS_cjmp_f
+  { LOWER_BRANCH, MINS_JL, 0 },                    // HINS_cjmplt_b
+  { LOWER_BRANCH, MINS_JL, 0 },                    // HINS_cjmplt_w
+  { LOWER_BRANCH, MINS_JL, 0 },                    // HINS_cjmplt_l
+  { LOWER_BRANCH, MINS_JL, 0 },                    // HINS_cjmplt_q
+  { LOWER_BRANCH, MINS_JLE, 0 },                   // HINS_cjmplte_b
+  { LOWER_BRANCH, MINS_JLE, 0 },                   // HINS_cjmplte_w
+  { LOWER_BRANCH, MINS_JLE, 0 },                   // HINS_cjmplte_l
+  { LOWER_BRANCH, MINS_JLE, 0 },                   // HINS_cjmplte_q
+  { LOWER_BRANCH, MINS_JG, 0 },                    // HINS_cjmpgt_b
+  { LOWER_BRANCH, MINS_JG, 0 },                    // HINS_cjmpgt_w
+  { LOWER_BRANCH, MINS_JG, 0 },                    // HINS_cjmpgt_l
+  { LOWER_BRANCH, MINS_JG, 0 },                    // HINS_cjmpgt_q
+  { LOWER_BRANCH, MINS_JGE, 0 },                   // HINS_cjmpgte_b
+  { LOWER_BRANCH, MINS_JGE, 0 },                   // HINS_cjmpgte_w
+  { LOWER_BRANCH, MINS_JGE, 0 },                   // HINS_cjmpgte_l
+  { LOWER_BRANCH, MINS_JGE, 0 },                   // HINS_cjmpgte_q
+  { LOWER_BRANCH, MINS_JE, 0 },                    // HINS_cjmpeq_b
+  { LOWER_BRANCH, MINS_JE, 0 },                    // HINS_cjmpeq_w
+  { LOWER_BRANCH, MINS_JE, 0 },                    // HINS_cjmpeq_l
+  { LOWER_BRANCH, MINS_JE, 0 },                    // HINS_cjmpeq_q
+  { LOWER_BRANCH, MINS_JNE, 0 },                   // HINS_cjmpneq_b
+  { LOWER_BRANCH, MINS_JNE, 0 },                   // HINS_cjmpneq_w
+  { LOWER_BRANCH, MINS_JNE, 0 },                   // HINS_cjmpneq_l
+  { LOWER_BRANCH, MINS_JNE, 0 },                   // HINS_cjmpneq_q
+  { LOWER_BITTEST, MINS_BTQ, 0 },                  // HINS_cjmpbit_q
+  { LOWER_JUMPTABLE, MINS_JMP, 0 },                // HINS_jmptab
+  { LOWER_UNSUPPORTED, MINS_NOP, 0 },              // HINS_sel_b
+  { LOWER_SELECT, MINS_CMOVNE, 0 },                // HINS_sel_w
+  { LOWER_SELECT, MINS_CMOVNE, 0 },                // HINS_sel_l
+  { LOWER_SELECT, MINS_CMOVNE, 0 },                // HINS_sel_q
+};
+
+static_assert(sizeof(LOWERING_RULES) / sizeof(LOWERING_RULES[0]) == HINS_sel_q + 1,
+              "every high-level opcode needs a lowering rule");
+
+constexpr const LoweringRule &get_lowering_rule(HighLevelOpcode opcode) {
+  return LOWERING_RULES[opcode];
+}
+
+#endif // LOWLEVEL_LOWERING_H
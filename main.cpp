@@ -39,7 +39,12 @@ void usage() {
                   "  -L   print CFG of high-level code with liveness info\n"
                   "  -a   perform semantic analysis, print symbol table\n"
                   "  -h   print results of high-level code generation\n"
-                  "  -o   enable code optimization\n");
+                  "  -o   enable code optimization\n"
+                  "  -O1  only keep values in registers within basic blocks (fast)\n"
+                  "  -P   print how often each peephole optimization was applied (with -o)\n"
+                  "  -G   count how often the edges of the CFGs are taken (with -o; link\n"
+                  "       the program with profile_runtime.c to write the profile)\n"
+                  "  -U <profile>  lay out the code using an edge profile (with -o)\n");
   exit(1);
 }
 
@@ -54,7 +59,8 @@ enum class Mode {
   COMPILE,
 };
 
-void process_source_file(const std::string &filename, Mode mode, bool optimize);
+void process_source_file(const std::string &filename, Mode mode, OptimizationLevel opt_level,
+                         bool print_peephole_stats, ProfileMode profile_mode, const std::string &profile_filename);
 
 int main(int argc, char **argv) {
   if (argc < 2) {
@@ -62,7 +68,10 @@ int main(int argc, char **argv) {
   }
 
   Mode mode = Mode::COMPILE;
-  bool optimize = false;
+  OptimizationLevel opt_level = OptimizationLevel::NONE;
+  bool print_peephole_stats = false;
+  ProfileMode profile_mode = ProfileMode::NONE;
+  std::string profile_filename;
 
   int index = 1;
   while (index < argc) {
@@ -83,20 +92,30 @@ int main(int argc, char **argv) {
       mode = Mode::HIGHLEVEL_CODEGEN;
     } else if (arg == "-o") {
       // enable code optimization
-      optimize = true;
+      opt_level = OptimizationLevel::FULL;
+    } else if (arg == "-O1") {
+      // only use the block-local register cache
+      opt_level = OptimizationLevel::LOCAL_REGISTERS;
+    } else if (arg == "-P") {
+      print_peephole_stats = true;
+    } else if (arg == "-G") {
+      profile_mode = ProfileMode::GENERATE;
+    } else if (arg == "-U" && index + 1 < argc) {
+      profile_mode = ProfileMode::USE;
+      profile_filename = argv[++index];
     } else {
       break;
     }
     index++;
   }
 
-  if (index >= argc) {
+  if (index >= argc || (profile_mode != ProfileMode::NONE && opt_level != OptimizationLevel::FULL)) {
     usage();
   }
 
   const char *filename = argv[index];
   try {
-    process_source_file(filename, mode, optimize);
+    process_source_file(filename, mode, opt_level, print_peephole_stats, profile_mode, profile_filename);
   } catch (BaseException &ex) {
     const Location &loc = ex.get_loc();
     if (loc.is_valid()) {
@@ -110,8 +129,10 @@ int main(int argc, char **argv) {
   return 0;
 }
 
-void process_source_file(const std::string &filename, Mode mode, bool optimize) {
+void process_source_file(const std::string &filename, Mode mode, OptimizationLevel opt_level,
+                         bool print_peephole_stats, ProfileMode profile_mode, const std::string &profile_filename) {
   Context ctx;
+  ctx.set_profile_mode(profile_mode, profile_filename);
 
   if (mode == Mode::PRINT_TOKENS) {
     std::vector<Node *> tokens;
@@ -156,9 +177,9 @@ void process_source_file(const std::string &filename, Mode mode, bool optimize)
         }
 
         if (mode == Mode::COMPILE || mode == Mode::PRINT_LOWLEVEL_CFG)
-          ctx.lowlevel_codegen(module_collector.get(), optimize);
+          ctx.lowlevel_codegen(module_collector.get(), opt_level, print_peephole_stats);
         else
-          ctx.highlevel_codegen(module_collector.get(), optimize);
+          ctx.highlevel_codegen(module_collector.get(), opt_level == OptimizationLevel::FULL);
       }
     }
   }
@@ -5,3 +5,6 @@ ModuleCollector::ModuleCollector() {
 
 ModuleCollector::~ModuleCollector() {
 }
+
+void ModuleCollector::collect_profile_counters(const std::string &name, const std::vector<unsigned long> &values) {
+}
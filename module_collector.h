@@ -2,6 +2,7 @@
 #define MODULE_COLLECTOR_H
 
 #include <memory>
+#include <vector>
 #include "instruction_seq.h"
 #include "type.h"
 
@@ -18,6 +19,10 @@ public:
   virtual void collect_string_constant(const std::string &name, const std::string &strval) = 0;
   virtual void collect_global_var(const std::string &name, const std::shared_ptr<Type> &type) = 0;
   virtual void collect_function(const std::string &name, const std::shared_ptr<InstructionSequence> &iseq) = 0;
+
+  // The counter array of edge profiling (with its initial contents),
+  // after all of the functions: ignored by default
+  virtual void collect_profile_counters(const std::string &name, const std::vector<unsigned long> &values);
 };
 
 #endif // MODULE_COLLECTOR_H
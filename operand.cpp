@@ -40,6 +40,7 @@ namespace {
             { Operand::VREG_MEM,         { .flags = HL|MEMREF } },
             { Operand::VREG_MEM_IDX,     { .flags = HL|MEMREF|HAS_INDEX } },
             { Operand::VREG_MEM_OFF,     { .flags = HL|MEMREF|HAS_OFFSET } },
+            { Operand::VREG_MEM_IDX_OFF, { .flags = HL|MEMREF|HAS_INDEX|HAS_OFFSET } },
             { Operand::MREG8,            { .flags = LL } },
             { Operand::MREG16,           { .flags = LL } },
             { Operand::MREG32,           { .flags = LL } },
@@ -47,6 +48,7 @@ namespace {
             { Operand::MREG64_MEM,       { .flags = LL|MEMREF } },
             { Operand::MREG64_MEM_IDX,   { .flags = LL|MEMREF|HAS_INDEX } },
             { Operand::MREG64_MEM_OFF,   { .flags = LL|MEMREF|HAS_OFFSET } },
+            { Operand::MREG64_MEM_IDX_OFF, { .flags = LL|MEMREF|HAS_INDEX|HAS_OFFSET } },
             { Operand::IMM_IVAL,         { .flags = HL|LL|IMM_IVAL } },
             { Operand::LABEL,            { .flags = HL|LL|LABEL } },
             { Operand::IMM_LABEL,        { .flags = HL|LL|IMM_LABEL } },
@@ -64,7 +66,7 @@ Operand::Operand(Kind kind)
         : m_kind(kind)
         , m_basereg(-1)
         , m_index_reg(-1)
-        , m_imm_ival(-1) , callee_register(false){
+        , m_imm_ival(-1) , m_scale(1), callee_register(false){
 }
 
 // ival1 is either basereg or imm_ival (depending on operand Kind)
@@ -85,7 +87,9 @@ Operand::Operand(Kind kind, int basereg, long ival2)
         : m_kind(kind)
         , m_basereg(basereg)
         , m_index_reg(-1)
-        , m_imm_ival(-1) {
+        , m_imm_ival(-1)
+        , m_scale(1)
+        , callee_register(false) {
     const OperandProperties &props = oprops(kind);
     if (props.has_index_reg()) {
         m_index_reg = int(ival2);
@@ -96,6 +100,19 @@ Operand::Operand(Kind kind, int basereg, long ival2)
     }
 }
 
+// for memory references with a base register, scaled index register,
+// and offset
+Operand::Operand(Kind kind, int basereg, int index_reg, long offset, int scale)
+        : Operand(kind) {
+    const OperandProperties &props = oprops(kind);
+    assert(props.has_index_reg() && props.has_offset());
+    assert(scale == 1 || scale == 2 || scale == 4 || scale == 8);
+    m_basereg = basereg;
+    m_index_reg = index_reg;
+    m_imm_ival = offset;
+    m_scale = scale;
+}
+
 // for label or immediate label operands
 Operand::Operand(Kind kind, const std::string &label)
         : Operand(kind) {
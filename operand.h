@@ -20,6 +20,8 @@ public:
         VREG_MEM,        // memref using vreg ptr             (vr0)
         VREG_MEM_IDX,    // memref using vreg ptr+index       (vr0, vr1)
         VREG_MEM_OFF,    // memref using vreg ptr+imm offset  8(vr0q)
+        VREG_MEM_IDX_OFF,// memref using vreg ptr+index*scale+imm offset
+                         //                                   8(vr0, vr1, 4)
 
         MREG8,           // just an mreg                      %al
         MREG16,          // just an mreg                      %ax
@@ -28,6 +30,8 @@ public:
         MREG64_MEM,      // memref using mreg ptr             (%rax)
         MREG64_MEM_IDX,  // memref using mreg ptr+index       (%rax,%rsi)
         MREG64_MEM_OFF,  // memref using mreg ptr+imm offset  8(%rax)
+        MREG64_MEM_IDX_OFF,// memref using mreg ptr+index*scale+imm offset
+                         //                                   8(%rax,%rsi,4)
 
         IMM_IVAL,        // immediate 8-bit signed int        $1
 
@@ -39,6 +43,7 @@ private:
     Kind m_kind;
     int m_basereg, m_index_reg;
     long m_imm_ival;
+    int m_scale;
     std::string m_label;
     bool callee_register;
 
@@ -51,6 +56,10 @@ public:
     // ival2 is either index_reg or imm_ival (depending on operand kind)
     Operand(Kind kind, int basereg, long ival2);
 
+    // for memory references with a base register, an index register
+    // scaled by 1, 2, 4, or 8, and an offset
+    Operand(Kind kind, int basereg, int index_reg, long offset, int scale);
+
     // for label or immediate label operands
     Operand(Kind kind, const std::string &label);
 
@@ -102,6 +111,10 @@ public:
 
     long get_offset() const;
 
+    // scale factor of the index register (1 unless the operand
+    // is a scaled index memory reference)
+    int get_scale() const { return m_scale; }
+
     Operand to_memref() const;
 
     Operand from_memref() const;
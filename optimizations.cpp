@@ -1,7 +1,11 @@
 #include "optimizations.h"
 
+#include <climits>
+#include <algorithm>
 #include "cfg.h"
 #include "highlevel.h"
+#include "highlevel_defuse.h"
+#include "local_storage_allocation.h"
 
 // ConstantPropagation
 
@@ -35,9 +39,19 @@ std::shared_ptr<InstructionSequence> ConstantPropagation::constant_propagation(I
         // Make sure not doing invalid instruction, enter jmp etc
         if (instruction->get_num_operands() < 2) {
             result->append(instruction->duplicate());
-        } else if(match_hl(HighLevelOpcode::HINS_mov_b, opcode) && instruction->get_operand(1).is_imm_ival()) {
-            // We are moving constant into vreg
-            constants[instruction->get_operand(0).get_base_reg()] = instruction->get_operand(1).get_imm_ival();
+        } else if(match_hl(HighLevelOpcode::HINS_mov_b, opcode) && instruction->get_operand(1).is_imm_ival()
+                  && instruction->get_operand(0).get_kind() == Operand::VREG) {
+            // We are moving constant into vreg; the move stays, since the
+            // vreg can also be used in other blocks (dead moves are
+            // removed by the liveness-based dead code elimination)
+            // (only constants which fit in an instruction's 32 bit immediate
+            // are propagated)
+            long value = instruction->get_operand(1).get_imm_ival();
+            if (value >= INT32_MIN && value <= INT32_MAX)
+                constants[instruction->get_operand(0).get_base_reg()] = value;
+            else
+                constants.erase(instruction->get_operand(0).get_base_reg());
+            result->append(instruction->duplicate());
         }
         else {
 
@@ -48,6 +62,19 @@ std::shared_ptr<InstructionSequence> ConstantPropagation::constant_propagation(I
 
                 if (left.has_base_reg() &&
                     constants.find(left.get_base_reg()) != constants.end() ) {
+                    if (match_hl(HighLevelOpcode::HINS_neg_b, opcode) && origin.get_kind() == Operand::VREG) {
+                        // Fold the negation of a constant (e.g. a negative literal)
+                        long value = -constants[left.get_base_reg()];
+                        if (highlevel_opcode_get_dest_operand_size(opcode) <= 4)
+                            value = int(value);
+                        auto mov_opcode = HighLevelOpcode(HINS_mov_b + (opcode - HINS_neg_b));
+                        result->append(new Instruction(mov_opcode, origin, Operand(Operand::IMM_IVAL, value)));
+                        if (value >= INT32_MIN && value <= INT32_MAX)
+                            constants[origin.get_base_reg()] = value;
+                        else
+                            constants.erase(origin.get_base_reg());
+                        continue;
+                    }
                     // Make new instruction with constant swapped in
                     Operand copied_constant(Operand::IMM_IVAL, constants[left.get_base_reg()]);
                     result->append(new Instruction(instruction->get_opcode(), origin, copied_constant));
@@ -76,6 +103,10 @@ std::shared_ptr<InstructionSequence> ConstantPropagation::constant_propagation(I
             } else {
                 continue;
             }
+
+            // a vreg redefined by anything else no longer holds its constant
+            if (HighLevel::is_def(instruction))
+                constants.erase(origin.get_base_reg());
         }
 
 
@@ -184,52 +215,2772 @@ std::shared_ptr<ControlFlowGraph> ConstantPropagation::transform_cfg() {
     return ControlFlowGraphTransform::transform_cfg();
 }
 
-// LIVE ANALYSIS
-LiveRegisters::LiveRegisters(const std::shared_ptr<ControlFlowGraph> &cfg)
+// LocalValueNumbering
+
+namespace {
+
+// Marker "opcode" for the value loaded from a memory reference: the key
+// is the value number of the address and the width of the load
+const int LVN_LOAD = -1;
+
+int opcode_size_variant(int size) {
+    switch (size) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        default: return 3;
+    }
+}
+
+// Does the instruction write through a memory reference?
+bool is_store(Instruction *instruction) {
+    auto opcode = static_cast<HighLevelOpcode>(instruction->get_opcode());
+    if (instruction->get_num_operands() < 2 || HighLevel::is_conditional_jump(opcode)) {
+        return false;
+    }
+    return instruction->get_operand(0).is_memref();
+}
+
+}
+
+LocalValueNumbering::LocalValueNumbering(const std::shared_ptr<ControlFlowGraph> &cfg)
         : ControlFlowGraphTransform(cfg)
-        , m_live_vregs(cfg) {
-    m_live_vregs.execute();
+        , m_next_vn(0) {
 }
 
-LiveRegisters::~LiveRegisters() {
+std::size_t LocalValueNumbering::ValueKeyHash::operator()(const ValueKey &key) const {
+    std::size_t h = std::hash<int>()(key.opcode);
+    h = h * 31 + std::hash<int>()(key.left);
+    h = h * 31 + std::hash<int>()(key.right);
+    return h;
 }
 
-std::shared_ptr<InstructionSequence>
-LiveRegisters::transform_basic_block(const InstructionSequence *orig_bb) {
-    // LiveVregs needs a pointer to a BasicBlock object to get a dataflow
-    // fact for that basic block
-    const auto *orig_bb_as_basic_block =
-            dynamic_cast<const BasicBlock *>(orig_bb);
+/// Value numbering within a single basic block. Every value computed in the
+/// block gets a number; an instruction that recomputes a value which is still
+/// held in some vreg is replaced by a copy from that vreg, and uses of a value
+/// are redirected to the vreg that first computed it so that the copies become
+/// dead (and are removed by LiveRegisters).
+/// \param orig_bb the original basic block
+/// \return the transformed instruction sequence
+std::shared_ptr<InstructionSequence> LocalValueNumbering::transform_basic_block(const InstructionSequence *orig_bb) {
+    reset();
+    return number_block(orig_bb);
+}
 
-    std::shared_ptr<InstructionSequence> result_iseq(new InstructionSequence());
+/// Number the values of one block, starting from the current state of the
+/// value table (LocalValueNumbering starts every block from an empty table,
+/// GlobalValueNumbering from the values of the dominating blocks)
+std::shared_ptr<InstructionSequence> LocalValueNumbering::number_block(const InstructionSequence *orig_bb) {
+    std::shared_ptr<InstructionSequence> result(new InstructionSequence());
 
-    for (auto i = orig_bb->cbegin(); i != orig_bb->cend(); ++i) {
-        Instruction *orig_ins = *i;
-        bool preserve_instruction = true;
+    for (auto i = orig_bb->cbegin(); i != orig_bb->cend(); i++) {
+        Instruction *instruction = *i;
+        int opcode = instruction->get_opcode();
 
-        if (HighLevel::is_def(orig_ins)) {
-            Operand dest = orig_ins->get_operand(0);
+        if (opcode == HINS_call) {
+            // the callee may modify memory and the argument/return vregs
+            result->append(instruction->duplicate());
+            m_loads.clear();
+            for (int vreg = 0; vreg < LocalStorageAllocation::VREG_FIRST_LOCAL; vreg++) {
+                assign(vreg, m_next_vn++);
+            }
+            continue;
+        }
 
-            LiveVregs::FactType live_after =
-                    m_live_vregs.get_fact_after_instruction(orig_bb_as_basic_block, orig_ins);
+        // Redirect uses to the canonical vreg holding the same value
+        Operand operands[Instruction::MAX_OPERANDS];
+        unsigned num_operands = instruction->get_num_operands();
+        for (unsigned j = 0; j < num_operands; j++) {
+            operands[j] = HighLevel::is_use(instruction, j)
+                    ? canonical(instruction->get_operand(j))
+                    : instruction->get_operand(j);
+        }
 
-            if (!live_after.test(dest.get_base_reg()) && !is_caller_saved(dest.get_base_reg()))
-                // destination register is dead immediately after this instruction,
-                // so it can be eliminated
-                preserve_instruction = false;
+        if (!HighLevel::is_def(instruction) || !is_value_op(opcode) || num_operands < 2) {
+            Instruction *copy = new Instruction(opcode, operands[0], operands[1], operands[2], operands[3], num_operands);
+            copy->set_jump_table(instruction->get_jump_table());
+            result->append(copy);
+
+            if (is_store(instruction)) {
+                int size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(opcode));
+                int stored = operand_vn(operands[1], size);
+                int address = vreg_vn(operands[0].get_base_reg());
+
+                // nothing is known about memory after a store, except what was just stored
+                m_loads.clear();
+                if (match_hl(HINS_mov_b, opcode) && operands[0].get_kind() == Operand::VREG_MEM) {
+                    m_loads[make_key(LVN_LOAD, address, size)] = stored;
+                }
+            } else if (HighLevel::is_def(instruction)) {
+                assign(operands[0].get_base_reg(), m_next_vn++);
+            }
+            continue;
         }
 
-        if (preserve_instruction)
-            result_iseq->append(orig_ins->duplicate());
+        int dest = operands[0].get_base_reg();
+        int src_size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(opcode));
+        int dest_size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(opcode));
+
+        if (match_hl(HINS_mov_b, opcode)) {
+            // a copy (or a load): the destination takes on the source's value
+            int vn = operand_vn(operands[1], src_size);
+            if (operands[1].is_memref()) {
+                auto constant = m_constant_of.find(vn);
+                int holder = find_holder(vn, true);
+                if (constant != m_constant_of.end()) {
+                    operands[1] = Operand(Operand::IMM_IVAL, constant->second);
+                } else if (holder >= 0 && holder != dest) {
+                    operands[1] = Operand(Operand::VREG, holder);
+                }
+            }
+            result->append(new Instruction(opcode, operands[0], operands[1]));
+            assign(dest, vn);
+            defined(instruction, vn);
+            continue;
+        }
+
+        int left = num_operands > 1 ? operand_vn(operands[1], src_size) : -1;
+        int right = num_operands > 2 ? operand_vn(operands[2], src_size) : -1;
+        ValueKey key = make_key(opcode, left, right);
+
+        auto existing = m_values.find(key);
+        if (existing != m_values.end()) {
+            int holder = find_holder(existing->second, true);
+            if (holder == dest) {
+                // the destination already holds this value
+                defined(instruction, existing->second);
+                continue;
+            }
+            if (holder >= 0) {
+                auto mov_opcode = static_cast<HighLevelOpcode>(HINS_mov_b + opcode_size_variant(dest_size));
+                result->append(new Instruction(mov_opcode, operands[0], Operand(Operand::VREG, holder)));
+                assign(dest, existing->second);
+                defined(instruction, existing->second);
+                continue;
+            }
+        }
+
+        int vn = m_next_vn++;
+        record_value(key, vn);
+        result->append(new Instruction(opcode, operands[0], operands[1], operands[2], num_operands));
+        assign(dest, vn);
+        defined(instruction, vn);
     }
 
-    return result_iseq;
+    return result;
+}
+
+void LocalValueNumbering::reset() {
+    m_next_vn = 0;
+    m_values.clear();
+    m_loads.clear();
+    m_constants.clear();
+    m_labels.clear();
+    m_constant_of.clear();
+    m_vreg_vn.clear();
+    m_holders.clear();
+}
 
+/// A vreg not yet seen in the block holds some unknown value,
+/// which gets a fresh number
+int LocalValueNumbering::entry_vn(int vreg) {
+    return m_next_vn++;
 }
 
+void LocalValueNumbering::record_value(const ValueKey &key, int vn) {
+    m_values[key] = vn;
+}
 
-bool LiveRegisters::is_caller_saved(int vreg_num) {
-    if (vreg_num <= 2) {
+void LocalValueNumbering::defined(const Instruction *orig_ins, int vn) {
+}
+
+/// Get the value number currently held by a vreg
+int LocalValueNumbering::vreg_vn(int vreg) {
+    auto i = m_vreg_vn.find(vreg);
+    if (i != m_vreg_vn.end()) {
+        return i->second;
+    }
+    int vn = entry_vn(vreg);
+    assign(vreg, vn);
+    return vn;
+}
+
+/// Get the value number of a source operand
+/// \param operand the operand
+/// \param size the operand width, used to distinguish loads and constants of different widths
+int LocalValueNumbering::operand_vn(const Operand &operand, int size) {
+    switch (operand.get_kind()) {
+        case Operand::VREG:
+            return vreg_vn(operand.get_base_reg());
+        case Operand::VREG_MEM: {
+            ValueKey key = make_key(LVN_LOAD, vreg_vn(operand.get_base_reg()), size);
+            auto i = m_loads.find(key);
+            if (i != m_loads.end()) {
+                return i->second;
+            }
+            int vn = m_next_vn++;
+            m_loads[key] = vn;
+            return vn;
+        }
+        case Operand::IMM_IVAL: {
+            auto i = m_constants.find({ operand.get_imm_ival(), size });
+            if (i != m_constants.end()) {
+                return i->second;
+            }
+            int vn = m_next_vn++;
+            m_constants[{ operand.get_imm_ival(), size }] = vn;
+            m_constant_of[vn] = operand.get_imm_ival();
+            return vn;
+        }
+        case Operand::IMM_LABEL:
+        case Operand::LABEL: {
+            auto i = m_labels.find(operand.get_label());
+            if (i != m_labels.end()) {
+                return i->second;
+            }
+            int vn = m_next_vn++;
+            m_labels[operand.get_label()] = vn;
+            return vn;
+        }
+        default:
+            // anything else is never considered equal to another value
+            return m_next_vn++;
+    }
+}
+
+void LocalValueNumbering::assign(int vreg, int vn) {
+    m_vreg_vn[vreg] = vn;
+    m_holders[vn].push_back(vreg);
+}
+
+/// Find the first vreg (in order of assignment) which still holds a value
+/// \param vn the value number
+/// \param any_vreg if false, only vregs used for locals and temporaries
+///                 (not argument/return or machine vregs) are considered
+/// \return the vreg, or -1 if no vreg holds the value any more
+int LocalValueNumbering::find_holder(int vn, bool any_vreg) {
+    auto i = m_holders.find(vn);
+    if (i == m_holders.end()) {
+        return -1;
+    }
+    // (iterate by index: checking a holder can assign the entry value of
+    // a vreg, which may add holders)
+    for (unsigned j = 0; j < i->second.size(); j++) {
+        int vreg = i->second[j];
+        if (vreg_vn(vreg) == vn && (any_vreg || vreg >= LocalStorageAllocation::VREG_FIRST_LOCAL)) {
+            return vreg;
+        }
+    }
+    return -1;
+}
+
+/// Replace the vreg in an operand with the first vreg holding the same value
+Operand LocalValueNumbering::canonical(const Operand &operand) {
+    if (operand.get_kind() != Operand::VREG && operand.get_kind() != Operand::VREG_MEM) {
+        return operand;
+    }
+    int holder = find_holder(vreg_vn(operand.get_base_reg()), false);
+    if (holder < 0 || holder == operand.get_base_reg()) {
+        return operand;
+    }
+    Operand replacement(Operand::VREG, holder);
+    return operand.is_memref() ? replacement.to_memref() : replacement;
+}
+
+/// Build the key for a computed value, putting the operands of commutative
+/// operations in a canonical order (and a > b as b < a)
+LocalValueNumbering::ValueKey LocalValueNumbering::make_key(int opcode, int left, int right) {
+    if (match_hl(HINS_cmpgt_b, opcode) || match_hl(HINS_cmpgte_b, opcode)) {
+        opcode += (HINS_cmplt_b - HINS_cmpgt_b);
+        std::swap(left, right);
+    }
+    bool commutative = match_hl(HINS_add_b, opcode) || match_hl(HINS_mul_b, opcode)
+            || match_hl(HINS_and_b, opcode) || match_hl(HINS_or_b, opcode) || match_hl(HINS_xor_b, opcode)
+            || match_hl(HINS_cmpeq_b, opcode) || match_hl(HINS_cmpneq_b, opcode);
+    if (commutative && left > right) {
+        std::swap(left, right);
+    }
+    return { opcode, left, right };
+}
+
+/// Is the opcode a side effect free computation of its destination?
+bool LocalValueNumbering::is_value_op(int opcode) {
+    return (opcode >= HINS_add_b && opcode <= HINS_uconv_lq) || opcode == HINS_localaddr;
+}
+
+bool LocalValueNumbering::match_hl(int base, int hl_opcode) {
+    return hl_opcode >= base && hl_opcode < (base + 4);
+}
+
+// GlobalValueNumbering
+
+GlobalValueNumbering::GlobalValueNumbering(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : LocalValueNumbering(cfg)
+        , m_reaching_defs(cfg)
+        , m_dominators(cfg)
+        , m_cur_block(nullptr) {
+    m_reaching_defs.execute();
+
+    // Number the blocks in a preorder walk of the dominator tree, so that the
+    // values computed in a block are available to all of the blocks it dominates
+    visit(cfg->get_entry_block());
+}
+
+/// Value numbering over the whole function. The blocks have already been
+/// numbered by the constructor, in dominator tree order: blocks which are
+/// unreachable were not, and are numbered on their own.
+/// \param orig_bb the original basic block
+/// \return the transformed instruction sequence
+std::shared_ptr<InstructionSequence> GlobalValueNumbering::transform_basic_block(const InstructionSequence *orig_bb) {
+    auto i = m_numbered.find(orig_bb);
+    if (i != m_numbered.end()) {
+        return i->second;
+    }
+    return std::shared_ptr<InstructionSequence>(orig_bb->duplicate());
+}
+
+/// Number a block and then the blocks it dominates. The value table and
+/// holders are scoped: whatever was added while numbering the subtree
+/// is removed again before returning.
+void GlobalValueNumbering::visit(BasicBlock *bb) {
+    std::size_t value_mark = m_value_log.size();
+    std::size_t holder_mark = m_holder_log.size();
+
+    // vreg contents and memory are only known from the reaching definitions
+    // at the start of each block
+    m_cur_block = bb;
+    m_vreg_vn.clear();
+    m_loads.clear();
+    m_numbered[bb] = number_block(bb);
+
+    const std::vector<BasicBlock *> &children = m_dominators.get_children(bb);
+    for (auto i = children.begin(); i != children.end(); i++) {
+        visit(*i);
+    }
+
+    while (m_holder_log.size() > holder_mark) {
+        m_holders[m_holder_log.back()].pop_back();
+        m_holder_log.pop_back();
+    }
+    while (m_value_log.size() > value_mark) {
+        const std::pair<ValueKey, int> &entry = m_value_log.back();
+        if (entry.second < 0) {
+            m_values.erase(entry.first);
+        } else {
+            m_values[entry.first] = entry.second;
+        }
+        m_value_log.pop_back();
+    }
+}
+
+/// The value of a vreg on entry to the current block is known if exactly one
+/// definition of it reaches the block. That definition must be in a dominating
+/// block (every path to the block passes through it), which has already been
+/// numbered.
+int GlobalValueNumbering::entry_vn(int vreg) {
+    // the return value and argument vregs are also used by the low-level code
+    // (e.g. for division), so values are never kept in them from one block
+    // to another
+    if (vreg < LocalStorageAllocation::VREG_FIRST_ARG + 6) {
+        return m_next_vn++;
+    }
+
+    const ReachingDefsFact &fact = m_reaching_defs.get_fact_at_beginning_of_block(m_cur_block);
+    auto defs = fact.defs.find(vreg);
+    if (defs == fact.defs.end() || (defs->second.size() == 1 && *defs->second.begin() == nullptr)) {
+        // the value from function entry
+        auto i = m_initial_vn.find(vreg);
+        if (i == m_initial_vn.end()) {
+            i = m_initial_vn.insert({ vreg, m_next_vn++ }).first;
+        }
+        return i->second;
+    }
+
+    if (defs->second.size() == 1) {
+        const Instruction *def = *defs->second.begin();
+        if (def->get_opcode() == HINS_call) {
+            auto i = m_clobbered_vn.find({ def, vreg });
+            if (i == m_clobbered_vn.end()) {
+                i = m_clobbered_vn.insert({ { def, vreg }, m_next_vn++ }).first;
+            }
+            return i->second;
+        }
+        auto i = m_def_vn.find(def);
+        if (i != m_def_vn.end()) {
+            return i->second;
+        }
+    }
+
+    // several definitions reach the block (or one not numbered yet):
+    // the vreg holds a value not seen anywhere else
+    return m_next_vn++;
+}
+
+void GlobalValueNumbering::record_value(const ValueKey &key, int vn) {
+    auto i = m_values.find(key);
+    m_value_log.push_back({ key, i != m_values.end() ? i->second : -1 });
+    m_values[key] = vn;
+}
+
+void GlobalValueNumbering::assign(int vreg, int vn) {
+    LocalValueNumbering::assign(vreg, vn);
+    m_holder_log.push_back(vn);
+}
+
+void GlobalValueNumbering::defined(const Instruction *orig_ins, int vn) {
+    m_def_vn[orig_ins] = vn;
+}
+
+// LoopTransform
+
+LoopTransform::LoopTransform(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_dominators(cfg)
+        , m_loops(m_dominators)
+        , m_next_vreg(LocalStorageAllocation::VREG_FIRST_LOCAL) {
+}
+
+LoopTransform::~LoopTransform() {
+    for (auto i = m_code.begin(); i != m_code.end(); i++) {
+        for (Instruction *ins : *i) {
+            delete ins;
+        }
+    }
+}
+
+std::shared_ptr<InstructionSequence> LoopTransform::transform_basic_block(const InstructionSequence *orig_bb) {
+    return std::shared_ptr<InstructionSequence>(orig_bb->duplicate());
+}
+
+/// Make the working copy of the code, and count the definitions of each vreg
+void LoopTransform::load_code() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+
+    m_code.resize(cfg->get_num_blocks());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            m_code[bb->get_id()].push_back(ins->duplicate());
+
+            if (ins->get_opcode() == HINS_call) {
+                for (int vreg = 0; vreg < LocalStorageAllocation::VREG_FIRST_LOCAL; vreg++) {
+                    m_def_count[vreg]++;
+                }
+            } else if (HighLevel::is_def(ins)) {
+                m_def_count[ins->get_operand(0).get_base_reg()]++;
+            }
+
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                const Operand &operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    m_next_vreg = std::max(m_next_vreg, operand.get_base_reg() + 1);
+                }
+                if (operand.has_index_reg()) {
+                    m_next_vreg = std::max(m_next_vreg, operand.get_index_reg() + 1);
+                }
+            }
+        }
+    }
+}
+
+/// Find the preheader of a loop, creating one if there is no block outside the
+/// loop that is the only way in to the header. The created preheader is placed
+/// just before the header (so it can't be created if the header is reached by
+/// falling through from inside the loop); branches into the loop are
+/// redirected to it.
+/// \return the slot of the preheader, or -1 if there is none
+int LoopTransform::find_preheader(const Loop *loop) {
+    BasicBlock *existing = m_loops.get_preheader(loop);
+    if (existing != nullptr) {
+        return int(existing->get_id());
+    }
+
+    BasicBlock *header = loop->header;
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    bool entered_by_branch = false;
+    const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(header);
+    for (auto i = incoming.begin(); i != incoming.end(); i++) {
+        Edge *edge = *i;
+        BasicBlock *pred = edge->get_source();
+        if (loop->contains(pred)) {
+            if (edge->get_kind() == EDGE_FALLTHROUGH) {
+                return -1;
+            }
+            continue;
+        }
+        // a loop entered from a jump table would need the table rewritten
+        if (pred->get_kind() != BASICBLOCK_INTERIOR || edge->get_kind() == EDGE_MULTIWAY) {
+            return -1;
+        }
+        if (edge->get_kind() == EDGE_BRANCH) {
+            entered_by_branch = true;
+        }
+    }
+    if (header->get_kind() != BASICBLOCK_INTERIOR || (entered_by_branch && !header->has_label())) {
+        return -1;
+    }
+
+    unsigned slot = unsigned(m_code.size());
+    m_code.emplace_back();
+    m_created.push_back({ header, entered_by_branch ? header->get_label() + "_pre" : "" });
+    m_created_for_header[header->get_id()] = slot;
+    return int(slot);
+}
+
+/// Get the slots of the blocks in a loop, in reverse postorder, including
+/// the preheaders created for nested loops
+std::vector<unsigned> LoopTransform::get_loop_slots(const Loop *loop) {
+    std::vector<unsigned> slots;
+    for (BasicBlock *bb : loop->blocks) {
+        auto created = m_created_for_header.find(bb->get_id());
+        if (bb != loop->header && created != m_created_for_header.end()) {
+            slots.push_back(created->second);
+        }
+        slots.push_back(bb->get_id());
+    }
+    return slots;
+}
+
+/// Get the original block for a slot (for a created preheader, its loop's header)
+const BasicBlock *LoopTransform::get_slot_block(unsigned slot) {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    return slot < cfg->get_num_blocks() ? cfg->get_block(slot) : m_created[slot - cfg->get_num_blocks()].header;
+}
+
+/// Append code to a preheader (before the jump to the loop, if there is one)
+void LoopTransform::append_to_preheader(unsigned preheader, const std::vector<Instruction *> &code) {
+    std::vector<Instruction *> &dest = m_code[preheader];
+    auto pos = dest.end();
+    if (!dest.empty() && HighLevel::is_jump(dest.back()->get_opcode())) {
+        --pos;
+    }
+    dest.insert(pos, code.begin(), code.end());
+}
+
+/// Build the transformed control-flow graph from the working copy of the code
+std::shared_ptr<ControlFlowGraph> LoopTransform::build_cfg() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    std::shared_ptr<ControlFlowGraph> result(new ControlFlowGraph());
+
+    // leave room in the code order for the created preheaders, which
+    // go just before their headers
+    int scale = m_created.empty() ? 1 : 2;
+
+    std::vector<BasicBlock *> block_map(m_code.size(), nullptr);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        block_map[orig->get_id()] = result->create_basic_block(orig->get_kind(), orig->get_code_order() * scale, orig->get_label());
+    }
+    for (unsigned i = 0; i < m_created.size(); i++) {
+        const CreatedPreheader &created = m_created[i];
+        unsigned slot = cfg->get_num_blocks() + i;
+        block_map[slot] = result->create_basic_block(BASICBLOCK_INTERIOR, created.header->get_code_order() * scale - 1, created.label);
+    }
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            Edge *edge = *j;
+            BasicBlock *target = block_map[edge->get_target()->get_id()];
+
+            // edges entering a loop go to its created preheader
+            auto created = m_created_for_header.find(edge->get_target()->get_id());
+            if (created != m_created_for_header.end()
+                && !m_loops.get_loop_for(edge->get_target())->contains(orig)) {
+                target = block_map[created->second];
+                std::vector<Instruction *> &code = m_code[orig->get_id()];
+                if (edge->get_kind() == EDGE_BRANCH) {
+                    Instruction *branch = code.back();
+                    unsigned num_operands = branch->get_num_operands();
+                    Operand operands[3];
+                    for (unsigned k = 0; k < num_operands; k++) {
+                        operands[k] = branch->get_operand(k);
+                    }
+                    operands[num_operands - 1] = Operand(Operand::LABEL, target->get_label());
+                    code.back() = new Instruction(branch->get_opcode(), operands[0], operands[1], operands[2], num_operands);
+                    delete branch;
+                }
+            }
+
+            result->create_edge(block_map[orig->get_id()], target, edge->get_kind());
+        }
+    }
+    for (unsigned i = 0; i < m_created.size(); i++) {
+        unsigned slot = cfg->get_num_blocks() + i;
+        result->create_edge(block_map[slot], block_map[m_created[i].header->get_id()], EDGE_FALLTHROUGH);
+    }
+
+    // the result blocks take over the instructions
+    for (unsigned slot = 0; slot < m_code.size(); slot++) {
+        for (Instruction *ins : m_code[slot]) {
+            block_map[slot]->append(ins);
+        }
+        m_code[slot].clear();
+    }
+
+    return result;
+}
+
+// LoopInvariantCodeMotion
+
+LoopInvariantCodeMotion::LoopInvariantCodeMotion(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : LoopTransform(cfg) {
+}
+
+/// Hoist loop invariant computations into loop preheaders. Loops are
+/// processed innermost first, so that an invariant hoisted out of a nested
+/// loop can be hoisted further out of the loops containing it.
+/// \return the transformed control-flow graph
+std::shared_ptr<ControlFlowGraph> LoopInvariantCodeMotion::transform_cfg() {
+    load_code();
+    find_frame_addresses();
+
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        hoist(m_loops.get_loop(i));
+    }
+
+    return build_cfg();
+}
+
+/// Find the vregs (each defined only once) holding a constant, and the ones
+/// holding an address in the stack frame: a local's address, possibly plus
+/// a constant offset (as for struct fields). A load from a frame address
+/// can't fault, so it may be executed speculatively.
+void LoopInvariantCodeMotion::find_frame_addresses() {
+    // definitions dominate their uses, so one pass in reverse postorder suffices
+    const std::vector<BasicBlock *> &rpo = m_dominators.get_reverse_postorder();
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        for (Instruction *ins : m_code[(*i)->get_id()]) {
+            if (!HighLevel::is_def(ins) || m_def_count[ins->get_operand(0).get_base_reg()] != 1) {
+                continue;
+            }
+            int dest = ins->get_operand(0).get_base_reg();
+            int opcode = ins->get_opcode();
+
+            if (opcode == HINS_localaddr) {
+                m_frame_addresses.insert(dest);
+            } else if (opcode == HINS_mov_q && ins->get_operand(1).is_imm_ival()) {
+                m_constant_vregs[dest] = ins->get_operand(1).get_imm_ival();
+            } else if (opcode == HINS_add_q) {
+                const Operand &left = ins->get_operand(1);
+                const Operand &right = ins->get_operand(2);
+                auto is_frame = [this](const Operand &op) {
+                    return op.get_kind() == Operand::VREG && m_frame_addresses.count(op.get_base_reg()) > 0;
+                };
+                auto is_constant = [this](const Operand &op) {
+                    return op.is_imm_ival()
+                           || (op.get_kind() == Operand::VREG && m_constant_vregs.count(op.get_base_reg()) > 0);
+                };
+                if ((is_frame(left) && is_constant(right)) || (is_constant(left) && is_frame(right))) {
+                    m_frame_addresses.insert(dest);
+                }
+            }
+        }
+    }
+}
+
+/// Hoist the invariant instructions of one loop into its preheader
+void LoopInvariantCodeMotion::hoist(const Loop *loop) {
+    int preheader = find_preheader(loop);
+    if (preheader < 0) {
+        return;
+    }
+
+    LoopSummary summary;
+    summary.loop = loop;
+    summary.slots = get_loop_slots(loop);
+    summary.writes_memory = false;
+    for (unsigned slot : summary.slots) {
+        for (Instruction *ins : m_code[slot]) {
+            if (ins->get_opcode() == HINS_call) {
+                summary.writes_memory = true;
+                for (int vreg = 0; vreg < LocalStorageAllocation::VREG_FIRST_LOCAL; vreg++) {
+                    summary.defs[vreg]++;
+                }
+            } else if (HighLevel::is_def(ins)) {
+                summary.defs[ins->get_operand(0).get_base_reg()]++;
+            } else if (is_store(ins)) {
+                summary.writes_memory = true;
+            }
+        }
+    }
+
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    for (BasicBlock *bb : loop->blocks) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        for (auto i = outgoing.begin(); i != outgoing.end(); i++) {
+            if (!loop->contains((*i)->get_target())) {
+                summary.exiting.push_back(bb);
+                break;
+            }
+        }
+    }
+
+    // An instruction can only be invariant once the instructions defining
+    // its operands are known to be, so iterate until nothing changes
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned slot : summary.slots) {
+            for (Instruction *ins : m_code[slot]) {
+                if (summary.invariant.count(ins) == 0 && is_invariant(ins, slot, summary)) {
+                    summary.invariant.insert(ins);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (summary.invariant.empty()) {
+        return;
+    }
+
+    // Move the invariant instructions in loop order (a definition dominates
+    // its uses, so operands are computed before they are used)
+    std::vector<Instruction *> hoisted;
+    for (unsigned slot : summary.slots) {
+        std::vector<Instruction *> remaining;
+        for (Instruction *ins : m_code[slot]) {
+            (summary.invariant.count(ins) > 0 ? hoisted : remaining).push_back(ins);
+        }
+        m_code[slot] = remaining;
+    }
+
+    append_to_preheader(unsigned(preheader), hoisted);
+}
+
+/// Is an instruction a computation whose result is the same on every
+/// iteration of the loop, and which can be moved to the preheader?
+/// Its destination must be defined nowhere else, and computing it must
+/// be safe even on iterations (or executions of the loop) where it wasn't
+/// originally computed.
+bool LoopInvariantCodeMotion::is_invariant(Instruction *ins, unsigned slot, const LoopSummary &summary) {
+    int opcode = ins->get_opcode();
+    if (!LocalValueNumbering::is_value_op(opcode) || !HighLevel::is_def(ins)
+        || ins->get_num_operands() < 2) {
+        return false;
+    }
+
+    int dest = ins->get_operand(0).get_base_reg();
+    if (dest < LocalStorageAllocation::VREG_FIRST_LOCAL || m_def_count[dest] != 1) {
+        return false;
+    }
+
+    // division can fault, so it is only hoisted if it is executed anyway
+    bool is_division = (opcode >= HINS_div_b && opcode <= HINS_div_q) || (opcode >= HINS_mod_b && opcode <= HINS_mod_q)
+                       || (opcode >= HINS_udiv_b && opcode <= HINS_umod_q);
+    if (is_division && !is_guaranteed(slot, summary)) {
+        return false;
+    }
+
+    for (unsigned i = 1; i < ins->get_num_operands(); i++) {
+        const Operand &operand = ins->get_operand(i);
+        switch (operand.get_kind()) {
+            case Operand::IMM_IVAL:
+            case Operand::IMM_LABEL:
+                break;
+            case Operand::VREG:
+                if (!is_invariant_vreg(operand.get_base_reg(), summary)) {
+                    return false;
+                }
+                break;
+            case Operand::VREG_MEM:
+                // a load gets the same value on every iteration if nothing
+                // in the loop writes to memory; it is only done speculatively
+                // if the address is in the stack frame
+                if (summary.writes_memory || !is_invariant_vreg(operand.get_base_reg(), summary)) {
+                    return false;
+                }
+                if (m_frame_addresses.count(operand.get_base_reg()) == 0 && !is_guaranteed(slot, summary)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/// A vreg is invariant if it isn't defined in the loop, or if its only
+/// definition is invariant
+bool LoopInvariantCodeMotion::is_invariant_vreg(int vreg, const LoopSummary &summary) {
+    auto defs = summary.defs.find(vreg);
+    if (defs == summary.defs.end()) {
+        return true;
+    }
+    if (m_def_count[vreg] != 1) {
+        return false;
+    }
+    for (Instruction *ins : summary.invariant) {
+        if (HighLevel::is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Is the code in a slot executed on every execution of the loop?
+/// (It is if its block dominates all of the blocks leaving the loop.)
+bool LoopInvariantCodeMotion::is_guaranteed(unsigned slot, const LoopSummary &summary) {
+    const BasicBlock *bb = get_slot_block(slot);
+    for (BasicBlock *exiting : summary.exiting) {
+        if (!m_dominators.dominates(bb, exiting)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// InductionVariableStrengthReduction
+
+InductionVariableStrengthReduction::InductionVariableStrengthReduction(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : LoopTransform(cfg)
+        , m_live_vregs(cfg) {
+    m_live_vregs.execute();
+}
+
+/// Strength reduction of array indexing in loops. An address base + i * size
+/// computed from a basic induction variable i becomes a pointer which is
+/// incremented along with i; comparisons of i with a loop invariant value are
+/// rewritten to compare the pointer instead (linear function test
+/// replacement), after which i is removed if nothing else needs it.
+/// \return the transformed control-flow graph
+std::shared_ptr<ControlFlowGraph> InductionVariableStrengthReduction::transform_cfg() {
+    load_code();
+
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        reduce(m_loops.get_loop(i));
+    }
+
+    return build_cfg();
+}
+
+void InductionVariableStrengthReduction::reduce(const Loop *loop) {
+    int preheader = find_preheader(loop);
+    if (preheader < 0) {
+        return;
+    }
+    std::vector<unsigned> slots = get_loop_slots(loop);
+
+    // Count the definitions in the loop
+    std::map<int, int> defs;
+    std::map<int, std::pair<unsigned, unsigned>> def_position;
+    for (unsigned slot : slots) {
+        for (unsigned i = 0; i < m_code[slot].size(); i++) {
+            Instruction *ins = m_code[slot][i];
+            if (ins->get_opcode() == HINS_call) {
+                for (int vreg = 0; vreg < LocalStorageAllocation::VREG_FIRST_LOCAL; vreg++) {
+                    defs[vreg]++;
+                }
+            } else if (HighLevel::is_def(ins)) {
+                defs[ins->get_operand(0).get_base_reg()]++;
+                def_position[ins->get_operand(0).get_base_reg()] = { slot, i };
+            }
+        }
+    }
+
+    std::map<int, BasicIV> ivs;
+    for (auto i = def_position.begin(); i != def_position.end(); i++) {
+        BasicIV iv;
+        if (defs[i->first] == 1 && find_basic_iv(loop, i->second.first, i->second.second, iv)) {
+            ivs[iv.vreg] = iv;
+        }
+    }
+    if (ivs.empty()) {
+        return;
+    }
+
+    // Replace each address computation base + scale * iv by a copy of
+    // a pointer kept equal to it
+    std::vector<ReducedIV> reduced;
+    std::vector<Instruction *> init;
+    for (unsigned slot : slots) {
+        for (unsigned i = 0; i < m_code[slot].size(); i++) {
+            ReducedIV derived;
+            unsigned first;
+            if (!match_derived(slot, i, ivs, defs, derived, first)) {
+                continue;
+            }
+
+            // the address must be computed from one value of the iv
+            const BasicIV &iv = ivs[derived.iv];
+            bool straddles = false;
+            for (unsigned j = first; j <= i; j++) {
+                straddles = straddles || (iv.slot == slot && (m_code[slot][j] == iv.def || m_code[slot][j] == iv.add));
+            }
+            if (straddles) {
+                continue;
+            }
+
+            int pointer = -1;
+            for (const ReducedIV &existing : reduced) {
+                if (existing.iv == derived.iv && existing.base == derived.base && existing.scale == derived.scale
+                    && existing.offset == derived.offset) {
+                    pointer = existing.vreg;
+                }
+            }
+            if (pointer < 0) {
+                pointer = m_next_vreg++;
+                emit_scaled(init, pointer, derived, initial_value(unsigned(preheader), derived.iv), iv.size);
+                derived.vreg = pointer;
+                reduced.push_back(derived);
+            }
+
+            Instruction *orig = m_code[slot][i];
+            m_code[slot][i] = new Instruction(HINS_mov_q, orig->get_operand(0), Operand(Operand::VREG, pointer));
+            delete orig;
+        }
+    }
+    if (reduced.empty()) {
+        return;
+    }
+
+    // Linear function test replacement: i < n becomes p < base + (n + offset) * scale,
+    // in comparisons (operands 1 and 2) and compare-and-branches (operands 0 and 1)
+    for (unsigned slot : slots) {
+        for (unsigned i = 0; i < m_code[slot].size(); i++) {
+            Instruction *ins = m_code[slot][i];
+            int opcode = ins->get_opcode();
+            bool is_branch = HighLevel::is_compare_and_branch(opcode);
+            if (!is_branch && (opcode < HINS_cmplt_b || opcode > HINS_cmpneq_q || ins->get_num_operands() != 3)) {
+                continue;
+            }
+
+            unsigned first = is_branch ? 0 : 1;
+            for (unsigned side = first; side <= first + 1; side++) {
+                unsigned other = 2 * first + 1 - side;
+                const Operand &counter = ins->get_operand(side);
+                const Operand &limit = ins->get_operand(other);
+                if (counter.get_kind() != Operand::VREG || ivs.count(counter.get_base_reg()) == 0) {
+                    continue;
+                }
+                const BasicIV &iv = ivs[counter.get_base_reg()];
+                bool invariant_limit = limit.is_imm_ival()
+                        || (limit.get_kind() == Operand::VREG && defs.count(limit.get_base_reg()) == 0);
+                if (!invariant_limit || highlevel_opcode_get_source_operand_size(HighLevelOpcode(opcode)) != iv.size) {
+                    continue;
+                }
+
+                // scaling by a positive factor keeps the order of the values
+                const ReducedIV *pointer = nullptr;
+                for (const ReducedIV &candidate : reduced) {
+                    if (candidate.iv == iv.vreg && candidate.scale > 0 && pointer == nullptr) {
+                        pointer = &candidate;
+                    }
+                }
+                if (pointer == nullptr) {
+                    continue;
+                }
+
+                int bound = m_next_vreg++;
+                emit_scaled(init, bound, *pointer, limit, iv.size);
+
+                Operand operands[3] = { ins->get_operand(0), ins->get_operand(1), ins->get_operand(2) };
+                operands[side] = Operand(Operand::VREG, pointer->vreg);
+                operands[other] = Operand(Operand::VREG, bound);
+                int cmp_opcode = opcode - opcode_size_variant(iv.size) + opcode_size_variant(8);
+                m_code[slot][i] = new Instruction(cmp_opcode, operands[0], operands[1], operands[2]);
+                delete ins;
+                break;
+            }
+        }
+    }
+
+    // Keep the pointers in step with their induction variables
+    for (auto i = ivs.begin(); i != ivs.end(); i++) {
+        const BasicIV &iv = i->second;
+        std::vector<Instruction *> &code = m_code[iv.slot];
+        auto pos = std::find(code.begin(), code.end(), iv.def) + 1;
+        for (const ReducedIV &derived : reduced) {
+            if (derived.iv == iv.vreg) {
+                Operand pointer(Operand::VREG, derived.vreg);
+                pos = code.insert(pos, new Instruction(HINS_add_q, pointer, pointer,
+                                                       Operand(Operand::IMM_IVAL, derived.scale * iv.step))) + 1;
+                m_def_count[derived.vreg]++;
+            }
+        }
+    }
+    append_to_preheader(unsigned(preheader), init);
+
+    // Remove the computations the pointers replaced, and the induction variables
+    // no longer needed: only used to compute their own next value, and not
+    // live after the loop
+    remove_dead_code(slots);
+
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    std::map<int, int> uses = count_uses();
+    for (auto i = ivs.begin(); i != ivs.end(); i++) {
+        const BasicIV &iv = i->second;
+        if (uses[iv.vreg] != 1
+            || (iv.add != iv.def && uses[iv.add->get_operand(0).get_base_reg()] != 1)) {
+            continue;
+        }
+
+        bool live_after = false;
+        for (BasicBlock *bb : loop->blocks) {
+            const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+            for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+                BasicBlock *target = (*j)->get_target();
+                if (!loop->contains(target) && m_live_vregs.get_fact_at_beginning_of_block(target).test(iv.vreg)) {
+                    live_after = true;
+                }
+            }
+        }
+        if (live_after) {
+            continue;
+        }
+
+        std::vector<Instruction *> &code = m_code[iv.slot];
+        for (Instruction *ins : { iv.add, iv.def }) {
+            auto pos = std::find(code.begin(), code.end(), ins);
+            if (pos != code.end()) {
+                code.erase(pos);
+                delete ins;
+            }
+        }
+    }
+}
+
+/// Is the definition at a position the increment of a basic induction
+/// variable? It must be i = i + c (or i - c), possibly computed in a
+/// temporary first, and be executed exactly once per iteration: in a block
+/// of the loop itself (not of a nested loop) which dominates the back edges.
+bool InductionVariableStrengthReduction::find_basic_iv(const Loop *loop, unsigned slot, unsigned index, BasicIV &iv) {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    if (slot >= cfg->get_num_blocks()) {
+        return false;
+    }
+    const BasicBlock *bb = cfg->get_block(slot);
+    if (m_loops.get_loop_for(bb) != loop) {
+        return false;
+    }
+    for (BasicBlock *latch : loop->latches) {
+        if (!m_dominators.dominates(bb, latch)) {
+            return false;
+        }
+    }
+
+    Instruction *def = m_code[slot][index];
+    int vreg = def->get_operand(0).get_base_reg();
+    Instruction *add = def;
+    int opcode = def->get_opcode();
+    if ((opcode == HINS_mov_l || opcode == HINS_mov_q) && def->get_operand(1).get_kind() == Operand::VREG) {
+        int temp = def->get_operand(1).get_base_reg();
+        unsigned add_index;
+        if (m_def_count[temp] != 1 || (add = find_def_before(slot, index, temp, add_index)) == nullptr) {
+            return false;
+        }
+    }
+
+    int add_opcode = add->get_opcode();
+    int size = (opcode == HINS_mov_l || opcode == HINS_add_l || opcode == HINS_sub_l) ? 4 : 8;
+    bool is_add = add_opcode == HINS_add_l || add_opcode == HINS_add_q;
+    bool is_sub = add_opcode == HINS_sub_l || add_opcode == HINS_sub_q;
+    if ((!is_add && !is_sub) || highlevel_opcode_get_dest_operand_size(HighLevelOpcode(add_opcode)) != size
+        || (opcode != add_opcode && opcode != HINS_mov_l && opcode != HINS_mov_q)) {
+        return false;
+    }
+
+    const Operand &left = add->get_operand(1);
+    const Operand &right = add->get_operand(2);
+    auto is_iv = [vreg](const Operand &op) { return op.get_kind() == Operand::VREG && op.get_base_reg() == vreg; };
+    long step;
+    if (is_iv(left) && right.is_imm_ival()) {
+        step = is_add ? right.get_imm_ival() : -right.get_imm_ival();
+    } else if (is_add && left.is_imm_ival() && is_iv(right)) {
+        step = left.get_imm_ival();
+    } else {
+        return false;
+    }
+
+    iv = { vreg, step, size, slot, def, add };
+    return true;
+}
+
+/// Match an address computation add_q p, base, x where base is loop invariant
+/// and x = (iv + offset) * scale (with iv + offset sign extended first if the
+/// iv is 32 bits), all computed in the same block
+/// \param first set to the position of the first instruction of the computation
+bool InductionVariableStrengthReduction::match_derived(unsigned slot, unsigned index, const std::map<int, BasicIV> &ivs,
+                                                       const std::map<int, int> &defs, ReducedIV &derived, unsigned &first) {
+    Instruction *ins = m_code[slot][index];
+    if (ins->get_opcode() != HINS_add_q || !HighLevel::is_def(ins) || m_def_count[ins->get_operand(0).get_base_reg()] != 1) {
+        return false;
+    }
+
+    for (unsigned side = 1; side <= 2; side++) {
+        const Operand &base = ins->get_operand(side);
+        const Operand &offset = ins->get_operand(3 - side);
+        if (base.get_kind() != Operand::VREG || defs.count(base.get_base_reg()) > 0
+            || offset.get_kind() != Operand::VREG || m_def_count[offset.get_base_reg()] != 1) {
+            continue;
+        }
+
+        unsigned mul_index;
+        Instruction *mul = find_def_before(slot, index, offset.get_base_reg(), mul_index);
+        if (mul == nullptr || mul->get_opcode() != HINS_mul_q) {
+            continue;
+        }
+        const Operand &mul_left = mul->get_operand(1);
+        const Operand &mul_right = mul->get_operand(2);
+        const Operand &scale = mul_left.is_imm_ival() ? mul_left : mul_right;
+        const Operand &index_value = mul_left.is_imm_ival() ? mul_right : mul_left;
+        if (!scale.is_imm_ival() || index_value.get_kind() != Operand::VREG) {
+            continue;
+        }
+
+        int value = index_value.get_base_reg();
+        int size = 8;
+        first = mul_index;
+        if (ivs.count(value) == 0) {
+            // a 32 bit value, sign extended
+            unsigned conv_index;
+            Instruction *conv = m_def_count[value] == 1 ? find_def_before(slot, mul_index, value, conv_index) : nullptr;
+            if (conv == nullptr || conv->get_opcode() != HINS_sconv_lq || conv->get_operand(1).get_kind() != Operand::VREG) {
+                continue;
+            }
+            value = conv->get_operand(1).get_base_reg();
+            size = 4;
+            first = conv_index;
+        }
+
+        // the iv itself, or iv + c or iv - c
+        long constant = 0;
+        if (ivs.count(value) == 0 && m_def_count[value] == 1) {
+            unsigned add_index;
+            Instruction *add = find_def_before(slot, first, value, add_index);
+            int add_opcode = add != nullptr ? add->get_opcode() : -1;
+            int add_size = add != nullptr ? highlevel_opcode_get_dest_operand_size(HighLevelOpcode(add_opcode)) : 0;
+            if (add_size == size && (match_hl(HINS_add_b, add_opcode) || match_hl(HINS_sub_b, add_opcode))) {
+                const Operand &left = add->get_operand(1);
+                const Operand &right = add->get_operand(2);
+                if (left.get_kind() == Operand::VREG && right.is_imm_ival()) {
+                    value = left.get_base_reg();
+                    constant = match_hl(HINS_add_b, add_opcode) ? right.get_imm_ival() : -right.get_imm_ival();
+                    first = add_index;
+                } else if (match_hl(HINS_add_b, add_opcode) && left.is_imm_ival() && right.get_kind() == Operand::VREG) {
+                    value = right.get_base_reg();
+                    constant = left.get_imm_ival();
+                    first = add_index;
+                }
+            }
+        }
+        if (ivs.count(value) == 0 || ivs.at(value).size != size) {
+            continue;
+        }
+
+        derived = { value, base.get_base_reg(), scale.get_imm_ival(), constant, -1 };
+        return true;
+    }
+    return false;
+}
+
+/// Find the instruction defining a vreg in a slot, before a given position
+Instruction *InductionVariableStrengthReduction::find_def_before(unsigned slot, unsigned index, int vreg, unsigned &def_index) {
+    for (unsigned i = index; i-- > 0; ) {
+        Instruction *ins = m_code[slot][i];
+        if (HighLevel::is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+            def_index = i;
+            return ins;
+        }
+    }
+    return nullptr;
+}
+
+/// Get the value a vreg has at the end of a preheader: a constant if that is
+/// what it was last set to there, otherwise the vreg itself
+Operand InductionVariableStrengthReduction::initial_value(unsigned preheader, int vreg) {
+    unsigned def_index;
+    Instruction *def = find_def_before(preheader, unsigned(m_code[preheader].size()), vreg, def_index);
+    if (def != nullptr && (def->get_opcode() == HINS_mov_l || def->get_opcode() == HINS_mov_q)
+        && def->get_operand(1).is_imm_ival()) {
+        return def->get_operand(1);
+    }
+    return Operand(Operand::VREG, vreg);
+}
+
+/// Emit code computing dest = base + (value + offset) * scale for a derived
+/// induction variable, where the value (a vreg or a constant) has the size
+/// of the induction variable (4 or 8 bytes)
+void InductionVariableStrengthReduction::emit_scaled(std::vector<Instruction *> &code, int dest,
+                                                     const ReducedIV &derived, const Operand &value, int size) {
+    Operand dest_operand(Operand::VREG, dest);
+    Operand base_operand(Operand::VREG, derived.base);
+    m_def_count[dest]++;
+
+    if (value.is_imm_ival()) {
+        long offset = (value.get_imm_ival() + derived.offset) * derived.scale;
+        code.push_back(offset == 0
+                       ? new Instruction(HINS_mov_q, dest_operand, base_operand)
+                       : new Instruction(HINS_add_q, dest_operand, base_operand, Operand(Operand::IMM_IVAL, offset)));
+        return;
+    }
+
+    Operand wide = value;
+    if (size == 4) {
+        wide = Operand(Operand::VREG, m_next_vreg++);
+        m_def_count[wide.get_base_reg()]++;
+        code.push_back(new Instruction(HINS_sconv_lq, wide, value));
+    }
+    Operand scaled(Operand::VREG, m_next_vreg++);
+    m_def_count[scaled.get_base_reg()]++;
+    code.push_back(new Instruction(HINS_mul_q, scaled, wide, Operand(Operand::IMM_IVAL, derived.scale)));
+    if (derived.offset == 0) {
+        code.push_back(new Instruction(HINS_add_q, dest_operand, base_operand, scaled));
+        return;
+    }
+    Operand sum(Operand::VREG, m_next_vreg++);
+    m_def_count[sum.get_base_reg()]++;
+    code.push_back(new Instruction(HINS_add_q, sum, base_operand, scaled));
+    code.push_back(new Instruction(HINS_add_q, dest_operand, sum, Operand(Operand::IMM_IVAL, derived.offset * derived.scale)));
+}
+
+/// Remove computations in a loop whose results (in vregs defined only once)
+/// are never used
+bool InductionVariableStrengthReduction::remove_dead_code(const std::vector<unsigned> &slots) {
+    bool removed_any = false;
+    bool removed = true;
+    while (removed) {
+        removed = false;
+        std::map<int, int> uses = count_uses();
+        for (unsigned slot : slots) {
+            std::vector<Instruction *> &code = m_code[slot];
+            for (auto i = code.begin(); i != code.end(); ) {
+                Instruction *ins = *i;
+                if (HighLevel::is_def(ins) && LocalValueNumbering::is_value_op(ins->get_opcode())
+                    && ins->get_operand(0).get_base_reg() >= LocalStorageAllocation::VREG_FIRST_LOCAL
+                    && m_def_count[ins->get_operand(0).get_base_reg()] == 1
+                    && uses[ins->get_operand(0).get_base_reg()] == 0) {
+                    i = code.erase(i);
+                    delete ins;
+                    removed = true;
+                } else {
+                    i++;
+                }
+            }
+        }
+        removed_any = removed_any || removed;
+    }
+    return removed_any;
+}
+
+/// Count the uses of each vreg in the function
+std::map<int, int> InductionVariableStrengthReduction::count_uses() {
+    std::map<int, int> uses;
+    for (auto i = m_code.begin(); i != m_code.end(); i++) {
+        for (Instruction *ins : *i) {
+            for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+                if (HighLevel::is_use(ins, j)) {
+                    const Operand &operand = ins->get_operand(j);
+                    uses[operand.get_base_reg()]++;
+                    if (operand.has_index_reg()) {
+                        uses[operand.get_index_reg()]++;
+                    }
+                }
+            }
+        }
+    }
+    return uses;
+}
+
+bool InductionVariableStrengthReduction::match_hl(int base, int hl_opcode) {
+    return hl_opcode >= base && hl_opcode < (base + 4);
+}
+
+// ValueRangeOptimization
+
+ValueRangeOptimization::ValueRangeOptimization(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_ranges(cfg)
+        , m_next_vreg(LocalStorageAllocation::VREG_FIRST_LOCAL) {
+    m_ranges.execute();
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                const Operand &operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    m_next_vreg = std::max(m_next_vreg, operand.get_base_reg() + 1);
+                }
+                if (operand.has_index_reg()) {
+                    m_next_vreg = std::max(m_next_vreg, operand.get_index_reg() + 1);
+                }
+            }
+        }
+    }
+}
+
+std::shared_ptr<InstructionSequence> ValueRangeOptimization::transform_basic_block(const InstructionSequence *orig_bb) {
+    return m_code[dynamic_cast<const BasicBlock *>(orig_bb)->get_id()];
+}
+
+/// Transform the code of each block, and if branches were found to always
+/// go the same way, remove the edges they never take, and the blocks
+/// which can then no longer be reached.
+/// \return the transformed control-flow graph
+std::shared_ptr<ControlFlowGraph> ValueRangeOptimization::transform_cfg() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+
+    // the outcome of the branch ending each block: 1 if it is always
+    // taken, 0 if it never is, and -1 if it depends on the values compared
+    std::vector<int> outcomes(cfg->get_num_blocks(), -1);
+    m_code.assign(cfg->get_num_blocks(), nullptr);
+    bool decided = false;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        m_code[bb->get_id()] = rewrite(bb, outcomes[bb->get_id()]);
+        decided = decided || outcomes[bb->get_id()] >= 0;
+    }
+    if (!decided) {
+        return ControlFlowGraphTransform::transform_cfg();
+    }
+
+    auto is_taken = [&outcomes](const Edge *edge) {
+        int outcome = outcomes[edge->get_source()->get_id()];
+        return outcome < 0 || (edge->get_kind() == EDGE_BRANCH) == (outcome == 1);
+    };
+
+    std::vector<bool> reached(cfg->get_num_blocks(), false);
+    std::vector<BasicBlock *> work = { cfg->get_entry_block() };
+    reached[cfg->get_entry_block()->get_id()] = true;
+    reached[cfg->get_exit_block()->get_id()] = true;
+    while (!work.empty()) {
+        BasicBlock *bb = work.back();
+        work.pop_back();
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        for (auto i = outgoing.begin(); i != outgoing.end(); i++) {
+            BasicBlock *target = (*i)->get_target();
+            if (is_taken(*i) && !reached[target->get_id()]) {
+                reached[target->get_id()] = true;
+                work.push_back(target);
+            }
+        }
+    }
+
+    std::shared_ptr<ControlFlowGraph> result(new ControlFlowGraph());
+    std::vector<BasicBlock *> block_map(cfg->get_num_blocks(), nullptr);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        if (!reached[orig->get_id()]) {
+            continue;
+        }
+        BasicBlock *bb = result->create_basic_block(orig->get_kind(), orig->get_code_order(), orig->get_label());
+        const std::shared_ptr<InstructionSequence> &code = m_code[orig->get_id()];
+        for (auto j = code->cbegin(); j != code->cend(); j++) {
+            bb->append((*j)->duplicate());
+        }
+        block_map[orig->get_id()] = bb;
+    }
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        if (!reached[orig->get_id()]) {
+            continue;
+        }
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            Edge *edge = *j;
+            if (is_taken(edge)) {
+                result->create_edge(block_map[orig->get_id()], block_map[edge->get_target()->get_id()], edge->get_kind());
+            }
+        }
+    }
+    return result;
+}
+
+/// Transform the code of a block, keeping track of the ranges of the
+/// values of vregs from one instruction to the next.
+/// \param bb the block
+/// \param outcome set to 1 if the branch ending the block is always taken
+///                (it becomes a jmp), 0 if it never is (it is removed),
+///                and otherwise -1
+/// \return the transformed code
+std::shared_ptr<InstructionSequence> ValueRangeOptimization::rewrite(const BasicBlock *bb, int &outcome) {
+    std::shared_ptr<InstructionSequence> result(new InstructionSequence());
+    outcome = -1;
+
+    ValueRangeAnalysis analysis;
+    ValueRangeAnalysis::FactType fact = m_ranges.get_fact_at_beginning_of_block(bb);
+    // the conversions which defined vregs earlier in the block, while
+    // the vregs they converted still have the same values
+    std::map<int, Instruction *> conversions;
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = *i;
+        int opcode = ins->get_opcode();
+        Instruction *replacement = nullptr;
+        bool removed = false;
+
+        // nothing is known in a block which can't be reached
+        if (!fact.is_top) {
+            if (opcode >= HINS_cjmplt_b && opcode <= HINS_cjmpneq_q) {
+                int size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(opcode));
+                ValueRange left = ValueRangeAnalysis::get_operand_range(fact, ins->get_operand(0), size);
+                ValueRange right = ValueRangeAnalysis::get_operand_range(fact, ins->get_operand(1), size);
+                outcome = ValueRangeAnalysis::decide(ValueRangeAnalysis::Relation((opcode - HINS_cjmplt_b) / 4), left, right);
+                if (outcome == 1) {
+                    replacement = new Instruction(HINS_jmp, ins->get_operand(2));
+                } else if (outcome == 0) {
+                    removed = true;
+                } else if (size == 8 && left.fits(4) && right.fits(4)) {
+                    // compare the low halves
+                    replacement = new Instruction(opcode - 1, ins->get_operand(0), ins->get_operand(1), ins->get_operand(2));
+                }
+            } else if ((opcode == HINS_cjmp_t || opcode == HINS_cjmp_f) && ins->get_operand(0).get_kind() == Operand::VREG
+                       && fact.ranges.count(ins->get_operand(0).get_base_reg()) > 0) {
+                const ValueRange &condition = fact.ranges.at(ins->get_operand(0).get_base_reg());
+                outcome = ValueRangeAnalysis::decide(opcode == HINS_cjmp_t ? ValueRangeAnalysis::NEQ : ValueRangeAnalysis::EQ,
+                                                     condition, ValueRange::constant(0, condition.size));
+                if (outcome == 1) {
+                    replacement = new Instruction(HINS_jmp, ins->get_operand(1));
+                } else if (outcome == 0) {
+                    removed = true;
+                }
+            } else if (opcode >= HINS_cmplt_b && opcode <= HINS_cmpneq_q) {
+                // a comparison with a known result is a move of the result
+                ValueRange value = ValueRangeAnalysis::evaluate(ins, fact);
+                if (value.is_constant()) {
+                    int mov_opcode = HINS_mov_b + (opcode - HINS_cmplt_b) % 4;
+                    replacement = new Instruction(mov_opcode, ins->get_operand(0), Operand(Operand::IMM_IVAL, value.lo));
+                }
+            } else if (opcode >= HINS_sconv_bw && opcode <= HINS_uconv_lq) {
+                bool is_signed = opcode <= HINS_sconv_lq;
+                int from_size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(opcode));
+                int to_size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(opcode));
+                Operand source = ins->get_operand(1);
+                bool combined = false;
+
+                // a conversion of the result of a conversion converts the
+                // original value, if the first one widened it
+                auto earlier = (source.get_kind() == Operand::VREG) ? conversions.find(source.get_base_reg()) : conversions.end();
+                if (earlier != conversions.end()
+                    && highlevel_opcode_get_dest_operand_size(HighLevelOpcode(earlier->second->get_opcode())) == from_size) {
+                    Instruction *first = earlier->second;
+                    bool first_signed = first->get_opcode() <= HINS_sconv_lq;
+                    int first_size = highlevel_opcode_get_source_operand_size(HighLevelOpcode(first->get_opcode()));
+                    // extending a zero-extended value zero-extends the
+                    // original one, and a sign-extended value is only
+                    // zero-extended if it isn't negative
+                    if (!first_signed || is_signed
+                        || ValueRangeAnalysis::get_operand_range(fact, first->get_operand(1), first_size).is_nonnegative()) {
+                        combined = true;
+                        is_signed = first_signed && is_signed;
+                        from_size = first_size;
+                        source = first->get_operand(1);
+                    }
+                }
+
+                // a value which isn't negative is zero-extended to 64 bits
+                // by any write of its 32-bit register
+                if (is_signed && from_size == 4 && to_size == 8
+                    && ValueRangeAnalysis::get_operand_range(fact, source, from_size).is_nonnegative()) {
+                    is_signed = false;
+                }
+
+                int new_opcode = get_conversion_opcode(is_signed, from_size, to_size);
+                if (new_opcode != opcode || combined) {
+                    replacement = new Instruction(new_opcode, ins->get_operand(0), source);
+                }
+            } else if ((opcode == HINS_div_q || opcode == HINS_mod_q || opcode == HINS_udiv_q || opcode == HINS_umod_q)
+                       && ins->get_operand(0).get_kind() == Operand::VREG) {
+                // divide values which fit in 32 bits with a 32-bit division:
+                // nonnegative values with an unsigned one
+                ValueRange left = ValueRangeAnalysis::get_operand_range(fact, ins->get_operand(1), 8);
+                ValueRange right = ValueRangeAnalysis::get_operand_range(fact, ins->get_operand(2), 8);
+                bool remainder = (opcode == HINS_mod_q || opcode == HINS_umod_q);
+                int narrow_opcode = -1, conversion = -1;
+                if (left.lo >= 0 && right.lo >= 0 && left.hi <= long(UINT_MAX) && right.hi <= long(UINT_MAX)) {
+                    narrow_opcode = remainder ? HINS_umod_l : HINS_udiv_l;
+                    conversion = HINS_uconv_lq;
+                } else if ((opcode == HINS_div_q || opcode == HINS_mod_q) && left.fits(4) && right.fits(4)
+                           && !(left.lo == INT_MIN && right.lo <= -1 && right.hi >= -1)) {
+                    narrow_opcode = remainder ? HINS_mod_l : HINS_div_l;
+                    conversion = HINS_sconv_lq;
+                }
+                if (narrow_opcode >= 0) {
+                    Operand temp(Operand::VREG, m_next_vreg++);
+                    result->append(new Instruction(narrow_opcode, temp, ins->get_operand(1), ins->get_operand(2)));
+                    replacement = new Instruction(conversion, ins->get_operand(0), temp);
+                }
+            }
+        }
+
+        if (replacement != nullptr) {
+            result->append(replacement);
+        } else if (!removed) {
+            result->append(ins->duplicate());
+        }
+
+        analysis.model_instruction(ins, fact);
+
+        // forget the conversions of vregs which the instruction changes
+        if (opcode == HINS_call || HighLevel::is_def(ins)) {
+            int def = (opcode == HINS_call) ? -1 : ins->get_operand(0).get_base_reg();
+            auto changed = [def](int vreg) {
+                return vreg == def || (def < 0 && vreg < LocalStorageAllocation::VREG_FIRST_LOCAL);
+            };
+            for (auto j = conversions.begin(); j != conversions.end(); ) {
+                if (changed(j->first) || changed(j->second->get_operand(1).get_base_reg())) {
+                    j = conversions.erase(j);
+                } else {
+                    j++;
+                }
+            }
+            if (opcode >= HINS_sconv_bw && opcode <= HINS_uconv_lq && ins->get_operand(1).get_kind() == Operand::VREG
+                && ins->get_operand(1).get_base_reg() != def) {
+                conversions[def] = ins;
+            }
+        }
+    }
+
+    // a block whose code is all removed keeps a nop for its label
+    if (result->get_length() == 0 && bb->get_length() > 0) {
+        result->append(new Instruction(HINS_nop));
+    }
+    return result;
+}
+
+/// Get the opcode of a conversion.
+/// \param is_signed true for a sign extension, false for a zero extension
+/// \param from_size size of the source, in bytes
+/// \param to_size size of the destination, in bytes
+/// \return the opcode
+int ValueRangeOptimization::get_conversion_opcode(bool is_signed, int from_size, int to_size) {
+    // sconv_bw, bl, bq, wl, wq, lq, followed by the uconvs in the same order
+    int index;
+    if (from_size == 1) {
+        index = (to_size == 2) ? 0 : (to_size == 4) ? 1 : 2;
+    } else if (from_size == 2) {
+        index = (to_size == 4) ? 3 : 4;
+    } else {
+        index = 5;
+    }
+    return (is_signed ? HINS_sconv_bw : HINS_uconv_bw) + index;
+}
+
+// ControlFlowSimplification
+
+ControlFlowSimplification::ControlFlowSimplification(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : ControlFlowGraphTransform(cfg) {
+}
+
+ControlFlowSimplification::~ControlFlowSimplification() {
+    for (auto i = m_blocks.begin(); i != m_blocks.end(); i++) {
+        for (auto j = i->code.begin(); j != i->code.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+std::shared_ptr<InstructionSequence> ControlFlowSimplification::transform_basic_block(const InstructionSequence *orig_bb) {
+    return std::shared_ptr<InstructionSequence>(orig_bb->duplicate());
+}
+
+/// Simplify the control flow until nothing changes, and build the
+/// control-flow graph of the blocks which remain.
+/// \return the transformed control-flow graph
+std::shared_ptr<ControlFlowGraph> ControlFlowSimplification::transform_cfg() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+
+    m_blocks.assign(cfg->get_num_blocks(), Block());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        Block &block = m_blocks[bb->get_id()];
+        block.orig = bb;
+        block.removed = false;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            block.code.push_back((*j)->duplicate());
+        }
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            block.successors.push_back({ (*j)->get_target()->get_id(), (*j)->get_kind() });
+        }
+        if (bb->has_label()) {
+            m_labeled_blocks[bb->get_label()] = bb->get_id();
+        }
+    }
+
+    bool simplified = false;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = m_blocks.begin(); i != m_blocks.end(); i++) {
+            if (!i->removed && i->orig->get_kind() == BASICBLOCK_INTERIOR) {
+                changed = fold_branch(*i) || changed;
+                changed = thread_jumps(*i) || changed;
+            }
+        }
+        changed = remove_unreachable_blocks() || changed;
+        changed = remove_jumps_to_next_block() || changed;
+
+        std::vector<unsigned> num_preds(m_blocks.size(), 0);
+        for (auto i = m_blocks.begin(); i != m_blocks.end(); i++) {
+            for (auto j = i->successors.begin(); j != i->successors.end(); j++) {
+                if (!i->removed) {
+                    num_preds[j->first]++;
+                }
+            }
+        }
+        for (unsigned i = 0; i < m_blocks.size(); i++) {
+            if (!m_blocks[i].removed) {
+                changed = merge_successor(i, num_preds) || changed;
+            }
+        }
+        simplified = simplified || changed;
+    }
+    if (!simplified) {
+        return ControlFlowGraphTransform::transform_cfg();
+    }
+
+    // The instructions are now owned by the blocks of the result
+    std::shared_ptr<ControlFlowGraph> result(new ControlFlowGraph());
+    std::vector<BasicBlock *> block_map(m_blocks.size(), nullptr);
+    for (unsigned i = 0; i < m_blocks.size(); i++) {
+        Block &block = m_blocks[i];
+        if (block.removed) {
+            continue;
+        }
+        BasicBlock *bb = result->create_basic_block(block.orig->get_kind(), block.orig->get_code_order(),
+                                                    block.orig->get_label());
+        for (auto j = block.code.begin(); j != block.code.end(); j++) {
+            bb->append(*j);
+        }
+        block.code.clear();
+        block_map[i] = bb;
+    }
+    for (unsigned i = 0; i < m_blocks.size(); i++) {
+        const Block &block = m_blocks[i];
+        if (block.removed) {
+            continue;
+        }
+        for (auto j = block.successors.begin(); j != block.successors.end(); j++) {
+            result->create_edge(block_map[i], block_map[j->first], j->second);
+        }
+    }
+    return result;
+}
+
+/// Fold the branch ending a block if its outcome is known: a branch
+/// which is always taken becomes a jmp, and one which never is (or
+/// which goes where the block falls through to) is removed.
+/// \param block the block
+/// \return true if the branch was folded
+bool ControlFlowSimplification::fold_branch(Block &block) {
+    if (block.code.empty() || block.successors.size() != 2) {
+        return false;
+    }
+    Instruction *ins = block.code.back();
+    int opcode = ins->get_opcode();
+    if (!HighLevel::is_conditional_jump(opcode)) {
+        return false;
+    }
+
+    int outcome = -1;
+    if (block.successors[0].first == block.successors[1].first) {
+        outcome = 0;
+    } else if (HighLevel::is_compare_and_branch(opcode) && ins->get_operand(0).get_kind() == Operand::IMM_IVAL
+               && ins->get_operand(1).get_kind() == Operand::IMM_IVAL) {
+        int size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(opcode));
+        outcome = ValueRangeAnalysis::decide(ValueRangeAnalysis::Relation((opcode - HINS_cjmplt_b) / 4),
+                                             ValueRange::constant(ins->get_operand(0).get_imm_ival(), size),
+                                             ValueRange::constant(ins->get_operand(1).get_imm_ival(), size));
+    } else if ((opcode == HINS_cjmp_t || opcode == HINS_cjmp_f) && ins->get_operand(0).get_kind() == Operand::IMM_IVAL) {
+        outcome = (ins->get_operand(0).get_imm_ival() != 0) == (opcode == HINS_cjmp_t);
+    }
+    if (outcome < 0) {
+        return false;
+    }
+
+    block.code.pop_back();
+    if (outcome == 1) {
+        block.code.push_back(new Instruction(HINS_jmp, ins->get_operand(ins->get_num_operands() - 1)));
+        remove_successor(block, EDGE_FALLTHROUGH);
+    } else {
+        remove_successor(block, EDGE_BRANCH);
+        if (block.code.empty()) {
+            block.code.push_back(new Instruction(HINS_nop));
+        }
+    }
+    delete ins;
+    return true;
+}
+
+/// Make the jumps and branches ending a block go to the block where
+/// control ends up after passing through blocks which only forward it.
+/// A block which falls through to such a block jumps there instead.
+/// \param block the block
+/// \return true if any target was changed
+bool ControlFlowSimplification::thread_jumps(Block &block) {
+    if (block.code.empty()) {
+        return false;
+    }
+    Instruction *last = block.code.back();
+    bool changed = false;
+
+    if (last->is_multiway_branch()) {
+        const std::shared_ptr<const JumpTable> &jump_table = last->get_jump_table();
+        std::shared_ptr<JumpTable> threaded(new JumpTable(*jump_table));
+        for (auto i = threaded->targets.begin(); i != threaded->targets.end(); i++) {
+            unsigned dest = find_destination(m_labeled_blocks.at(*i));
+            if (get_block_label(dest) != *i) {
+                *i = get_block_label(dest);
+                changed = true;
+            }
+        }
+        if (!changed) {
+            return false;
+        }
+        last->set_jump_table(threaded);
+        block.successors.clear();
+        std::set<unsigned> targets;
+        for (auto i = threaded->targets.begin(); i != threaded->targets.end(); i++) {
+            unsigned target = m_labeled_blocks.at(*i);
+            if (targets.insert(target).second) {
+                block.successors.push_back({ target, EDGE_MULTIWAY });
+            }
+        }
+        return true;
+    }
+
+    for (auto i = block.successors.begin(); i != block.successors.end(); i++) {
+        unsigned dest = find_destination(i->first);
+        if (dest == i->first) {
+            continue;
+        }
+        if (i->second == EDGE_BRANCH) {
+            Operand operands[Instruction::MAX_OPERANDS];
+            unsigned num_operands = last->get_num_operands();
+            for (unsigned j = 0; j < num_operands; j++) {
+                operands[j] = last->get_operand(j);
+            }
+            operands[num_operands - 1] = Operand(Operand::LABEL, get_block_label(dest));
+            Instruction *threaded = new Instruction(last->get_opcode(), operands[0], operands[1], operands[2],
+                                                    operands[3], num_operands);
+            delete last;
+            block.code.back() = last = threaded;
+        } else if (i->second == EDGE_FALLTHROUGH && !HighLevel::is_conditional_jump(last->get_opcode())
+                   && last->get_opcode() != HINS_call) {
+            // (a call must end its block)
+            block.code.push_back(last = new Instruction(HINS_jmp, Operand(Operand::LABEL, get_block_label(dest))));
+            i->second = EDGE_BRANCH;
+        } else {
+            continue;
+        }
+        i->first = dest;
+        changed = true;
+    }
+    return changed;
+}
+
+/// Merge a block with its successor, if the successor is the only one
+/// and the block is its only predecessor (removing the jmp to it). Each
+/// block still falls through to the block after it in the code order.
+/// \param index the index of the block
+/// \param num_preds the number of predecessors of each block
+/// \return true if the blocks were merged
+bool ControlFlowSimplification::merge_successor(unsigned index, const std::vector<unsigned> &num_preds) {
+    Block &block = m_blocks[index];
+    if (block.orig->get_kind() != BASICBLOCK_INTERIOR || block.successors.size() != 1 || block.code.empty()) {
+        return false;
+    }
+    unsigned succ_index = block.successors[0].first;
+    EdgeKind kind = block.successors[0].second;
+    Block &succ = m_blocks[succ_index];
+    if (succ_index == index || succ.orig->get_kind() != BASICBLOCK_INTERIOR || num_preds[succ_index] != 1) {
+        return false;
+    }
+
+    // The merged block takes the place of the first block in the code
+    // order, so the successor must not fall through to another block:
+    // that block follows the successor in the code order
+    bool succ_falls_through = false;
+    for (auto i = succ.successors.begin(); i != succ.successors.end(); i++) {
+        succ_falls_through = succ_falls_through || i->second == EDGE_FALLTHROUGH;
+    }
+
+    Instruction *last = block.code.back();
+    if (kind == EDGE_BRANCH && last->get_opcode() == HINS_jmp && !succ_falls_through) {
+        block.code.pop_back();
+        delete last;
+    } else if (kind != EDGE_FALLTHROUGH || last->get_opcode() == HINS_call) {
+        return false;
+    }
+
+    block.code.insert(block.code.end(), succ.code.begin(), succ.code.end());
+    block.successors = succ.successors;
+    succ.code.clear();
+    succ.successors.clear();
+    succ.removed = true;
+    return true;
+}
+
+/// Remove the blocks which can't be reached from the entry block (the
+/// exit block is always kept).
+/// \return true if any block was removed
+bool ControlFlowSimplification::remove_unreachable_blocks() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    std::vector<bool> reached(m_blocks.size(), false);
+    std::vector<unsigned> work = { cfg->get_entry_block()->get_id() };
+    reached[cfg->get_entry_block()->get_id()] = true;
+    reached[cfg->get_exit_block()->get_id()] = true;
+    while (!work.empty()) {
+        const Block &block = m_blocks[work.back()];
+        work.pop_back();
+        for (auto i = block.successors.begin(); i != block.successors.end(); i++) {
+            if (!reached[i->first]) {
+                reached[i->first] = true;
+                work.push_back(i->first);
+            }
+        }
+    }
+
+    bool changed = false;
+    for (unsigned i = 0; i < m_blocks.size(); i++) {
+        Block &block = m_blocks[i];
+        if (!reached[i] && !block.removed) {
+            for (auto j = block.code.begin(); j != block.code.end(); j++) {
+                delete *j;
+            }
+            block.code.clear();
+            block.successors.clear();
+            block.removed = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/// Remove the jmps to the block which follows in the code order: the
+/// block falls through to it instead.
+/// \return true if any jmp was removed
+bool ControlFlowSimplification::remove_jumps_to_next_block() {
+    std::vector<Block *> blocks;
+    for (auto i = m_blocks.begin(); i != m_blocks.end(); i++) {
+        if (!i->removed) {
+            blocks.push_back(&(*i));
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(), [](const Block *left, const Block *right) {
+        return left->orig->get_code_order() < right->orig->get_code_order();
+    });
+
+    bool changed = false;
+    for (unsigned i = 0; i + 1 < blocks.size(); i++) {
+        Block &block = *blocks[i];
+        if (block.code.empty() || block.code.back()->get_opcode() != HINS_jmp
+            || &m_blocks[block.successors[0].first] != blocks[i + 1]) {
+            continue;
+        }
+        delete block.code.back();
+        block.code.pop_back();
+        if (block.code.empty()) {
+            block.code.push_back(new Instruction(HINS_nop));
+        }
+        block.successors[0].second = EDGE_FALLTHROUGH;
+        changed = true;
+    }
+    return changed;
+}
+
+/// Check whether a block only passes control on to its successor: it
+/// contains nothing but nops, and possibly a jmp at the end.
+/// \param block the block
+/// \return true if the block forwards control
+bool ControlFlowSimplification::is_forwarding(const Block &block) const {
+    if (block.orig->get_kind() != BASICBLOCK_INTERIOR || block.successors.size() != 1) {
+        return false;
+    }
+    for (unsigned i = 0; i < block.code.size(); i++) {
+        int opcode = block.code[i]->get_opcode();
+        if (opcode != HINS_nop && !(opcode == HINS_jmp && i + 1 == block.code.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Find where control goes from a block, passing through the blocks
+/// which only forward it. The destination must have a label (so it can
+/// be jumped to), and the search stops at a cycle of forwarding blocks.
+/// \param index the index of the block
+/// \return the index of the destination block
+unsigned ControlFlowSimplification::find_destination(unsigned index) const {
+    std::set<unsigned> visited = { index };
+    unsigned dest = index;
+    while (is_forwarding(m_blocks[dest])) {
+        unsigned next = m_blocks[dest].successors[0].first;
+        if (m_blocks[next].orig->get_kind() != BASICBLOCK_INTERIOR || !m_blocks[next].orig->has_label()
+            || !visited.insert(next).second) {
+            break;
+        }
+        dest = next;
+    }
+    return dest;
+}
+
+std::string ControlFlowSimplification::get_block_label(unsigned index) const {
+    return m_blocks[index].orig->get_label();
+}
+
+void ControlFlowSimplification::remove_successor(Block &block, EdgeKind kind) {
+    for (auto i = block.successors.begin(); i != block.successors.end(); i++) {
+        if (i->second == kind) {
+            block.successors.erase(i);
+            return;
+        }
+    }
+}
+
+// BlockLayout
+
+namespace {
+
+// Probability that a loop branch stays in the loop, and that a branch
+// goes to a path which returns (Ball and Larus)
+const double LOOP_BRANCH_PROBABILITY = 0.88;
+const double RETURN_BRANCH_PROBABILITY = 0.28;
+
+// Number of times the header of a loop is assumed to be executed each
+// time the loop is entered
+const double LOOP_ITERATIONS = 8.0;
+
+// Get the conditional jump which branches when the given one doesn't,
+// or -1 if there is none
+int get_inverted_branch(int opcode) {
+    if (opcode == HINS_cjmp_t || opcode == HINS_cjmp_f) {
+        return opcode == HINS_cjmp_t ? HINS_cjmp_f : HINS_cjmp_t;
+    }
+    if (!HighLevel::is_compare_and_branch(opcode)) {
+        return -1;
+    }
+    // LT, LTE, GT, GTE, EQ, NEQ
+    static const int INVERTED[] = { 3, 2, 1, 0, 5, 4 };
+    int relation = (opcode - HINS_cjmplt_b) / 4;
+    return HINS_cjmplt_b + INVERTED[relation] * 4 + (opcode - HINS_cjmplt_b) % 4;
+}
+
+}
+
+BlockLayout::BlockLayout(const std::shared_ptr<ControlFlowGraph> &cfg, int next_label_num)
+        : ControlFlowGraphTransform(cfg)
+        , m_dominators(cfg)
+        , m_loops(m_dominators)
+        , m_next_label_num(next_label_num) {
+    estimate_weights();
+}
+
+BlockLayout::~BlockLayout() {
+}
+
+std::shared_ptr<InstructionSequence> BlockLayout::transform_basic_block(const InstructionSequence *orig_bb) {
+    return std::shared_ptr<InstructionSequence>(orig_bb->duplicate());
+}
+
+/// Place the blocks in the order found by the layout: the code order of
+/// each block is its position. A block which no longer falls through to
+/// the block after it has its branch inverted, or jumps (a block ending
+/// with a call or a conditional jump is followed by a new block with the
+/// jump), and a jmp to the block after it is removed.
+/// \return the transformed control-flow graph
+std::shared_ptr<ControlFlowGraph> BlockLayout::transform_cfg() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    std::vector<BasicBlock *> order = find_layout();
+
+    std::shared_ptr<ControlFlowGraph> result(new ControlFlowGraph());
+    std::vector<BasicBlock *> block_map(cfg->get_num_blocks(), nullptr);
+    for (unsigned i = 0; i < order.size(); i++) {
+        BasicBlock *orig = order[i];
+        block_map[orig->get_id()] = result->create_basic_block(orig->get_kind(), int(i * 2), orig->get_label());
+    }
+
+    for (unsigned i = 0; i < order.size(); i++) {
+        BasicBlock *orig = order[i];
+        BasicBlock *bb = block_map[orig->get_id()];
+        BasicBlock *next = (i + 1 < order.size()) ? block_map[order[i + 1]->get_id()] : nullptr;
+
+        std::vector<Instruction *> code;
+        for (auto j = orig->cbegin(); j != orig->cend(); j++) {
+            code.push_back((*j)->duplicate());
+        }
+        int opcode = code.empty() ? -1 : code.back()->get_opcode();
+
+        BasicBlock *fall_target = nullptr, *branch_target = nullptr;
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            Edge *edge = *j;
+            BasicBlock *target = block_map[edge->get_target()->get_id()];
+            if (edge->get_kind() == EDGE_FALLTHROUGH) {
+                fall_target = target;
+            } else if (edge->get_kind() == EDGE_BRANCH) {
+                branch_target = target;
+            } else {
+                result->create_edge(bb, target, EDGE_MULTIWAY);
+            }
+        }
+
+        if (branch_target != nullptr && opcode == HINS_jmp && branch_target == next) {
+            delete code.back();
+            code.pop_back();
+            if (code.empty()) {
+                code.push_back(new Instruction(HINS_nop));
+            }
+            std::swap(fall_target, branch_target);
+        } else if (branch_target == next && fall_target != nullptr && fall_target != next
+                   && get_inverted_branch(opcode) >= 0) {
+            Instruction *branch = code.back();
+            unsigned num_operands = branch->get_num_operands();
+            Operand operands[3];
+            for (unsigned k = 0; k < num_operands; k++) {
+                operands[k] = branch->get_operand(k);
+            }
+            operands[num_operands - 1] = Operand(Operand::LABEL, get_target_label(fall_target));
+            code.back() = new Instruction(get_inverted_branch(opcode), operands[0], operands[1], operands[2], num_operands);
+            delete branch;
+            std::swap(fall_target, branch_target);
+        }
+
+        if (fall_target != nullptr && fall_target != next) {
+            // (the entry block always falls through to the block after it,
+            // and the return to the exit block)
+            assert(orig->get_kind() == BASICBLOCK_INTERIOR && fall_target->get_kind() == BASICBLOCK_INTERIOR);
+            Instruction *jump = new Instruction(HINS_jmp, Operand(Operand::LABEL, get_target_label(fall_target)));
+            if (opcode == HINS_call || HighLevel::is_conditional_jump(opcode)) {
+                // (a call or a branch must end its block)
+                BasicBlock *jump_block = result->create_basic_block(BASICBLOCK_INTERIOR, int(i * 2 + 1));
+                jump_block->append(jump);
+                result->create_edge(jump_block, fall_target, EDGE_BRANCH);
+                result->create_edge(bb, jump_block, EDGE_FALLTHROUGH);
+            } else {
+                code.push_back(jump);
+                result->create_edge(bb, fall_target, EDGE_BRANCH);
+            }
+        } else if (fall_target != nullptr) {
+            result->create_edge(bb, fall_target, EDGE_FALLTHROUGH);
+        }
+        if (branch_target != nullptr) {
+            result->create_edge(bb, branch_target, EDGE_BRANCH);
+        }
+
+        for (auto j = code.begin(); j != code.end(); j++) {
+            bb->append(*j);
+        }
+    }
+    return result;
+}
+
+/// Estimate how often each block is executed, and how often each edge is
+/// taken, for each call: the blocks are visited in reverse postorder, so
+/// the frequency of a block is the sum of the weights of the edges into
+/// it (other than loop back edges), times the number of iterations if
+/// it is the header of a loop. A block is cold if it is only reached by
+/// edges which are predicted to be taken rarely, or from cold blocks.
+/// If the function ran while it was profiled, the counts of its blocks
+/// and edges are used instead, and the blocks which never ran are cold.
+void BlockLayout::estimate_weights() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    m_frequencies.assign(cfg->get_num_blocks(), 0.0);
+    m_cold.assign(cfg->get_num_blocks(), false);
+
+    if (cfg->get_entry_block()->get_count() > 0) {
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            BasicBlock *bb = *i;
+            m_frequencies[bb->get_id()] = double(bb->get_count());
+            m_cold[bb->get_id()] = bb->get_count() == 0 && bb->get_kind() == BASICBLOCK_INTERIOR;
+            const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+            for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+                m_weights[*j] = double(std::max(0L, (*j)->get_count()));
+            }
+        }
+        return;
+    }
+
+    const std::vector<BasicBlock *> &rpo = m_dominators.get_reverse_postorder();
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        BasicBlock *bb = *i;
+        if (bb->get_kind() == BASICBLOCK_ENTRY) {
+            m_frequencies[bb->get_id()] = 1.0;
+        } else {
+            double frequency = 0.0;
+            bool is_loop_header = false;
+            bool is_cold = true;
+            const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(bb);
+            for (auto j = incoming.begin(); j != incoming.end(); j++) {
+                if (is_back_edge(*j)) {
+                    is_loop_header = true;
+                } else if (m_dominators.is_reachable((*j)->get_source())) {
+                    auto weight = m_weights.find(*j);
+                    frequency += (weight != m_weights.end()) ? weight->second : 0.0;
+                    bool is_cold_edge;
+                    get_probability(*j, is_cold_edge);
+                    is_cold = is_cold && (is_cold_edge || m_cold[(*j)->get_source()->get_id()]);
+                }
+            }
+            m_frequencies[bb->get_id()] = is_loop_header ? frequency * LOOP_ITERATIONS : frequency;
+            m_cold[bb->get_id()] = is_cold && bb->get_kind() == BASICBLOCK_INTERIOR;
+        }
+
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            bool is_cold_edge;
+            m_weights[*j] = m_frequencies[bb->get_id()] * get_probability(*j, is_cold_edge);
+        }
+    }
+}
+
+/// Estimate the probability that an edge is taken when its source block
+/// is executed. The loop heuristic comes first: a back edge is likely to
+/// be taken, and an edge leaving the innermost loop of the source is
+/// unlikely to be if the other edge stays in it. Otherwise, an edge to
+/// a path which returns is unlikely to be taken if the other edge's path
+/// doesn't (and the edge is cold).
+/// \param edge the edge
+/// \param is_cold set to true if the edge is predicted to be taken rarely
+/// \return the probability
+double BlockLayout::get_probability(const Edge *edge, bool &is_cold) const {
+    is_cold = false;
+    const ControlFlowGraph::EdgeList &outgoing = m_dominators.get_cfg()->get_outgoing_edges(edge->get_source());
+    if (outgoing.size() == 1) {
+        return 1.0;
+    }
+    if (edge->get_kind() == EDGE_MULTIWAY || outgoing.size() != 2) {
+        return 1.0 / outgoing.size();
+    }
+    const Edge *other = (outgoing[0] == edge) ? outgoing[1] : outgoing[0];
+    if (other->get_target() == edge->get_target()) {
+        return 0.5;
+    }
+
+    if (is_back_edge(edge) != is_back_edge(other)) {
+        return is_back_edge(edge) ? LOOP_BRANCH_PROBABILITY : 1.0 - LOOP_BRANCH_PROBABILITY;
+    }
+    const Loop *loop = m_loops.get_loop_for(edge->get_source());
+    if (loop != nullptr && loop->contains(edge->get_target()) != loop->contains(other->get_target())) {
+        return loop->contains(edge->get_target()) ? LOOP_BRANCH_PROBABILITY : 1.0 - LOOP_BRANCH_PROBABILITY;
+    }
+    if (is_returning(edge->get_target()) != is_returning(other->get_target())) {
+        is_cold = is_returning(edge->get_target());
+        return is_cold ? RETURN_BRANCH_PROBABILITY : 1.0 - RETURN_BRANCH_PROBABILITY;
+    }
+    return 0.5;
+}
+
+bool BlockLayout::is_back_edge(const Edge *edge) const {
+    return m_dominators.is_reachable(edge->get_source()) && m_dominators.dominates(edge->get_target(), edge->get_source());
+}
+
+/// Check whether control goes straight from a block to the return,
+/// through blocks with a single successor.
+/// \param bb the block
+/// \return true if the block's path returns
+bool BlockLayout::is_returning(const BasicBlock *bb) const {
+    std::shared_ptr<ControlFlowGraph> cfg = m_dominators.get_cfg();
+    std::set<const BasicBlock *> visited;
+    while (bb->get_kind() != BASICBLOCK_EXIT) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        if (outgoing.size() != 1 || !visited.insert(bb).second) {
+            return false;
+        }
+        bb = outgoing[0]->get_target();
+    }
+    return true;
+}
+
+/// Check whether the layout may place the target of an edge right after
+/// its source, so the source falls through to it.
+/// \param edge the edge
+/// \return true if the edge can become a fall through
+bool BlockLayout::can_fall_through(const Edge *edge) const {
+    if (edge->get_source() == edge->get_target() || edge->get_target()->get_kind() == BASICBLOCK_ENTRY) {
+        return false;
+    }
+    if (edge->get_kind() == EDGE_FALLTHROUGH) {
+        return true;
+    }
+    if (edge->get_kind() == EDGE_MULTIWAY) {
+        return false;
+    }
+    int opcode = edge->get_source()->get_last_instruction()->get_opcode();
+    return opcode == HINS_jmp || get_inverted_branch(opcode) >= 0;
+}
+
+/// Build the chains of blocks, and put them in order.
+/// \return the blocks in the order of the layout
+std::vector<BasicBlock *> BlockLayout::find_layout() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    unsigned num_blocks = cfg->get_num_blocks();
+    std::vector<std::vector<BasicBlock *>> chains(num_blocks);
+    std::vector<unsigned> chain_of(num_blocks);
+    std::vector<BasicBlock *> blocks;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        chains[bb->get_id()].push_back(bb);
+        chain_of[bb->get_id()] = bb->get_id();
+        blocks.push_back(bb);
+    }
+    std::sort(blocks.begin(), blocks.end(), [](const BasicBlock *left, const BasicBlock *right) {
+        return left->get_code_order() < right->get_code_order();
+    });
+
+    // The edge from the entry and the edge to the exit must fall through,
+    // so they come first; then the heaviest edges, and of edges with the
+    // same weight, those which already fell through
+    std::vector<Edge *> edges;
+    for (auto i = blocks.begin(); i != blocks.end(); i++) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(*i);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            if (can_fall_through(*j)) {
+                edges.push_back(*j);
+            }
+        }
+    }
+    auto is_fixed = [](const Edge *edge) {
+        return edge->get_source()->get_kind() == BASICBLOCK_ENTRY || edge->get_target()->get_kind() == BASICBLOCK_EXIT;
+    };
+    std::stable_sort(edges.begin(), edges.end(), [&](const Edge *left, const Edge *right) {
+        if (is_fixed(left) != is_fixed(right)) {
+            return is_fixed(left);
+        }
+        if (m_weights[left] != m_weights[right]) {
+            return m_weights[left] > m_weights[right];
+        }
+        return left->get_kind() == EDGE_FALLTHROUGH && right->get_kind() != EDGE_FALLTHROUGH;
+    });
+
+    for (auto i = edges.begin(); i != edges.end(); i++) {
+        std::vector<BasicBlock *> &source_chain = chains[chain_of[(*i)->get_source()->get_id()]];
+        std::vector<BasicBlock *> &target_chain = chains[chain_of[(*i)->get_target()->get_id()]];
+        if (&source_chain == &target_chain || source_chain.back() != (*i)->get_source()
+            || target_chain.front() != (*i)->get_target()) {
+            continue;
+        }
+        // the chains of the entry and the exit can only be joined if no
+        // other blocks are left, since they must go between them
+        if (source_chain.front()->get_kind() == BASICBLOCK_ENTRY && target_chain.back()->get_kind() == BASICBLOCK_EXIT
+            && source_chain.size() + target_chain.size() < num_blocks) {
+            continue;
+        }
+        for (auto j = target_chain.begin(); j != target_chain.end(); j++) {
+            chain_of[(*j)->get_id()] = chain_of[source_chain.front()->get_id()];
+        }
+        source_chain.insert(source_chain.end(), target_chain.begin(), target_chain.end());
+        target_chain.clear();
+    }
+
+    // The chains other than those of the entry and exit, hot chains first,
+    // each in the original order of their first blocks
+    std::vector<BasicBlock *> hot, cold;
+    for (auto i = blocks.begin(); i != blocks.end(); i++) {
+        const std::vector<BasicBlock *> &chain = chains[(*i)->get_id()];
+        if (chain.empty() || chain.front()->get_kind() == BASICBLOCK_ENTRY || chain.back()->get_kind() == BASICBLOCK_EXIT) {
+            continue;
+        }
+        bool is_cold = true;
+        for (auto j = chain.begin(); j != chain.end(); j++) {
+            is_cold = is_cold && m_cold[(*j)->get_id()];
+        }
+        std::vector<BasicBlock *> &dest = is_cold ? cold : hot;
+        dest.insert(dest.end(), chain.begin(), chain.end());
+    }
+
+    std::vector<BasicBlock *> order = chains[chain_of[cfg->get_entry_block()->get_id()]];
+    order.insert(order.end(), hot.begin(), hot.end());
+    order.insert(order.end(), cold.begin(), cold.end());
+    if (chain_of[cfg->get_exit_block()->get_id()] != chain_of[cfg->get_entry_block()->get_id()]) {
+        const std::vector<BasicBlock *> &exit_chain = chains[chain_of[cfg->get_exit_block()->get_id()]];
+        order.insert(order.end(), exit_chain.begin(), exit_chain.end());
+    }
+    return order;
+}
+
+/// Get the label of a block which is jumped to, giving it a new label if
+/// it had none (it was only fallen through to).
+/// \param bb the block
+/// \return the label
+std::string BlockLayout::get_target_label(BasicBlock *bb) {
+    if (!bb->has_label()) {
+        bb->set_label(".L" + std::to_string(m_next_label_num++));
+    }
+    return bb->get_label();
+}
+
+// IfConversion
+
+namespace {
+
+// Most that the instructions executed speculatively (whichever way the
+// branch goes) may cost: a well predicted branch costs about a cycle,
+// and a mispredicted one 15 to 20
+const int MAX_SPECULATED_COST = 4;
+
+// Does the instruction mention the vreg?
+bool mentions_vreg(const Instruction *ins, int vreg) {
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        const Operand &operand = ins->get_operand(i);
+        if ((operand.has_base_reg() && operand.get_base_reg() == vreg)
+            || (operand.has_index_reg() && operand.get_index_reg() == vreg)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_comparison(int opcode) {
+    return opcode >= HINS_cmplt_b && opcode <= HINS_cmpneq_q;
+}
+
+}
+
+IfConversion::IfConversion(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_live_vregs(cfg)
+        , m_dominators(cfg)
+        , m_loops(m_dominators)
+        , m_next_vreg(LocalStorageAllocation::VREG_FIRST_LOCAL) {
+    m_live_vregs.execute();
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                const Operand &operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    m_next_vreg = std::max(m_next_vreg, operand.get_base_reg() + 1);
+                }
+                if (operand.has_index_reg()) {
+                    m_next_vreg = std::max(m_next_vreg, operand.get_index_reg() + 1);
+                }
+            }
+        }
+    }
+}
+
+std::shared_ptr<InstructionSequence> IfConversion::transform_basic_block(const InstructionSequence *orig_bb) {
+    return std::shared_ptr<InstructionSequence>(orig_bb->duplicate());
+}
+
+/// Replace the branches which only choose the value of one vreg with
+/// selects. The arms of a converted branch are removed, and its block
+/// continues with the block where the arms joined. Converting an inner
+/// if can make the enclosing one convertible, so the function is
+/// transformed again until nothing changes.
+/// \return the transformed control-flow graph
+std::shared_ptr<ControlFlowGraph> IfConversion::transform_cfg() {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+
+    std::vector<Conversion> conversions;
+    std::vector<int> conversion_for_head(cfg->get_num_blocks(), -1);
+    std::vector<bool> removed(cfg->get_num_blocks(), false);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        Conversion conversion;
+        if (convert(*i, conversion)) {
+            conversion_for_head[conversion.head->get_id()] = int(conversions.size());
+            removed[conversion.fall_arm->get_id()] = true;
+            if (conversion.branch_arm != nullptr) {
+                removed[conversion.branch_arm->get_id()] = true;
+            }
+            conversions.push_back(conversion);
+        }
+    }
+    if (conversions.empty()) {
+        return ControlFlowGraphTransform::transform_cfg();
+    }
+
+    std::shared_ptr<ControlFlowGraph> result(new ControlFlowGraph());
+    std::vector<BasicBlock *> block_map(cfg->get_num_blocks(), nullptr);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        if (!removed[orig->get_id()]) {
+            block_map[orig->get_id()] = result->create_basic_block(orig->get_kind(), orig->get_code_order(), orig->get_label());
+        }
+    }
+
+    // a converted block falls through to the join block if it still
+    // follows in code order, and otherwise jumps to it
+    std::vector<const BasicBlock *> order(cfg->bb_begin(), cfg->bb_end());
+    std::sort(order.begin(), order.end(), [](const BasicBlock *left, const BasicBlock *right) {
+        return left->get_code_order() < right->get_code_order();
+    });
+    for (Conversion &conversion : conversions) {
+        auto pos = std::find(order.begin(), order.end(), conversion.head) + 1;
+        while (pos != order.end() && removed[(*pos)->get_id()]) {
+            pos++;
+        }
+        BasicBlock *head = block_map[conversion.head->get_id()];
+        BasicBlock *join = block_map[conversion.join->get_id()];
+        if (pos != order.end() && *pos == conversion.join) {
+            result->create_edge(head, join, EDGE_FALLTHROUGH);
+        } else {
+            conversion.code.push_back(new Instruction(HINS_jmp, Operand(Operand::LABEL, join->get_label())));
+            result->create_edge(head, join, EDGE_BRANCH);
+        }
+    }
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *bb = block_map[orig->get_id()];
+        if (bb == nullptr) {
+            continue;
+        }
+        int index = conversion_for_head[orig->get_id()];
+        if (index >= 0) {
+            for (Instruction *ins : conversions[index].code) {
+                bb->append(ins);
+            }
+            continue;
+        }
+
+        for (auto j = orig->cbegin(); j != orig->cend(); j++) {
+            bb->append((*j)->duplicate());
+        }
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            Edge *edge = *j;
+            result->create_edge(bb, block_map[edge->get_target()->get_id()], edge->get_kind());
+        }
+    }
+
+    IfConversion again(result);
+    return again.transform_cfg();
+}
+
+/// Check whether the branch ending a block can be converted, and if so,
+/// make the code replacing the block and its arms: the block's own code,
+/// the computations of both arms, and a select of the vreg they assign.
+/// \param head the block ending with the branch
+/// \param conversion the conversion (set if the branch can be converted)
+/// \return true if the branch can be converted
+bool IfConversion::convert(BasicBlock *head, Conversion &conversion) {
+    std::shared_ptr<ControlFlowGraph> cfg = get_orig_cfg();
+    if (head->get_kind() != BASICBLOCK_INTERIOR || head->get_length() == 0) {
+        return false;
+    }
+    Instruction *branch = head->get_last_instruction();
+    int opcode = branch->get_opcode();
+    bool is_compare_and_branch = HighLevel::is_compare_and_branch(opcode);
+    if (!is_compare_and_branch
+        && ((opcode != HINS_cjmp_t && opcode != HINS_cjmp_f) || branch->get_operand(0).get_kind() != Operand::VREG)) {
+        return false;
+    }
+
+    // find the shape: a diamond, where the arms join after the branch
+    // target, or a triangle, where the arm skipped by the branch
+    // continues at the branch target
+    const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(head);
+    if (outgoing.size() != 2) {
+        return false;
+    }
+    BasicBlock *fall = nullptr, *target = nullptr;
+    for (Edge *edge : outgoing) {
+        if (edge->get_kind() == EDGE_FALLTHROUGH) {
+            fall = edge->get_target();
+        } else if (edge->get_kind() == EDGE_BRANCH) {
+            target = edge->get_target();
+        }
+    }
+    if (fall == nullptr || target == nullptr || fall == target
+        || fall->get_kind() != BASICBLOCK_INTERIOR || cfg->get_incoming_edges(fall).size() != 1
+        || cfg->get_outgoing_edges(fall).size() != 1) {
+        return false;
+    }
+    BasicBlock *join = cfg->get_outgoing_edges(fall).front()->get_target();
+    bool is_triangle = (join == target);
+    if (!is_triangle
+        && (target->get_kind() != BASICBLOCK_INTERIOR || cfg->get_incoming_edges(target).size() != 1
+            || cfg->get_outgoing_edges(target).size() != 1
+            || cfg->get_outgoing_edges(target).front()->get_target() != join)) {
+        return false;
+    }
+    if (join->get_kind() != BASICBLOCK_INTERIOR || join == head || !join->has_label()) {
+        return false;
+    }
+
+    const LiveVregs::FactType &live_at_join = m_live_vregs.get_fact_at_beginning_of_block(join);
+    Arm fall_arm, branch_arm;
+    if (!get_arm(fall, live_at_join, fall_arm)) {
+        return false;
+    }
+    Operand dest = fall_arm.assignment->get_operand(0);
+    int vreg = dest.get_base_reg();
+    if (!is_triangle) {
+        if (!get_arm(target, live_at_join, branch_arm)
+            || branch_arm.assignment->get_opcode() != fall_arm.assignment->get_opcode()
+            || branch_arm.assignment->get_operand(0).get_base_reg() != vreg) {
+            return false;
+        }
+    }
+    if (vreg >= LocalStorageAllocation::VREG_FIRST_LOCAL && !live_at_join.test(vreg)) {
+        return false;
+    }
+    if (fall_arm.cost + branch_arm.cost > MAX_SPECULATED_COST) {
+        return false;
+    }
+    Operand fall_value = fall_arm.assignment->get_operand(1);
+    Operand branch_value = is_triangle ? dest : branch_arm.assignment->get_operand(1);
+
+    // both arms' computations are done before the select, so neither
+    // may change what the other one, or the select, uses
+    const LiveVregs::FactType &live_at_target = m_live_vregs.get_fact_at_beginning_of_block(target);
+    for (Instruction *ins : fall_arm.code) {
+        if (live_at_target.test(ins->get_operand(0).get_base_reg())) {
+            return false;
+        }
+    }
+    for (Instruction *ins : branch_arm.code) {
+        if (fall_value.get_kind() == Operand::VREG && ins->get_operand(0).get_base_reg() == fall_value.get_base_reg()) {
+            return false;
+        }
+    }
+    std::vector<Instruction *> speculated(fall_arm.code);
+    speculated.insert(speculated.end(), branch_arm.code.begin(), branch_arm.code.end());
+
+    // the condition: a compare-and-branch becomes a comparison, and the
+    // comparison setting the boolean of cjmp_t/cjmp_f is moved next to
+    // the select (if nothing speculated gets in the way) so that the
+    // select can use its flags
+    unsigned head_length = head->get_length() - 1;
+    Instruction *compare = nullptr;
+    bool compare_after = true;
+    std::vector<Operand> inputs;
+    if (is_compare_and_branch) {
+        inputs = { branch->get_operand(0), branch->get_operand(1) };
+    } else if (head_length > 0 && is_comparison(head->get_instruction(head_length - 1)->get_opcode())
+               && head->get_instruction(head_length - 1)->get_operand(0).get_base_reg() == branch->get_operand(0).get_base_reg()) {
+        compare = head->get_instruction(--head_length);
+        inputs = { compare->get_operand(1), compare->get_operand(2) };
+    } else {
+        inputs = { branch->get_operand(0) };
+    }
+    for (Instruction *ins : speculated) {
+        int spec_dest = ins->get_operand(0).get_base_reg();
+        if (!is_compare_and_branch && spec_dest == branch->get_operand(0).get_base_reg()) {
+            return false;
+        }
+        if (compare != nullptr && (mentions_vreg(compare, spec_dest) || mentions_vreg(ins, compare->get_operand(0).get_base_reg()))) {
+            compare_after = false;
+        }
+        for (const Operand &input : inputs) {
+            if (input.has_base_reg() && input.get_base_reg() == spec_dest) {
+                compare_after = false;
+            }
+        }
+    }
+
+    if (is_biased(head, inputs)) {
+        return false;
+    }
+
+    Operand condition = branch->get_operand(0);
+    if (is_compare_and_branch) {
+        if (m_next_vreg >= int(LiveVregsAnalysis::MAX_VREGS)) {
+            return false;
+        }
+        condition = Operand(Operand::VREG, m_next_vreg++);
+        compare = new Instruction(HINS_cmplt_b + (opcode - HINS_cjmplt_b), condition, branch->get_operand(0), branch->get_operand(1));
+    } else if (compare != nullptr) {
+        compare = compare->duplicate();
+    }
+
+    std::vector<Instruction *> &code = conversion.code;
+    for (unsigned i = 0; i < head_length; i++) {
+        code.push_back(head->get_instruction(i)->duplicate());
+    }
+    if (compare != nullptr && !compare_after) {
+        code.push_back(compare);
+    }
+    for (Instruction *ins : speculated) {
+        code.push_back(ins->duplicate());
+    }
+    if (compare != nullptr && compare_after) {
+        code.push_back(compare);
+    }
+    // the branch is taken when the condition is true, except for cjmp_f
+    bool true_is_branch = (opcode != HINS_cjmp_f);
+    int sel_opcode = HINS_sel_b + (fall_arm.assignment->get_opcode() - HINS_mov_b);
+    code.push_back(new Instruction(sel_opcode, dest, condition,
+                                   true_is_branch ? branch_value : fall_value,
+                                   true_is_branch ? fall_value : branch_value));
+
+    conversion.head = head;
+    conversion.fall_arm = fall;
+    conversion.branch_arm = is_triangle ? nullptr : target;
+    conversion.join = join;
+    return true;
+}
+
+/// Check whether an arm of a branch can be executed speculatively: it must
+/// end by assigning a vreg (which it may jump after), and compute nothing
+/// else that is used after the arms join, or could fault, or has a side effect.
+/// \param bb the arm's block
+/// \param live_at_join the vregs live where the arms join
+/// \param arm the arm's code (set if it can be speculated)
+/// \return true if the arm can be speculated
+bool IfConversion::get_arm(BasicBlock *bb, const LiveVregs::FactType &live_at_join, Arm &arm) {
+    std::vector<Instruction *> code;
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = *i;
+        if (ins->get_opcode() != HINS_nop) {
+            code.push_back(ins);
+        }
+    }
+    if (!code.empty() && code.back()->get_opcode() == HINS_jmp) {
+        code.pop_back();
+    }
+    if (code.empty()) {
+        return false;
+    }
+
+    Instruction *assignment = code.back();
+    code.pop_back();
+    int opcode = assignment->get_opcode();
+    // there is no conditional move of a byte
+    if (opcode < HINS_mov_w || opcode > HINS_mov_q || assignment->get_operand(0).get_kind() != Operand::VREG
+        || assignment->get_operand(1).is_memref()) {
+        return false;
+    }
+    int vreg = assignment->get_operand(0).get_base_reg();
+
+    for (Instruction *ins : code) {
+        int ins_opcode = ins->get_opcode();
+        bool is_division = (ins_opcode >= HINS_div_b && ins_opcode <= HINS_mod_q)
+                           || (ins_opcode >= HINS_udiv_b && ins_opcode <= HINS_umod_q);
+        if (!LocalValueNumbering::is_value_op(ins_opcode) || is_division || !HighLevel::is_def(ins)) {
+            return false;
+        }
+        for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+            if (ins->get_operand(i).is_memref()) {
+                return false;
+            }
+        }
+        int dest = ins->get_operand(0).get_base_reg();
+        if (dest < LocalStorageAllocation::VREG_FIRST_LOCAL || dest == vreg || live_at_join.test(dest)) {
+            return false;
+        }
+    }
+
+    // only the computations the assigned value needs are kept (the rest
+    // is dead, since nothing computed is live after the join)
+    std::set<int> needed;
+    if (assignment->get_operand(1).get_kind() == Operand::VREG) {
+        needed.insert(assignment->get_operand(1).get_base_reg());
+    }
+    arm.code.clear();
+    arm.cost = 0;
+    for (auto i = code.rbegin(); i != code.rend(); i++) {
+        Instruction *ins = *i;
+        int dest = ins->get_operand(0).get_base_reg();
+        if (needed.count(dest) == 0) {
+            continue;
+        }
+        needed.erase(dest);
+        for (unsigned j = 1; j < ins->get_num_operands(); j++) {
+            if (ins->get_operand(j).get_kind() == Operand::VREG) {
+                needed.insert(ins->get_operand(j).get_base_reg());
+            }
+        }
+        arm.code.insert(arm.code.begin(), ins);
+        arm.cost += get_speculation_cost(ins->get_opcode());
+    }
+    arm.assignment = assignment;
+    return true;
+}
+
+/// A branch in a loop on a condition computed from values which are the
+/// same on every iteration goes the same way every time, so it is always
+/// predicted correctly, and converting it would only add work.
+/// \param head the block ending with the branch
+/// \param inputs the operands the condition is computed from
+/// \return true if the branch is biased
+bool IfConversion::is_biased(BasicBlock *head, const std::vector<Operand> &inputs) {
+    Loop *loop = m_loops.get_loop_for(head);
+    if (loop == nullptr) {
+        return false;
+    }
+    std::set<int> vregs;
+    for (const Operand &input : inputs) {
+        if (input.is_memref()) {
+            return false;
+        }
+        if (input.get_kind() == Operand::VREG) {
+            vregs.insert(input.get_base_reg());
+        }
+    }
+    for (BasicBlock *bb : loop->blocks) {
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            Instruction *ins = *i;
+            if (HighLevel::is_def(ins) && vregs.count(ins->get_operand(0).get_base_reg()) != 0) {
+                return false;
+            }
+            if (ins->get_opcode() == HINS_call && !vregs.empty()
+                && *vregs.begin() < LocalStorageAllocation::VREG_FIRST_LOCAL) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// Estimated cost in cycles of executing an instruction speculatively
+int IfConversion::get_speculation_cost(int opcode) {
+    return (opcode >= HINS_mul_b && opcode <= HINS_mul_q) ? 3 : 1;
+}
+
+// LIVE ANALYSIS
+LiveRegisters::LiveRegisters(const std::shared_ptr<ControlFlowGraph> &cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_live_vregs(cfg) {
+    m_live_vregs.execute();
+}
+
+LiveRegisters::~LiveRegisters() {
+}
+
+std::shared_ptr<InstructionSequence>
+LiveRegisters::transform_basic_block(const InstructionSequence *orig_bb) {
+    // LiveVregs needs a pointer to a BasicBlock object to get a dataflow
+    // fact for that basic block
+    const auto *orig_bb_as_basic_block =
+            dynamic_cast<const BasicBlock *>(orig_bb);
+
+    std::shared_ptr<InstructionSequence> result_iseq(new InstructionSequence());
+
+    for (auto i = orig_bb->cbegin(); i != orig_bb->cend(); ++i) {
+        Instruction *orig_ins = *i;
+        bool preserve_instruction = true;
+
+        if (HighLevel::is_def(orig_ins)) {
+            Operand dest = orig_ins->get_operand(0);
+
+            LiveVregs::FactType live_after =
+                    m_live_vregs.get_fact_after_instruction(orig_bb_as_basic_block, orig_ins);
+
+            if (!live_after.test(dest.get_base_reg()) && !is_caller_saved(dest.get_base_reg()))
+                // destination register is dead immediately after this instruction,
+                // so it can be eliminated
+                preserve_instruction = false;
+        }
+
+        if (preserve_instruction)
+            result_iseq->append(orig_ins->duplicate());
+    }
+
+    // a block whose code is all dead keeps a nop for its label
+    if (result_iseq->get_length() == 0 && orig_bb->get_length() > 0)
+        result_iseq->append(new Instruction(HINS_nop));
+
+    return result_iseq;
+
+}
+
+
+bool LiveRegisters::is_caller_saved(int vreg_num) {
+    // the return value and argument vregs are used by ret and call
+    // instructions, which liveness doesn't see
+    if (vreg_num < LocalStorageAllocation::VREG_FIRST_ARG + 6) {
         return true;
     }
     return false;
@@ -5,9 +5,18 @@
 #ifndef COMPILERS_2_OPTIMIZATIONS_H
 #define COMPILERS_2_OPTIMIZATIONS_H
 
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "cfg.h"
 #include "cfg_transform.h"
 #include "live_vregs.h"
+#include "reaching_defs.h"
+#include "value_ranges.h"
+#include "dominators.h"
+#include "loops.h"
 
 class ConstantPropagation : public ControlFlowGraphTransform {
 private:
@@ -45,6 +54,402 @@ public:
 };
 
 
+class LocalValueNumbering : public ControlFlowGraphTransform {
+protected:
+    // A computed value: the opcode and the value numbers of its source operands
+    struct ValueKey {
+        int opcode;
+        int left;
+        int right;
+
+        bool operator==(const ValueKey &other) const {
+            return opcode == other.opcode && left == other.left && right == other.right;
+        }
+    };
+
+    struct ValueKeyHash {
+        std::size_t operator()(const ValueKey &key) const;
+    };
+
+    int m_next_vn;
+    std::unordered_map<ValueKey, int, ValueKeyHash> m_values;
+    // values loaded from memory, only known until the next store or call
+    std::unordered_map<ValueKey, int, ValueKeyHash> m_loads;
+    // value numbers of constants, by value and width (a vreg holding a
+    // narrower constant can't stand for a wider one)
+    std::map<std::pair<long, int>, int> m_constants;
+    std::unordered_map<std::string, int> m_labels;
+    std::map<int, long> m_constant_of;
+    std::map<int, int> m_vreg_vn;
+    std::map<int, std::vector<int>> m_holders;
+
+public:
+    explicit LocalValueNumbering(const std::shared_ptr<ControlFlowGraph> &cfg);
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+    static bool is_value_op(int opcode);
+
+protected:
+    std::shared_ptr<InstructionSequence> number_block(const InstructionSequence *orig_bb);
+
+    void reset();
+
+    // Value number of a vreg not yet assigned in the current block
+    virtual int entry_vn(int vreg);
+
+    // Record a computed value in the value table
+    virtual void record_value(const ValueKey &key, int vn);
+
+    // Make a vreg hold a value
+    virtual void assign(int vreg, int vn);
+
+    // Called with each instruction of the original block defining a vreg
+    virtual void defined(const Instruction *orig_ins, int vn);
+
+    int vreg_vn(int vreg);
+
+    int operand_vn(const Operand &operand, int size);
+
+    int find_holder(int vn, bool any_vreg);
+
+    Operand canonical(const Operand &operand);
+
+    static ValueKey make_key(int opcode, int left, int right);
+
+    static bool match_hl(int base, int hl_opcode);
+};
+
+
+class GlobalValueNumbering : public LocalValueNumbering {
+private:
+    ReachingDefs m_reaching_defs;
+    DominatorTree m_dominators;
+    const BasicBlock *m_cur_block;
+    // value numbers of the definitions (and of the values reaching from
+    // function entry or clobbered by a call)
+    std::map<const Instruction *, int> m_def_vn;
+    std::map<int, int> m_initial_vn;
+    std::map<std::pair<const Instruction *, int>, int> m_clobbered_vn;
+    // undo logs restoring the value table and holders when leaving
+    // a dominator subtree
+    std::vector<std::pair<ValueKey, int>> m_value_log;
+    std::vector<int> m_holder_log;
+    std::map<const InstructionSequence *, std::shared_ptr<InstructionSequence>> m_numbered;
+
+public:
+    explicit GlobalValueNumbering(const std::shared_ptr<ControlFlowGraph> &cfg);
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+private:
+    void visit(BasicBlock *bb);
+
+    int entry_vn(int vreg) override;
+
+    void record_value(const ValueKey &key, int vn) override;
+
+    void assign(int vreg, int vn) override;
+
+    void defined(const Instruction *orig_ins, int vn) override;
+};
+
+
+// Base class for transformations of the loops of a function. It keeps a
+// working copy of the code (one slot per original block, followed by
+// the preheaders created for loops) from which the result is built.
+class LoopTransform : public ControlFlowGraphTransform {
+protected:
+    // A preheader block created for a loop which didn't have one
+    struct CreatedPreheader {
+        BasicBlock *header;
+        std::string label;
+    };
+
+    DominatorTree m_dominators;
+    LoopInfo m_loops;
+    std::vector<std::vector<Instruction *>> m_code;
+    std::vector<CreatedPreheader> m_created;
+    std::map<unsigned, unsigned> m_created_for_header;
+    // number of definitions of each vreg in the function
+    std::map<int, int> m_def_count;
+    // first vreg number not used in the function
+    int m_next_vreg;
+
+public:
+    explicit LoopTransform(const std::shared_ptr<ControlFlowGraph> &cfg);
+    ~LoopTransform() override;
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+protected:
+    void load_code();
+
+    int find_preheader(const Loop *loop);
+
+    std::vector<unsigned> get_loop_slots(const Loop *loop);
+
+    const BasicBlock *get_slot_block(unsigned slot);
+
+    void append_to_preheader(unsigned preheader, const std::vector<Instruction *> &code);
+
+    std::shared_ptr<ControlFlowGraph> build_cfg();
+};
+
+
+class LoopInvariantCodeMotion : public LoopTransform {
+private:
+    // What is known about the code of a loop while looking for invariants
+    struct LoopSummary {
+        const Loop *loop;
+        std::vector<unsigned> slots;
+        std::map<int, int> defs;
+        bool writes_memory;
+        std::vector<BasicBlock *> exiting;
+        std::set<Instruction *> invariant;
+    };
+
+    std::set<int> m_frame_addresses;
+    std::map<int, long> m_constant_vregs;
+
+public:
+    explicit LoopInvariantCodeMotion(const std::shared_ptr<ControlFlowGraph> &cfg);
+
+    std::shared_ptr<ControlFlowGraph> transform_cfg() override;
+
+private:
+    void find_frame_addresses();
+
+    void hoist(const Loop *loop);
+
+    bool is_invariant(Instruction *ins, unsigned slot, const LoopSummary &summary);
+
+    bool is_invariant_vreg(int vreg, const LoopSummary &summary);
+
+    bool is_guaranteed(unsigned slot, const LoopSummary &summary);
+};
+
+
+class InductionVariableStrengthReduction : public LoopTransform {
+private:
+    // A basic induction variable: a vreg changed by a constant step
+    // exactly once per iteration
+    struct BasicIV {
+        int vreg;
+        long step;
+        int size;
+        unsigned slot;
+        // the definition of the vreg, and the add computing its new value
+        // (the same instruction unless the sum is computed in a temporary)
+        Instruction *def;
+        Instruction *add;
+    };
+
+    // A derived induction variable base + scale * (iv + offset) kept
+    // in its own vreg
+    struct ReducedIV {
+        int iv;
+        int base;
+        long scale;
+        long offset;
+        int vreg;
+    };
+
+    LiveVregs m_live_vregs;
+
+public:
+    explicit InductionVariableStrengthReduction(const std::shared_ptr<ControlFlowGraph> &cfg);
+
+    std::shared_ptr<ControlFlowGraph> transform_cfg() override;
+
+private:
+    void reduce(const Loop *loop);
+
+    bool find_basic_iv(const Loop *loop, unsigned slot, unsigned index, BasicIV &iv);
+
+    bool match_derived(unsigned slot, unsigned index, const std::map<int, BasicIV> &ivs,
+                       const std::map<int, int> &defs, ReducedIV &derived, unsigned &first);
+
+    Instruction *find_def_before(unsigned slot, unsigned index, int vreg, unsigned &def_index);
+
+    Operand initial_value(unsigned preheader, int vreg);
+
+    void emit_scaled(std::vector<Instruction *> &code, int dest, const ReducedIV &derived, const Operand &value, int size);
+
+    bool remove_dead_code(const std::vector<unsigned> &slots);
+
+    std::map<int, int> count_uses();
+
+    static bool match_hl(int base, int hl_opcode);
+};
+
+
+// Value-range optimization: the ranges of the values of vregs (see
+// value_ranges.h) decide comparisons and branches which have the same
+// outcome for all of the values, show that sign extensions of values which
+// can't be negative are zero extensions (which are free for 32-bit values),
+// combine pairs of extensions, and let 64-bit divisions and comparisons of
+// values which fit in 32 bits use the faster 32-bit instructions.
+class ValueRangeOptimization : public ControlFlowGraphTransform {
+private:
+    ValueRanges m_ranges;
+    int m_next_vreg;
+    // the transformed code of each block
+    std::vector<std::shared_ptr<InstructionSequence>> m_code;
+
+public:
+    explicit ValueRangeOptimization(const std::shared_ptr<ControlFlowGraph> &cfg);
+
+    std::shared_ptr<ControlFlowGraph> transform_cfg() override;
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+private:
+    std::shared_ptr<InstructionSequence> rewrite(const BasicBlock *bb, int &outcome);
+
+    static int get_conversion_opcode(bool is_signed, int from_size, int to_size);
+};
+
+
+// Control-flow simplification: a branch whose outcome is known (its
+// operands are constants, or it goes to the block it would fall through
+// to) becomes a jump or is removed, jumps and branches to blocks which
+// only pass control on to another block go straight to that block, a
+// block whose only successor has no other predecessor is merged with it,
+// and blocks which can't be reached from the entry are deleted. Each of
+// these can enable the others, so they are repeated until nothing
+// changes. The blocks are then laid out again when the CFG is converted
+// to an InstructionSequence.
+class ControlFlowSimplification : public ControlFlowGraphTransform {
+private:
+    // The code of a block as it is transformed, and its successors (the
+    // index of the target block, and the kind of the edge)
+    struct Block {
+        const BasicBlock *orig;
+        std::vector<Instruction *> code;
+        std::vector<std::pair<unsigned, EdgeKind>> successors;
+        bool removed;
+    };
+
+    std::vector<Block> m_blocks;
+    std::map<std::string, unsigned> m_labeled_blocks;
+
+public:
+    explicit ControlFlowSimplification(const std::shared_ptr<ControlFlowGraph> &cfg);
+    ~ControlFlowSimplification();
+
+    std::shared_ptr<ControlFlowGraph> transform_cfg() override;
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+private:
+    bool fold_branch(Block &block);
+    bool thread_jumps(Block &block);
+    bool merge_successor(unsigned index, const std::vector<unsigned> &num_preds);
+    bool remove_unreachable_blocks();
+    bool remove_jumps_to_next_block();
+    bool is_forwarding(const Block &block) const;
+    unsigned find_destination(unsigned index) const;
+    std::string get_block_label(unsigned index) const;
+    static void remove_successor(Block &block, EdgeKind kind);
+};
+
+
+// Basic block layout: the blocks are placed so that the edges most likely
+// to be taken fall through. Each block starts as a chain of its own, and
+// the edges are visited from the heaviest, each joining the chain which
+// ends with its source to the chain which starts with its target (as in
+// Pettis and Hansen's algorithm). The chain of the entry block goes first,
+// then the other chains in their original order, then the cold ones, and
+// the chain ending with the return last. The weights of the edges are
+// their counts if the CFG has them from an edge profile (and blocks
+// which never ran are cold), or else are estimated from static
+// heuristics: loop branches
+// usually stay in the loop, branches to paths which return early usually
+// aren't taken (those paths are cold), and each loop multiplies the
+// frequency of its blocks. Where a block no longer falls through to the
+// block after it, its branch is inverted, or a jump is added.
+class BlockLayout : public ControlFlowGraphTransform {
+private:
+    DominatorTree m_dominators;
+    LoopInfo m_loops;
+    // estimated number of times each block is executed per call (by id)
+    std::vector<double> m_frequencies;
+    std::vector<bool> m_cold;
+    std::map<const Edge *, double> m_weights;
+    int m_next_label_num;
+
+public:
+    BlockLayout(const std::shared_ptr<ControlFlowGraph> &cfg, int next_label_num);
+    ~BlockLayout();
+
+    std::shared_ptr<ControlFlowGraph> transform_cfg() override;
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+    int get_next_label_num() const { return m_next_label_num; }
+
+private:
+    void estimate_weights();
+    double get_probability(const Edge *edge, bool &is_cold) const;
+    bool is_back_edge(const Edge *edge) const;
+    bool is_returning(const BasicBlock *bb) const;
+    bool can_fall_through(const Edge *edge) const;
+    std::vector<BasicBlock *> find_layout();
+    std::string get_target_label(BasicBlock *bb);
+};
+
+
+// If-conversion: a short branch which only decides which value one vreg
+// gets (a diamond, where both arms assign it, or a triangle, where only
+// the arm the branch skips does) becomes a select of the two values.
+// The rest of the arms' code is then executed whichever way the branch
+// would have gone, so it must be cheap, and unable to fault or to change
+// anything the other path uses.
+class IfConversion : public ControlFlowGraphTransform {
+private:
+    // A branch to convert: the block ending with it, its arms (the block
+    // it falls through to, and the block it jumps to, or null for a
+    // triangle), the block where they join, and the code replacing them
+    struct Conversion {
+        BasicBlock *head;
+        BasicBlock *fall_arm;
+        BasicBlock *branch_arm;
+        BasicBlock *join;
+        std::vector<Instruction *> code;
+    };
+
+    // The code of an arm: the computations it needs, and the move
+    // assigning the selected vreg
+    struct Arm {
+        std::vector<Instruction *> code;
+        Instruction *assignment = nullptr;
+        int cost = 0;
+    };
+
+    LiveVregs m_live_vregs;
+    DominatorTree m_dominators;
+    LoopInfo m_loops;
+    int m_next_vreg;
+
+public:
+    explicit IfConversion(const std::shared_ptr<ControlFlowGraph> &cfg);
+
+    std::shared_ptr<ControlFlowGraph> transform_cfg() override;
+
+    std::shared_ptr<InstructionSequence> transform_basic_block(const InstructionSequence *orig_bb) override;
+
+private:
+    bool convert(BasicBlock *head, Conversion &conversion);
+
+    bool get_arm(BasicBlock *bb, const LiveVregs::FactType &live_at_join, Arm &arm);
+
+    bool is_biased(BasicBlock *head, const std::vector<Operand> &inputs);
+
+    static int get_speculation_cost(int opcode);
+};
+
+
 class LiveRegisters : public ControlFlowGraphTransform {
 private:
     LiveVregs m_live_vregs;
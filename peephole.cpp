@@ -0,0 +1,703 @@
+#include <cassert>
+#include "instruction.h"
+#include "lowlevel.h"
+#include "peephole.h"
+
+namespace {
+
+// Resources which instructions read and write: bit n is the low byte of
+// machine register n, bit 16 + n the rest of the register (so setcc and
+// movzb of the same register are seen to overwrite it together), and
+// FLAGS is the condition codes
+typedef unsigned long Resources;
+
+const Resources FLAGS = 1UL << 32;
+const Resources ALL_RESOURCES = (1UL << 33) - 1;
+
+// Both parts of the registers in a mask of register numbers
+Resources whole_regs(unsigned regs) {
+  return Resources(regs) | (Resources(regs) << 16);
+}
+
+Resources reg_bit(MachineReg mreg) {
+  return whole_regs(1u << mreg);
+}
+
+const Resources ARG_REGS = reg_bit(MREG_RDI) | reg_bit(MREG_RSI) | reg_bit(MREG_RDX)
+                        | reg_bit(MREG_RCX) | reg_bit(MREG_R8) | reg_bit(MREG_R9);
+const Resources CALLER_SAVED = ARG_REGS | reg_bit(MREG_RAX) | reg_bit(MREG_R10) | reg_bit(MREG_R11);
+const Resources CALLEE_SAVED = reg_bit(MREG_RBX) | reg_bit(MREG_RBP) | reg_bit(MREG_R12)
+                            | reg_bit(MREG_R13) | reg_bit(MREG_R14) | reg_bit(MREG_R15);
+
+bool match_ll(int base, int ll_opcode) {
+  return ll_opcode >= base && ll_opcode < (base + 4);
+}
+
+bool is_conditional_jump(int ll_opcode) {
+  return ll_opcode >= MINS_JE && ll_opcode <= MINS_JAE;
+}
+
+bool is_reg(const Operand &operand) {
+  Operand::Kind kind = operand.get_kind();
+  return kind == Operand::MREG8 || kind == Operand::MREG16 || kind == Operand::MREG32 || kind == Operand::MREG64;
+}
+
+// Is the operand a register which is written as a whole? (Writing the 32
+// bit register zero extends to 64 bits, writing the 8 or 16 bit register
+// doesn't.)
+bool is_full_reg(const Operand &operand) {
+  return operand.get_kind() == Operand::MREG32 || operand.get_kind() == Operand::MREG64;
+}
+
+bool is_scratch_reg(const Operand &operand) {
+  return is_full_reg(operand) && (operand.get_base_reg() == MREG_R10 || operand.get_base_reg() == MREG_R11);
+}
+
+// Registers which an operand refers to
+unsigned regs_of(const Operand &operand) {
+  unsigned regs = 0;
+  if (operand.has_base_reg()) {
+    regs |= 1u << operand.get_base_reg();
+  }
+  if (operand.has_index_reg()) {
+    regs |= 1u << operand.get_index_reg();
+  }
+  return regs;
+}
+
+bool same_operand(const Operand &a, const Operand &b) {
+  if (a.get_kind() != b.get_kind()) {
+    return false;
+  }
+  if (a.has_base_reg() != b.has_base_reg() || (a.has_base_reg() && a.get_base_reg() != b.get_base_reg())) {
+    return false;
+  }
+  if (a.has_index_reg() && (a.get_index_reg() != b.get_index_reg() || a.get_scale() != b.get_scale())) {
+    return false;
+  }
+  if (a.has_offset() && a.get_offset() != b.get_offset()) {
+    return false;
+  }
+  if (a.is_imm_ival() && a.get_imm_ival() != b.get_imm_ival()) {
+    return false;
+  }
+  return !a.has_label() || a.get_label() == b.get_label();
+}
+
+bool fits_imm32(long value) {
+  return value >= -2147483648L && value <= 2147483647L;
+}
+
+struct Effects {
+  Resources reads;
+  Resources kills;    // overwritten completely
+};
+
+void read(const Operand &operand, Effects &effects) {
+  if (operand.get_kind() == Operand::MREG8) {
+    effects.reads |= regs_of(operand);
+  } else {
+    effects.reads |= whole_regs(regs_of(operand));
+  }
+}
+
+void write(const Operand &operand, Effects &effects) {
+  if (is_full_reg(operand)) {
+    effects.kills |= whole_regs(regs_of(operand));
+  } else if (is_reg(operand)) {
+    // the rest of an 8 or 16 bit register keeps its value
+    effects.kills |= regs_of(operand);
+  } else {
+    effects.reads |= whole_regs(regs_of(operand));
+  }
+}
+
+// The resources which a low-level instruction reads and writes
+Effects get_effects(Instruction *ins) {
+  Effects effects = { 0, 0 };
+  int opcode = ins->get_opcode();
+  unsigned num_operands = ins->get_num_operands();
+
+  if (match_ll(MINS_MOVB, opcode) || (opcode >= MINS_MOVSBW && opcode <= MINS_MOVZLQ) || opcode == MINS_LEAQ) {
+    read(ins->get_operand(0), effects);
+    write(ins->get_operand(1), effects);
+  } else if ((match_ll(MINS_XORB, opcode) || match_ll(MINS_SUBB, opcode)) && is_reg(ins->get_operand(0))
+             && same_operand(ins->get_operand(0), ins->get_operand(1))) {
+    // zeroing a register doesn't depend on its value
+    write(ins->get_operand(1), effects);
+    effects.kills |= FLAGS;
+  } else if (match_ll(MINS_ADDB, opcode) || match_ll(MINS_SUBB, opcode) || match_ll(MINS_ANDB, opcode)
+             || match_ll(MINS_ORB, opcode) || match_ll(MINS_XORB, opcode) || match_ll(MINS_CMPB, opcode)) {
+    read(ins->get_operand(0), effects);
+    read(ins->get_operand(1), effects);
+    if (!match_ll(MINS_CMPB, opcode)) {
+      write(ins->get_operand(1), effects);
+    }
+    effects.kills |= FLAGS;
+  } else if (((opcode == MINS_IMULL || opcode == MINS_IMULQ) && num_operands == 1)
+             || opcode == MINS_MULL || opcode == MINS_MULQ) {
+    // the one operand form multiplies %rax, giving the product in %rdx:%rax
+    read(ins->get_operand(0), effects);
+    effects.reads |= reg_bit(MREG_RAX);
+    effects.kills |= reg_bit(MREG_RAX) | reg_bit(MREG_RDX) | FLAGS;
+  } else if (opcode == MINS_IMULL || opcode == MINS_IMULQ) {
+    // the three operand form only writes its destination
+    read(ins->get_operand(0), effects);
+    read(ins->get_operand(1), effects);
+    write(ins->get_operand(num_operands - 1), effects);
+    effects.kills |= FLAGS;
+  } else if (match_ll(MINS_SALB, opcode) || match_ll(MINS_SARB, opcode) || match_ll(MINS_SHRB, opcode)) {
+    // a shift by 0 leaves the flags unchanged
+    const Operand &count = ins->get_operand(0);
+    read(count, effects);
+    read(ins->get_operand(1), effects);
+    write(ins->get_operand(1), effects);
+    if (count.is_imm_ival() && (count.get_imm_ival() & 31) != 0) {
+      effects.kills |= FLAGS;
+    }
+  } else if (match_ll(MINS_NEGB, opcode) || match_ll(MINS_NOTB, opcode)
+             || match_ll(MINS_INCB, opcode) || match_ll(MINS_DECB, opcode)) {
+    // inc and dec leave the carry flag unchanged, not doesn't change flags
+    read(ins->get_operand(0), effects);
+    write(ins->get_operand(0), effects);
+    if (match_ll(MINS_NEGB, opcode)) {
+      effects.kills |= FLAGS;
+    }
+  } else if (opcode >= MINS_SETL && opcode <= MINS_SETNE) {
+    effects.reads |= FLAGS;
+    write(ins->get_operand(0), effects);
+  } else if (opcode >= MINS_CMOVL && opcode <= MINS_CMOVNE) {
+    // the destination keeps its value if the condition doesn't hold
+    effects.reads |= FLAGS;
+    read(ins->get_operand(0), effects);
+    read(ins->get_operand(1), effects);
+    write(ins->get_operand(1), effects);
+  } else if (is_conditional_jump(opcode)) {
+    effects.reads |= FLAGS;
+  } else if (opcode == MINS_BTL || opcode == MINS_BTQ) {
+    read(ins->get_operand(0), effects);
+    read(ins->get_operand(1), effects);
+    effects.kills |= FLAGS;
+  } else if (opcode == MINS_JMP && !ins->get_operand(0).is_label()) {
+    // an indirect jump reads the registers of the jump table address
+    read(ins->get_operand(0), effects);
+  } else if (opcode == MINS_JMP || opcode == MINS_NOP) {
+    // no effects
+  } else if (opcode == MINS_CALL) {
+    effects.reads |= ARG_REGS | reg_bit(MREG_RAX) | reg_bit(MREG_RSP);
+    effects.kills |= CALLER_SAVED | FLAGS;
+  } else if (opcode == MINS_RET) {
+    effects.reads |= reg_bit(MREG_RAX) | reg_bit(MREG_RSP) | CALLEE_SAVED;
+  } else if (opcode == MINS_CDQ || opcode == MINS_CQTO) {
+    effects.reads |= reg_bit(MREG_RAX);
+    effects.kills |= reg_bit(MREG_RDX);
+  } else if (opcode == MINS_IDIVL || opcode == MINS_IDIVQ || opcode == MINS_DIVL || opcode == MINS_DIVQ) {
+    read(ins->get_operand(0), effects);
+    effects.reads |= reg_bit(MREG_RAX) | reg_bit(MREG_RDX);
+    effects.kills |= reg_bit(MREG_RAX) | reg_bit(MREG_RDX) | FLAGS;
+  } else if (opcode == MINS_PUSHQ) {
+    read(ins->get_operand(0), effects);
+    effects.reads |= reg_bit(MREG_RSP);
+  } else if (opcode == MINS_POPQ) {
+    effects.reads |= reg_bit(MREG_RSP);
+    write(ins->get_operand(0), effects);
+  } else {
+    // unknown instruction: assume it needs everything
+    effects.reads = ALL_RESOURCES;
+  }
+  return effects;
+}
+
+// Can an instruction writing its last operand be applied to a memory
+// reference instead of a register?
+bool allows_memory_dest(int ll_opcode) {
+  return ll_opcode != MINS_IMULL && ll_opcode != MINS_IMULQ;
+}
+
+// Operations which read and write their last operand
+bool is_read_modify_write(int ll_opcode) {
+  return match_ll(MINS_ADDB, ll_opcode) || match_ll(MINS_SUBB, ll_opcode) || match_ll(MINS_ANDB, ll_opcode)
+      || match_ll(MINS_ORB, ll_opcode) || match_ll(MINS_XORB, ll_opcode) || match_ll(MINS_SALB, ll_opcode)
+      || match_ll(MINS_SARB, ll_opcode) || match_ll(MINS_SHRB, ll_opcode) || match_ll(MINS_NEGB, ll_opcode) || match_ll(MINS_NOTB, ll_opcode)
+      || match_ll(MINS_INCB, ll_opcode) || match_ll(MINS_DECB, ll_opcode)
+      || ll_opcode == MINS_IMULL || ll_opcode == MINS_IMULQ;
+}
+
+// Operand size in bytes of an instruction with size variants
+int get_size(int ll_opcode) {
+  if (ll_opcode == MINS_IMULL) {
+    return 4;
+  } else if (ll_opcode == MINS_IMULQ) {
+    return 8;
+  }
+  static const int BASES[] = { MINS_MOVB, MINS_ADDB, MINS_SUBB, MINS_CMPB, MINS_ANDB, MINS_ORB, MINS_XORB,
+                               MINS_NEGB, MINS_NOTB, MINS_INCB, MINS_DECB, MINS_SALB, MINS_SARB, MINS_SHRB };
+  for (int base : BASES) {
+    if (match_ll(base, ll_opcode)) {
+      return 1 << (ll_opcode - base);
+    }
+  }
+  return 0;
+}
+
+LowLevelOpcode invert_jump(int ll_opcode) {
+  switch (ll_opcode) {
+  case MINS_JE:  return MINS_JNE;
+  case MINS_JNE: return MINS_JE;
+  case MINS_JL:  return MINS_JGE;
+  case MINS_JGE: return MINS_JL;
+  case MINS_JLE: return MINS_JG;
+  case MINS_JG:  return MINS_JLE;
+  case MINS_JB:  return MINS_JAE;
+  case MINS_JAE: return MINS_JB;
+  case MINS_JBE: return MINS_JA;
+  case MINS_JA:  return MINS_JBE;
+  default:
+    assert(false);
+    return MINS_NOP;
+  }
+}
+
+LowLevelOpcode setcc_to_jump(int ll_opcode) {
+  switch (ll_opcode) {
+  case MINS_SETL:  return MINS_JL;
+  case MINS_SETLE: return MINS_JLE;
+  case MINS_SETG:  return MINS_JG;
+  case MINS_SETGE: return MINS_JGE;
+  case MINS_SETE:  return MINS_JE;
+  case MINS_SETNE: return MINS_JNE;
+  default:
+    assert(false);
+    return MINS_NOP;
+  }
+}
+
+}
+
+const PeepholeOptimizer::Rule PeepholeOptimizer::RULES[] = {
+  { "jump-to-next",     1, &PeepholeOptimizer::match_jump_to_next },
+  { "branch-over-jump", 2, &PeepholeOptimizer::match_branch_over_jump },
+  { "setcc-branch",     4, &PeepholeOptimizer::match_setcc_branch },
+  { "self-move",        1, &PeepholeOptimizer::match_self_move },
+  { "move-back",        2, &PeepholeOptimizer::match_move_back },
+  { "store-to-load",    2, &PeepholeOptimizer::match_store_to_load },
+  { "extend-load",      2, &PeepholeOptimizer::match_extend_load },
+  { "forward-scratch",  2, &PeepholeOptimizer::match_forward_scratch },
+  { "scratch-rmw",      3, &PeepholeOptimizer::match_scratch_rmw },
+  { "dead-move",        1, &PeepholeOptimizer::match_dead_move },
+  { "zero-idiom",       1, &PeepholeOptimizer::match_zero_idiom },
+};
+
+PeepholeOptimizer::PeepholeOptimizer(const std::shared_ptr<InstructionSequence> &iseq)
+  : m_iseq(iseq)
+  , m_hits(get_num_rules(), 0)
+  , m_label_index_valid(false) {
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+    m_code.push_back({ i.has_label() ? i.get_label() : "", (*i)->duplicate() });
+  }
+}
+
+PeepholeOptimizer::~PeepholeOptimizer() {
+  for (auto i = m_code.begin(); i != m_code.end(); ++i) {
+    delete i->ins;
+  }
+}
+
+std::shared_ptr<InstructionSequence> PeepholeOptimizer::optimize() {
+  // The label at the end couldn't be moved along with the code
+  if (m_iseq->has_label_at_end()) {
+    return m_iseq;
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (unsigned pos = 0; pos < m_code.size(); pos++) {
+      for (unsigned rule = 0; rule < get_num_rules() && pos < m_code.size(); rule++) {
+        if (apply(rule, pos)) {
+          changed = true;
+        }
+      }
+    }
+  }
+
+  std::shared_ptr<InstructionSequence> result(new InstructionSequence());
+  result->set_funcdef_ast(m_iseq->get_funcdef_ast());
+  for (auto i = m_code.begin(); i != m_code.end(); ++i) {
+    if (!i->label.empty()) {
+      result->define_label(i->label);
+    }
+    result->append(i->ins);
+  }
+  m_code.clear();
+  return result;
+}
+
+unsigned PeepholeOptimizer::get_num_rules() const {
+  return unsigned(sizeof(RULES) / sizeof(RULES[0]));
+}
+
+const char *PeepholeOptimizer::get_rule_name(unsigned rule) const {
+  return RULES[rule].name;
+}
+
+unsigned PeepholeOptimizer::get_num_hits(unsigned rule) const {
+  return m_hits.at(rule);
+}
+
+// Try a rule at a position, and replace the instructions it matches
+bool PeepholeOptimizer::apply(unsigned rule, unsigned pos) {
+  unsigned window = RULES[rule].window;
+  if (pos + window > m_code.size()) {
+    return false;
+  }
+  // control can only enter the window at its start
+  for (unsigned i = pos + 1; i < pos + window; i++) {
+    if (!m_code[i].label.empty()) {
+      return false;
+    }
+  }
+
+  std::vector<Instruction *> replacement;
+  if (!(this->*RULES[rule].match)(pos, replacement)) {
+    return false;
+  }
+
+  std::string label = m_code[pos].label;
+  if (replacement.empty() && !label.empty()) {
+    // the label moves to the next instruction, which can't have one
+    if (pos + window >= m_code.size() || !m_code[pos + window].label.empty()) {
+      return false;
+    }
+    m_code[pos + window].label = label;
+  }
+
+  for (unsigned i = pos; i < pos + window; i++) {
+    delete m_code[i].ins;
+  }
+  m_code.erase(m_code.begin() + pos, m_code.begin() + pos + window);
+  std::vector<Entry> entries;
+  for (auto i = replacement.begin(); i != replacement.end(); ++i) {
+    entries.push_back({ entries.empty() ? label : "", *i });
+  }
+  m_code.insert(m_code.begin() + pos, entries.begin(), entries.end());
+
+  m_label_index_valid = false;
+  m_hits[rule]++;
+  return true;
+}
+
+bool PeepholeOptimizer::find_label(const std::string &label, unsigned &index) {
+  if (!m_label_index_valid) {
+    m_label_index.clear();
+    for (unsigned i = 0; i < m_code.size(); i++) {
+      if (!m_code[i].label.empty()) {
+        m_label_index[m_code[i].label] = i;
+      }
+    }
+    m_label_index_valid = true;
+  }
+  auto i = m_label_index.find(label);
+  if (i == m_label_index.end()) {
+    return false;
+  }
+  index = i->second;
+  return true;
+}
+
+// Add the positions control can go to after an instruction. Returns false
+// if they aren't known.
+bool PeepholeOptimizer::get_successors(unsigned pos, std::vector<unsigned> &successors) {
+  Instruction *ins = m_code[pos].ins;
+  int opcode = ins->get_opcode();
+  if (opcode == MINS_RET) {
+    return true;
+  }
+  if (ins->is_multiway_branch()) {
+    const std::vector<std::string> &targets = ins->get_jump_table()->targets;
+    for (auto i = targets.begin(); i != targets.end(); ++i) {
+      unsigned target;
+      if (!find_label(*i, target)) {
+        return false;
+      }
+      successors.push_back(target);
+    }
+    return true;
+  }
+  if (opcode == MINS_JMP || is_conditional_jump(opcode)) {
+    unsigned target;
+    if (!ins->get_operand(0).is_label() || !find_label(ins->get_operand(0).get_label(), target)) {
+      return false;
+    }
+    successors.push_back(target);
+    if (opcode == MINS_JMP) {
+      return true;
+    }
+  }
+  successors.push_back(pos + 1);
+  return true;
+}
+
+// Check whether any of a set of resources may be read, on some path from
+// the instruction at a position, before it is overwritten
+bool PeepholeOptimizer::is_live_after(unsigned pos, unsigned long resources) {
+  for (unsigned long resource = 1; resource <= resources; resource <<= 1) {
+    if ((resources & resource) == 0) {
+      continue;
+    }
+    std::vector<bool> visited(m_code.size(), false);
+    std::vector<unsigned> work;
+    if (!get_successors(pos, work)) {
+      return true;
+    }
+    while (!work.empty()) {
+      unsigned i = work.back();
+      work.pop_back();
+      if (i >= m_code.size() || visited[i]) {
+        continue;
+      }
+      visited[i] = true;
+      Effects effects = get_effects(m_code[i].ins);
+      if ((effects.reads & resource) != 0) {
+        return true;
+      }
+      if ((effects.kills & resource) != 0) {
+        continue;
+      }
+      if (!get_successors(i, work)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// jmp .L or jcc .L, when .L labels the next instruction
+bool PeepholeOptimizer::match_jump_to_next(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *ins = m_code[pos].ins;
+  if ((ins->get_opcode() != MINS_JMP && !is_conditional_jump(ins->get_opcode()))
+      || !ins->get_operand(0).is_label()) {
+    return false;
+  }
+  return pos + 1 < m_code.size() && m_code[pos + 1].label == ins->get_operand(0).get_label();
+}
+
+// jcc .L1; jmp .L2, when .L1 labels the next instruction
+bool PeepholeOptimizer::match_branch_over_jump(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *jcc = m_code[pos].ins;
+  Instruction *jmp = m_code[pos + 1].ins;
+  if (!is_conditional_jump(jcc->get_opcode()) || jmp->get_opcode() != MINS_JMP || !jmp->get_operand(0).is_label()
+      || pos + 2 >= m_code.size() || m_code[pos + 2].label != jcc->get_operand(0).get_label()) {
+    return false;
+  }
+  replacement.push_back(new Instruction(invert_jump(jcc->get_opcode()), jmp->get_operand(0)));
+  return true;
+}
+
+// A comparison result which is only used by a conditional jump on it
+bool PeepholeOptimizer::match_setcc_branch(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *setcc = m_code[pos].ins;
+  Instruction *movzb = m_code[pos + 1].ins;
+  Instruction *cmp = m_code[pos + 2].ins;
+  Instruction *jcc = m_code[pos + 3].ins;
+  if (setcc->get_opcode() < MINS_SETL || setcc->get_opcode() > MINS_SETNE
+      || (movzb->get_opcode() != MINS_MOVZBL && movzb->get_opcode() != MINS_MOVZBQ)
+      || (cmp->get_opcode() != MINS_CMPL && cmp->get_opcode() != MINS_CMPQ)
+      || (jcc->get_opcode() != MINS_JNE && jcc->get_opcode() != MINS_JE)) {
+    return false;
+  }
+  const Operand &result = movzb->get_operand(1);
+  if (!same_operand(setcc->get_operand(0), movzb->get_operand(0))
+      || !is_full_reg(result) || result.get_base_reg() != setcc->get_operand(0).get_base_reg()
+      || !cmp->get_operand(0).is_imm_ival() || cmp->get_operand(0).get_imm_ival() != 0
+      || !same_operand(cmp->get_operand(1), result)) {
+    return false;
+  }
+  if (is_live_after(pos + 3, whole_regs(regs_of(result))) || is_live_after(pos + 3, FLAGS)) {
+    return false;
+  }
+  LowLevelOpcode opcode = setcc_to_jump(setcc->get_opcode());
+  if (jcc->get_opcode() == MINS_JE) {
+    opcode = invert_jump(opcode);
+  }
+  replacement.push_back(new Instruction(opcode, jcc->get_operand(0)));
+  return true;
+}
+
+// mov %r, %r (except movl, which clears the upper half of the register)
+bool PeepholeOptimizer::match_self_move(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *ins = m_code[pos].ins;
+  return match_ll(MINS_MOVB, ins->get_opcode()) && ins->get_opcode() != MINS_MOVL
+      && is_reg(ins->get_operand(0)) && same_operand(ins->get_operand(0), ins->get_operand(1));
+}
+
+// mov A, B; mov B, A
+bool PeepholeOptimizer::match_move_back(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *first = m_code[pos].ins;
+  Instruction *second = m_code[pos + 1].ins;
+  if (!match_ll(MINS_MOVB, first->get_opcode()) || second->get_opcode() != first->get_opcode()
+      || !same_operand(first->get_operand(0), second->get_operand(1))
+      || !same_operand(first->get_operand(1), second->get_operand(0))) {
+    return false;
+  }
+  // the first move must not change the address of A
+  if ((regs_of(first->get_operand(1)) & regs_of(first->get_operand(0))) != 0 && first->get_operand(0).is_memref()) {
+    return false;
+  }
+  replacement.push_back(first->duplicate());
+  return true;
+}
+
+// mov S, M; mov M, %r where S is a register or immediate (a store), or
+// mov M, S; mov M, %r where S is a register (a load)
+bool PeepholeOptimizer::match_store_to_load(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *first = m_code[pos].ins;
+  Instruction *load = m_code[pos + 1].ins;
+  if (!match_ll(MINS_MOVB, first->get_opcode()) || load->get_opcode() != first->get_opcode()
+      || !load->get_operand(0).is_memref() || !is_reg(load->get_operand(1))) {
+    return false;
+  }
+  const Operand &mem = load->get_operand(0);
+  Operand value;
+  if (same_operand(first->get_operand(1), mem)) {
+    value = first->get_operand(0);
+  } else if (same_operand(first->get_operand(0), mem) && (regs_of(first->get_operand(1)) & regs_of(mem)) == 0) {
+    value = first->get_operand(1);
+  } else {
+    return false;
+  }
+  if (!is_reg(value) && !value.is_imm_ival()) {
+    return false;
+  }
+
+  replacement.push_back(first->duplicate());
+  if (!same_operand(value, load->get_operand(1))) {
+    replacement.push_back(new Instruction(load->get_opcode(), value, load->get_operand(1)));
+  }
+  return true;
+}
+
+// movzb/movzw M, %r; movs/movz %r8/%r16, %s: the load can do the extension
+// (if %r isn't used later, or is %s)
+bool PeepholeOptimizer::match_extend_load(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *load = m_code[pos].ins;
+  Instruction *extend = m_code[pos + 1].ins;
+  int opcode = extend->get_opcode();
+  if ((load->get_opcode() != MINS_MOVZBL && load->get_opcode() != MINS_MOVZWL) || !load->get_operand(0).is_memref()
+      || opcode < MINS_MOVSBW || opcode > MINS_MOVZLQ) {
+    return false;
+  }
+  const Operand &reg = load->get_operand(1);
+  const Operand &value = extend->get_operand(0);
+  const Operand &dest = extend->get_operand(1);
+  Operand::Kind kind = load->get_opcode() == MINS_MOVZBL ? Operand::MREG8 : Operand::MREG16;
+  if (value.get_kind() != kind || value.get_base_reg() != reg.get_base_reg() || !is_full_reg(dest)) {
+    return false;
+  }
+  if (dest.get_base_reg() != reg.get_base_reg() && is_live_after(pos + 1, whole_regs(regs_of(reg)))) {
+    return false;
+  }
+  replacement.push_back(new Instruction(opcode, load->get_operand(0), dest));
+  return true;
+}
+
+// mov X, %r10; op %r10, Y: op can use X directly
+bool PeepholeOptimizer::match_forward_scratch(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *mov = m_code[pos].ins;
+  Instruction *ins = m_code[pos + 1].ins;
+  int opcode = ins->get_opcode();
+  if ((mov->get_opcode() != MINS_MOVL && mov->get_opcode() != MINS_MOVQ) || !is_scratch_reg(mov->get_operand(1))
+      || ins->get_num_operands() != 2 || get_size(opcode) != get_size(mov->get_opcode())
+      || !(match_ll(MINS_MOVB, opcode) || match_ll(MINS_CMPB, opcode)
+           || (is_read_modify_write(opcode) && !match_ll(MINS_SALB, opcode) && !match_ll(MINS_SARB, opcode)
+               && !match_ll(MINS_SHRB, opcode)))) {
+    return false;
+  }
+  const Operand &src = mov->get_operand(0);
+  const Operand &scratch = mov->get_operand(1);
+  const Operand &dest = ins->get_operand(1);
+  if (!same_operand(ins->get_operand(0), scratch) || (regs_of(dest) & regs_of(scratch)) != 0
+      || (src.is_memref() && dest.is_memref()) || (dest.is_memref() && !allows_memory_dest(opcode))
+      || (src.is_imm_ival() && !fits_imm32(src.get_imm_ival()))) {
+    return false;
+  }
+  if (is_live_after(pos + 1, whole_regs(regs_of(scratch)))) {
+    return false;
+  }
+  replacement.push_back(new Instruction(opcode, src, dest));
+  return true;
+}
+
+// mov A, %r10; op B, %r10; mov %r10, A: op can update A in place
+bool PeepholeOptimizer::match_scratch_rmw(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *load = m_code[pos].ins;
+  Instruction *ins = m_code[pos + 1].ins;
+  Instruction *store = m_code[pos + 2].ins;
+  int opcode = ins->get_opcode();
+  if ((load->get_opcode() != MINS_MOVL && load->get_opcode() != MINS_MOVQ) || store->get_opcode() != load->get_opcode()
+      || !is_scratch_reg(load->get_operand(1)) || !is_read_modify_write(opcode)
+      || get_size(opcode) != get_size(load->get_opcode()) || ins->get_num_operands() > 2
+      || ((opcode == MINS_IMULL || opcode == MINS_IMULQ) && ins->get_num_operands() != 2)) {
+    return false;
+  }
+  const Operand &var = load->get_operand(0);
+  const Operand &scratch = load->get_operand(1);
+  unsigned num_operands = ins->get_num_operands();
+  if (!same_operand(ins->get_operand(num_operands - 1), scratch) || !same_operand(store->get_operand(0), scratch)
+      || !same_operand(store->get_operand(1), var) || (regs_of(var) & regs_of(scratch)) != 0
+      || (var.is_memref() && !allows_memory_dest(opcode)) || var.is_imm_ival()) {
+    return false;
+  }
+  if (num_operands == 2) {
+    const Operand &src = ins->get_operand(0);
+    if ((regs_of(src) & regs_of(scratch)) != 0 || (src.is_memref() && var.is_memref())) {
+      return false;
+    }
+  }
+  if (is_live_after(pos + 2, whole_regs(regs_of(scratch)))) {
+    return false;
+  }
+  if (num_operands == 2) {
+    replacement.push_back(new Instruction(opcode, ins->get_operand(0), var));
+  } else {
+    replacement.push_back(new Instruction(opcode, var));
+  }
+  return true;
+}
+
+// A move (or setcc) into a register whose value is never used
+bool PeepholeOptimizer::match_dead_move(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *ins = m_code[pos].ins;
+  int opcode = ins->get_opcode();
+  if (opcode >= MINS_SETL && opcode <= MINS_SETNE) {
+    // (only the low byte of the register is written)
+    const Operand &dest = ins->get_operand(0);
+    return is_reg(dest) && !is_live_after(pos, regs_of(dest));
+  }
+  if (!(opcode == MINS_MOVL || opcode == MINS_MOVQ || opcode == MINS_LEAQ
+        || (opcode >= MINS_MOVSBW && opcode <= MINS_MOVZLQ))) {
+    return false;
+  }
+  const Operand &dest = ins->get_operand(1);
+  if (!is_full_reg(dest) || dest.get_base_reg() == MREG_RSP || dest.get_base_reg() == MREG_RBP) {
+    return false;
+  }
+  return !is_live_after(pos, whole_regs(regs_of(dest)));
+}
+
+// mov $0, %r becomes the shorter xor %r, %r, if the flags are dead
+bool PeepholeOptimizer::match_zero_idiom(unsigned pos, std::vector<Instruction *> &replacement) {
+  Instruction *ins = m_code[pos].ins;
+  if ((ins->get_opcode() != MINS_MOVL && ins->get_opcode() != MINS_MOVQ)
+      || !ins->get_operand(0).is_imm_ival() || ins->get_operand(0).get_imm_ival() != 0
+      || !is_full_reg(ins->get_operand(1))) {
+    return false;
+  }
+  if (is_live_after(pos, FLAGS)) {
+    return false;
+  }
+  // writing the 32 bit register clears the upper half
+  Operand reg(Operand::MREG32, ins->get_operand(1).get_base_reg());
+  replacement.push_back(new Instruction(MINS_XORL, reg, reg));
+  return true;
+}
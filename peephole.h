@@ -0,0 +1,88 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include "instruction_seq.h"
+
+// Peephole optimization of the low-level (x86-64) code of a function.
+// A window slides over the code, and at each position the rules are tried
+// in order: a rule looks at a fixed number of consecutive instructions
+// (none of which may be labeled, except the first), and if they match,
+// replaces them. This is repeated until no rule matches anywhere.
+//
+//   jump-to-next       jmp/jcc .L  .L:               (removed)
+//   branch-over-jump   jcc .L1; jmp .L2  .L1:        j!cc .L2
+//   setcc-branch       setcc %b; movzb %b, %r;
+//                      cmp $0, %r; jne/je .L         jcc/j!cc .L
+//   self-move          mov %r, %r                    (removed)
+//   move-back          mov A, B; mov B, A            mov A, B
+//   store-to-load      mov S, M; mov M, %r           mov S, M; mov S, %r
+//   extend-load        movz M, %r; movs/movz %r, %s  movs/movz M, %s
+//   forward-scratch    mov X, %r10; op %r10, Y       op X, Y
+//   scratch-rmw        mov A, %r10; op B, %r10;
+//                      mov %r10, A                   op B, A
+//   dead-move          mov X, %r or setcc %r
+//                      (%r is dead)                  (removed)
+//   zero-idiom         mov $0, %r                    xor %r, %r
+//
+// Rules which remove a register or flags write check that the value is
+// dead, by a search of the paths through the code following the window.
+class PeepholeOptimizer {
+private:
+  struct Entry {
+    std::string label;
+    Instruction *ins;
+  };
+
+  // A rule's matcher checks the instructions starting at a position, and
+  // if they match, adds the instructions which replace them
+  typedef bool (PeepholeOptimizer::*Matcher)(unsigned pos, std::vector<Instruction *> &replacement);
+
+  struct Rule {
+    const char *name;
+    unsigned window;    // number of instructions replaced
+    Matcher match;
+  };
+
+  static const Rule RULES[];
+
+  std::shared_ptr<InstructionSequence> m_iseq;
+  std::vector<Entry> m_code;
+  // number of times each rule was applied
+  std::vector<unsigned> m_hits;
+  std::map<std::string, unsigned> m_label_index;
+  bool m_label_index_valid;
+
+public:
+  PeepholeOptimizer(const std::shared_ptr<InstructionSequence> &iseq);
+  ~PeepholeOptimizer();
+
+  std::shared_ptr<InstructionSequence> optimize();
+
+  unsigned get_num_rules() const;
+  const char *get_rule_name(unsigned rule) const;
+  unsigned get_num_hits(unsigned rule) const;
+
+private:
+  bool apply(unsigned rule, unsigned pos);
+  bool find_label(const std::string &label, unsigned &index);
+  bool get_successors(unsigned pos, std::vector<unsigned> &successors);
+  bool is_live_after(unsigned pos, unsigned long resources);
+
+  bool match_jump_to_next(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_branch_over_jump(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_setcc_branch(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_self_move(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_move_back(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_store_to_load(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_extend_load(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_forward_scratch(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_scratch_rmw(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_dead_move(unsigned pos, std::vector<Instruction *> &replacement);
+  bool match_zero_idiom(unsigned pos, std::vector<Instruction *> &replacement);
+};
+
+#endif // PEEPHOLE_H
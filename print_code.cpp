@@ -1,5 +1,6 @@
 #include <cassert>
 #include "highlevel_formatter.h"
+#include "instruction.h"
 #include "print_instruction_seq.h"
 #include "print_highlevel_code.h"
 
@@ -32,6 +33,30 @@ void PrintCode::collect_function(const std::string &name, const std::shared_ptr<
   // print_instructions will be overridden by the concrete implementation
   // class to use the appropriate kind of formatter
   print_instructions(iseq);
+
+  // jump tables of multi-way branches go in the read-only data
+  for (auto i = iseq->cbegin(); i != iseq->cend(); ++i) {
+    const Instruction *ins = *i;
+    if (ins->is_multiway_branch()) {
+      const JumpTable &table = *ins->get_jump_table();
+      set_mode(RODATA);
+      printf("\t.align 8\n");
+      printf("%s:\n", table.label.c_str());
+      for (auto j = table.targets.begin(); j != table.targets.end(); ++j) {
+        printf("\t.quad %s\n", j->c_str());
+      }
+    }
+  }
+}
+
+void PrintCode::collect_profile_counters(const std::string &name, const std::vector<unsigned long> &values) {
+  set_mode(DATA);
+  printf("\n\t.globl %s\n", name.c_str());
+  printf("\t.align 8\n");
+  printf("%s:\n", name.c_str());
+  for (auto i = values.begin(); i != values.end(); ++i) {
+    printf("\t.quad %lu\n", *i);
+  }
 }
 
 void PrintCode::set_mode(Mode mode) {
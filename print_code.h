@@ -18,6 +18,7 @@ public:
   virtual void collect_string_constant(const std::string &name, const std::string &strval);
   virtual void collect_global_var(const std::string &name, const std::shared_ptr<Type> &type);
   virtual void collect_function(const std::string &name, const std::shared_ptr<InstructionSequence> &iseq);
+  virtual void collect_profile_counters(const std::string &name, const std::vector<unsigned long> &values);
 
   // This can be overridden depending on whether we're printing high-level
   // or low-level instructions
@@ -0,0 +1,66 @@
+/*
+ * Runtime of edge profiling: link this with a program compiled by
+ * "nearly_cc -o -G". When the program exits, the counter array generated
+ * by the compiler is written to the profile file (named by the
+ * NEARLY_CC_PROFILE environment variable, or nearly_cc.prof), one value
+ * per line, starting with the length of the array. If the profile file
+ * was written by the same program, its counts are added to this run's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern unsigned long __nearly_cc_profile[];
+
+static const char *get_profile_filename(void) {
+  const char *filename = getenv("NEARLY_CC_PROFILE");
+  return (filename != NULL) ? filename : "nearly_cc.prof";
+}
+
+/* Add the counts of an earlier run, if its array has the same length and
+   the same function records (hashes and numbers of counters) */
+static void merge_profile(const char *filename) {
+  unsigned long length = __nearly_cc_profile[0];
+  unsigned long *old = calloc(length, sizeof(unsigned long));
+  FILE *in = fopen(filename, "r");
+  unsigned long i, n = 0, pos;
+  int same = 0;
+
+  if (old != NULL && in != NULL) {
+    while (n < length && fscanf(in, "%lu", &old[n]) == 1)
+      n++;
+    same = (n == length && old[0] == length);
+    for (pos = 1; same && pos + 2 <= length; pos += 2 + __nearly_cc_profile[pos + 1])
+      same = (old[pos] == __nearly_cc_profile[pos] && old[pos + 1] == __nearly_cc_profile[pos + 1]);
+  }
+  if (same) {
+    for (pos = 1; pos + 2 <= length; pos += 2 + __nearly_cc_profile[pos + 1]) {
+      for (i = 0; i < __nearly_cc_profile[pos + 1]; i++)
+        __nearly_cc_profile[pos + 2 + i] += old[pos + 2 + i];
+    }
+  }
+  if (in != NULL)
+    fclose(in);
+  free(old);
+}
+
+static void write_profile(void) {
+  const char *filename = get_profile_filename();
+  unsigned long i;
+  FILE *out;
+
+  merge_profile(filename);
+  out = fopen(filename, "w");
+  if (out == NULL) {
+    perror(filename);
+    return;
+  }
+  for (i = 0; i < __nearly_cc_profile[0]; i++)
+    fprintf(out, "%lu\n", __nearly_cc_profile[i]);
+  fclose(out);
+}
+
+__attribute__((constructor))
+static void register_profile(void) {
+  atexit(write_profile);
+}
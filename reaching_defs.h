@@ -0,0 +1,96 @@
+#ifndef REACHING_DEFS_H
+#define REACHING_DEFS_H
+
+#include <map>
+#include <set>
+#include <string>
+#include "instruction.h"
+#include "highlevel.h"
+#include "highlevel_defuse.h"
+#include "local_storage_allocation.h"
+#include "dataflow.h"
+
+// Dataflow fact for reaching definitions: for each vreg, the set of
+// instructions whose definition of the vreg may reach the current point.
+// A vreg that is not in the map is only reached by its (implicit) value
+// on entry to the function, which is represented by a null pointer when
+// it has to be combined with real definitions.
+struct ReachingDefsFact {
+  // true for the "top" fact of blocks that have not been reached yet
+  bool is_top;
+  std::map<int, std::set<const Instruction *>> defs;
+
+  ReachingDefsFact() : is_top(true) { }
+
+  bool operator==(const ReachingDefsFact &other) const {
+    return is_top == other.is_top && defs == other.defs;
+  }
+  bool operator!=(const ReachingDefsFact &other) const { return !(*this == other); }
+};
+
+class ReachingDefsAnalysis : public ForwardAnalysis {
+public:
+  typedef ReachingDefsFact FactType;
+
+  // The top fact combines nondestructively with any other fact
+  FactType get_top_fact() const { return FactType(); }
+
+  // Combine facts: a definition reaches if it reaches along any edge
+  FactType combine_facts(const FactType &left, const FactType &right) const {
+    if (left.is_top) { return right; }
+    if (right.is_top) { return left; }
+
+    FactType result;
+    result.is_top = false;
+    merge(result, left, right);
+    merge(result, right, left);
+    return result;
+  }
+
+  // Model an instruction: a def of a vreg replaces all of the definitions
+  // of that vreg that reached it. A call is treated as defining the
+  // argument, return value, and machine vregs.
+  void model_instruction(Instruction *ins, FactType &fact) const {
+    // Nothing is defined at the start of the function's first block (which
+    // only has the entry block as predecessor, since it begins with the
+    // enter instruction), so its top fact becomes the fact for function entry
+    fact.is_top = false;
+
+    if (ins->get_opcode() == HINS_call) {
+      for (int vreg = 0; vreg < LocalStorageAllocation::VREG_FIRST_LOCAL; vreg++) {
+        fact.defs[vreg] = { ins };
+      }
+    } else if (HighLevel::is_def(ins)) {
+      fact.defs[ins->get_operand(0).get_base_reg()] = { ins };
+    }
+  }
+
+  // Convert a dataflow fact to a string: the number of definitions
+  // reaching each vreg ("entry" stands for the value on function entry)
+  std::string fact_to_string(const FactType &fact) const {
+    std::string s("{");
+    for (auto i = fact.defs.begin(); i != fact.defs.end(); i++) {
+      if (s != "{") { s += ","; }
+      s += std::to_string(i->first) + ":" + std::to_string(i->second.size());
+    }
+    s += "}";
+    return s;
+  }
+
+private:
+  // Add the definitions of each vreg in 'from' to 'result'; if 'other' has no
+  // definitions of the vreg, its value on function entry reaches too
+  static void merge(FactType &result, const FactType &from, const FactType &other) {
+    for (auto i = from.defs.begin(); i != from.defs.end(); i++) {
+      std::set<const Instruction *> &defs = result.defs[i->first];
+      defs.insert(i->second.begin(), i->second.end());
+      if (other.defs.count(i->first) == 0) {
+        defs.insert(nullptr);
+      }
+    }
+  }
+};
+
+typedef Dataflow<ReachingDefsAnalysis> ReachingDefs;
+
+#endif // REACHING_DEFS_H
@@ -0,0 +1,332 @@
+#include <cassert>
+#include <algorithm>
+#include "highlevel.h"
+#include "highlevel_defuse.h"
+#include "live_vregs.h"
+#include "dominators.h"
+#include "loops.h"
+#include "register_allocation.h"
+
+namespace {
+
+// Highest vreg number standing for a machine register
+const int LAST_PRECOLORED_VREG = 6;
+
+// Caller-saved registers which can hold vregs (%r10 and %r11 are
+// reserved as scratch registers for the low-level code generator)
+const MachineReg CALLER_SAVED[] = {
+  MREG_RCX, MREG_RDX, MREG_RSI, MREG_RDI, MREG_R8, MREG_R9, MREG_RAX,
+};
+
+const MachineReg CALLEE_SAVED[] = {
+  MREG_RBX, MREG_R12, MREG_R13, MREG_R14, MREG_R15,
+};
+
+bool match_hl(int base, int hl_opcode) {
+  return hl_opcode >= base && hl_opcode < (base + 4);
+}
+
+bool is_division(int hl_opcode) {
+  return match_hl(HINS_div_b, hl_opcode) || match_hl(HINS_mod_b, hl_opcode)
+      || match_hl(HINS_udiv_b, hl_opcode) || match_hl(HINS_umod_b, hl_opcode);
+}
+
+}
+
+RegisterAllocation::RegisterAllocation(const std::shared_ptr<ControlFlowGraph> &cfg)
+  : m_cfg(cfg) {
+}
+
+RegisterAllocation::~RegisterAllocation() {
+}
+
+void RegisterAllocation::allocate() {
+  find_candidates();
+  build_interference();
+  simplify_and_select();
+}
+
+bool RegisterAllocation::get_mreg(int vreg, MachineReg &mreg) const {
+  if (vreg <= LAST_PRECOLORED_VREG) {
+    mreg = get_precolored_mreg(vreg);
+    return true;
+  }
+  auto i = m_assignment.find(vreg);
+  if (i == m_assignment.end()) {
+    return false;
+  }
+  mreg = i->second;
+  return true;
+}
+
+MachineReg RegisterAllocation::get_precolored_mreg(int vreg) {
+  static const MachineReg PRECOLORED[] = {
+    MREG_RAX, MREG_RDI, MREG_RSI, MREG_RDX, MREG_RCX, MREG_R8, MREG_R9,
+  };
+  assert(vreg >= 0 && vreg <= LAST_PRECOLORED_VREG);
+  return PRECOLORED[vreg];
+}
+
+bool RegisterAllocation::is_callee_saved(MachineReg mreg) {
+  return std::find(std::begin(CALLEE_SAVED), std::end(CALLEE_SAVED), mreg) != std::end(CALLEE_SAVED);
+}
+
+void RegisterAllocation::find_candidates() {
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); ++i) {
+    BasicBlock *bb = *i;
+    for (auto j = bb->cbegin(); j != bb->cend(); ++j) {
+      Instruction *ins = *j;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        const Operand &operand = ins->get_operand(k);
+        if (operand.has_base_reg() && operand.get_base_reg() > LAST_PRECOLORED_VREG) {
+          m_candidates.insert(operand.get_base_reg());
+        }
+        if (operand.has_index_reg() && operand.get_index_reg() > LAST_PRECOLORED_VREG) {
+          m_candidates.insert(operand.get_index_reg());
+        }
+      }
+    }
+  }
+
+  m_colors.assign(std::begin(CALLER_SAVED), std::end(CALLER_SAVED));
+  m_colors.insert(m_colors.end(), std::begin(CALLEE_SAVED), std::end(CALLEE_SAVED));
+}
+
+void RegisterAllocation::build_interference() {
+  LiveVregs live_vregs(m_cfg);
+  live_vregs.execute();
+
+  DominatorTree dominators(m_cfg);
+  LoopInfo loops(dominators);
+
+  int max_vreg = m_candidates.empty() ? LAST_PRECOLORED_VREG : *m_candidates.rbegin();
+
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); ++i) {
+    BasicBlock *bb = *i;
+
+    double weight = 1.0;
+    for (int depth = loops.get_loop_depth(bb); depth > 0; depth--) {
+      weight *= 10.0;
+    }
+
+    // The arguments of a call are the argument vregs assigned since the
+    // previous call (calls end basic blocks, so they are in this block)
+    std::vector<int> args;
+    for (auto j = bb->cbegin(); j != bb->cend(); ++j) {
+      Instruction *ins = *j;
+      if (ins->get_opcode() == HINS_call) {
+        break;
+      }
+      if (HighLevel::is_def(ins)) {
+        int dest = ins->get_operand(0).get_base_reg();
+        if (dest >= 1 && dest <= 6) {
+          args.push_back(dest);
+        }
+      }
+    }
+
+    // Walk the block backwards, starting from the vregs live at its end
+    LiveVregs::FactType live = live_vregs.get_fact_at_end_of_block(bb);
+    for (auto j = bb->crbegin(); j != bb->crend(); ++j) {
+      Instruction *ins = *j;
+      int opcode = ins->get_opcode();
+
+      if (opcode == HINS_call) {
+        // The call defines the return value and clobbers every
+        // caller-saved register
+        live.reset(0);
+        for (int vreg = 0; vreg <= max_vreg; vreg++) {
+          if (live.test(vreg)) {
+            forbid_caller_saved(vreg);
+            m_crosses_call.insert(vreg);
+          }
+        }
+        for (auto k = args.begin(); k != args.end(); ++k) {
+          live.set(*k);
+        }
+        continue;
+      }
+
+      int dest = HighLevel::is_def(ins) ? ins->get_operand(0).get_base_reg() : -1;
+
+      if (is_division(opcode)) {
+        // Division uses %rax and %rdx for its dividend and results
+        for (int vreg = 0; vreg <= max_vreg; vreg++) {
+          if (live.test(vreg) && vreg != dest) {
+            forbid(vreg, MREG_RAX);
+            forbid(vreg, MREG_RDX);
+          }
+        }
+        for (unsigned k = 1; k < ins->get_num_operands(); k++) {
+          if (ins->get_operand(k).has_base_reg()) {
+            forbid(ins->get_operand(k).get_base_reg(), MREG_RAX);
+            forbid(ins->get_operand(k).get_base_reg(), MREG_RDX);
+          }
+        }
+      }
+
+      if (dest >= 0) {
+        // The source of a register to register copy doesn't interfere
+        // with its destination, since they hold the same value
+        int move_src = -1;
+        if (match_hl(HINS_mov_b, opcode) && ins->get_operand(1).get_kind() == Operand::VREG) {
+          move_src = ins->get_operand(1).get_base_reg();
+          m_move_related[dest].insert(move_src);
+          m_move_related[move_src].insert(dest);
+        }
+        for (int vreg = 0; vreg <= max_vreg; vreg++) {
+          if (live.test(vreg) && vreg != move_src) {
+            add_interference(dest, vreg);
+          }
+        }
+        live.reset(dest);
+        m_spill_cost[dest] += weight;
+      }
+
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (HighLevel::is_use(ins, k)) {
+          const Operand &operand = ins->get_operand(k);
+          live.set(operand.get_base_reg());
+          m_spill_cost[operand.get_base_reg()] += weight;
+          if (operand.has_index_reg()) {
+            live.set(operand.get_index_reg());
+            m_spill_cost[operand.get_index_reg()] += weight;
+          }
+        }
+      }
+    }
+  }
+}
+
+void RegisterAllocation::add_interference(int a, int b) {
+  if (a == b) {
+    return;
+  }
+  bool a_candidate = m_candidates.count(a) > 0;
+  bool b_candidate = m_candidates.count(b) > 0;
+  if (a_candidate && b_candidate) {
+    m_interference[a].insert(b);
+    m_interference[b].insert(a);
+  } else if (a_candidate && b <= LAST_PRECOLORED_VREG) {
+    forbid(a, get_precolored_mreg(b));
+  } else if (b_candidate && a <= LAST_PRECOLORED_VREG) {
+    forbid(b, get_precolored_mreg(a));
+  }
+}
+
+void RegisterAllocation::forbid(int vreg, MachineReg mreg) {
+  if (m_candidates.count(vreg) > 0) {
+    m_forbidden[vreg].insert(mreg);
+  }
+}
+
+void RegisterAllocation::forbid_caller_saved(int vreg) {
+  for (auto i = std::begin(CALLER_SAVED); i != std::end(CALLER_SAVED); ++i) {
+    forbid(vreg, *i);
+  }
+}
+
+void RegisterAllocation::simplify_and_select() {
+  const int k = int(m_colors.size());
+
+  std::map<int, int> degree;
+  for (auto i = m_candidates.begin(); i != m_candidates.end(); ++i) {
+    degree[*i] = int(m_interference[*i].size() + m_forbidden[*i].size());
+  }
+
+  // Simplify: remove vregs with fewer than k neighbors, lowest priority
+  // first, so that the vregs with the highest priority are colored first.
+  // When there are none, optimistically remove the vreg which is cheapest
+  // to spill relative to its degree: it might still get a color.
+  std::vector<int> stack;
+  std::set<int> remaining(m_candidates);
+  while (!remaining.empty()) {
+    int pick = -1;
+    for (auto i = remaining.begin(); i != remaining.end(); ++i) {
+      if (degree[*i] < k && (pick < 0 || m_spill_cost[*i] < m_spill_cost[pick])) {
+        pick = *i;
+      }
+    }
+    if (pick < 0) {
+      double best = 0.0;
+      for (auto i = remaining.begin(); i != remaining.end(); ++i) {
+        double cost = m_spill_cost[*i] / degree[*i];
+        if (pick < 0 || cost < best) {
+          pick = *i;
+          best = cost;
+        }
+      }
+    }
+
+    stack.push_back(pick);
+    remaining.erase(pick);
+    const std::set<int> &neighbors = m_interference[pick];
+    for (auto i = neighbors.begin(); i != neighbors.end(); ++i) {
+      if (remaining.count(*i) > 0) {
+        degree[*i]--;
+      }
+    }
+  }
+
+  // Select: color the vregs in the reverse order of their removal
+  while (!stack.empty()) {
+    int vreg = stack.back();
+    stack.pop_back();
+    MachineReg mreg;
+    if (choose_register(vreg, mreg)) {
+      m_assignment[vreg] = mreg;
+    } else {
+      m_spilled.insert(vreg);
+    }
+  }
+}
+
+bool RegisterAllocation::choose_register(int vreg, MachineReg &mreg) const {
+  std::set<MachineReg> unavailable;
+  auto forbidden = m_forbidden.find(vreg);
+  if (forbidden != m_forbidden.end()) {
+    unavailable = forbidden->second;
+  }
+  auto neighbors = m_interference.find(vreg);
+  if (neighbors != m_interference.end()) {
+    for (auto i = neighbors->second.begin(); i != neighbors->second.end(); ++i) {
+      auto assigned = m_assignment.find(*i);
+      if (assigned != m_assignment.end()) {
+        unavailable.insert(assigned->second);
+      }
+    }
+  }
+
+  // Prefer the register of a vreg this one is copied to or from,
+  // so that the copy disappears
+  auto related = m_move_related.find(vreg);
+  if (related != m_move_related.end()) {
+    for (auto i = related->second.begin(); i != related->second.end(); ++i) {
+      MachineReg hint;
+      if (get_mreg(*i, hint) && unavailable.count(hint) == 0
+          && std::find(m_colors.begin(), m_colors.end(), hint) != m_colors.end()) {
+        mreg = hint;
+        return true;
+      }
+    }
+  }
+
+  // A vreg live across a call can only get a callee-saved register:
+  // prefer one which already has to be saved
+  if (m_crosses_call.count(vreg) > 0) {
+    for (auto i = m_assignment.begin(); i != m_assignment.end(); ++i) {
+      if (is_callee_saved(i->second) && unavailable.count(i->second) == 0) {
+        mreg = i->second;
+        return true;
+      }
+    }
+  }
+
+  for (auto i = m_colors.begin(); i != m_colors.end(); ++i) {
+    if (unavailable.count(*i) == 0) {
+      mreg = *i;
+      return true;
+    }
+  }
+  return false;
+}
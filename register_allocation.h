@@ -0,0 +1,78 @@
+#ifndef REGISTER_ALLOCATION_H
+#define REGISTER_ALLOCATION_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include "cfg.h"
+#include "lowlevel.h"
+
+// Global register allocation for the vregs of a high-level function,
+// using graph coloring (Chaitin-Briggs, with optimistic coloring).
+//
+// The interference graph is built from LiveVregs liveness. Vregs 0-6
+// are precolored: they stand for the return value and argument registers.
+// A vreg live across a call interferes with every caller-saved register,
+// and a vreg live across (or used by) a division interferes with %rax
+// and %rdx.
+//
+// The priority (spill cost) of a vreg is its number of occurrences, each
+// weighted by 10 to the loop depth of its block, so loop counters and
+// other hot variables are colored first and get the registers they are
+// hinted towards: the register of a vreg they are copied to or from, and
+// for vregs live across calls, a callee-saved register which is already
+// saved. A vreg which can't be colored is spilled, which means it simply
+// keeps its stack slot: the low-level code generator already handles
+// memory operands using %r10 and %r11, which are never allocated.
+class RegisterAllocation {
+private:
+  std::shared_ptr<ControlFlowGraph> m_cfg;
+  // vregs which are candidates for allocation
+  std::set<int> m_candidates;
+  // interference edges between candidate vregs
+  std::map<int, std::set<int>> m_interference;
+  // machine registers each candidate can't be assigned
+  std::map<int, std::set<MachineReg>> m_forbidden;
+  // vregs each candidate is copied to or from
+  std::map<int, std::set<int>> m_move_related;
+  std::map<int, double> m_spill_cost;
+  // vregs live across a call
+  std::set<int> m_crosses_call;
+  // registers which can be assigned, in order of preference
+  std::vector<MachineReg> m_colors;
+  std::map<int, MachineReg> m_assignment;
+  std::set<int> m_spilled;
+
+public:
+  RegisterAllocation(const std::shared_ptr<ControlFlowGraph> &cfg);
+  ~RegisterAllocation();
+
+  void allocate();
+
+  // Get the machine register assigned to a vreg (precolored or allocated);
+  // returns false if the vreg lives in memory
+  bool get_mreg(int vreg, MachineReg &mreg) const;
+
+  // Machine registers assigned to the vregs which weren't spilled
+  const std::map<int, MachineReg> &get_assignment() const { return m_assignment; }
+
+  unsigned get_num_allocated() const { return unsigned(m_assignment.size()); }
+  unsigned get_num_spilled() const { return unsigned(m_spilled.size()); }
+
+  // Machine register which a precolored vreg (0-6) stands for
+  static MachineReg get_precolored_mreg(int vreg);
+
+  static bool is_callee_saved(MachineReg mreg);
+
+private:
+  void find_candidates();
+  void build_interference();
+  void add_interference(int a, int b);
+  void forbid(int vreg, MachineReg mreg);
+  void forbid_caller_saved(int vreg);
+  void simplify_and_select();
+  bool choose_register(int vreg, MachineReg &mreg) const;
+};
+
+#endif // REGISTER_ALLOCATION_H
@@ -10,7 +10,8 @@
 #include "semantic_analysis.h"
 
 SemanticAnalysis::SemanticAnalysis()
-        : m_global_symtab(new SymbolTable(nullptr, "root")) {
+        : m_global_symtab(new SymbolTable(nullptr, "root"))
+        , m_loop_depth(0) {
     m_cur_symtab = m_global_symtab;
 }
 
@@ -285,6 +286,12 @@ void SemanticAnalysis::visit_binary_expression(Node *n) {
         case TOK_MINUS:
         case TOK_DIVIDE:
         case TOK_ASTERISK:
+        case TOK_MOD:
+        case TOK_LEFT_SHIFT:
+        case TOK_RIGHT_SHIFT:
+        case TOK_AMPERSAND:
+        case TOK_BITWISE_OR:
+        case TOK_BITWISE_XOR:
             visit_math(n);
             break;
         case TOK_LT:
@@ -292,6 +299,7 @@ void SemanticAnalysis::visit_binary_expression(Node *n) {
         case TOK_GT:
         case TOK_GTE:
         case TOK_EQUALITY:
+        case TOK_INEQUALITY:
         case TOK_LOGICAL_AND:
         case TOK_LOGICAL_OR:
             visit_comparison(n);
@@ -361,6 +369,9 @@ void SemanticAnalysis::visit_assign(Node *n) {
             SemanticError::raise(n->get_loc(), "Tried to assign non integer to integer");
         }
     }
+
+    // The value is stored with the width of the left hand side
+    n->set_kid(2, convert_integral(n->get_kid(2), lhs));
 }
 
 void SemanticAnalysis::visit_math(Node *n) {
@@ -372,7 +383,22 @@ void SemanticAnalysis::visit_math(Node *n) {
         lhs = n->get_kid(1)->get_type();
     }
     std::shared_ptr<Type> rhs = n->get_kid(2)->get_type();
-
+    if (rhs->is_integral() && rhs->get_basic_type_kind() < BasicTypeKind::INT) {
+        n->set_kid(2, promote_to_int(n->get_kid(2)));
+        rhs = n->get_kid(2)->get_type();
+    }
+    // An int operand with a long one is converted to long (but the count
+    // of a shift to the type of the value shifted)
+    if (lhs->is_integral() && rhs->is_integral() && lhs->get_basic_type_kind() != rhs->get_basic_type_kind()) {
+        int op = n->get_kid(0)->get_tag();
+        if (op == TOK_LEFT_SHIFT || op == TOK_RIGHT_SHIFT || lhs->get_basic_type_kind() > rhs->get_basic_type_kind()) {
+            n->set_kid(2, convert_integral(n->get_kid(2), lhs));
+            rhs = n->get_kid(2)->get_type();
+        } else {
+            n->set_kid(1, convert_integral(n->get_kid(1), rhs));
+            lhs = n->get_kid(1)->get_type();
+        }
+    }
 
     if (lhs->is_void() || rhs->is_void()) {
         SemanticError::raise(n->get_loc(), "Cannot do math on Void type");
@@ -384,8 +410,31 @@ void SemanticAnalysis::visit_math(Node *n) {
 }
 
 void SemanticAnalysis::visit_comparison(Node *n) {
+    // Operands of different types are compared as ints, and so are unsigned
+    // chars and shorts (comparisons are signed)
+    std::shared_ptr<Type> left = n->get_kid(1)->get_type();
+    std::shared_ptr<Type> right = n->get_kid(2)->get_type();
+    bool promote = left->is_integral() && right->is_integral()
+                   && (left->get_basic_type_kind() != right->get_basic_type_kind()
+                       || !left->is_signed() || !right->is_signed());
+    for (unsigned i = 1; i <= 2; i++) {
+        std::shared_ptr<Type> type = n->get_kid(i)->get_type();
+        if (promote && type->get_basic_type_kind() < BasicTypeKind::INT) {
+            n->set_kid(i, promote_to_int(n->get_kid(i)));
+        }
+    }
     std::shared_ptr<Type> lhs = n->get_kid(1)->get_type();
     std::shared_ptr<Type> rhs = n->get_kid(2)->get_type();
+    // and an int with a long as longs
+    if (lhs->is_integral() && rhs->is_integral() && lhs->get_basic_type_kind() != rhs->get_basic_type_kind()) {
+        if (lhs->get_basic_type_kind() > rhs->get_basic_type_kind()) {
+            n->set_kid(2, convert_integral(n->get_kid(2), lhs));
+        } else {
+            n->set_kid(1, convert_integral(n->get_kid(1), rhs));
+        }
+        lhs = n->get_kid(1)->get_type();
+        rhs = n->get_kid(2)->get_type();
+    }
 
     if (lhs->is_pointer() != rhs->is_pointer()) {
         SemanticError::raise(n->get_loc(), "Tried to compare pointer and non pointer");
@@ -417,7 +466,21 @@ void SemanticAnalysis::visit_postfix_expression(Node *n) {
 }
 
 void SemanticAnalysis::visit_conditional_expression(Node *n) {
-    // None of these three appear in any example, and frankly I don't even know what they look like
+    // visit the condition and the two alternatives
+    visit(n->get_kid(0));
+    visit(n->get_kid(1));
+    visit(n->get_kid(2));
+    std::shared_ptr<Type> if_true = n->get_kid(1)->get_type();
+    std::shared_ptr<Type> if_false = n->get_kid(2)->get_type();
+
+    if (if_true->is_void() || if_false->is_void() || if_true->is_struct() || if_false->is_struct()) {
+        SemanticError::raise(n->get_loc(), "Conditional expression needs values");
+    }
+    if (if_true->is_pointer() != if_false->is_pointer()) {
+        SemanticError::raise(n->get_loc(), "Tried to choose between pointer and non pointer");
+    }
+    // annotate with type of result
+    n->set_type(if_true);
 }
 
 void SemanticAnalysis::visit_cast_expression(Node *n) {
@@ -445,6 +508,7 @@ void SemanticAnalysis::visit_function_call_expression(Node *n) {
         if (!(check_different(arg, param))) {
             SemanticError::raise(n->get_loc(), "Argument type does not match parameter type");
         }
+        n->get_kid(1)->set_kid(i, convert_integral(n->get_kid(1)->get_kid(i), param));
     }
     n->set_type(func->get_type()->get_base_type());
 }
@@ -562,6 +626,7 @@ void SemanticAnalysis::visit_literal_value(Node *n) {
 void SemanticAnalysis::visit_return_expression_statement(Node *n) {
     visit(n->get_kid(0));
     std::shared_ptr<Type> return_type = m_cur_symtab->lookup_recursive(m_cur_symtab->get_name(), SymbolKind::FUNCTION)->get_type()->get_base_type();
+    n->set_kid(0, convert_integral(n->get_kid(0), return_type));
     // check name of symbol table
     if (!return_type->is_same(n->get_kid(0)->get_type().get())) {
         SemanticError::raise(n->get_loc(), "Return type does not match function declaration");
@@ -571,7 +636,9 @@ void SemanticAnalysis::visit_return_expression_statement(Node *n) {
 Node *SemanticAnalysis::promote_to_int(Node *n) {
     assert(n->get_type()->is_integral());
     assert(n->get_type()->get_basic_type_kind() < BasicTypeKind::INT);
-    std::shared_ptr<Type> type(new BasicType(BasicTypeKind::INT, n->get_type()->is_signed()));
+    // (to a signed int even if it was unsigned, since every char and short
+    // value is an int value)
+    std::shared_ptr<Type> type(new BasicType(BasicTypeKind::INT, true));
     return implicit_conversion(n, type);
 }
 
@@ -581,6 +648,19 @@ Node *SemanticAnalysis::implicit_conversion(Node *n, const std::shared_ptr<Type>
     return conversion.release();
 }
 
+/// Convert an integer value to another integer type of a different
+/// width (other values are returned unchanged)
+/// \param n the expression
+/// \param type the type its value is converted to
+Node *SemanticAnalysis::convert_integral(Node *n, const std::shared_ptr<Type> &type) {
+    if (!n->get_type()->is_integral() || !type->is_integral()
+        || n->get_type()->get_basic_type_kind() == type->get_basic_type_kind()) {
+        return n;
+    }
+    std::shared_ptr<Type> converted(new BasicType(type->get_basic_type_kind(), type->is_signed()));
+    return implicit_conversion(n, converted);
+}
+
 
 void SemanticAnalysis::enter_scope(std::string name) {
     auto *scope = new SymbolTable(m_cur_symtab, std::move(name));
@@ -594,3 +674,115 @@ void SemanticAnalysis::leave_scope() {
     assert(m_cur_symtab != nullptr);
 }
 
+
+void SemanticAnalysis::visit_while_statement(Node *n) {
+    m_loop_depth++;
+    visit_children(n);
+    m_loop_depth--;
+}
+
+void SemanticAnalysis::visit_do_while_statement(Node *n) {
+    m_loop_depth++;
+    visit_children(n);
+    m_loop_depth--;
+}
+
+void SemanticAnalysis::visit_for_statement(Node *n) {
+    m_loop_depth++;
+    visit_children(n);
+    m_loop_depth--;
+}
+
+void SemanticAnalysis::visit_switch_statement(Node *n) {
+    visit(n->get_kid(0));
+    if (!n->get_kid(0)->get_type()->is_integral()) {
+        SemanticError::raise(n->get_loc(), "Switch on a value which is not an integer");
+    }
+
+    // the case labels in the body belong to this switch
+    m_switches.push_back({ std::set<long>(), false });
+    visit(n->get_kid(1));
+    m_switches.pop_back();
+}
+
+/// Check the value of a case label, which must be an integer constant
+/// different from the other case values of the switch, and annotate the
+/// node with it
+/// \param n case statement node
+void SemanticAnalysis::visit_case_statement(Node *n) {
+    if (m_switches.empty()) {
+        SemanticError::raise(n->get_loc(), "Case label outside of a switch statement");
+    }
+
+    visit(n->get_kid(0));
+    long value;
+    if (!get_constant_value(n->get_kid(0), value)) {
+        SemanticError::raise(n->get_loc(), "Case label is not an integer constant");
+    }
+    if (!m_switches.back().values.insert(value).second) {
+        SemanticError::raise(n->get_loc(), "Duplicate case value %ld", value);
+    }
+    n->set_literal_value(LiteralValue(value, false, false));
+
+    visit(n->get_kid(1));
+}
+
+void SemanticAnalysis::visit_default_statement(Node *n) {
+    if (m_switches.empty()) {
+        SemanticError::raise(n->get_loc(), "Default label outside of a switch statement");
+    }
+    if (m_switches.back().has_default) {
+        SemanticError::raise(n->get_loc(), "Switch statement has more than one default label");
+    }
+    m_switches.back().has_default = true;
+
+    visit(n->get_kid(0));
+}
+
+void SemanticAnalysis::visit_break_statement(Node *n) {
+    if (m_loop_depth == 0 && m_switches.empty()) {
+        SemanticError::raise(n->get_loc(), "Break statement outside of a loop or switch statement");
+    }
+}
+
+void SemanticAnalysis::visit_continue_statement(Node *n) {
+    if (m_loop_depth == 0) {
+        SemanticError::raise(n->get_loc(), "Continue statement outside of a loop");
+    }
+}
+
+/// Evaluate an integer constant expression: a literal, possibly with
+/// unary operators applied to it
+/// \param n the expression (already visited)
+/// \param value set to the value of the expression
+/// \return true if the expression is an integer constant
+bool SemanticAnalysis::get_constant_value(Node *n, long &value) {
+    if (n->get_tag() == AST_LITERAL_VALUE) {
+        LiteralValue lit = n->get_literal_value();
+        if (lit.get_kind() == LiteralValueKind::INTEGER) {
+            value = lit.get_int_value();
+            return true;
+        }
+        if (lit.get_kind() == LiteralValueKind::CHARACTER) {
+            value = lit.get_char_value();
+            return true;
+        }
+        return false;
+    }
+
+    if (n->get_tag() == AST_UNARY_EXPRESSION && get_constant_value(n->get_kid(1), value)) {
+        switch (n->get_kid(0)->get_tag()) {
+            case TOK_MINUS:
+                value = -value;
+                return true;
+            case TOK_PLUS:
+                return true;
+            case TOK_BITWISE_COMPL:
+                value = ~value;
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
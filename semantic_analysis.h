@@ -3,7 +3,9 @@
 
 #include <cstdint>
 #include <memory>
+#include <set>
 #include <utility>
+#include <vector>
 #include "type.h"
 #include "symtab.h"
 #include "ast_visitor.h"
@@ -12,6 +14,16 @@ class SemanticAnalysis : public ASTVisitor {
 private:
     SymbolTable *m_global_symtab, *m_cur_symtab;
 
+    // The case values of each enclosing switch statement, and whether
+    // it has a default label
+    struct SwitchInfo {
+        std::set<long> values;
+        bool has_default;
+    };
+    std::vector<SwitchInfo> m_switches;
+    // number of enclosing loops
+    unsigned m_loop_depth;
+
 public:
     SemanticAnalysis();
     virtual ~SemanticAnalysis();
@@ -37,6 +49,14 @@ public:
     virtual void visit_variable_ref(Node *n);
     virtual void visit_literal_value(Node *n);
     virtual void visit_return_expression_statement(Node *n);
+    virtual void visit_while_statement(Node *n);
+    virtual void visit_do_while_statement(Node *n);
+    virtual void visit_for_statement(Node *n);
+    virtual void visit_switch_statement(Node *n);
+    virtual void visit_case_statement(Node *n);
+    virtual void visit_default_statement(Node *n);
+    virtual void visit_break_statement(Node *n);
+    virtual void visit_continue_statement(Node *n);
 
     SymbolTable *get_global_symtab() { return m_global_symtab; }
 
@@ -63,6 +83,10 @@ private:
 
     static Node *implicit_conversion(Node *n, const std::shared_ptr<Type> &type);
 
+    static Node *convert_integral(Node *n, const std::shared_ptr<Type> &type);
+
+    static bool get_constant_value(Node *n, long &value);
+
 };
 
 #endif // SEMANTIC_ANALYSIS_H
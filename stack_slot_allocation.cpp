@@ -0,0 +1,173 @@
+#include <cassert>
+#include <algorithm>
+#include "highlevel.h"
+#include "highlevel_defuse.h"
+#include "live_vregs.h"
+#include "stack_slot_allocation.h"
+
+StackSlotAllocation::StackSlotAllocation(const std::shared_ptr<ControlFlowGraph> &cfg,
+                                         const std::set<int> &vregs,
+                                         const std::map<int, int> &vreg_sizes)
+  : m_cfg(cfg)
+  , m_vregs(vregs)
+  , m_vreg_sizes(vreg_sizes)
+  , m_num_slots(0)
+  , m_size(0) {
+}
+
+StackSlotAllocation::~StackSlotAllocation() {
+}
+
+void StackSlotAllocation::allocate() {
+  find_intervals();
+  color_intervals();
+}
+
+long StackSlotAllocation::get_offset(int vreg) const {
+  auto i = m_offsets.find(vreg);
+  assert(i != m_offsets.end());
+  return i->second;
+}
+
+int StackSlotAllocation::get_vreg_size(int vreg) const {
+  auto i = m_vreg_sizes.find(vreg);
+  return (i == m_vreg_sizes.end() || i->second <= 0) ? 8 : i->second;
+}
+
+void StackSlotAllocation::find_intervals() {
+  if (m_vregs.empty()) {
+    return;
+  }
+
+  LiveVregs live_vregs(m_cfg);
+  live_vregs.execute();
+  LiveVregsAnalysis analysis;
+
+  auto add_live = [this](const LiveVregs::FactType &live, unsigned pos) {
+    for (auto i = m_vregs.begin(); i != m_vregs.end(); ++i) {
+      if (live.test(*i)) {
+        extend_interval(*i, pos);
+      }
+    }
+  };
+
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); ++i) {
+    BasicBlock *bb = *i;
+    if (bb->get_length() == 0) {
+      continue;
+    }
+
+    // Walk the block backwards, starting from the vregs live at its end
+    LiveVregs::FactType live = live_vregs.get_fact_at_end_of_block(bb);
+    unsigned pos = unsigned(bb->get_code_order()) + bb->get_length();
+    for (auto j = bb->crbegin(); j != bb->crend(); ++j) {
+      Instruction *ins = *j;
+      pos--;
+
+      add_live(live, pos);
+      if (HighLevel::is_def(ins)) {
+        int dest = ins->get_operand(0).get_base_reg();
+        extend_interval(dest, pos);
+        if (pos < m_def_extents.size()) {
+          extend_interval(dest, m_def_extents[pos]);
+        }
+      }
+      analysis.model_instruction(ins, live);
+      add_live(live, pos);
+    }
+  }
+}
+
+void StackSlotAllocation::extend_interval(int vreg, unsigned pos) {
+  if (m_vregs.count(vreg) == 0) {
+    return;
+  }
+  auto i = m_intervals.find(vreg);
+  if (i == m_intervals.end()) {
+    m_intervals[vreg] = { pos, pos };
+  } else {
+    i->second.first = std::min(i->second.first, pos);
+    i->second.second = std::max(i->second.second, pos);
+  }
+}
+
+void StackSlotAllocation::color_intervals() {
+  struct Slot {
+    int size;
+    unsigned end;   // last position of the intervals assigned so far
+  };
+  std::vector<Slot> slots;
+  std::map<int, unsigned> vreg_slots;
+
+  // Visit the intervals in order of their start: a slot is free when
+  // the last interval assigned to it ended before the current one
+  // starts. Of the free slots which are wide enough, take the narrowest.
+  std::vector<int> order;
+  for (auto i = m_intervals.begin(); i != m_intervals.end(); ++i) {
+    order.push_back(i->first);
+  }
+  std::stable_sort(order.begin(), order.end(), [this](int left, int right) {
+    return m_intervals.at(left).first < m_intervals.at(right).first;
+  });
+
+  for (auto i = order.begin(); i != order.end(); ++i) {
+    int size = get_vreg_size(*i);
+    const std::pair<unsigned, unsigned> &interval = m_intervals.at(*i);
+    int pick = -1;
+    for (unsigned j = 0; j < slots.size(); j++) {
+      if (slots[j].end < interval.first && slots[j].size >= size
+          && (pick < 0 || slots[j].size < slots[pick].size)) {
+        pick = int(j);
+      }
+    }
+    if (pick < 0) {
+      slots.push_back({ size, interval.second });
+      pick = int(slots.size()) - 1;
+    } else {
+      slots[pick].end = interval.second;
+    }
+    vreg_slots[*i] = unsigned(pick);
+  }
+
+  // Vregs which are never live (they only occur in unreachable code)
+  // can share any slot which is wide enough
+  for (auto i = m_vregs.begin(); i != m_vregs.end(); ++i) {
+    if (vreg_slots.count(*i) > 0) {
+      continue;
+    }
+    int size = get_vreg_size(*i);
+    int pick = -1;
+    for (unsigned j = 0; j < slots.size() && pick < 0; j++) {
+      if (slots[j].size >= size) {
+        pick = int(j);
+      }
+    }
+    if (pick < 0) {
+      slots.push_back({ size, 0 });
+      pick = int(slots.size()) - 1;
+    }
+    vreg_slots[*i] = unsigned(pick);
+  }
+
+  // Lay out the slots from the widest to the narrowest
+  std::vector<unsigned> layout;
+  for (unsigned i = 0; i < slots.size(); i++) {
+    layout.push_back(i);
+  }
+  std::stable_sort(layout.begin(), layout.end(), [&slots](unsigned left, unsigned right) {
+    return slots[left].size > slots[right].size;
+  });
+
+  std::vector<long> slot_offsets(slots.size());
+  long offset = 0;
+  for (auto i = layout.begin(); i != layout.end(); ++i) {
+    slot_offsets[*i] = offset;
+    offset += slots[*i].size;
+  }
+
+  m_num_slots = unsigned(slots.size());
+  m_size = (offset + 7) & ~7L;
+  for (auto i = vreg_slots.begin(); i != vreg_slots.end(); ++i) {
+    m_offsets[i->first] = slot_offsets[i->second];
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef STACK_SLOT_ALLOCATION_H
+#define STACK_SLOT_ALLOCATION_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include "cfg.h"
+
+// Stack slot allocation for the vregs of a high-level function which
+// live in memory, by coloring their live intervals: vregs whose
+// intervals don't overlap share a slot.
+//
+// A position is the index of an instruction in the function's high-level
+// code (the code order of a basic block is the index of its first
+// instruction). The live interval of a vreg spans every position where it
+// is defined or live before or after the instruction, so two vregs with
+// disjoint intervals are never live at the same time.
+//
+// Each slot is as wide as the widest vreg it holds. The slots are laid out
+// from the widest to the narrowest, so every slot is naturally aligned,
+// and the size of the storage area is a multiple of 8.
+class StackSlotAllocation {
+private:
+  std::shared_ptr<ControlFlowGraph> m_cfg;
+  // vregs which need a stack slot
+  std::set<int> m_vregs;
+  // size in bytes of the value of each vreg (8 if unknown)
+  std::map<int, int> m_vreg_sizes;
+  // last position where the value defined at each position might still
+  // be stored to its slot (empty if values are stored when defined)
+  std::vector<unsigned> m_def_extents;
+  // first and last position of each vreg's live interval
+  std::map<int, std::pair<unsigned, unsigned>> m_intervals;
+  // offset of each vreg's slot from the start of the storage area
+  std::map<int, long> m_offsets;
+  unsigned m_num_slots;
+  long m_size;
+
+public:
+  StackSlotAllocation(const std::shared_ptr<ControlFlowGraph> &cfg,
+                      const std::set<int> &vregs,
+                      const std::map<int, int> &vreg_sizes);
+  ~StackSlotAllocation();
+
+  // Values which are stored to their slots after they are defined (for
+  // example, by a register cache writing back modified values) keep
+  // their slots until the given positions
+  void set_def_extents(const std::vector<unsigned> &def_extents) { m_def_extents = def_extents; }
+
+  void allocate();
+
+  // Offset of a vreg's slot from the start (lowest address) of the
+  // storage area
+  long get_offset(int vreg) const;
+
+  // Size in bytes of the storage area
+  long get_size() const { return m_size; }
+
+  unsigned get_num_slots() const { return m_num_slots; }
+
+private:
+  int get_vreg_size(int vreg) const;
+  void find_intervals();
+  void extend_interval(int vreg, unsigned pos);
+  void color_intervals();
+};
+
+#endif // STACK_SLOT_ALLOCATION_H
@@ -0,0 +1,147 @@
+#include <cassert>
+#include <set>
+#include <iostream>
+#include "node.h"
+#include "symtab.h"
+#include "instruction.h"
+#include "highlevel.h"
+#include "highlevel_defuse.h"
+#include "local_storage_allocation.h"
+#include "tail_calls.h"
+
+namespace {
+
+// Number of arguments passed in registers (vr1 to vr6)
+const int NUM_REGISTER_ARGS = 6;
+
+// The vreg which the result of a call is in
+const int RETVAL = LocalStorageAllocation::VREG_RETVAL;
+
+bool is_move(Instruction *ins) {
+  int opcode = ins->get_opcode();
+  return opcode >= HINS_mov_b && opcode <= HINS_mov_q;
+}
+
+}
+
+TailCallElimination::TailCallElimination(const std::shared_ptr<InstructionSequence> &iseq)
+  : m_iseq(iseq) {
+}
+
+TailCallElimination::~TailCallElimination() {
+}
+
+// Follow the code after the call to the leave and ret: it may only copy
+// the result between vregs (keeping track of the vregs holding it), load
+// values into vregs, and jump
+bool TailCallElimination::is_tail_call(unsigned index) const {
+  assert(m_iseq->get_instruction(index)->get_opcode() == HINS_call);
+
+  std::set<int> copies;
+  copies.insert(RETVAL);
+  int copy_opcode = -1;
+  std::set<unsigned> visited;
+  unsigned i = index + 1;
+  while (i < m_iseq->get_length() && visited.insert(i).second) {
+    Instruction *ins = m_iseq->get_instruction(i);
+    int opcode = ins->get_opcode();
+    if (opcode == HINS_jmp) {
+      i = m_iseq->get_index_of_labeled_instruction(ins->get_operand(0).get_label());
+    } else if (opcode == HINS_nop) {
+      i++;
+    } else if (opcode == HINS_leave) {
+      return i + 1 < m_iseq->get_length() && m_iseq->get_instruction(i + 1)->get_opcode() == HINS_ret
+          && copies.count(RETVAL) > 0;
+    } else if (is_move(ins) && ins->get_operand(0).get_kind() == Operand::VREG) {
+      // a copy must have the width of the result (a narrower or wider
+      // move converts it)
+      const Operand &src = ins->get_operand(1);
+      int dest = ins->get_operand(0).get_base_reg();
+      if (src.get_kind() == Operand::VREG && copies.count(src.get_base_reg()) > 0
+          && (copy_opcode == -1 || copy_opcode == opcode)) {
+        copies.insert(dest);
+        copy_opcode = opcode;
+      } else {
+        copies.erase(dest);
+      }
+      i++;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool TailCallElimination::is_sibling_call(unsigned index) const {
+  if (has_frame_variables() || !is_tail_call(index)) {
+    return false;
+  }
+
+  // The arguments are moved into their vregs just before the call
+  for (unsigned i = index; i > 0 && !m_iseq->has_label(i); i--) {
+    Instruction *ins = m_iseq->get_instruction(i - 1);
+    if (ins->get_opcode() == HINS_call || HighLevel::is_jump(ins->get_opcode())) {
+      break;
+    }
+    if (HighLevel::is_def(ins)) {
+      int dest = ins->get_operand(0).get_base_reg();
+      if (dest >= LocalStorageAllocation::VREG_FIRST_ARG + NUM_REGISTER_ARGS
+          && dest < LocalStorageAllocation::VREG_FIRST_LOCAL) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<InstructionSequence> TailCallElimination::eliminate_tail_recursion() {
+  Node *funcdef = m_iseq->get_funcdef_ast();
+  std::string fn_name = funcdef->get_kid(1)->get_str();
+  if (has_frame_variables() || m_iseq->get_length() < 2 || m_iseq->get_instruction(0)->get_opcode() != HINS_enter) {
+    return m_iseq;
+  }
+
+  std::set<unsigned> tail_calls;
+  for (unsigned i = 0; i < m_iseq->get_length(); i++) {
+    Instruction *ins = m_iseq->get_instruction(i);
+    if (ins->get_opcode() == HINS_call && ins->get_operand(0).get_label() == fn_name && is_tail_call(i)) {
+      tail_calls.insert(i);
+    }
+  }
+  if (tail_calls.empty()) {
+    return m_iseq;
+  }
+
+  // The body starts right after the enter, with the moves of the
+  // parameters out of the argument vregs
+  std::string start_label = ".L" + fn_name + "_start";
+  auto start = m_iseq->cbegin();
+  ++start;
+  if (start.has_label()) {
+    start_label = start.get_label();
+  }
+
+  std::shared_ptr<InstructionSequence> result(new InstructionSequence());
+  result->set_funcdef_ast(funcdef);
+  unsigned index = 0;
+  for (auto i = m_iseq->cbegin(); i != m_iseq->cend(); ++i, ++index) {
+    if (i.has_label()) {
+      result->define_label(i.get_label());
+    } else if (index == 1) {
+      result->define_label(start_label);
+    }
+    if (tail_calls.count(index) > 0) {
+      result->append(new Instruction(HINS_jmp, Operand(Operand::LABEL, start_label)));
+    } else {
+      result->append((*i)->duplicate());
+    }
+  }
+
+  std::cout << "/* Function '" << fn_name << "': " << tail_calls.size()
+            << " self-recursive tail call(s) replaced by jumps */" << std::endl;
+  return result;
+}
+
+bool TailCallElimination::has_frame_variables() const {
+  return m_iseq->get_funcdef_ast()->get_symbol()->get_offset() != 0;
+}
@@ -0,0 +1,41 @@
+#ifndef TAIL_CALLS_H
+#define TAIL_CALLS_H
+
+#include <memory>
+#include "instruction_seq.h"
+
+// Tail calls in the high-level code of a function: calls after which the
+// function only copies the result of the call into vr0 (or doesn't touch
+// vr0) and returns. A self-recursive tail call is replaced by a jump to
+// the start of the function body, which moves the arguments (already in
+// the argument vregs) into the parameters again. Other tail calls are made
+// jumps to the callee by the low-level code generator, once the stack
+// frame has been removed (the callee returns to this function's caller).
+//
+// Both require that no variables are in the stack frame, since the
+// arguments of the call could point to them.
+class TailCallElimination {
+private:
+  std::shared_ptr<InstructionSequence> m_iseq;
+
+public:
+  TailCallElimination(const std::shared_ptr<InstructionSequence> &iseq);
+  ~TailCallElimination();
+
+  // Is the call at the index a tail call?
+  bool is_tail_call(unsigned index) const;
+
+  // Can the call at the index be made a jump to the callee? It must be a
+  // tail call with all of its arguments in registers, and the function
+  // must have no variables in its stack frame.
+  bool is_sibling_call(unsigned index) const;
+
+  // Replace the self-recursive tail calls by jumps to the start of the
+  // function body: returns the transformed code
+  std::shared_ptr<InstructionSequence> eliminate_tail_recursion();
+
+private:
+  bool has_frame_variables() const;
+};
+
+#endif // TAIL_CALLS_H
@@ -0,0 +1,614 @@
+#include <climits>
+#include <algorithm>
+#include "highlevel_defuse.h"
+#include "local_storage_allocation.h"
+#include "cfg.h"
+#include "value_ranges.h"
+
+namespace {
+
+// Bounds which the ranges combined where paths join are widened to: the
+// limits of the integer types, 0 and 1, and one inside the limits of int
+// and long (the most a counter which is compared with < can be, so that
+// incrementing it doesn't overflow)
+const long WIDENING_BOUNDS[] = {
+  LONG_MIN, LONG_MIN + 1, INT_MIN, INT_MIN + 1, SHRT_MIN, SCHAR_MIN, -1, 0, 1,
+  SCHAR_MAX, UCHAR_MAX, SHRT_MAX, USHRT_MAX, INT_MAX - 1, INT_MAX, UINT_MAX, LONG_MAX - 1, LONG_MAX,
+};
+
+// Mask of the bits of a value of the size
+unsigned long get_width_mask(int size) {
+  return size >= 8 ? ~0UL : (1UL << (8 * size)) - 1;
+}
+
+// Sign-extend the low bits of a value of the size
+long truncate(long value, int size) {
+  if (size >= 8) {
+    return value;
+  }
+  int shift = 64 - 8 * size;
+  return long((unsigned long) value << shift) >> shift;
+}
+
+// The range lo..hi, or every value of the size if lo..hi does not fit
+// (because the operation computing it overflowed)
+ValueRange make_range(long lo, long hi, int size) {
+  ValueRange result = ValueRange::full(size);
+  if (lo >= ValueRange::min_value(size) && hi <= ValueRange::max_value(size)) {
+    result.lo = lo;
+    result.hi = hi;
+  }
+  return result;
+}
+
+// Number of low bits known to be 0
+int get_trailing_zeros(const ValueRange &range) {
+  return range.zeros == ~0UL ? 64 : __builtin_ctzl(~range.zeros);
+}
+
+void set_trailing_zeros(ValueRange &range, int count) {
+  range.zeros |= count >= 64 ? ~0UL : (1UL << count) - 1;
+}
+
+// Get the shift count of a shift instruction, if it is a constant
+// smaller than the number of bits of the size
+bool get_shift_count(const ValueRange &count, int size, int &result) {
+  if (!count.is_constant() || count.lo < 0 || count.lo >= 8 * size) {
+    return false;
+  }
+  result = int(count.lo);
+  return true;
+}
+
+// Add the quotients of the values of a by the values b_lo..b_hi (which
+// don't include 0) to lo..hi: returns false if a quotient overflows
+bool add_quotients(const ValueRange &a, long b_lo, long b_hi, long &lo, long &hi) {
+  if (a.lo == LONG_MIN && b_lo <= -1 && b_hi >= -1) {
+    return false;
+  }
+  // for a fixed divisor, the quotient is monotonic in the dividend and
+  // vice versa, so the extremes are at the corners
+  const long quotients[] = { a.lo / b_lo, a.lo / b_hi, a.hi / b_lo, a.hi / b_hi };
+  for (long q : quotients) {
+    lo = std::min(lo, q);
+    hi = std::max(hi, q);
+  }
+  return true;
+}
+
+ValueRange divide(const ValueRange &a, const ValueRange &b, int size) {
+  long lo = LONG_MAX, hi = LONG_MIN;
+  if (b.lo < 0 && !add_quotients(a, b.lo, std::min(b.hi, -1L), lo, hi)) {
+    return ValueRange::full(size);
+  }
+  if (b.hi > 0 && !add_quotients(a, std::max(b.lo, 1L), b.hi, lo, hi)) {
+    return ValueRange::full(size);
+  }
+  if (lo > hi) {
+    // the divisor is 0
+    return ValueRange::full(size);
+  }
+  return make_range(lo, hi, size);
+}
+
+ValueRange remainder(const ValueRange &a, const ValueRange &b, int size) {
+  if (b.lo == LONG_MIN || (b.lo == 0 && b.hi == 0)) {
+    return ValueRange::full(size);
+  }
+  // the remainder is smaller in magnitude than the divisor, and has the
+  // sign of the dividend
+  long limit = std::max(-b.lo, b.hi) - 1;
+  long lo = a.lo >= 0 ? 0 : std::max(a.lo, -limit);
+  long hi = a.hi <= 0 ? 0 : std::min(a.hi, limit);
+  return make_range(lo, hi, size);
+}
+
+}
+
+ValueRange ValueRange::full(int size) {
+  return { min_value(size), max_value(size), 0, 0, size };
+}
+
+ValueRange ValueRange::constant(long value, int size) {
+  value = truncate(value, size);
+  return { value, value, ~(unsigned long) value, (unsigned long) value, size };
+}
+
+long ValueRange::min_value(int size) {
+  return size >= 8 ? LONG_MIN : -(1L << (8 * size - 1));
+}
+
+long ValueRange::max_value(int size) {
+  return size >= 8 ? LONG_MAX : (1L << (8 * size - 1)) - 1;
+}
+
+bool ValueRange::is_full() const {
+  return lo == min_value(size) && hi == max_value(size) && zeros == 0 && ones == 0;
+}
+
+bool ValueRange::normalize() {
+  lo = std::max(lo, min_value(size));
+  hi = std::min(hi, max_value(size));
+
+  unsigned long sign = 1UL << (8 * size - 1);
+  unsigned long upper = ~get_width_mask(size);
+  for (int i = 0; i < 2; i++) {
+    // the bits above the size are copies of the sign bit
+    zeros = (zeros & sign) != 0 ? zeros | upper : zeros & ~upper;
+    ones = (ones & sign) != 0 ? ones | upper : ones & ~upper;
+    if ((zeros & ones) != 0) {
+      return false;
+    }
+
+    // if the sign is known, the smallest value has the unknown bits 0,
+    // and the largest has them 1
+    if (((zeros | ones) & sign) != 0) {
+      lo = std::max(lo, long(ones));
+      hi = std::min(hi, long(~zeros));
+    }
+    if (lo > hi) {
+      return false;
+    }
+
+    // all values have the bits of the bounds above the highest bit in
+    // which the bounds differ
+    unsigned long differ = (unsigned long) (lo ^ hi);
+    unsigned long known;
+    if (differ == 0) {
+      known = ~0UL;
+    } else {
+      int highest = 63 - __builtin_clzl(differ);
+      known = highest == 63 ? 0 : ~0UL << (highest + 1);
+    }
+    zeros |= ~(unsigned long) lo & known;
+    ones |= (unsigned long) lo & known;
+  }
+  return (zeros & ones) == 0;
+}
+
+ValueRange ValueRange::join(const ValueRange &left, const ValueRange &right) {
+  ValueRange result = { std::min(left.lo, right.lo), std::max(left.hi, right.hi),
+                        left.zeros & right.zeros, left.ones & right.ones, left.size };
+  result.normalize();
+  return result;
+}
+
+ValueRangeAnalysis::FactType ValueRangeAnalysis::combine_facts(const FactType &left, const FactType &right) const {
+  if (left.is_top) { return right; }
+  if (right.is_top) { return left; }
+
+  FactType result;
+  result.is_top = false;
+  for (auto i = left.ranges.begin(); i != left.ranges.end(); i++) {
+    auto j = right.ranges.find(i->first);
+    if (j == right.ranges.end() || j->second.size != i->second.size) {
+      continue;
+    }
+    ValueRange range = ValueRange::join(i->second, j->second);
+    if (range != i->second || range != j->second) {
+      // widen the range, so that a loop can only make the range of a
+      // value grow a few times
+      long lo = ValueRange::min_value(range.size), hi = ValueRange::max_value(range.size);
+      for (long bound : WIDENING_BOUNDS) {
+        if (bound <= range.lo && bound > lo) { lo = bound; }
+        if (bound >= range.hi && bound < hi) { hi = bound; }
+      }
+      // (the high bits are only the ones known from the new bounds, since
+      // otherwise they would keep the range from growing)
+      ValueRange widened = make_range(lo, hi, range.size);
+      set_trailing_zeros(widened, get_trailing_zeros(range));
+      widened.normalize();
+      range = widened;
+    }
+    if (!range.is_full()) {
+      result.ranges[i->first] = range;
+    }
+  }
+  return result;
+}
+
+void ValueRangeAnalysis::model_instruction(Instruction *ins, FactType &fact) const {
+  // code in a block which can't be reached doesn't change anything
+  if (fact.is_top) {
+    return;
+  }
+
+  if (ins->get_opcode() == HINS_call) {
+    for (int vreg = 0; vreg < LocalStorageAllocation::VREG_FIRST_LOCAL; vreg++) {
+      fact.ranges.erase(vreg);
+    }
+  } else if (HighLevel::is_def(ins)) {
+    int vreg = ins->get_operand(0).get_base_reg();
+    ValueRange range = evaluate(ins, fact);
+    if (range.is_full()) {
+      fact.ranges.erase(vreg);
+    } else {
+      fact.ranges[vreg] = range;
+    }
+  }
+}
+
+void ValueRangeAnalysis::model_edge(const Edge *edge, FactType &fact) const {
+  const BasicBlock *source = edge->get_source();
+  // nothing is known about any vreg on entry to the function
+  if (source->get_kind() == BASICBLOCK_ENTRY) {
+    fact.is_top = false;
+    return;
+  }
+  if (fact.is_top || source->get_length() == 0
+      || (edge->get_kind() != EDGE_BRANCH && edge->get_kind() != EDGE_FALLTHROUGH)) {
+    return;
+  }
+
+  Instruction *ins = source->get_last_instruction();
+  int opcode = ins->get_opcode();
+  bool taken = (edge->get_kind() == EDGE_BRANCH);
+
+  Relation relation;
+  Operand left, right;
+  int size;
+  if (opcode == HINS_cjmp_t || opcode == HINS_cjmp_f) {
+    // compare the condition with 0 at the size it was computed with
+    left = ins->get_operand(0);
+    if (left.get_kind() != Operand::VREG || fact.ranges.count(left.get_base_reg()) == 0) {
+      return;
+    }
+    size = fact.ranges.at(left.get_base_reg()).size;
+    right = Operand(Operand::IMM_IVAL, 0);
+    relation = (opcode == HINS_cjmp_t) ? NEQ : EQ;
+  } else if (opcode >= HINS_cjmplt_b && opcode <= HINS_cjmpneq_q) {
+    left = ins->get_operand(0);
+    right = ins->get_operand(1);
+    size = highlevel_opcode_get_dest_operand_size(HighLevelOpcode(opcode));
+    relation = Relation((opcode - HINS_cjmplt_b) / 4);
+  } else {
+    return;
+  }
+
+  ValueRange left_range = get_operand_range(fact, left, size);
+  ValueRange right_range = get_operand_range(fact, right, size);
+  if (!refine(relation, taken, left_range, right_range)) {
+    // control can't go this way
+    fact = FactType();
+    return;
+  }
+
+  // record the narrowed ranges of vregs compared at the size they have
+  const Operand *operands[] = { &left, &right };
+  const ValueRange *ranges[] = { &left_range, &right_range };
+  for (int i = 0; i < 2; i++) {
+    if (operands[i]->get_kind() != Operand::VREG) {
+      continue;
+    }
+    int vreg = operands[i]->get_base_reg();
+    auto existing = fact.ranges.find(vreg);
+    if (existing == fact.ranges.end() || existing->second.size == size) {
+      fact.ranges[vreg] = *ranges[i];
+    }
+  }
+}
+
+std::string ValueRangeAnalysis::fact_to_string(const FactType &fact) const {
+  std::string s("{");
+  for (auto i = fact.ranges.begin(); i != fact.ranges.end(); i++) {
+    if (s != "{") { s += ","; }
+    s += std::to_string(i->first) + ":" + std::to_string(i->second.lo) + ".." + std::to_string(i->second.hi);
+  }
+  s += "}";
+  return s;
+}
+
+ValueRange ValueRangeAnalysis::get_operand_range(const FactType &fact, const Operand &operand, int size) {
+  if (operand.is_imm_ival()) {
+    return ValueRange::constant(operand.get_imm_ival(), size);
+  }
+  if (operand.get_kind() != Operand::VREG) {
+    return ValueRange::full(size);
+  }
+  auto i = fact.ranges.find(operand.get_base_reg());
+  if (i == fact.ranges.end() || i->second.size < size) {
+    return ValueRange::full(size);
+  }
+
+  ValueRange range = i->second;
+  if (range.size == size) {
+    return range;
+  }
+  // the value is read from its low bytes
+  if (range.fits(size)) {
+    range.size = size;
+    return range;
+  }
+  ValueRange result = ValueRange::full(size);
+  result.zeros = range.zeros & get_width_mask(size);
+  result.ones = range.ones & get_width_mask(size);
+  result.normalize();
+  return result;
+}
+
+ValueRange ValueRangeAnalysis::evaluate(Instruction *ins, const FactType &fact) {
+  HighLevelOpcode opcode = HighLevelOpcode(ins->get_opcode());
+  int size = highlevel_opcode_get_dest_operand_size(opcode);
+  if (size == 0) {
+    return ValueRange::full(8);
+  }
+
+  if (opcode >= HINS_sconv_bw && opcode <= HINS_uconv_lq) {
+    int source_size = highlevel_opcode_get_source_operand_size(opcode);
+    ValueRange a = get_operand_range(fact, ins->get_operand(1), source_size);
+    if (opcode >= HINS_uconv_bw && a.lo < 0) {
+      // the value of the bits of the source
+      unsigned long mask = get_width_mask(source_size);
+      ValueRange result = ValueRange::full(size);
+      if (a.hi < 0) {
+        result.lo = a.lo + long(mask) + 1;
+        result.hi = a.hi + long(mask) + 1;
+      } else {
+        result.lo = 0;
+        result.hi = long(mask);
+      }
+      result.zeros = (a.zeros & mask) | ~mask;
+      result.ones = a.ones & mask;
+      return result.normalize() ? result : ValueRange::full(size);
+    }
+    a.size = size;
+    return a;
+  }
+
+  if (opcode >= HINS_sel_b && opcode <= HINS_sel_q) {
+    return ValueRange::join(get_operand_range(fact, ins->get_operand(2), size),
+                            get_operand_range(fact, ins->get_operand(3), size));
+  }
+
+  if (opcode < HINS_add_b || opcode > HINS_mov_q) {
+    return ValueRange::full(size);
+  }
+
+  int base = opcode - (opcode - HINS_add_b) % 4;
+  ValueRange a = get_operand_range(fact, ins->get_operand(1), size);
+  ValueRange b = ins->get_num_operands() > 2 ? get_operand_range(fact, ins->get_operand(2), size) : a;
+  ValueRange result = ValueRange::full(size);
+  int count;
+  long lo, hi;
+  switch (base) {
+  case HINS_mov_b:
+    return a;
+
+  case HINS_add_b:
+  case HINS_inc_b:
+    if (base == HINS_inc_b) {
+      b = ValueRange::constant(1, size);
+    }
+    if (!__builtin_add_overflow(a.lo, b.lo, &lo) && !__builtin_add_overflow(a.hi, b.hi, &hi)) {
+      result = make_range(lo, hi, size);
+    }
+    set_trailing_zeros(result, std::min(get_trailing_zeros(a), get_trailing_zeros(b)));
+    break;
+
+  case HINS_sub_b:
+  case HINS_dec_b:
+    if (base == HINS_dec_b) {
+      b = ValueRange::constant(1, size);
+    }
+    if (!__builtin_sub_overflow(a.lo, b.hi, &lo) && !__builtin_sub_overflow(a.hi, b.lo, &hi)) {
+      result = make_range(lo, hi, size);
+    }
+    set_trailing_zeros(result, std::min(get_trailing_zeros(a), get_trailing_zeros(b)));
+    break;
+
+  case HINS_mul_b:
+    {
+      long products[4];
+      if (!__builtin_mul_overflow(a.lo, b.lo, &products[0]) && !__builtin_mul_overflow(a.lo, b.hi, &products[1])
+          && !__builtin_mul_overflow(a.hi, b.lo, &products[2]) && !__builtin_mul_overflow(a.hi, b.hi, &products[3])) {
+        result = make_range(*std::min_element(products, products + 4), *std::max_element(products, products + 4), size);
+      }
+      set_trailing_zeros(result, get_trailing_zeros(a) + get_trailing_zeros(b));
+    }
+    break;
+
+  case HINS_div_b:
+  case HINS_udiv_b:
+    // an unsigned division of nonnegative values is also a signed one
+    if (base == HINS_div_b || (a.lo >= 0 && b.lo >= 0)) {
+      result = divide(a, b, size);
+    }
+    break;
+
+  case HINS_mod_b:
+  case HINS_umod_b:
+    if (base == HINS_mod_b || (a.lo >= 0 && b.lo >= 0)) {
+      result = remainder(a, b, size);
+    } else if (b.lo > 0) {
+      result = make_range(0, b.hi - 1, size);
+    }
+    break;
+
+  case HINS_lshift_b:
+    if (get_shift_count(b, size, count)) {
+      if (!__builtin_mul_overflow(a.lo, 1L << count, &lo) && !__builtin_mul_overflow(a.hi, 1L << count, &hi)) {
+        result = make_range(lo, hi, size);
+      }
+      result.zeros = (a.zeros << count) | ((1UL << count) - 1);
+      result.ones = a.ones << count;
+    }
+    break;
+
+  case HINS_rshift_b:
+    if (get_shift_count(b, size, count)) {
+      // an arithmetic shift of the sign-extended value
+      result.lo = a.lo >> count;
+      result.hi = a.hi >> count;
+      result.zeros = (unsigned long) (long(a.zeros) >> count);
+      result.ones = (unsigned long) (long(a.ones) >> count);
+    } else {
+      result.lo = std::min(a.lo, 0L);
+      result.hi = std::max(a.hi, -1L);
+    }
+    break;
+
+  case HINS_urshift_b:
+    if (get_shift_count(b, size, count)) {
+      if (count == 0) {
+        return a;
+      }
+      unsigned long mask = get_width_mask(size);
+      if (a.lo >= 0 || a.hi < 0) {
+        // the bits of the bounds are in the same order as the bounds
+        result.lo = long(((unsigned long) a.lo & mask) >> count);
+        result.hi = long(((unsigned long) a.hi & mask) >> count);
+      } else {
+        result.lo = 0;
+        result.hi = long(mask >> count);
+      }
+      result.zeros = ((a.zeros & mask) >> count) | ~(mask >> count);
+      result.ones = (a.ones & mask) >> count;
+    } else if (a.lo >= 0) {
+      result = make_range(0, a.hi, size);
+    }
+    break;
+
+  case HINS_cmplt_b:
+  case HINS_cmplte_b:
+  case HINS_cmpgt_b:
+  case HINS_cmpgte_b:
+  case HINS_cmpeq_b:
+  case HINS_cmpneq_b:
+    {
+      int outcome = decide(Relation((base - HINS_cmplt_b) / 4), a, b);
+      result = outcome < 0 ? make_range(0, 1, size) : ValueRange::constant(outcome, size);
+    }
+    break;
+
+  case HINS_not_b:
+    if (a.lo > 0 || a.hi < 0 || (a.ones != 0)) {
+      result = ValueRange::constant(0, size);
+    } else if (a.lo == 0 && a.hi == 0) {
+      result = ValueRange::constant(1, size);
+    } else {
+      result = make_range(0, 1, size);
+    }
+    break;
+
+  case HINS_and_b:
+    result.zeros = a.zeros | b.zeros;
+    result.ones = a.ones & b.ones;
+    if (a.lo >= 0 || b.lo >= 0) {
+      result.lo = 0;
+      result.hi = std::min(a.lo >= 0 ? a.hi : LONG_MAX, b.lo >= 0 ? b.hi : LONG_MAX);
+    }
+    break;
+
+  case HINS_or_b:
+    result.zeros = a.zeros & b.zeros;
+    result.ones = a.ones | b.ones;
+    if (a.lo >= 0 && b.lo >= 0) {
+      result.lo = std::max(a.lo, b.lo);
+    }
+    break;
+
+  case HINS_xor_b:
+    {
+      unsigned long known = (a.zeros | a.ones) & (b.zeros | b.ones);
+      result.zeros = known & ~(a.ones ^ b.ones);
+      result.ones = known & (a.ones ^ b.ones);
+    }
+    break;
+
+  case HINS_neg_b:
+    if (a.lo != ValueRange::min_value(size)) {
+      result = make_range(-a.hi, -a.lo, size);
+    }
+    set_trailing_zeros(result, get_trailing_zeros(a));
+    break;
+
+  case HINS_compl_b:
+    result = make_range(~a.hi, ~a.lo, size);
+    result.zeros = a.ones;
+    result.ones = a.zeros;
+    break;
+  }
+
+  return result.normalize() ? result : ValueRange::full(size);
+}
+
+int ValueRangeAnalysis::decide(Relation relation, const ValueRange &left, const ValueRange &right) {
+  switch (relation) {
+  case LT:
+    return left.hi < right.lo ? 1 : (left.lo >= right.hi ? 0 : -1);
+  case LTE:
+    return left.hi <= right.lo ? 1 : (left.lo > right.hi ? 0 : -1);
+  case GT:
+    return decide(LT, right, left);
+  case GTE:
+    return decide(LTE, right, left);
+  case EQ:
+    if (left.is_constant() && right.is_constant() && left.lo == right.lo) {
+      return 1;
+    }
+    // disjoint ranges, or a bit known to differ
+    if (left.hi < right.lo || right.hi < left.lo
+        || ((left.zeros & right.ones) | (left.ones & right.zeros)) != 0) {
+      return 0;
+    }
+    return -1;
+  case NEQ:
+    {
+      int outcome = decide(EQ, left, right);
+      return outcome < 0 ? -1 : 1 - outcome;
+    }
+  }
+  return -1;
+}
+
+bool ValueRangeAnalysis::refine(Relation relation, bool holds, ValueRange &left, ValueRange &right) {
+  if (!holds) {
+    static const Relation NEGATED[] = { GTE, GT, LTE, LT, NEQ, EQ };
+    relation = NEGATED[relation];
+  }
+
+  switch (relation) {
+  case LT:
+    if (right.hi == LONG_MIN || left.lo == LONG_MAX) {
+      return false;
+    }
+    left.hi = std::min(left.hi, right.hi - 1);
+    right.lo = std::max(right.lo, left.lo + 1);
+    break;
+  case LTE:
+    left.hi = std::min(left.hi, right.hi);
+    right.lo = std::max(right.lo, left.lo);
+    break;
+  case GT:
+    return refine(LT, true, right, left);
+  case GTE:
+    return refine(LTE, true, right, left);
+  case EQ:
+    left.lo = right.lo = std::max(left.lo, right.lo);
+    left.hi = right.hi = std::min(left.hi, right.hi);
+    left.zeros = right.zeros = left.zeros | right.zeros;
+    left.ones = right.ones = left.ones | right.ones;
+    break;
+  case NEQ:
+    {
+      // a value which is excluded can only be removed from the ends of a range
+      ValueRange *ranges[] = { &left, &right };
+      for (int i = 0; i < 2; i++) {
+        ValueRange &range = *ranges[i];
+        const ValueRange &other = *ranges[1 - i];
+        if (!other.is_constant()) {
+          continue;
+        }
+        if (range.lo == other.lo) {
+          if (range.lo == LONG_MAX) { return false; }
+          range.lo++;
+        } else if (range.hi == other.lo) {
+          if (range.hi == LONG_MIN) { return false; }
+          range.hi--;
+        }
+      }
+    }
+    break;
+  }
+  return left.normalize() && right.normalize();
+}
@@ -0,0 +1,115 @@
+#ifndef VALUE_RANGES_H
+#define VALUE_RANGES_H
+
+#include <map>
+#include <string>
+#include "instruction.h"
+#include "operand.h"
+#include "highlevel.h"
+#include "dataflow.h"
+
+// What is known about the value of a vreg (or operand) of a given size in
+// bytes: the signed values lo..hi it may have, and the bits which are known
+// to be 0 or 1. The bit masks are of the value sign-extended to 64 bits,
+// so the bits above the size are known only if the sign bit is.
+struct ValueRange {
+  long lo, hi;
+  unsigned long zeros, ones;
+  int size;
+
+  bool operator==(const ValueRange &other) const {
+    return lo == other.lo && hi == other.hi && zeros == other.zeros && ones == other.ones && size == other.size;
+  }
+  bool operator!=(const ValueRange &other) const { return !(*this == other); }
+
+  // Any value of the size
+  static ValueRange full(int size);
+
+  // Exactly one value (truncated to the size)
+  static ValueRange constant(long value, int size);
+
+  // The smallest and largest values of the size
+  static long min_value(int size);
+  static long max_value(int size);
+
+  bool is_full() const;
+  bool is_constant() const { return lo == hi; }
+  bool is_nonnegative() const { return lo >= 0; }
+  bool fits(int size) const { return lo >= min_value(size) && hi <= max_value(size); }
+
+  // Make the range and the known bits agree with each other (each can
+  // narrow the other): returns false if no value is possible
+  bool normalize();
+
+  // Values which are in either range
+  static ValueRange join(const ValueRange &left, const ValueRange &right);
+};
+
+// Dataflow fact for value ranges: the range of each vreg whose value is
+// limited. A vreg that is not in the map may have any value.
+struct ValueRangeFact {
+  // true for blocks which have not been reached (yet, or at all, if
+  // every edge into them has been found to be impossible)
+  bool is_top;
+  std::map<int, ValueRange> ranges;
+
+  ValueRangeFact() : is_top(true) { }
+
+  bool operator==(const ValueRangeFact &other) const {
+    return is_top == other.is_top && ranges == other.ranges;
+  }
+  bool operator!=(const ValueRangeFact &other) const { return !(*this == other); }
+};
+
+// Forward analysis of the ranges and known bits of the values of vregs.
+// Each instruction computes the range of its result from the ranges of its
+// operands, and each edge leaving a conditional branch narrows the ranges
+// of the values compared to those for which control goes that way.
+// Where paths join, the ranges are combined and then widened to the next
+// of a few fixed bounds (such as the limits of the integer types), so that
+// the ranges of values modified in a loop stop growing quickly.
+class ValueRangeAnalysis : public ForwardAnalysis {
+public:
+  typedef ValueRangeFact FactType;
+
+  const static bool MODELS_EDGES = true;
+
+  // The top fact combines nondestructively with any other fact
+  FactType get_top_fact() const { return FactType(); }
+
+  // Combine facts: a vreg's value may be in its range for either fact
+  FactType combine_facts(const FactType &left, const FactType &right) const;
+
+  // Model an instruction: the range of the result of a def replaces the
+  // range its vreg had. A call may change the argument, return value, and
+  // machine vregs.
+  void model_instruction(Instruction *ins, FactType &fact) const;
+
+  // Model an edge: the outcome of the branch ending its source block
+  // narrows the ranges of the vregs compared
+  void model_edge(const Edge *edge, FactType &fact) const;
+
+  // Convert a dataflow fact to a string: the range of each vreg
+  std::string fact_to_string(const FactType &fact) const;
+
+  // The range of the value of an operand read with the given size
+  static ValueRange get_operand_range(const FactType &fact, const Operand &operand, int size);
+
+  // The range of the result of an instruction defining a vreg
+  static ValueRange evaluate(Instruction *ins, const FactType &fact);
+
+  // Relations compared by the cmpXX and cjmpXX instructions, in their order
+  enum Relation { LT, LTE, GT, GTE, EQ, NEQ };
+
+  // Decide a relation: 1 if it holds for all values of the ranges, 0 if
+  // it holds for none, and -1 if that depends on the values
+  static int decide(Relation relation, const ValueRange &left, const ValueRange &right);
+
+  // Narrow two ranges to the values for which the relation holds (or, if
+  // holds is false, doesn't): returns false if there are none
+  static bool refine(Relation relation, bool holds, ValueRange &left, ValueRange &right);
+};
+
+typedef Dataflow<ValueRangeAnalysis> ValueRanges;
+
+#endif // VALUE_RANGES_H